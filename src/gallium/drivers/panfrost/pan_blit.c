@@ -30,6 +30,8 @@
 #include "pan_context.h"
 #include "pan_util.h"
 #include "util/format/u_format.h"
+#include "util/u_sampler.h"
+#include "compiler/nir/nir_builder.h"
 
 void
 panfrost_blitter_save(struct panfrost_context *ctx, bool render_cond)
@@ -81,5 +83,720 @@ panfrost_blit(struct pipe_context *pipe,
                 unreachable("Unsupported blit\n");
 
         panfrost_blitter_save(ctx, info->render_condition_enable);
+
+        /* The draws of the blitter are traced as a blit */
+        ctx->blit = info;
         util_blitter_blit(ctx->blitter, info);
+        ctx->blit = NULL;
+}
+
+/* Copy a range of a buffer into another with a compute job, one 32-bit word
+ * per invocation. Used to land staged uploads without waiting on the GPU.
+ * The job goes into a batch not tied to the framebuffer, and resource
+ * tracking orders it after earlier users of the destination and before later
+ * ones, so the caller does not need to flush.
+ */
+
+#define PAN_COPY_BUFFER_WG_SIZE 64
+
+static void *
+panfrost_create_copy_buffer_cs(struct panfrost_context *ctx)
+{
+        struct panfrost_screen *screen = pan_screen(ctx->base.screen);
+
+        nir_builder b =
+                nir_builder_init_simple_shader(MESA_SHADER_COMPUTE,
+                                               screen->vtbl.get_compiler_options(),
+                                               "panfrost_copy_buffer");
+
+        b.shader->info.workgroup_size[0] = PAN_COPY_BUFFER_WG_SIZE;
+        b.shader->info.workgroup_size[1] = 1;
+        b.shader->info.workgroup_size[2] = 1;
+        b.shader->info.num_ssbos = 2;
+        b.shader->info.internal = true;
+
+        /* SSBO 0 is the source, SSBO 1 the destination, both bound to exactly
+         * the copied range */
+        nir_ssa_def *zero = nir_imm_int(&b, 0);
+        nir_ssa_def *one = nir_imm_int(&b, 1);
+        nir_ssa_def *id = nir_channel(&b, nir_load_global_invocation_id(&b, 32), 0);
+        nir_ssa_def *offset = nir_imul_imm(&b, id, 4);
+
+        nir_push_if(&b, nir_ult(&b, offset, nir_get_ssbo_size(&b, one)));
+        {
+                nir_ssa_def *value = nir_load_ssbo(&b, 1, 32, zero, offset,
+                                                   .align_mul = 4);
+
+                nir_store_ssbo(&b, value, one, offset, .write_mask = 0x1,
+                               .align_mul = 4);
+        }
+        nir_pop_if(&b, NULL);
+
+        struct pipe_compute_state cso = {
+                .ir_type = PIPE_SHADER_IR_NIR,
+                .prog = b.shader,
+        };
+
+        return ctx->base.create_compute_state(&ctx->base, &cso);
+}
+
+void
+panfrost_copy_buffer_gpu(struct panfrost_context *ctx,
+                         struct pipe_resource *dst, unsigned dst_offset,
+                         struct pipe_resource *src, unsigned src_offset,
+                         unsigned size)
+{
+        struct pipe_context *pctx = &ctx->base;
+        struct panfrost_screen *screen = pan_screen(pctx->screen);
+
+        assert(((dst_offset | src_offset | size) & 3) == 0);
+
+        if (!ctx->copy_buffer_cs)
+                ctx->copy_buffer_cs = panfrost_create_copy_buffer_cs(ctx);
+
+        /* Save the compute state we are about to clobber */
+        void *saved_cs = ctx->uncompiled[PIPE_SHADER_COMPUTE];
+        const struct pipe_grid_info *saved_grid = ctx->compute_grid;
+        struct pipe_shader_buffer saved[2] = { 0 };
+
+        for (unsigned i = 0; i < 2; ++i) {
+                if (!(ctx->ssbo_mask[PIPE_SHADER_COMPUTE] & BITFIELD_BIT(i)))
+                        continue;
+
+                saved[i] = ctx->ssbo[PIPE_SHADER_COMPUTE][i];
+                saved[i].buffer = NULL;
+                pipe_resource_reference(&saved[i].buffer,
+                                        ctx->ssbo[PIPE_SHADER_COMPUTE][i].buffer);
+        }
+
+        struct pipe_shader_buffer buffers[2] = {
+                { .buffer = src, .buffer_offset = src_offset, .buffer_size = size },
+                { .buffer = dst, .buffer_offset = dst_offset, .buffer_size = size },
+        };
+
+        pctx->bind_compute_state(pctx, ctx->copy_buffer_cs);
+        pctx->set_shader_buffers(pctx, PIPE_SHADER_COMPUTE, 0, 2, buffers, 0x2);
+
+        struct pipe_grid_info info = {
+                .block = { PAN_COPY_BUFFER_WG_SIZE, 1, 1 },
+                .grid = {
+                        DIV_ROUND_UP(size / 4, PAN_COPY_BUFFER_WG_SIZE), 1, 1
+                },
+        };
+
+        struct panfrost_batch *batch = panfrost_get_batch_for_upload(ctx);
+        ctx->dirty |= PAN_DIRTY_PARAMS;
+        screen->vtbl.launch_grid_on_batch(batch, &info);
+
+        /* Restore, making sure the next compute or draw re-emits its state */
+        pctx->bind_compute_state(pctx, saved_cs);
+        pctx->set_shader_buffers(pctx, PIPE_SHADER_COMPUTE, 0, 2, saved, 0);
+        ctx->compute_grid = saved_grid;
+        panfrost_dirty_state_all(ctx);
+
+        for (unsigned i = 0; i < 2; ++i)
+                pipe_resource_reference(&saved[i].buffer, NULL);
+}
+
+/* Generate mipmaps with compute. Each invocation filters one texel of the
+ * first level written by a dispatch from the level above, sampling with the
+ * same bilinear footprint as the blitter. A workgroup covers an 8x8 tile of
+ * that level, so while the level dimensions stay even, the next levels are
+ * exact 2x2 reductions of the tile and are computed in shared memory. Up to
+ * PAN_MIPMAP_MAX_LEVELS levels are thus written by a single compute job,
+ * without vertex/tiler jobs, tile buffer writeback or re-reading the
+ * intermediate levels.
+ */
+
+#define PAN_MIPMAP_WG_SIZE 8
+
+static void
+panfrost_mipmap_barrier(nir_builder *b)
+{
+        nir_memory_barrier_shared(b);
+        nir_control_barrier(b);
+}
+
+static void *
+panfrost_create_mipmap_cs(struct panfrost_context *ctx, unsigned nr_levels)
+{
+        struct panfrost_screen *screen = pan_screen(ctx->base.screen);
+
+        nir_builder b =
+                nir_builder_init_simple_shader(MESA_SHADER_COMPUTE,
+                                               screen->vtbl.get_compiler_options(),
+                                               "panfrost_mipmap_%u", nr_levels);
+
+        b.shader->info.workgroup_size[0] = PAN_MIPMAP_WG_SIZE;
+        b.shader->info.workgroup_size[1] = PAN_MIPMAP_WG_SIZE;
+        b.shader->info.workgroup_size[2] = 1;
+        b.shader->info.shared_size =
+                PAN_MIPMAP_WG_SIZE * PAN_MIPMAP_WG_SIZE * 16;
+        b.shader->info.num_textures = 1;
+        b.shader->info.num_images = nr_levels;
+        b.shader->info.internal = true;
+        BITSET_SET(b.shader->info.textures_used, 0);
+        BITSET_SET(b.shader->info.samplers_used, 0);
+        BITSET_SET_RANGE(b.shader->info.images_used, 0, nr_levels - 1);
+
+        /* Texture 0 is the source level, image N the Nth level written */
+        nir_ssa_def *zero = nir_imm_int(&b, 0);
+        nir_ssa_def *local = nir_trim_vector(&b, nir_load_local_invocation_id(&b), 2);
+        nir_ssa_def *group = nir_trim_vector(&b, nir_load_workgroup_id(&b, 32), 2);
+        nir_ssa_def *lx = nir_channel(&b, local, 0);
+        nir_ssa_def *ly = nir_channel(&b, local, 1);
+        nir_ssa_def *slot =
+                nir_imul_imm(&b, nir_iadd(&b, nir_imul_imm(&b, ly, PAN_MIPMAP_WG_SIZE), lx), 16);
+        nir_ssa_def *value = NULL;
+
+        for (unsigned l = 0; l < nr_levels; ++l) {
+                unsigned tile = PAN_MIPMAP_WG_SIZE >> l;
+                nir_ssa_def *pos = nir_iadd(&b, nir_imul_imm(&b, group, tile), local);
+                nir_ssa_def *size =
+                        nir_image_size(&b, 2, 32, nir_imm_int(&b, l), zero,
+                                       .image_dim = GLSL_SAMPLER_DIM_2D);
+
+                if (l == 0) {
+                        nir_ssa_def *coord =
+                                nir_fdiv(&b, nir_fadd_imm(&b, nir_u2f32(&b, pos), 0.5),
+                                         nir_u2f32(&b, size));
+
+                        nir_tex_instr *tex = nir_tex_instr_create(b.shader, 2);
+                        tex->op = nir_texop_txl;
+                        tex->sampler_dim = GLSL_SAMPLER_DIM_2D;
+                        tex->dest_type = nir_type_float32;
+                        tex->coord_components = 2;
+                        tex->src[0].src_type = nir_tex_src_coord;
+                        tex->src[0].src = nir_src_for_ssa(coord);
+                        tex->src[1].src_type = nir_tex_src_lod;
+                        tex->src[1].src = nir_src_for_ssa(nir_imm_float(&b, 0));
+                        nir_ssa_dest_init(&tex->instr, &tex->dest, 4, 32, NULL);
+                        nir_builder_instr_insert(&b, &tex->instr);
+                        value = &tex->dest.ssa;
+                } else {
+                        /* Average the 2x2 texels of the previous level. Only
+                         * the top-left tile x tile invocations produce a
+                         * texel, the others read in-bounds garbage */
+                        nir_store_shared(&b, value, slot, .write_mask = 0xf,
+                                         .align_mul = 16);
+                        panfrost_mipmap_barrier(&b);
+
+                        nir_ssa_def *sum = NULL;
+
+                        for (unsigned j = 0; j < 2; ++j) {
+                                for (unsigned i = 0; i < 2; ++i) {
+                                        nir_ssa_def *x = nir_iand_imm(&b, nir_iadd_imm(&b, nir_imul_imm(&b, lx, 2), i),
+                                                                      PAN_MIPMAP_WG_SIZE - 1);
+                                        nir_ssa_def *y = nir_iand_imm(&b, nir_iadd_imm(&b, nir_imul_imm(&b, ly, 2), j),
+                                                                      PAN_MIPMAP_WG_SIZE - 1);
+                                        nir_ssa_def *offs =
+                                                nir_imul_imm(&b, nir_iadd(&b, nir_imul_imm(&b, y, PAN_MIPMAP_WG_SIZE), x), 16);
+                                        nir_ssa_def *texel =
+                                                nir_load_shared(&b, 4, 32, offs, .align_mul = 16);
+
+                                        sum = sum ? nir_fadd(&b, sum, texel) : texel;
+                                }
+                        }
+
+                        value = nir_fmul_imm(&b, sum, 0.25);
+
+                        /* Everyone has read before the next level overwrites */
+                        panfrost_mipmap_barrier(&b);
+                }
+
+                nir_ssa_def *in_bounds =
+                        nir_ball(&b, nir_iand(&b, nir_ult(&b, pos, size),
+                                              nir_ult(&b, local, nir_imm_ivec2(&b, tile, tile))));
+
+                nir_push_if(&b, in_bounds);
+                {
+                        nir_image_store(&b, nir_imm_int(&b, l),
+                                        nir_pad_vector_imm_int(&b, pos, 0, 4),
+                                        nir_ssa_undef(&b, 1, 32), value, zero,
+                                        .image_dim = GLSL_SAMPLER_DIM_2D,
+                                        .src_type = nir_type_float32,
+                                        .access = ACCESS_NON_READABLE);
+                }
+                nir_pop_if(&b, NULL);
+        }
+
+        struct pipe_compute_state cso = {
+                .ir_type = PIPE_SHADER_IR_NIR,
+                .prog = b.shader,
+                .static_shared_mem = b.shader->info.shared_size,
+        };
+
+        return ctx->base.create_compute_state(&ctx->base, &cso);
+}
+
+/* Image descriptors use the hardware format of the view, swizzle included,
+ * so stores only land in the right channels if the format is not swizzled:
+ * luminance, intensity, alpha and BGRA orders go through the blitter */
+static bool
+panfrost_format_has_identity_swizzle(enum pipe_format format)
+{
+        const struct util_format_description *desc =
+                util_format_description(format);
+
+        for (unsigned c = 0; c < 4; ++c) {
+                unsigned swizzle = desc->swizzle[c];
+
+                if (c < desc->nr_channels) {
+                        if (swizzle != PIPE_SWIZZLE_X + c)
+                                return false;
+                } else if (swizzle != PIPE_SWIZZLE_0 &&
+                           swizzle != PIPE_SWIZZLE_1) {
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+static bool
+panfrost_can_generate_mipmap_gpu(struct panfrost_context *ctx,
+                                 struct panfrost_resource *rsrc,
+                                 enum pipe_format format)
+{
+        struct pipe_screen *screen = ctx->base.screen;
+
+        if (rsrc->base.target != PIPE_TEXTURE_2D || rsrc->base.nr_samples > 1)
+                return false;
+
+        /* Images cannot be AFBC, keep it and let the blitter render instead */
+        if (drm_is_afbc(rsrc->image.layout.modifier))
+                return false;
+
+        /* Image stores do not encode sRGB or pack depth/stencil, and integer
+         * formats are not filtered at all */
+        if (!util_format_is_plain(format) || util_format_is_srgb(format) ||
+            util_format_is_depth_or_stencil(format) ||
+            util_format_is_pure_integer(format) ||
+            !panfrost_format_has_identity_swizzle(format))
+                return false;
+
+        return screen->is_format_supported(screen, format, PIPE_TEXTURE_2D,
+                                           0, 0,
+                                           PIPE_BIND_SAMPLER_VIEW |
+                                           PIPE_BIND_RENDER_TARGET |
+                                           PIPE_BIND_SHADER_IMAGE);
+}
+
+bool
+panfrost_generate_mipmap_gpu(struct panfrost_context *ctx,
+                             struct pipe_resource *prsrc,
+                             enum pipe_format format,
+                             unsigned base_level, unsigned last_level)
+{
+        struct pipe_context *pctx = &ctx->base;
+        struct panfrost_resource *rsrc = pan_resource(prsrc);
+
+        if (!panfrost_can_generate_mipmap_gpu(ctx, rsrc, format))
+                return false;
+
+        if (!ctx->mipmap_sampler) {
+                struct pipe_sampler_state sampler = {
+                        .wrap_s = PIPE_TEX_WRAP_CLAMP_TO_EDGE,
+                        .wrap_t = PIPE_TEX_WRAP_CLAMP_TO_EDGE,
+                        .wrap_r = PIPE_TEX_WRAP_CLAMP_TO_EDGE,
+                        .min_img_filter = PIPE_TEX_FILTER_LINEAR,
+                        .mag_img_filter = PIPE_TEX_FILTER_LINEAR,
+                        .min_mip_filter = PIPE_TEX_MIPFILTER_NONE,
+                };
+
+                ctx->mipmap_sampler = pctx->create_sampler_state(pctx, &sampler);
+        }
+
+        /* Save the compute state we are about to clobber */
+        void *saved_cs = ctx->uncompiled[PIPE_SHADER_COMPUTE];
+        const struct pipe_grid_info *saved_grid = ctx->compute_grid;
+        unsigned saved_sampler_count = ctx->sampler_count[PIPE_SHADER_COMPUTE];
+        void *saved_samplers[PIPE_MAX_SAMPLERS];
+        struct pipe_sampler_view *saved_view = NULL;
+        struct pipe_image_view saved_images[PAN_MIPMAP_MAX_LEVELS] = { 0 };
+
+        memcpy(saved_samplers, ctx->samplers[PIPE_SHADER_COMPUTE],
+               sizeof(saved_samplers));
+        pipe_sampler_view_reference(&saved_view,
+                                    (struct pipe_sampler_view *)ctx->sampler_views[PIPE_SHADER_COMPUTE][0]);
+
+        for (unsigned i = 0; i < PAN_MIPMAP_MAX_LEVELS; ++i) {
+                if (ctx->image_mask[PIPE_SHADER_COMPUTE] & BITFIELD_BIT(i))
+                        util_copy_image_view(&saved_images[i],
+                                             &ctx->images[PIPE_SHADER_COMPUTE][i]);
+        }
+
+        pctx->bind_sampler_states(pctx, PIPE_SHADER_COMPUTE, 0, 1,
+                                  &ctx->mipmap_sampler);
+
+        for (unsigned level = base_level; level < last_level; ) {
+                /* Chain levels while the last one written has even
+                 * dimensions, so the next is exactly a 2x2 reduction */
+                unsigned nr = 1;
+
+                while (nr < PAN_MIPMAP_MAX_LEVELS && level + nr < last_level &&
+                       !(u_minify(prsrc->width0, level + nr) & 1) &&
+                       !(u_minify(prsrc->height0, level + nr) & 1))
+                        ++nr;
+
+                if (!ctx->mipmap_cs[nr - 1])
+                        ctx->mipmap_cs[nr - 1] = panfrost_create_mipmap_cs(ctx, nr);
+
+                struct pipe_sampler_view templ;
+                u_sampler_view_default_template(&templ, prsrc, format);
+                templ.u.tex.first_level = templ.u.tex.last_level = level;
+
+                struct pipe_sampler_view *view =
+                        pctx->create_sampler_view(pctx, prsrc, &templ);
+
+                struct pipe_image_view images[PAN_MIPMAP_MAX_LEVELS];
+
+                for (unsigned i = 0; i < nr; ++i) {
+                        images[i] = (struct pipe_image_view) {
+                                .resource = prsrc,
+                                .format = format,
+                                .access = PIPE_IMAGE_ACCESS_WRITE,
+                                .shader_access = PIPE_IMAGE_ACCESS_WRITE,
+                                .u.tex.level = level + 1 + i,
+                        };
+                }
+
+                pctx->bind_compute_state(pctx, ctx->mipmap_cs[nr - 1]);
+                pctx->set_sampler_views(pctx, PIPE_SHADER_COMPUTE, 0, 1, 0,
+                                        true, &view);
+                pctx->set_shader_images(pctx, PIPE_SHADER_COMPUTE, 0, nr, 0,
+                                        images);
+
+                struct pipe_grid_info info = {
+                        .block = { PAN_MIPMAP_WG_SIZE, PAN_MIPMAP_WG_SIZE, 1 },
+                        .grid = {
+                                DIV_ROUND_UP(u_minify(prsrc->width0, level + 1),
+                                             PAN_MIPMAP_WG_SIZE),
+                                DIV_ROUND_UP(u_minify(prsrc->height0, level + 1),
+                                             PAN_MIPMAP_WG_SIZE),
+                                1
+                        },
+                };
+
+                pctx->launch_grid(pctx, &info);
+
+                for (unsigned i = 0; i < nr; ++i)
+                        BITSET_SET(rsrc->valid.data, level + 1 + i);
+
+                level += nr;
+        }
+
+        /* Restore, making sure the next compute or draw re-emits its state */
+        pctx->bind_compute_state(pctx, saved_cs);
+        pctx->bind_sampler_states(pctx, PIPE_SHADER_COMPUTE, 0,
+                                  saved_sampler_count, saved_samplers);
+
+        /* Binding no samplers leaves the slots alone, do not keep pointing
+         * at the mipmap sampler */
+        if (!saved_sampler_count)
+                ctx->samplers[PIPE_SHADER_COMPUTE][0] = NULL;
+        pctx->set_sampler_views(pctx, PIPE_SHADER_COMPUTE, 0, 1, 0, true,
+                                &saved_view);
+        pctx->set_shader_images(pctx, PIPE_SHADER_COMPUTE, 0,
+                                PAN_MIPMAP_MAX_LEVELS, 0, saved_images);
+        ctx->compute_grid = saved_grid;
+        panfrost_dirty_state_all(ctx);
+
+        for (unsigned i = 0; i < PAN_MIPMAP_MAX_LEVELS; ++i)
+                util_copy_image_view(&saved_images[i], NULL);
+
+        return true;
+}
+
+/* Pack the superblocks of an AFBC image with compute, one invocation per
+ * superblock. A first job computes the body size of each superblock from its
+ * header, the CPU turns the sizes into offsets with pan_afbc_pack_offsets,
+ * then a second job copies the headers, pointing them at the packed bodies,
+ * and the bodies into the destination BO. This mirrors pan_afbc_pack_slice.
+ * Addresses are passed in uniform buffer 0 and the BOs are tracked by hand.
+ */
+
+#define PAN_AFBC_WG_SIZE 32
+
+struct panfrost_afbc_size_info {
+        uint64_t src;
+        uint64_t metadata;
+        uint32_t uncompressed_size;
+        uint32_t nr_blocks;
+};
+
+struct panfrost_afbc_pack_info {
+        uint64_t src;
+        uint64_t dst;
+        uint64_t metadata;
+        uint32_t header_size;
+        uint32_t nr_blocks;
+};
+
+#define panfrost_afbc_input(b, type, name) \
+        nir_load_ubo(b, sizeof(((struct type *)0)->name) / 4, 32, \
+                     nir_imm_int(b, 0), \
+                     nir_imm_int(b, offsetof(struct type, name)), \
+                     .align_mul = 4, .range = ~0)
+
+#define panfrost_afbc_input_ptr(b, type, name) \
+        nir_pack_64_2x32(b, panfrost_afbc_input(b, type, name))
+
+static nir_ssa_def *
+panfrost_afbc_body_size(nir_builder *b, unsigned arch, nir_ssa_def *header,
+                        nir_ssa_def *uncompressed_size)
+{
+        nir_ssa_def *size = nir_imm_int(b, 0);
+
+        for (unsigned i = 0; i < 16; ++i) {
+                unsigned bit = 32 + (i * 6);
+                unsigned word = bit / 32, shift = bit % 32;
+                nir_ssa_def *bits = nir_ushr_imm(b, nir_channel(b, header, word), shift);
+
+                if (shift > 32 - 6) {
+                        bits = nir_ior(b, bits,
+                                       nir_ishl_imm(b, nir_channel(b, header, word + 1),
+                                                    32 - shift));
+                }
+
+                nir_ssa_def *subblock_size = nir_iand_imm(b, bits, BITFIELD_MASK(6));
+
+                size = nir_iadd(b, size,
+                                nir_bcsel(b, nir_ieq_imm(b, subblock_size, 1),
+                                          uncompressed_size, subblock_size));
+        }
+
+        nir_ssa_def *solid = arch >= 7 ?
+                nir_ieq_imm(b, nir_iand_imm(b, nir_channel(b, header, 1),
+                                            BITFIELD_MASK(6)), 0) :
+                nir_ieq_imm(b, nir_channel(b, header, 0), 0);
+
+        return nir_bcsel(b, solid, nir_imm_int(b, 0), size);
+}
+
+static nir_builder
+panfrost_afbc_builder(struct panfrost_context *ctx, const char *name)
+{
+        struct panfrost_screen *screen = pan_screen(ctx->base.screen);
+
+        nir_builder b =
+                nir_builder_init_simple_shader(MESA_SHADER_COMPUTE,
+                                               screen->vtbl.get_compiler_options(),
+                                               "%s", name);
+
+        b.shader->info.workgroup_size[0] = PAN_AFBC_WG_SIZE;
+        b.shader->info.workgroup_size[1] = 1;
+        b.shader->info.workgroup_size[2] = 1;
+        b.shader->info.num_ubos = 1;
+        b.shader->info.internal = true;
+
+        return b;
+}
+
+static void *
+panfrost_afbc_create_cs(struct panfrost_context *ctx, nir_builder *b)
+{
+        struct pipe_compute_state cso = {
+                .ir_type = PIPE_SHADER_IR_NIR,
+                .prog = b->shader,
+        };
+
+        return ctx->base.create_compute_state(&ctx->base, &cso);
+}
+
+static void *
+panfrost_create_afbc_size_cs(struct panfrost_context *ctx)
+{
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
+        nir_builder b = panfrost_afbc_builder(ctx, "panfrost_afbc_size");
+        nir_ssa_def *idx = nir_channel(&b, nir_load_global_invocation_id(&b, 32), 0);
+
+        nir_push_if(&b, nir_ult(&b, idx, panfrost_afbc_input(&b, panfrost_afbc_size_info, nr_blocks)));
+        {
+                nir_ssa_def *src = panfrost_afbc_input_ptr(&b, panfrost_afbc_size_info, src);
+                nir_ssa_def *metadata = panfrost_afbc_input_ptr(&b, panfrost_afbc_size_info, metadata);
+                nir_ssa_def *header =
+                        nir_load_global(&b, nir_iadd(&b, src, nir_u2u64(&b, nir_imul_imm(&b, idx, AFBC_HEADER_BYTES_PER_TILE))),
+                                        16, 4, 32);
+                nir_ssa_def *size =
+                        panfrost_afbc_body_size(&b, dev->arch, header,
+                                                panfrost_afbc_input(&b, panfrost_afbc_size_info, uncompressed_size));
+
+                nir_store_global(&b, nir_iadd(&b, metadata, nir_u2u64(&b, nir_imul_imm(&b, idx, sizeof(struct pan_afbc_block_info)))),
+                                 4, size, 0x1);
+        }
+        nir_pop_if(&b, NULL);
+
+        return panfrost_afbc_create_cs(ctx, &b);
+}
+
+static void *
+panfrost_create_afbc_pack_cs(struct panfrost_context *ctx)
+{
+        nir_builder b = panfrost_afbc_builder(ctx, "panfrost_afbc_pack");
+        nir_ssa_def *idx = nir_channel(&b, nir_load_global_invocation_id(&b, 32), 0);
+
+        nir_push_if(&b, nir_ult(&b, idx, panfrost_afbc_input(&b, panfrost_afbc_pack_info, nr_blocks)));
+        {
+                nir_ssa_def *src = panfrost_afbc_input_ptr(&b, panfrost_afbc_pack_info, src);
+                nir_ssa_def *dst = panfrost_afbc_input_ptr(&b, panfrost_afbc_pack_info, dst);
+                nir_ssa_def *metadata = panfrost_afbc_input_ptr(&b, panfrost_afbc_pack_info, metadata);
+                nir_ssa_def *header_offset =
+                        nir_u2u64(&b, nir_imul_imm(&b, idx, AFBC_HEADER_BYTES_PER_TILE));
+                nir_ssa_def *header =
+                        nir_load_global(&b, nir_iadd(&b, src, header_offset), 16, 4, 32);
+                nir_ssa_def *info =
+                        nir_load_global(&b, nir_iadd(&b, metadata, nir_u2u64(&b, nir_imul_imm(&b, idx, sizeof(struct pan_afbc_block_info)))),
+                                        8, 2, 32);
+                nir_ssa_def *size = nir_channel(&b, info, 0);
+                nir_ssa_def *src_body = nir_channel(&b, header, 0);
+                nir_ssa_def *dst_body =
+                        nir_iadd(&b, panfrost_afbc_input(&b, panfrost_afbc_pack_info, header_size),
+                                 nir_channel(&b, info, 1));
+
+                /* Solid colour superblocks have no body to point to */
+                nir_ssa_def *new_header =
+                        nir_vector_insert_imm(&b, header,
+                                              nir_bcsel(&b, nir_ieq_imm(&b, size, 0),
+                                                        src_body, dst_body), 0);
+
+                nir_store_global(&b, nir_iadd(&b, dst, header_offset), 16,
+                                 new_header, 0xf);
+
+                /* Copy the body 16 bytes at a time. The padding up to the
+                 * next superblock is copied along, as it is within both the
+                 * worst-case source superblock and the aligned destination */
+                nir_variable *i = nir_local_variable_create(b.impl, glsl_uint_type(), "i");
+                nir_store_var(&b, i, nir_imm_int(&b, 0), 0x1);
+
+                nir_push_loop(&b);
+                {
+                        nir_ssa_def *offset = nir_load_var(&b, i);
+
+                        nir_push_if(&b, nir_uge(&b, offset, size));
+                        nir_jump(&b, nir_jump_break);
+                        nir_pop_if(&b, NULL);
+
+                        nir_ssa_def *data =
+                                nir_load_global(&b, nir_iadd(&b, src, nir_u2u64(&b, nir_iadd(&b, src_body, offset))),
+                                                16, 4, 32);
+
+                        nir_store_global(&b, nir_iadd(&b, dst, nir_u2u64(&b, nir_iadd(&b, dst_body, offset))),
+                                         16, data, 0xf);
+
+                        nir_store_var(&b, i, nir_iadd_imm(&b, offset, 16), 0x1);
+                }
+                nir_pop_loop(&b, NULL);
+        }
+        nir_pop_if(&b, NULL);
+
+        return panfrost_afbc_create_cs(ctx, &b);
+}
+
+static void
+panfrost_afbc_launch(struct panfrost_context *ctx,
+                     struct panfrost_batch *batch, void *cs,
+                     const void *inputs, unsigned size, unsigned nr_blocks)
+{
+        struct pipe_context *pctx = &ctx->base;
+        struct panfrost_screen *screen = pan_screen(pctx->screen);
+        struct panfrost_constant_buffer *pbuf =
+                &ctx->constant_buffer[PIPE_SHADER_COMPUTE];
+
+        /* Save the compute state we are about to clobber */
+        void *saved_cs = ctx->uncompiled[PIPE_SHADER_COMPUTE];
+        const struct pipe_grid_info *saved_grid = ctx->compute_grid;
+        bool saved_enabled = pbuf->enabled_mask & BITFIELD_BIT(0);
+        struct pipe_constant_buffer saved_cb = { 0 };
+
+        util_copy_constant_buffer(&saved_cb, &pbuf->cb[0], false);
+
+        struct pipe_constant_buffer cb = {
+                .buffer_size = size,
+                .user_buffer = inputs,
+        };
+
+        pctx->bind_compute_state(pctx, cs);
+        pctx->set_constant_buffer(pctx, PIPE_SHADER_COMPUTE, 0, false, &cb);
+
+        struct pipe_grid_info info = {
+                .block = { PAN_AFBC_WG_SIZE, 1, 1 },
+                .grid = { DIV_ROUND_UP(nr_blocks, PAN_AFBC_WG_SIZE), 1, 1 },
+        };
+
+        ctx->dirty |= PAN_DIRTY_PARAMS;
+        screen->vtbl.launch_grid_on_batch(batch, &info);
+
+        /* Restore, making sure the next compute or draw re-emits its state */
+        pctx->bind_compute_state(pctx, saved_cs);
+        pctx->set_constant_buffer(pctx, PIPE_SHADER_COMPUTE, 0, true,
+                                  saved_enabled ? &saved_cb : NULL);
+        ctx->compute_grid = saved_grid;
+        panfrost_dirty_state_all(ctx);
+}
+
+/* Write the body size of every superblock of a level to metadata + offset, as
+ * an array of struct pan_afbc_block_info */
+
+void
+panfrost_afbc_size_gpu(struct panfrost_context *ctx,
+                       struct panfrost_resource *rsrc,
+                       struct panfrost_bo *metadata, unsigned offset,
+                       unsigned level)
+{
+        const struct pan_image_layout *layout = &rsrc->image.layout;
+        unsigned nr_blocks = pan_afbc_superblock_count(layout, level);
+
+        if (!ctx->afbc_size_cs)
+                ctx->afbc_size_cs = panfrost_create_afbc_size_cs(ctx);
+
+        struct panfrost_afbc_size_info inputs = {
+                .src = rsrc->image.data.bo->ptr.gpu + rsrc->image.data.offset +
+                       layout->slices[level].offset,
+                .metadata = metadata->ptr.gpu + offset,
+                .uncompressed_size =
+                        pan_afbc_uncompressed_subblock_size(layout->format),
+                .nr_blocks = nr_blocks,
+        };
+
+        struct panfrost_batch *batch = panfrost_get_batch_for_upload(ctx);
+        panfrost_batch_read_rsrc(batch, rsrc, PIPE_SHADER_COMPUTE);
+        panfrost_batch_add_bo(batch, metadata, PIPE_SHADER_COMPUTE);
+
+        panfrost_afbc_launch(ctx, batch, ctx->afbc_size_cs, &inputs,
+                             sizeof(inputs), nr_blocks);
+}
+
+/* Pack a level into dst, given the offsets computed from the sizes */
+
+void
+panfrost_afbc_pack_gpu(struct panfrost_context *ctx,
+                       struct panfrost_resource *rsrc,
+                       struct panfrost_bo *dst,
+                       const struct pan_image_slice_layout *dst_slice,
+                       struct panfrost_bo *metadata, unsigned offset,
+                       unsigned level)
+{
+        const struct pan_image_layout *layout = &rsrc->image.layout;
+        unsigned nr_blocks = pan_afbc_superblock_count(layout, level);
+
+        if (!ctx->afbc_pack_cs)
+                ctx->afbc_pack_cs = panfrost_create_afbc_pack_cs(ctx);
+
+        struct panfrost_afbc_pack_info inputs = {
+                .src = rsrc->image.data.bo->ptr.gpu + rsrc->image.data.offset +
+                       layout->slices[level].offset,
+                .dst = dst->ptr.gpu + dst_slice->offset,
+                .metadata = metadata->ptr.gpu + offset,
+                .header_size = dst_slice->afbc.header_size,
+                .nr_blocks = nr_blocks,
+        };
+
+        struct panfrost_batch *batch = panfrost_get_batch_for_upload(ctx);
+        panfrost_batch_read_rsrc(batch, rsrc, PIPE_SHADER_COMPUTE);
+        panfrost_batch_add_bo(batch, metadata, PIPE_SHADER_COMPUTE);
+        panfrost_batch_add_bo(batch, dst, PIPE_SHADER_COMPUTE);
+
+        panfrost_afbc_launch(ctx, batch, ctx->afbc_pack_cs, &inputs,
+                             sizeof(inputs), nr_blocks);
 }
@@ -26,6 +26,7 @@
 #include "dma-uapi/dma-buf.h"
 
 #include "util/macros.h"
+#include "util/os_time.h"
 #include "util/u_prim.h"
 #include "util/u_vbuf.h"
 #include "util/u_helpers.h"
@@ -49,6 +50,7 @@
 #include "pan_indirect_draw.h"
 #include "pan_indirect_dispatch.h"
 #include "pan_blitter.h"
+#include "pan_tracepoints.h"
 
 #define PAN_GPU_INDIRECTS (PAN_ARCH == 7)
 
@@ -2847,11 +2849,19 @@ panfrost_import_dmabuf_fence(int dmabuf, int fence)
 }
 
 static uint64_t *
-panfrost_cs_ring_allocate_instrs(struct panfrost_cs *cs, unsigned count)
+panfrost_cs_ring_allocate_instrs(struct panfrost_device *dev,
+                                 struct panfrost_cs *cs, unsigned count)
 {
         pan_command_stream c = cs->cs;
+        bool wrap = c.ptr + count > c.end;
 
-        if (c.ptr + count > c.end) {
+        /* Don't overwrite instructions the GPU has not read yet */
+        uint64_t end = wrap ? cs->offset + cs->base.size + count * 8 :
+                cs->offset + (c.ptr + count - c.begin) * 8;
+
+        panfrost_cs_wait_ring(dev, cs, end);
+
+        if (wrap) {
                 assert(c.ptr <= c.end);
                 assert(c.begin + count <= c.ptr);
 
@@ -2865,7 +2875,6 @@ panfrost_cs_ring_allocate_instrs(struct panfrost_cs *cs, unsigned count)
                 cs->cs = c;
         }
 
-        /* TODO: Check against the extract offset */
         return c.ptr + count;
 }
 
@@ -2882,7 +2891,7 @@ emit_csf_queue(struct panfrost_batch *batch, struct panfrost_cs *cs,
         bool fragment = (cs->hw_resources & 2);
         bool vertex = (cs->hw_resources & 12); /* TILER | IDVS */
 
-        uint64_t *limit = panfrost_cs_ring_allocate_instrs(cs,
+        uint64_t *limit = panfrost_cs_ring_allocate_instrs(dev, cs,
                 128 + util_dynarray_num_elements(deps, struct panfrost_usage) * 4);
 
         pan_command_stream *c = &cs->cs;
@@ -3169,6 +3178,9 @@ init_cs(struct panfrost_context *ctx, struct panfrost_cs *cs)
         cs->seqnum = 0;
 
         cs->offset = 0;
+        cs->consumed = 0;
+        cs->mark_head = 0;
+        cs->mark_count = 0;
         c->ptr = cs->bo->ptr.cpu;
         c->begin = cs->bo->ptr.cpu;
         c->end = cs->bo->ptr.cpu + cs->base.size;
@@ -3866,6 +3878,36 @@ panfrost_emit_draw(void *out,
 }
 
 #if PAN_ARCH >= 9
+/*
+ * Size of the per-vertex varying record with memory allocated IDVS. Special
+ * varyings take 16 bytes each, followed by the general varyings packed as
+ * described by the vertex shader's layout. If the fragment shader reads
+ * general varyings the vertex shader does not write, a trailing dummy slot is
+ * allocated for them.
+ */
+static unsigned
+panfrost_varying_record_size(struct panfrost_compiled_shader *fs)
+{
+        const struct pan_varying_layout *layout = &fs->key.fs.varying_layout;
+        unsigned size = 16 * util_bitcount(fs->key.fs.fixed_varying_mask);
+
+        size += layout->size;
+
+        for (unsigned i = 0; i < fs->info.varyings.input_count; ++i) {
+                gl_varying_slot loc = fs->info.varyings.input[i].location;
+
+                if (loc < VARYING_SLOT_VAR0)
+                        continue;
+
+                if (!(layout->written & BITFIELD_BIT(loc - VARYING_SLOT_VAR0))) {
+                        size += 16;
+                        break;
+                }
+        }
+
+        return size;
+}
+
 static void
 panfrost_emit_malloc_vertex(struct panfrost_batch *batch,
                             const struct pipe_draw_info *info,
@@ -3874,7 +3916,6 @@ panfrost_emit_malloc_vertex(struct panfrost_batch *batch,
                             void *job)
 {
         struct panfrost_context *ctx = batch->ctx;
-        struct panfrost_compiled_shader *vs = ctx->prog[PIPE_SHADER_VERTEX];
         struct panfrost_compiled_shader *fs = ctx->prog[PIPE_SHADER_FRAGMENT];
 
         bool fs_required = panfrost_fs_required(fs, ctx->blend,
@@ -3899,13 +3940,8 @@ panfrost_emit_malloc_vertex(struct panfrost_batch *batch,
 
         pan_section_pack_cs_v10(job, &batch->cs_vertex, MALLOC_VERTEX_JOB, ALLOCATION, cfg) {
                 if (secondary_shader) {
-                        unsigned v = vs->info.varyings.output_count;
-                        unsigned f = fs->info.varyings.input_count;
-                        unsigned slots = MAX2(v, f);
-                        slots += util_bitcount(fs->key.fs.fixed_varying_mask);
-                        unsigned size = slots * 16;
+                        unsigned size = panfrost_varying_record_size(fs);
 
-                        /* Assumes 16 byte slots. We could do better. */
 #if PAN_ARCH < 10
                         cfg.vertex_packet_stride = size + 16;
 #endif
@@ -4157,6 +4193,56 @@ panfrost_cs_vertex_allocate_instrs(struct panfrost_batch *batch, unsigned count)
 }
 #endif
 
+#if PAN_ARCH >= 10
+static void
+emit_timestamp(struct panfrost_batch *batch, bool fragment,
+               mali_ptr address, bool end_of_pipe)
+{
+        pan_command_stream *c;
+        ASSERTED uint64_t *limit;
+
+        if (fragment) {
+                c = &batch->cs_fragment;
+                limit = c->end;
+        } else {
+                limit = panfrost_cs_vertex_allocate_instrs(batch, 4);
+                c = &batch->cs_vertex;
+        }
+
+        /* Waiting on every scoreboard slot makes the store wait for the jobs
+         * launched so far */
+        pan_emit_cs_48(c, 0x5a, address);
+        pan_pack_ins(c, CS_STORE_STATE, cfg) {
+                cfg.state = MALI_CS_STATE_TIMESTAMP;
+                cfg.address = 0x5a;
+                cfg.wait_mask = end_of_pipe ? 0xff : 0;
+        }
+
+        assert(c->ptr <= limit);
+}
+#else
+static void
+emit_timestamp(struct panfrost_batch *batch, bool fragment,
+               mali_ptr address, bool end_of_pipe)
+{
+        /* The fragment job chain may only contain the fragment job */
+        assert(!fragment);
+
+        struct panfrost_ptr job =
+                pan_pool_alloc_desc(&batch->pool.base, WRITE_VALUE_JOB);
+
+        pan_section_pack(job.cpu, WRITE_VALUE_JOB, PAYLOAD, cfg) {
+                cfg.address = address;
+                cfg.type = MALI_WRITE_VALUE_TYPE_SYSTEM_TIMESTAMP;
+        }
+
+        /* A barrier job only starts once the previous jobs are complete */
+        panfrost_add_job(&batch->pool.base, &batch->scoreboard,
+                         MALI_JOB_TYPE_WRITE_VALUE, end_of_pipe, false,
+                         0, 0, &job, false);
+}
+#endif
+
 static void
 panfrost_direct_draw(struct panfrost_batch *batch,
                      const struct pipe_draw_info *info,
@@ -4186,6 +4272,11 @@ panfrost_direct_draw(struct panfrost_batch *batch,
                 panfrost_update_shader_variant(ctx, PIPE_SHADER_FRAGMENT);
         }
 
+        if (unlikely(pan_device(ctx->base.screen)->debug & PAN_DBG_SPECIALIZE)) {
+                panfrost_update_uniform_specialization(ctx, PIPE_SHADER_VERTEX);
+                panfrost_update_uniform_specialization(ctx, PIPE_SHADER_FRAGMENT);
+        }
+
         /* Take into account a negative bias */
         ctx->indirect_draw = false;
         ctx->vertex_count = draw->count + (info->index_size ? abs(draw->index_bias) : 0);
@@ -4374,6 +4465,13 @@ panfrost_indirect_draw(struct panfrost_batch *batch,
         ctx->drawid = drawid_offset;
         ctx->indirect_draw = true;
 
+        /* Like direct draws, drop variants specialized on uniforms that
+         * changed since they were compiled */
+        if (unlikely(dev->debug & PAN_DBG_SPECIALIZE)) {
+                panfrost_update_uniform_specialization(ctx, PIPE_SHADER_VERTEX);
+                panfrost_update_uniform_specialization(ctx, PIPE_SHADER_FRAGMENT);
+        }
+
         struct panfrost_compiled_shader *vs = ctx->prog[PIPE_SHADER_VERTEX];
 
         bool idvs = vs->info.vs.idvs;
@@ -4540,45 +4638,21 @@ panfrost_compatible_batch_state(struct panfrost_batch *batch,
 }
 
 static void
-panfrost_draw_vbo(struct pipe_context *pipe,
-                  const struct pipe_draw_info *info,
-                  unsigned drawid_offset,
-                  const struct pipe_draw_indirect_info *indirect,
-                  const struct pipe_draw_start_count_bias *draws,
-                  unsigned num_draws)
+panfrost_draw_vbo_on_batch(struct panfrost_batch *batch,
+                           const struct pipe_draw_info *info,
+                           unsigned drawid_offset,
+                           const struct pipe_draw_indirect_info *indirect,
+                           const struct pipe_draw_start_count_bias *draws,
+                           unsigned num_draws)
 {
-        struct panfrost_context *ctx = pan_context(pipe);
-        struct panfrost_device *dev = pan_device(pipe->screen);
-
-        if (!panfrost_render_condition_check(ctx))
-                return;
-
-        ctx->draw_calls++;
-
-        /* Emulate indirect draws unless we're using the experimental path */
-        if ((!(dev->debug & PAN_DBG_INDIRECT) || !PAN_GPU_INDIRECTS) && indirect && indirect->buffer) {
-                assert(num_draws == 1);
-                util_draw_indirect(pipe, info, indirect);
-                perf_debug(dev, "Emulating indirect draw on the CPU");
-                return;
-        }
-
-        /* Do some common setup */
-        struct panfrost_batch *batch = panfrost_get_batch_for_fbo(ctx);
-
-        /* Don't add too many jobs to a single batch. Hardware has a hard limit
-         * of 65536 jobs, but we choose a smaller soft limit (arbitrary) to
-         * avoid the risk of timeouts. This might not be a good idea. */
-        if (unlikely(batch->scoreboard.job_index > 10000))
-                batch = panfrost_get_fresh_batch_for_fbo(ctx, "Too many draws");
-
-        bool points = (info->mode == PIPE_PRIM_POINTS);
+        struct panfrost_context *ctx = batch->ctx;
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
 
-        if (unlikely(!panfrost_compatible_batch_state(batch, points))) {
-                batch = panfrost_get_fresh_batch_for_fbo(ctx, "State change");
+        batch->stats.draws += num_draws;
 
-                ASSERTED bool succ = panfrost_compatible_batch_state(batch, points);
-                assert(succ && "must be able to set state for a fresh batch");
+        if (!batch->vertex_traced) {
+                trace_start_vertex(&batch->trace, NULL);
+                batch->vertex_traced = true;
         }
 
         /* panfrost_batch_skip_rasterization reads
@@ -4620,6 +4694,12 @@ panfrost_draw_vbo(struct pipe_context *pipe,
         struct pipe_draw_info tmp_info = *info;
         unsigned drawid = drawid_offset;
 
+        if (ctx->blit) {
+                trace_start_blit(&batch->trace, NULL,
+                                 ctx->blit->src.resource->target,
+                                 ctx->blit->dst.resource->target);
+        }
+
         for (unsigned i = 0; i < num_draws; i++) {
                 panfrost_direct_draw(batch, &tmp_info, drawid, &draws[i]);
 
@@ -4629,47 +4709,83 @@ panfrost_draw_vbo(struct pipe_context *pipe,
                 }
         }
 
+        if (ctx->blit)
+                trace_end_blit(&batch->trace, NULL);
 }
 
-/* Launch grid is the compute equivalent of draw_vbo, so in this routine, we
- * construct the COMPUTE job and some of its payload.
- */
-
 static void
-panfrost_launch_grid(struct pipe_context *pipe,
-                const struct pipe_grid_info *info)
+panfrost_draw_vbo(struct pipe_context *pipe,
+                  const struct pipe_draw_info *info,
+                  unsigned drawid_offset,
+                  const struct pipe_draw_indirect_info *indirect,
+                  const struct pipe_draw_start_count_bias *draws,
+                  unsigned num_draws)
 {
         struct panfrost_context *ctx = pan_context(pipe);
+        struct panfrost_device *dev = pan_device(pipe->screen);
 
-        /* XXX - shouldn't be necessary with working memory barriers. Affected
-         * test: KHR-GLES31.core.compute_shader.pipeline-post-xfb */
-        panfrost_flush_all_batches(ctx, "Launch grid pre-barrier");
+        if (!panfrost_render_condition_check(ctx))
+                return;
+
+        ctx->draw_calls++;
+
+        /* Emulate indirect draws unless we're using the experimental path */
+        if ((!(dev->debug & PAN_DBG_INDIRECT) || !PAN_GPU_INDIRECTS) && indirect && indirect->buffer) {
+                assert(num_draws == 1);
+                util_draw_indirect(pipe, info, indirect);
+                perf_debug(dev, "Emulating indirect draw on the CPU");
+                return;
+        }
 
+        /* Do some common setup */
         struct panfrost_batch *batch = panfrost_get_batch_for_fbo(ctx);
 
-        if (info->indirect && !PAN_GPU_INDIRECTS) {
-                struct pipe_transfer *transfer;
-                uint32_t *params = pipe_buffer_map_range(pipe, info->indirect,
-                                info->indirect_offset,
-                                3 * sizeof(uint32_t),
-                                PIPE_MAP_READ,
-                                &transfer);
+        /* Don't add too many jobs to a single batch. Hardware has a hard limit
+         * of 65536 jobs, but we choose a smaller soft limit (arbitrary) to
+         * avoid the risk of timeouts. This might not be a good idea. */
+        if (unlikely(batch->scoreboard.job_index > 10000))
+                batch = panfrost_get_fresh_batch_for_fbo(ctx, "Too many draws");
 
-                struct pipe_grid_info direct = *info;
-                direct.indirect = NULL;
-                direct.grid[0] = params[0];
-                direct.grid[1] = params[1];
-                direct.grid[2] = params[2];
-                pipe_buffer_unmap(pipe, transfer);
+        bool points = (info->mode == PIPE_PRIM_POINTS);
 
-                if (params[0] && params[1] && params[2])
-                        panfrost_launch_grid(pipe, &direct);
+        if (unlikely(!panfrost_compatible_batch_state(batch, points))) {
+                batch = panfrost_get_fresh_batch_for_fbo(ctx, "State change");
 
-                return;
+                ASSERTED bool succ = panfrost_compatible_batch_state(batch, points);
+                assert(succ && "must be able to set state for a fresh batch");
         }
 
+        /* Only the emission is timed, not the flushes of other batches done
+         * above while getting this one */
+        uint64_t start_ns = os_time_get_nano();
+
+        panfrost_draw_vbo_on_batch(batch, info, drawid_offset, indirect,
+                                   draws, num_draws);
+
+        batch->stats.build_ns += os_time_get_nano() - start_ns;
+}
+
+/* Launch grid is the compute equivalent of draw_vbo, so in this routine, we
+ * construct the COMPUTE job and some of its payload.
+ */
+
+static void
+launch_grid_on_batch(struct panfrost_batch *batch,
+                     const struct pipe_grid_info *info)
+{
+        struct panfrost_context *ctx = batch->ctx;
+        uint64_t start_ns = os_time_get_nano();
+
         ctx->compute_grid = info;
 
+        if (!batch->vertex_traced) {
+                trace_start_vertex(&batch->trace, NULL);
+                batch->vertex_traced = true;
+        }
+
+        trace_start_compute(&batch->trace, NULL,
+                            info->grid[0], info->grid[1], info->grid[2]);
+
         UNUSED struct panfrost_ptr t =
                 pan_pool_alloc_desc_cs_v10(&batch->pool.base, COMPUTE_JOB);
 
@@ -4772,6 +4888,46 @@ panfrost_launch_grid(struct pipe_context *pipe,
                          MALI_JOB_TYPE_COMPUTE, true, false,
                          indirect_dep, 0, &t, false);
 #endif
+
+        trace_end_compute(&batch->trace, NULL);
+
+        batch->stats.build_ns += os_time_get_nano() - start_ns;
+}
+
+static void
+panfrost_launch_grid(struct pipe_context *pipe,
+                const struct pipe_grid_info *info)
+{
+        struct panfrost_context *ctx = pan_context(pipe);
+
+        /* XXX - shouldn't be necessary with working memory barriers. Affected
+         * test: KHR-GLES31.core.compute_shader.pipeline-post-xfb */
+        panfrost_flush_all_batches(ctx, "Launch grid pre-barrier");
+
+        struct panfrost_batch *batch = panfrost_get_batch_for_fbo(ctx);
+
+        if (info->indirect && !PAN_GPU_INDIRECTS) {
+                struct pipe_transfer *transfer;
+                uint32_t *params = pipe_buffer_map_range(pipe, info->indirect,
+                                info->indirect_offset,
+                                3 * sizeof(uint32_t),
+                                PIPE_MAP_READ,
+                                &transfer);
+
+                struct pipe_grid_info direct = *info;
+                direct.indirect = NULL;
+                direct.grid[0] = params[0];
+                direct.grid[1] = params[1];
+                direct.grid[2] = params[2];
+                pipe_buffer_unmap(pipe, transfer);
+
+                if (params[0] && params[1] && params[2])
+                        panfrost_launch_grid(pipe, &direct);
+
+                return;
+        }
+
+        launch_grid_on_batch(batch, info);
         panfrost_flush_all_batches(ctx, "Launch grid post-barrier");
 }
 
@@ -5433,6 +5589,8 @@ GENX(panfrost_cmdstream_screen_init)(struct panfrost_screen *screen)
         screen->vtbl.init_polygon_list = init_polygon_list;
         screen->vtbl.get_compiler_options = GENX(pan_shader_get_compiler_options);
         screen->vtbl.compile_shader = GENX(pan_shader_compile);
+        screen->vtbl.launch_grid_on_batch = launch_grid_on_batch;
+        screen->vtbl.emit_timestamp = emit_timestamp;
 #if PAN_ARCH >= 10
         screen->vtbl.emit_csf_toplevel = emit_csf_toplevel;
         screen->vtbl.init_cs = init_cs;
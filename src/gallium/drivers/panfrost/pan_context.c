@@ -29,6 +29,7 @@
 #include <poll.h>
 
 #include "pan_bo.h"
+#include "pan_capture.h"
 #include "pan_context.h"
 #include "pan_minmax_cache.h"
 
@@ -47,11 +48,14 @@
 #include "util/u_surface.h"
 #include "util/u_math.h"
 #include "util/u_debug_cb.h"
+#include "util/u_trace_gallium.h"
 
 #include "pan_fence.h"
 #include "pan_screen.h"
+#include "pan_tracepoints.h"
 #include "pan_util.h"
 #include "decode.h"
+#include "perf/pan_perf.h"
 #include "util/pan_lower_framebuffer.h"
 #include "compiler/nir/nir_serialize.h"
 
@@ -96,6 +100,79 @@ panfrost_writes_point_size(struct panfrost_context *ctx)
         return vs->info.vs.writes_point_size && ctx->active_prim == PIPE_PRIM_POINTS;
 }
 
+/* Records a tracepoint, writing the GPU timestamp to its slot in the
+ * timestamp buffer once the preceding work of the stage is done. cs is the
+ * fragment stream of the batch for fragment tracepoints, NULL otherwise. */
+
+static void
+panfrost_record_timestamp(struct u_trace *ut, void *cs, void *timestamps,
+                          unsigned idx, bool end_of_pipe)
+{
+        struct panfrost_batch *batch =
+                container_of(ut, struct panfrost_batch, trace);
+        struct panfrost_screen *screen = pan_screen(batch->ctx->base.screen);
+        struct panfrost_bo *bo = pan_resource(timestamps)->image.data.bo;
+        bool fragment = (cs == &batch->cs_fragment);
+        size_t offset = idx * sizeof(uint64_t);
+
+        /* Without a GPU to write the timestamp, use the current time */
+        if (screen->dev.no_gpu || batch->ctx->is_noop) {
+                panfrost_bo_mmap(bo);
+                *(uint64_t *)(bo->ptr.cpu + offset) =
+                        panfrost_query_timestamp(&screen->dev);
+                panfrost_bo_mem_clean(bo, offset, sizeof(uint64_t));
+        }
+
+        panfrost_batch_write_bo(batch, bo, fragment ? PIPE_SHADER_FRAGMENT :
+                                                      PIPE_SHADER_VERTEX);
+
+        screen->vtbl.emit_timestamp(batch, fragment, bo->ptr.gpu + offset,
+                                    end_of_pipe);
+}
+
+static uint64_t
+panfrost_read_timestamp(struct u_trace_context *utctx, void *timestamps,
+                        unsigned idx, void *flush_data)
+{
+        struct pipe_context *pctx = utctx->pctx;
+        struct panfrost_device *dev = pan_device(pctx->screen);
+        struct panfrost_bo *bo = pan_resource(timestamps)->image.data.bo;
+        size_t offset = idx * sizeof(uint64_t);
+
+        /* Only the first read of a chunk needs to wait for the GPU */
+        if (idx == 0) {
+                panfrost_bo_wait(bo, INT64_MAX, true);
+                panfrost_bo_mem_invalidate(bo, 0, bo->size);
+        }
+
+        if (!dev->timestamp_frequency)
+                return U_TRACE_NO_TIMESTAMP;
+
+        return panfrost_timestamp_to_ns(dev,
+                        *(uint64_t *)(bo->ptr.cpu + offset));
+}
+
+#ifdef HAVE_PERFETTO
+struct pan_perfetto_state *
+pan_perfetto_state(struct pipe_context *pctx)
+{
+        return &pan_context(pctx)->perfetto;
+}
+
+/* Current GPU time in nanoseconds, or zero if it can't be converted */
+
+uint64_t
+pan_perfetto_gpu_timestamp(struct pipe_context *pctx)
+{
+        struct panfrost_device *dev = pan_device(pctx->screen);
+
+        if (!dev->timestamp_frequency)
+                return 0;
+
+        return panfrost_timestamp_to_ns(dev, panfrost_query_timestamp(dev));
+}
+#endif
+
 /* The entire frame is in memory -- send it off to the kernel! */
 
 void
@@ -117,8 +194,17 @@ panfrost_flush(
                 *fence = f;
         }
 
+        if (flags & PIPE_FLUSH_END_OF_FRAME)
+                ctx->frame++;
+
         if (dev->debug & PAN_DBG_TRACE)
                 pandecode_next_frame();
+
+        if (dev->capture && (flags & PIPE_FLUSH_END_OF_FRAME))
+                pan_capture_frame(dev->capture);
+
+        u_trace_context_process(&ctx->trace_context,
+                                !!(flags & PIPE_FLUSH_END_OF_FRAME));
 }
 
 static void
@@ -392,11 +478,26 @@ panfrost_set_sampler_views(
         struct pipe_sampler_view **views)
 {
         struct panfrost_context *ctx = pan_context(pctx);
+        struct panfrost_device *dev = pan_device(pctx->screen);
         ctx->dirty_shader[shader] |= PAN_DIRTY_STAGE_TEXTURE;
 
         unsigned new_nr = 0;
         unsigned i;
 
+        /* Layout changes must happen before the views are bound. Textures
+         * done being rendered to may be packed once sampled */
+        for (i = 0; views && i < num_views; ++i) {
+                if (!views[i])
+                        continue;
+
+                struct panfrost_resource *rsrc = pan_resource(views[i]->texture);
+
+                panfrost_promote_layout(ctx, rsrc, views[i]->format);
+
+                if (unlikely(dev->debug & PAN_DBG_AFBC_PACK))
+                        panfrost_pack_afbc(ctx, rsrc);
+        }
+
         for (i = 0; i < num_views; ++i) {
                 struct pipe_sampler_view *view = views ? views[i] : NULL;
                 unsigned p = i + start_slot;
@@ -459,6 +560,23 @@ panfrost_set_framebuffer_state(struct pipe_context *pctx,
 {
         struct panfrost_context *ctx = pan_context(pctx);
 
+        /* Unpack packed AFBC and promote render targets before the state is
+         * updated, since layout conversions blit */
+        for (unsigned i = 0; i < fb->nr_cbufs; ++i) {
+                if (fb->cbufs[i]) {
+                        struct panfrost_resource *rsrc =
+                                pan_resource(fb->cbufs[i]->texture);
+
+                        panfrost_unpack_afbc(ctx, rsrc, "Rendering to packed AFBC");
+                        panfrost_promote_layout(ctx, rsrc, fb->cbufs[i]->format);
+                }
+        }
+
+        if (fb->zsbuf) {
+                panfrost_unpack_afbc(ctx, pan_resource(fb->zsbuf->texture),
+                                     "Rendering to packed AFBC");
+        }
+
         util_copy_framebuffer_state(&ctx->pipe_framebuffer, fb);
         ctx->batch = NULL;
 
@@ -570,6 +688,8 @@ panfrost_destroy(struct pipe_context *pipe)
         struct panfrost_context *panfrost = pan_context(pipe);
         struct panfrost_device *dev = pan_device(pipe->screen);
 
+        u_trace_context_fini(&panfrost->trace_context);
+
         if (dev->kbase && dev->mali.context_create) {
                 dev->mali.cs_term(&dev->mali, &panfrost->kbase_cs_vertex.base);
                 dev->mali.cs_term(&dev->mali, &panfrost->kbase_cs_fragment.base);
@@ -588,9 +708,28 @@ panfrost_destroy(struct pipe_context *pipe)
         if (panfrost->blitter)
                 util_blitter_destroy(panfrost->blitter);
 
+        if (panfrost->copy_buffer_cs)
+                pipe->delete_compute_state(pipe, panfrost->copy_buffer_cs);
+
+        for (unsigned i = 0; i < PAN_MIPMAP_MAX_LEVELS; ++i) {
+                if (panfrost->mipmap_cs[i])
+                        pipe->delete_compute_state(pipe, panfrost->mipmap_cs[i]);
+        }
+
+        if (panfrost->mipmap_sampler)
+                pipe->delete_sampler_state(pipe, panfrost->mipmap_sampler);
+
+        if (panfrost->afbc_size_cs)
+                pipe->delete_compute_state(pipe, panfrost->afbc_size_cs);
+
+        if (panfrost->afbc_pack_cs)
+                pipe->delete_compute_state(pipe, panfrost->afbc_pack_cs);
+
         util_unreference_framebuffer_state(&panfrost->pipe_framebuffer);
         u_upload_destroy(pipe->stream_uploader);
+        u_upload_destroy(panfrost->transfer_uploader);
 
+        panfrost_free_retired_pools(panfrost);
         panfrost_pool_cleanup(&panfrost->descs);
         panfrost_pool_cleanup(&panfrost->shaders);
 
@@ -606,16 +745,143 @@ panfrost_destroy(struct pipe_context *pipe)
         ralloc_free(pipe);
 }
 
+#define PAN_QUERY_PERF_DERIVED_LAST \
+        (PAN_QUERY_PERF_DERIVED + PAN_PERF_MAX_DERIVED - 1)
+
+/* The hardware counters are enabled for the first derived metric query and
+ * shared by all the queries of the screen */
+static bool
+panfrost_perf_query_get(struct panfrost_screen *screen)
+{
+        bool ok = true;
+
+        simple_mtx_lock(&screen->perf.lock);
+
+        if (screen->perf.users == 0) {
+                struct panfrost_perf *perf = rzalloc(screen, struct panfrost_perf);
+                panfrost_perf_init(perf, &screen->dev);
+
+                if (panfrost_perf_enable(perf) < 0) {
+                        mesa_loge("panfrost: could not enable the performance counters");
+                        ralloc_free(perf);
+                        ok = false;
+                } else {
+                        screen->perf.perf = perf;
+                        screen->perf.totals =
+                                rzalloc_array(perf, uint64_t, perf->n_counter_values);
+                        screen->perf.next_sample = 0;
+                }
+        }
+
+        if (ok)
+                screen->perf.users++;
+
+        simple_mtx_unlock(&screen->perf.lock);
+        return ok;
+}
+
+static void
+panfrost_perf_query_put(struct panfrost_screen *screen)
+{
+        simple_mtx_lock(&screen->perf.lock);
+
+        if (--screen->perf.users == 0) {
+                panfrost_perf_disable(screen->perf.perf);
+                ralloc_free(screen->perf.perf);
+                screen->perf.perf = NULL;
+                screen->perf.totals = NULL;
+        }
+
+        simple_mtx_unlock(&screen->perf.lock);
+}
+
+/* Dumps the counters and adds the new samples to the totals. Without delta,
+ * the totals are copied to start, otherwise delta gets the values counted
+ * since start was taken. Returns the time of the latest dump.
+ *
+ * Work that is still in flight is only counted by a later dump. */
+static uint64_t
+panfrost_perf_query_snapshot(struct panfrost_screen *screen, uint64_t *start,
+                             uint64_t *delta)
+{
+        simple_mtx_lock(&screen->perf.lock);
+
+        struct panfrost_perf *perf = screen->perf.perf;
+        uint64_t *totals = screen->perf.totals;
+
+        /* Dumps can wait up to a second for the kernel, so drop the lock
+         * meanwhile. Snapshots taken during another thread's dump only see
+         * the totals as they were before it. */
+        bool dumped = false;
+
+        if (!screen->perf.dumping) {
+                screen->perf.dumping = true;
+                simple_mtx_unlock(&screen->perf.lock);
+
+                dumped = panfrost_perf_dump(perf) == 0;
+
+                simple_mtx_lock(&screen->perf.lock);
+                screen->perf.dumping = false;
+        }
+
+        if (dumped) {
+                for (; screen->perf.next_sample < perf->n_samples;
+                     ++screen->perf.next_sample) {
+                        const struct panfrost_perf_sample *sample =
+                                panfrost_perf_get_sample(perf, screen->perf.next_sample);
+
+                        /* Overwritten before we got to it */
+                        if (!sample)
+                                continue;
+
+                        for (unsigned i = 0; i < perf->n_counter_values; ++i)
+                                totals[i] += sample->values[i];
+                }
+        }
+
+        for (unsigned i = 0; i < perf->n_counter_values; ++i) {
+                if (delta)
+                        delta[i] = totals[i] - start[i];
+                else
+                        start[i] = totals[i];
+        }
+
+        uint64_t ts = perf->last_sample_ts;
+        simple_mtx_unlock(&screen->perf.lock);
+        return ts;
+}
+
 static struct pipe_query *
 panfrost_create_query(struct pipe_context *pipe,
                       unsigned type,
                       unsigned index)
 {
+        struct panfrost_screen *screen = pan_screen(pipe->screen);
+        bool derived = type >= PAN_QUERY_PERF_DERIVED &&
+                       type <= PAN_QUERY_PERF_DERIVED_LAST;
+
+        if (derived) {
+                const struct panfrost_perf_config *cfg = screen->perf.cfg;
+
+                if (!cfg || type - PAN_QUERY_PERF_DERIVED >= cfg->n_derived)
+                        return NULL;
+
+                if (!panfrost_perf_query_get(screen))
+                        return NULL;
+        }
+
         struct panfrost_query *q = rzalloc(pipe, struct panfrost_query);
 
         q->type = type;
         q->index = index;
 
+        if (derived) {
+                unsigned n = screen->perf.perf->n_counter_values;
+
+                q->perf_start = rzalloc_array(q, uint64_t, n);
+                q->perf_values = rzalloc_array(q, uint64_t, n);
+        }
+
         return (struct pipe_query *) q;
 }
 
@@ -627,9 +893,41 @@ panfrost_destroy_query(struct pipe_context *pipe, struct pipe_query *q)
         if (query->rsrc)
                 pipe_resource_reference(&query->rsrc, NULL);
 
+        if (query->perf_start)
+                panfrost_perf_query_put(pan_screen(pipe->screen));
+
         ralloc_free(q);
 }
 
+static uint64_t
+panfrost_batch_stats_query(struct panfrost_context *ctx, unsigned type)
+{
+        struct panfrost_batch_stats *totals = &ctx->batch_stats.totals;
+
+        switch (type) {
+        case PAN_QUERY_BATCHES:
+                return ctx->batch_stats.count;
+        case PAN_QUERY_BATCHES_FORCED:
+                return ctx->batch_stats.forced;
+        case PAN_QUERY_BATCH_DRAWS:
+                return totals->draws;
+        case PAN_QUERY_BATCH_TILES:
+                return totals->tiles;
+        case PAN_QUERY_BATCH_BOS:
+                return totals->bos;
+        case PAN_QUERY_BATCH_POOL_BYTES:
+                return totals->pool_bytes;
+        case PAN_QUERY_BATCH_OPEN_TIME:
+                return totals->open_ns / 1000;
+        case PAN_QUERY_BATCH_BUILD_TIME:
+                return totals->build_ns / 1000;
+        case PAN_QUERY_BATCH_SUBMIT_TIME:
+                return totals->submit_ns / 1000;
+        default:
+                unreachable("Invalid batch statistics query");
+        }
+}
+
 static bool
 panfrost_begin_query(struct pipe_context *pipe, struct pipe_query *q)
 {
@@ -674,6 +972,23 @@ panfrost_begin_query(struct pipe_context *pipe, struct pipe_query *q)
                 query->start = ctx->draw_calls;
                 break;
 
+        case PAN_QUERY_BUFFER_MIGRATIONS:
+                query->start = ctx->buffer_migrations;
+                break;
+
+        case PAN_QUERY_CRC_CHECKED_TILES:
+                query->start = ctx->crc_checked_tiles;
+                break;
+
+        case PAN_QUERY_BATCHES ... PAN_QUERY_BATCH_SUBMIT_TIME:
+                query->start = panfrost_batch_stats_query(ctx, query->type);
+                break;
+
+        case PAN_QUERY_PERF_DERIVED ... PAN_QUERY_PERF_DERIVED_LAST:
+                query->start = panfrost_perf_query_snapshot(
+                        pan_screen(pipe->screen), query->perf_start, NULL);
+                break;
+
         default:
                 /* TODO: timestamp queries, etc? */
                 break;
@@ -704,6 +1019,24 @@ panfrost_end_query(struct pipe_context *pipe, struct pipe_query *q)
         case PAN_QUERY_DRAW_CALLS:
                 query->end = ctx->draw_calls;
                 break;
+        case PAN_QUERY_BUFFER_MIGRATIONS:
+                query->end = ctx->buffer_migrations;
+                break;
+        case PAN_QUERY_CRC_CHECKED_TILES:
+                /* Tiles are counted when the framebuffer is emitted */
+                panfrost_flush_all_batches(ctx, "CRC tile query");
+                query->end = ctx->crc_checked_tiles;
+                break;
+        case PAN_QUERY_BATCHES ... PAN_QUERY_BATCH_SUBMIT_TIME:
+                /* Only submitted batches are counted, but don't flush for
+                 * this since the flush pattern is what's being measured */
+                query->end = panfrost_batch_stats_query(ctx, query->type);
+                break;
+        case PAN_QUERY_PERF_DERIVED ... PAN_QUERY_PERF_DERIVED_LAST:
+                query->end = panfrost_perf_query_snapshot(
+                        pan_screen(pipe->screen), query->perf_start,
+                        query->perf_values);
+                break;
         }
 
         return true;
@@ -725,7 +1058,11 @@ panfrost_get_query_result(struct pipe_context *pipe,
         case PIPE_QUERY_OCCLUSION_PREDICATE:
         case PIPE_QUERY_OCCLUSION_PREDICATE_CONSERVATIVE:
                 panfrost_flush_writer(ctx, rsrc, "Occlusion query");
-                panfrost_bo_wait(rsrc->image.data.bo, INT64_MAX, false);
+
+                /* Submission is pipelined, so the result may not be ready */
+                if (!panfrost_bo_wait(rsrc->image.data.bo,
+                                      wait ? INT64_MAX : 0, false))
+                        return false;
 
                 /* Read back the query results */
                 uint64_t *result = (uint64_t *) rsrc->image.data.bo->ptr.cpu;
@@ -752,9 +1089,34 @@ panfrost_get_query_result(struct pipe_context *pipe,
                 break;
 
         case PAN_QUERY_DRAW_CALLS:
+        case PAN_QUERY_BUFFER_MIGRATIONS:
+        case PAN_QUERY_CRC_CHECKED_TILES:
+        case PAN_QUERY_BATCHES ... PAN_QUERY_BATCH_SUBMIT_TIME:
                 vresult->u64 = query->end - query->start;
                 break;
 
+        case PAN_QUERY_PERF_DERIVED ... PAN_QUERY_PERF_DERIVED_LAST: {
+                struct panfrost_screen *screen = pan_screen(pipe->screen);
+                const struct panfrost_perf_derived *derived =
+                        &screen->perf.cfg->derived[query->type - PAN_QUERY_PERF_DERIVED];
+
+                struct panfrost_perf_sample sample = {
+                        .timestamp = query->end,
+                        .duration = query->end - query->start,
+                        .values = query->perf_values,
+                };
+
+                double value =
+                        panfrost_perf_derived_read(derived, screen->perf.perf, &sample);
+
+                if (derived->units == PAN_PERF_DERIVED_UNITS_RATIO)
+                        vresult->f = value;
+                else
+                        vresult->u64 = llround(value);
+
+                break;
+        }
+
         default:
                 /* TODO: more queries */
                 break;
@@ -1058,6 +1420,12 @@ panfrost_create_context(struct pipe_screen *screen, void *priv, unsigned flags)
         gallium->stream_uploader = u_upload_create_default(gallium);
         gallium->const_uploader = gallium->stream_uploader;
 
+        /* Kept separate from the stream uploader, which is read by draws.
+         * Its buffers stay mapped persistently across transfers. */
+        ctx->transfer_uploader = u_upload_create(gallium, 1024 * 1024,
+                                                 PIPE_BIND_SHADER_BUFFER,
+                                                 PIPE_USAGE_STREAM, 0);
+
         panfrost_pool_init(&ctx->descs, ctx, dev,
                         0, 4096, "Descriptors", true, false);
 
@@ -1071,6 +1439,11 @@ panfrost_create_context(struct pipe_screen *screen, void *priv, unsigned flags)
 
         assert(ctx->blitter);
 
+        pan_gpu_tracepoint_config_variable();
+        u_trace_pipe_context_init(&ctx->trace_context, gallium,
+                                  panfrost_record_timestamp,
+                                  panfrost_read_timestamp, NULL);
+
         if (dev->kbase && dev->mali.context_create)
                 ctx->kbase_ctx = dev->mali.context_create(&dev->mali);
 
@@ -34,6 +34,8 @@
 #include "pan_encoder.h"
 #include "pan_texture.h"
 #include "pan_earlyzs.h"
+#include "pan_batch_graph.h"
+#include "pan_perfetto.h"
 
 #include "pipe/p_compiler.h"
 #include "util/detect.h"
@@ -45,6 +47,7 @@
 #include "util/u_blitter.h"
 #include "util/hash_table.h"
 #include "util/simple_mtx.h"
+#include "util/perf/u_trace.h"
 
 #include "midgard/midgard_compile.h"
 #include "compiler/shader_enums.h"
@@ -105,6 +108,11 @@ struct panfrost_query {
 
         /* Whether an occlusion query is for a MSAA framebuffer */
         bool msaa;
+
+        /* For derived metric queries, the accumulated counter values at
+         * begin, and the values counted between begin and end */
+        uint64_t *perf_start;
+        uint64_t *perf_values;
 };
 
 struct panfrost_streamout_target {
@@ -118,6 +126,16 @@ struct panfrost_streamout {
 };
 
 // TODO: This struct is a mess
+/* Number of submissions tracked per command stream ring. When the list is
+ * full, the oldest submission is waited on before recording another one. */
+#define PAN_CS_RING_MARKS 32
+
+struct panfrost_cs_mark {
+        /* Insert offset written for the submission, in bytes */
+        uint64_t insert;
+        uint64_t seqnum;
+};
+
 struct panfrost_cs {
         struct kbase_cs base;
         struct panfrost_bo *bo;
@@ -128,6 +146,26 @@ struct panfrost_cs {
         uint64_t kcpu_seqnum;
         uint64_t offset;
         unsigned hw_resources;
+
+        /* In-flight submissions, oldest first, used to avoid overwriting
+         * instructions the GPU has not consumed yet */
+        struct panfrost_cs_mark marks[PAN_CS_RING_MARKS];
+        unsigned mark_head, mark_count;
+
+        /* Ring offset the GPU is known to have read up to */
+        uint64_t consumed;
+};
+
+/* Number of cleaned up batches whose pools are kept for reuse, and number of
+ * recent batches looked at to size new pools */
+#define PAN_MAX_RETIRED_POOLS 8
+#define PAN_POOL_HISTORY 16
+
+struct panfrost_retired_pools {
+        struct panfrost_pool pool, invisible_pool;
+
+        /* CSF seqnums which must complete before the pools can be reused */
+        uint64_t vertex_seqnum, fragment_seqnum;
 };
 
 struct panfrost_context {
@@ -156,8 +194,33 @@ struct panfrost_context {
 
                 /** Set of active batches for faster traversal */
                 BITSET_DECLARE(active, PAN_MAX_BATCHES);
+
+                /* Order in which the batches must be submitted */
+                struct pan_batch_graph graph;
         } batches;
 
+        /* Pools of cleaned up batches, oldest first, reused by new batches
+         * once the GPU is done with them */
+        struct {
+                struct panfrost_retired_pools entries[PAN_MAX_RETIRED_POOLS];
+                unsigned head, count;
+
+                /* Bytes allocated by recent batches, to size new pools */
+                size_t usage[PAN_POOL_HISTORY];
+                size_t invisible_usage[PAN_POOL_HISTORY];
+                unsigned usage_idx;
+        } retired_pools;
+
+        /* Statistics for recently submitted batches, and totals over the
+         * lifetime of the context for the driver queries */
+        struct {
+                struct panfrost_batch_stats ring[PAN_BATCH_STATS_RING];
+                unsigned head;
+
+                struct panfrost_batch_stats totals;
+                uint64_t count, forced;
+        } batch_stats;
+
         /* Map from resources to panfrost_batches */
         struct hash_table *writers;
 
@@ -167,6 +230,19 @@ struct panfrost_context {
         /* Within a launch_grid call.. */
         const struct pipe_grid_info *compute_grid;
 
+        /* Within a blit call, for the blit tracepoints */
+        const struct pipe_blit_info *blit;
+
+        /* GPU tracepoints, see pan_tracepoints.py */
+        struct u_trace_context trace_context;
+
+        /* Number of batches submitted, identifying them in traces */
+        uint32_t submit_count;
+
+#ifdef HAVE_PERFETTO
+        struct pan_perfetto_state perfetto;
+#endif
+
         struct pipe_framebuffer_state pipe_framebuffer;
         struct panfrost_streamout streamout;
 
@@ -174,6 +250,8 @@ struct panfrost_context {
         uint64_t prims_generated;
         uint64_t tf_prims_generated;
         uint64_t draw_calls;
+        uint64_t buffer_migrations;
+        uint64_t crc_checked_tiles;
         struct panfrost_query *occlusion_query;
 
         bool indirect_draw;
@@ -216,6 +294,22 @@ struct panfrost_context {
 
         struct blitter_context *blitter;
 
+        /* Staging memory for buffer uploads that would otherwise stall, and
+         * the compute shader copying it into place. See
+         * panfrost_copy_buffer_gpu */
+        struct u_upload_mgr *transfer_uploader;
+        void *copy_buffer_cs;
+
+        /* Compute shaders generating 1 to PAN_MIPMAP_MAX_LEVELS mip levels at
+         * once, and their sampler. See panfrost_generate_mipmap_gpu */
+        void *mipmap_cs[PAN_MIPMAP_MAX_LEVELS];
+        void *mipmap_sampler;
+
+        /* Compute shaders sizing and packing AFBC superblocks. See
+         * panfrost_pack_afbc */
+        void *afbc_size_cs;
+        void *afbc_pack_cs;
+
         struct panfrost_blend_state *blend;
 
         /* On Valhall, does the current blend state use a blend shader for any
@@ -238,6 +332,9 @@ struct panfrost_context {
 
         bool is_noop;
 
+        /* Number of frames ended, used to track resource usage history */
+        unsigned frame;
+
         /* Mask of active render targets */
         uint8_t fb_rt_mask;
 
@@ -284,6 +381,9 @@ struct panfrost_fs_key {
         /* On Valhall, fixed_varying_mask of the linked vertex shader */
         uint32_t fixed_varying_mask;
 
+        /* On Valhall, varying_layout of the linked vertex shader */
+        struct pan_varying_layout varying_layout;
+
         /* Midgard shaders that read the tilebuffer must be keyed for
          * non-blendable formats
          */
@@ -296,6 +396,18 @@ struct panfrost_fs_key {
         uint8_t clip_plane_enable;
 };
 
+/* Maximum number of words of UBO 0 inlined into a specialized variant */
+#define PAN_MAX_SPECIALIZED_UNIFORMS 16
+
+/* Words of UBO 0 observed to be unchanged across draws, which are inlined as
+ * constants in specialized variants with PAN_MESA_DEBUG=specialize.
+ */
+struct panfrost_uniform_key {
+        unsigned count;
+        uint16_t offsets[PAN_MAX_SPECIALIZED_UNIFORMS];
+        uint32_t values[PAN_MAX_SPECIALIZED_UNIFORMS];
+};
+
 struct panfrost_shader_key {
         union {
                 /* Vertex shaders do not use shader keys. However, we have a
@@ -309,6 +421,9 @@ struct panfrost_shader_key {
                 /* Fragment shaders use regular shader keys */
                 struct panfrost_fs_key fs;
         };
+
+        /* Any graphics stage may be specialized on uniforms */
+        struct panfrost_uniform_key uniforms;
 };
 
 struct panfrost_compiled_shader {
@@ -362,6 +477,32 @@ struct panfrost_uncompiled_shader {
          * shaders for desktop GL.
          */
         uint32_t fixed_varying_mask;
+
+        /* On vertex shaders, packed layout of the general varyings, used on
+         * Valhall to size the varying buffer to the components written.
+         */
+        struct pan_varying_layout varying_layout;
+
+        /* Uniform specialization state, protected by the lock */
+        struct {
+                /* Whether the candidate words have been collected */
+                bool analyzed;
+
+                /* Candidate words: byte offsets into UBO 0 of the words
+                 * pushed by the generic variant.
+                 */
+                unsigned count;
+                uint16_t offsets[PAN_MAX_SPECIALIZED_UNIFORMS];
+
+                /* Last observed value of each candidate, and the number of
+                 * consecutive draws it has remained unchanged.
+                 */
+                uint32_t values[PAN_MAX_SPECIALIZED_UNIFORMS];
+                unsigned stable_draws[PAN_MAX_SPECIALIZED_UNIFORMS];
+
+                /* Number of specialized variants compiled so far */
+                unsigned nr_variants;
+        } spec;
 };
 
 /* The binary artefacts of compiling a shader. This differs from
@@ -442,6 +583,14 @@ panfrost_flush(
 bool
 panfrost_render_condition_check(struct panfrost_context *ctx);
 
+void
+panfrost_cs_wait_ring(struct panfrost_device *dev, struct panfrost_cs *cs,
+                      uint64_t end);
+
+void
+panfrost_update_uniform_specialization(struct panfrost_context *ctx,
+                                       enum pipe_shader_type type);
+
 void
 panfrost_update_shader_variant(struct panfrost_context *ctx,
                                enum pipe_shader_type type);
@@ -72,6 +72,12 @@ panfrost_fence_finish(struct pipe_screen *pscreen,
                 /* TODO: Use the timeout */
                 bool ret = dev->mali.syncobj_wait(&dev->mali, fence->kbase);
                 fence->signaled = ret;
+
+                /* A fault leaves the fence unsignalled, reset from here as
+                 * the context may not submit again */
+                if (ctx)
+                        panfrost_check_faults(pan_context(ctx));
+
                 return ret;
         }
 
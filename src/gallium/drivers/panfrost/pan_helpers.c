@@ -253,6 +253,11 @@ panfrost_track_image_access(struct panfrost_batch *batch,
                 if (is_buffer) {
                         util_range_add(&rsrc->base, &rsrc->valid_buffer_range,
                                         0, rsrc->base.width0);
+                } else {
+                        /* Shader writes bypass the CRC update */
+                        panfrost_invalidate_crc(rsrc, level,
+                                                image->u.tex.first_layer,
+                                                image->u.tex.last_layer);
                 }
         } else {
                 panfrost_batch_read_rsrc(batch, rsrc, stage);
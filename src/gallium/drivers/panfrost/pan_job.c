@@ -30,7 +30,9 @@
 #include "drm-uapi/panfrost_drm.h"
 
 #include "pan_bo.h"
+#include "pan_capture.h"
 #include "pan_context.h"
+#include "pan_tiler_heap.h"
 #include "util/hash_table.h"
 #include "util/ralloc.h"
 #include "util/format/u_format.h"
@@ -39,10 +41,18 @@
 #include "util/u_framebuffer.h"
 #include "pan_util.h"
 #include "decode.h"
+#include "util/os_time.h"
+#include "util/u_atomic.h"
+#include "util/u_debug.h"
+#include "util/perf/cpu_trace.h"
+#include "pan_tracepoints.h"
 
 #define foreach_batch(ctx, idx) \
         BITSET_FOREACH_SET(idx, ctx->batches.active, PAN_MAX_BATCHES)
 
+static_assert(PAN_MAX_BATCHES <= PAN_BATCH_GRAPH_MAX,
+              "batch slots must fit in the batch graph");
+
 static unsigned
 panfrost_batch_idx(struct panfrost_batch *batch)
 {
@@ -60,6 +70,144 @@ panfrost_batch_add_surface(struct panfrost_batch *batch, struct pipe_surface *su
         }
 }
 
+/* Returns whether the submission with the given seqnum on the CS is known to
+ * be finished. Submissions which never reached the kernel are treated as
+ * finished, as there is nothing to wait for. */
+static bool
+panfrost_cs_seqnum_done(kbase k, struct panfrost_cs *cs, uint64_t seqnum)
+{
+        struct kbase_event_slot *slot =
+                &k->event_slots[cs->base.event_mem_offset];
+
+        pthread_mutex_lock(&k->queue_lock);
+        bool done = (slot->last_submit <= seqnum) || (slot->last > seqnum);
+        pthread_mutex_unlock(&k->queue_lock);
+
+        return done;
+}
+
+#define PAN_POOL_DEFAULT_SLAB (64 * 1024)
+#define PAN_POOL_MIN_SLAB (16 * 1024)
+#define PAN_POOL_MAX_SLAB (1024 * 1024)
+
+/* Size pools to fit what recent batches allocated, so that most batches only
+ * need a single BO */
+static size_t
+panfrost_pool_slab_size(const size_t *usage)
+{
+        size_t max = 0;
+
+        for (unsigned i = 0; i < PAN_POOL_HISTORY; ++i)
+                max = MAX2(max, usage[i]);
+
+        if (!max)
+                return PAN_POOL_DEFAULT_SLAB;
+
+        return CLAMP(util_next_power_of_two64(max), PAN_POOL_MIN_SLAB,
+                     PAN_POOL_MAX_SLAB);
+}
+
+static bool
+panfrost_pool_idle(struct panfrost_pool *pool)
+{
+        util_dynarray_foreach(&pool->bos, struct panfrost_bo *, bo) {
+                if (!panfrost_bo_wait(*bo, 0, true))
+                        return false;
+        }
+
+        return true;
+}
+
+static bool
+panfrost_retired_pools_idle(struct panfrost_context *ctx,
+                            struct panfrost_retired_pools *entry)
+{
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
+
+        /* Pool BOs are not tracked in the BO usage lists with CSF, so check
+         * the queues directly */
+        if (dev->kbase && dev->arch >= 10) {
+                return panfrost_cs_seqnum_done(&dev->mali, &ctx->kbase_cs_vertex,
+                                               entry->vertex_seqnum) &&
+                       panfrost_cs_seqnum_done(&dev->mali, &ctx->kbase_cs_fragment,
+                                               entry->fragment_seqnum);
+        }
+
+        return panfrost_pool_idle(&entry->pool) &&
+               panfrost_pool_idle(&entry->invisible_pool);
+}
+
+/* Take the pools of the oldest retired batch if the GPU is done with them */
+static bool
+panfrost_batch_reuse_pools(struct panfrost_context *ctx,
+                           struct panfrost_batch *batch)
+{
+        struct panfrost_retired_pools *entry =
+                &ctx->retired_pools.entries[ctx->retired_pools.head];
+
+        if (!ctx->retired_pools.count ||
+            !panfrost_retired_pools_idle(ctx, entry))
+                return false;
+
+        batch->pool = entry->pool;
+        batch->invisible_pool = entry->invisible_pool;
+
+        ctx->retired_pools.head =
+                (ctx->retired_pools.head + 1) % PAN_MAX_RETIRED_POOLS;
+        --ctx->retired_pools.count;
+
+        panfrost_pool_reset(&batch->pool,
+                            panfrost_pool_slab_size(ctx->retired_pools.usage),
+                            true);
+        panfrost_pool_reset(&batch->invisible_pool,
+                            panfrost_pool_slab_size(ctx->retired_pools.invisible_usage),
+                            false);
+        return true;
+}
+
+static void
+panfrost_batch_retire_pools(struct panfrost_context *ctx,
+                            struct panfrost_batch *batch)
+{
+        unsigned idx = ctx->retired_pools.usage_idx;
+        ctx->retired_pools.usage[idx] = batch->pool.allocated;
+        ctx->retired_pools.invisible_usage[idx] = batch->invisible_pool.allocated;
+        ctx->retired_pools.usage_idx = (idx + 1) % PAN_POOL_HISTORY;
+
+        if (ctx->retired_pools.count == PAN_MAX_RETIRED_POOLS) {
+                panfrost_pool_cleanup(&batch->pool);
+                panfrost_pool_cleanup(&batch->invisible_pool);
+                return;
+        }
+
+        unsigned tail = (ctx->retired_pools.head + ctx->retired_pools.count) %
+                PAN_MAX_RETIRED_POOLS;
+
+        ctx->retired_pools.entries[tail] = (struct panfrost_retired_pools) {
+                .pool = batch->pool,
+                .invisible_pool = batch->invisible_pool,
+                .vertex_seqnum = ctx->kbase_cs_vertex.seqnum,
+                .fragment_seqnum = ctx->kbase_cs_fragment.seqnum,
+        };
+
+        ++ctx->retired_pools.count;
+}
+
+void
+panfrost_free_retired_pools(struct panfrost_context *ctx)
+{
+        for (unsigned i = 0; i < ctx->retired_pools.count; ++i) {
+                unsigned idx = (ctx->retired_pools.head + i) %
+                        PAN_MAX_RETIRED_POOLS;
+
+                panfrost_pool_cleanup(&ctx->retired_pools.entries[idx].pool);
+                panfrost_pool_cleanup(&ctx->retired_pools.entries[idx].invisible_pool);
+        }
+
+        ctx->retired_pools.head = 0;
+        ctx->retired_pools.count = 0;
+}
+
 static void
 panfrost_batch_init(struct panfrost_context *ctx,
                     const struct pipe_framebuffer_state *key,
@@ -72,6 +220,9 @@ panfrost_batch_init(struct panfrost_context *ctx,
         batch->ctx = ctx;
 
         batch->seqnum = ++ctx->batches.seqnum;
+        batch->init_ns = os_time_get_nano();
+
+        u_trace_init(&batch->trace, &ctx->trace_context);
 
         util_dynarray_init(&batch->bos, NULL);
 
@@ -90,21 +241,30 @@ panfrost_batch_init(struct panfrost_context *ctx,
 
         util_dynarray_init(&batch->dmabufs, NULL);
 
-        /* Preallocate the main pool, since every batch has at least one job
-         * structure so it will be used */
-        panfrost_pool_init(&batch->pool, NULL, dev, 0, 65536, "Batch pool", true, true);
-
-        /* Don't preallocate the invisible pool, since not every batch will use
-         * the pre-allocation, particularly if the varyings are larger than the
-         * preallocation and a reallocation is needed after anyway. */
-        panfrost_pool_init(&batch->invisible_pool, NULL, dev,
-                        PAN_BO_INVISIBLE, 65536, "Varyings", false, true);
+        if (!panfrost_batch_reuse_pools(ctx, batch)) {
+                /* Preallocate the main pool, since every batch has at least
+                 * one job structure so it will be used */
+                panfrost_pool_init(&batch->pool, NULL, dev, 0,
+                                   panfrost_pool_slab_size(ctx->retired_pools.usage),
+                                   "Batch pool", true, true);
+
+                /* Don't preallocate the invisible pool, since not every batch
+                 * will use the pre-allocation, particularly if the varyings
+                 * are larger than the preallocation and a reallocation is
+                 * needed after anyway. */
+                panfrost_pool_init(&batch->invisible_pool, NULL, dev,
+                                   PAN_BO_INVISIBLE,
+                                   panfrost_pool_slab_size(ctx->retired_pools.invisible_usage),
+                                   "Varyings", false, true);
+        }
 
         for (unsigned i = 0; i < batch->key.nr_cbufs; ++i)
                 panfrost_batch_add_surface(batch, batch->key.cbufs[i]);
 
         panfrost_batch_add_surface(batch, batch->key.zsbuf);
 
+        /* Pipelining is opt-in until it has been stress tested against
+         * out-of-order completion */
         if ((dev->debug & PAN_DBG_SYNC) || !(dev->debug & PAN_DBG_GOFASTER))
                 batch->needs_sync = true;
 
@@ -143,9 +303,12 @@ panfrost_batch_add_resource(struct panfrost_batch *batch,
         /* Reference the resource on the batch */
         pipe_reference(NULL, &rsrc->base.reference);
 
-        if (rsrc->scanout) {
-                if (dev->has_dmabuf_fence) {
-                        int fd = rsrc->image.data.bo->dmabuf_fd;
+        /* Shared buffers may be accessed by other devices and processes,
+         * so synchronise with them through the dma-buf */
+        int fd = rsrc->image.data.bo->dmabuf_fd;
+
+        if (rsrc->scanout || fd != -1) {
+                if (dev->has_dmabuf_fence && fd != -1) {
                         util_dynarray_append(&batch->dmabufs, int, fd);
                 } else {
                         perf_debug_ctx(ctx, "Forcing sync on batch");
@@ -156,10 +319,12 @@ panfrost_batch_add_resource(struct panfrost_batch *batch,
 
 static void
 panfrost_batch_remove_resource_internal(struct panfrost_context *ctx,
+                                        struct panfrost_batch *batch,
                                         struct panfrost_resource *rsrc)
 {
+        /* A later batch may have taken over as the writer */
         struct hash_entry *writer = _mesa_hash_table_search(ctx->writers, rsrc);
-        if (writer) {
+        if (writer && writer->data == batch) {
                 _mesa_hash_table_remove(ctx->writers, writer);
                 rsrc->track.nr_writers--;
         }
@@ -176,7 +341,7 @@ panfrost_batch_remove_resource_if_present(struct panfrost_context *ctx,
         struct set_entry *ent = _mesa_set_search(batch->resources, rsrc);
 
         if (ent != NULL) {
-                panfrost_batch_remove_resource_internal(ctx, rsrc);
+                panfrost_batch_remove_resource_internal(ctx, batch, rsrc);
                 _mesa_set_remove(batch->resources, ent);
         }
 }
@@ -188,7 +353,7 @@ panfrost_batch_destroy_resources(struct panfrost_context *ctx,
         set_foreach(batch->resources, entry) {
                 struct panfrost_resource *rsrc = (void *) entry->key;
 
-                panfrost_batch_remove_resource_internal(ctx, rsrc);
+                panfrost_batch_remove_resource_internal(ctx, batch, rsrc);
         }
 
         _mesa_set_destroy(batch->resources, NULL);
@@ -230,46 +395,105 @@ panfrost_batch_cleanup(struct panfrost_context *ctx, struct panfrost_batch *batc
                 util_dynarray_fini(&batch->resource_bos[i]);
 
         panfrost_batch_destroy_resources(ctx, batch);
-        panfrost_pool_cleanup(&batch->pool);
-        panfrost_pool_cleanup(&batch->invisible_pool);
+        panfrost_batch_retire_pools(ctx, batch);
 
         util_unreference_framebuffer_state(&batch->key);
 
         util_dynarray_fini(&batch->bos);
 
+        u_trace_fini(&batch->trace);
+
         memset(batch, 0, sizeof(*batch));
         BITSET_CLEAR(ctx->batches.active, batch_idx);
+        pan_batch_graph_remove(&ctx->batches.graph, batch_idx);
 }
 
 static void
 panfrost_batch_submit(struct panfrost_context *ctx,
-                      struct panfrost_batch *batch);
+                      struct panfrost_batch *batch, const char *reason);
+
+/* Order batch after other, which accessed a resource in a conflicting way.
+ * Submission is deferred until something needs the results, except when
+ * other is the batch currently being recorded into, which could otherwise
+ * keep growing after the point batch depends on. */
+
+static void
+panfrost_batch_add_dep(struct panfrost_context *ctx,
+                       struct panfrost_batch *batch,
+                       struct panfrost_batch *other)
+{
+        int current = ctx->batch ? panfrost_batch_idx(ctx->batch) : -1;
+
+        if (!pan_batch_graph_add(&ctx->batches.graph, panfrost_batch_idx(batch),
+                                 panfrost_batch_idx(other), current)) {
+                perf_debug_ctx(ctx, "Flushing the current FBO for a dependency");
+                panfrost_batch_submit(ctx, other, "Dependency on the current FBO");
+        }
+}
 
 static struct panfrost_batch *
 panfrost_get_batch(struct panfrost_context *ctx,
                    const struct pipe_framebuffer_state *key)
 {
         struct panfrost_batch *batch = NULL;
+        struct panfrost_batch *lru = NULL;
 
         for (unsigned i = 0; i < PAN_MAX_BATCHES; i++) {
-                if (ctx->batches.slots[i].seqnum &&
-                    util_framebuffer_state_equal(&ctx->batches.slots[i].key, key)) {
+                struct panfrost_batch *slot = &ctx->batches.slots[i];
+
+                if (slot->seqnum &&
+                    util_framebuffer_state_equal(&slot->key, key)) {
+                        /* Later batches were ordered against what the batch
+                         * contains so far, so anything added now would be
+                         * seen by them too early. Submit it and start over
+                         * in the same slot. */
+                        if (pan_batch_graph_has_dependents(&ctx->batches.graph, i)) {
+                                perf_debug_ctx(ctx, "Flushing a batch with dependents");
+                                panfrost_batch_submit(ctx, slot, "Batch has dependents");
+                                batch = slot;
+                                break;
+                        }
+
+                        /* Drawing would widen the bounds of a region
+                         * clear, clearing outside of the region */
+                        if (slot->clear_region) {
+                                panfrost_batch_submit(ctx, slot, "Region clear");
+                                batch = slot;
+                                break;
+                        }
+
                         /* We found a match, increase the seqnum for the LRU
                          * eviction logic.
                          */
-                        ctx->batches.slots[i].seqnum = ++ctx->batches.seqnum;
-                        return &ctx->batches.slots[i];
+                        slot->seqnum = ++ctx->batches.seqnum;
+                        return slot;
+                }
+
+                /* Free slots are always preferred */
+                if (!slot->seqnum) {
+                        if (!batch || batch->seqnum)
+                                batch = slot;
+                        continue;
                 }
 
-                if (!batch || batch->seqnum > ctx->batches.slots[i].seqnum)
-                        batch = &ctx->batches.slots[i];
+                if (!lru || lru->seqnum > slot->seqnum)
+                        lru = slot;
+
+                /* Prefer evicting batches that can be submitted on their
+                 * own, so that making room flushes a single batch */
+                if (!pan_batch_graph_has_deps(&ctx->batches.graph, i) &&
+                    (!batch || (batch->seqnum && batch->seqnum > slot->seqnum)))
+                        batch = slot;
         }
 
+        if (!batch)
+                batch = lru;
+
         assert(batch);
 
         /* The selected slot is used, we need to flush the batch */
         if (batch->seqnum)
-                panfrost_batch_submit(ctx, batch);
+                panfrost_batch_submit(ctx, batch, "Out of batch slots");
 
         panfrost_batch_init(ctx, key, batch);
 
@@ -317,7 +541,7 @@ panfrost_get_fresh_batch_for_fbo(struct panfrost_context *ctx, const char *reaso
 
         if (batch->scoreboard.first_job) {
                 perf_debug_ctx(ctx, "Flushing the current FBO due to: %s", reason);
-                panfrost_batch_submit(ctx, batch);
+                panfrost_batch_submit(ctx, batch, reason);
                 batch = panfrost_get_batch(ctx, &ctx->pipe_framebuffer);
         }
 
@@ -325,6 +549,43 @@ panfrost_get_fresh_batch_for_fbo(struct panfrost_context *ctx, const char *reaso
         return batch;
 }
 
+/* Get a batch not tied to any framebuffer, for work that only needs to be
+ * ordered against other batches through resource tracking, like staging
+ * uploads. Adding work to it never splits the current render pass.
+ */
+
+struct panfrost_batch *
+panfrost_get_batch_for_upload(struct panfrost_context *ctx)
+{
+        struct pipe_framebuffer_state key = { 0 };
+        struct panfrost_batch *batch = panfrost_get_batch(ctx, &key);
+
+        panfrost_dirty_state_all(ctx);
+        return batch;
+}
+
+/* Is a resource accessed by a pending batch that renders to a framebuffer?
+ * Writing the resource from another batch would require flushing it.
+ */
+
+bool
+panfrost_render_batches_use_resource(struct panfrost_context *ctx,
+                                     struct panfrost_resource *rsrc)
+{
+        unsigned i;
+        foreach_batch(ctx, i) {
+                struct panfrost_batch *batch = &ctx->batches.slots[i];
+
+                if (!batch->key.nr_cbufs && !batch->key.zsbuf)
+                        continue;
+
+                if (panfrost_batch_uses_resource(batch, rsrc))
+                        return true;
+        }
+
+        return false;
+}
+
 static void
 panfrost_batch_update_access(struct panfrost_batch *batch,
                              struct panfrost_resource *rsrc, bool writes)
@@ -336,25 +597,47 @@ panfrost_batch_update_access(struct panfrost_batch *batch,
 
         panfrost_batch_add_resource(batch, rsrc);
 
-        /* Flush users if required */
-        if (writes || ((writer != NULL) && (writer != batch))) {
+        /* Order after the previous writer when reading, and after every
+         * other user when writing */
+        if (writes) {
                 unsigned i;
                 foreach_batch(ctx, i) {
-                        struct panfrost_batch *batch = &ctx->batches.slots[i];
+                        struct panfrost_batch *other = &ctx->batches.slots[i];
 
-                        /* Skip the entry if this our batch. */
-                        if (i == batch_idx)
+                        /* Skip the entry if this our batch, or if it was
+                         * submitted as a dependency during the loop. */
+                        if (i == batch_idx || !other->seqnum)
                                 continue;
 
-                        /* Submit if it's a user */
-                        if (panfrost_batch_uses_resource(batch, rsrc))
-                                panfrost_batch_submit(ctx, batch);
+                        if (panfrost_batch_uses_resource(other, rsrc))
+                                panfrost_batch_add_dep(ctx, batch, other);
                 }
+        } else if (writer && writer != batch) {
+                panfrost_batch_add_dep(ctx, batch, writer);
         }
 
+        /* Only one batch is tracked as the writer, earlier ones are ordered
+         * before it */
         if (writes && (writer != batch)) {
+                if (!_mesa_hash_table_search(ctx->writers, rsrc))
+                        rsrc->track.nr_writers++;
+
                 _mesa_hash_table_insert(ctx->writers, rsrc, batch);
-                rsrc->track.nr_writers++;
+        }
+
+        /* New contents may be packed again, see panfrost_pack_afbc */
+        if (writes)
+                rsrc->afbc.checked = false;
+
+        /* Count frames of GPU use, see panfrost_promote_layout */
+        if (rsrc->history.gpu_frame != ctx->frame) {
+                rsrc->history.gpu_frame = ctx->frame;
+
+                if (rsrc->history.gpu_frames < UINT8_MAX)
+                        rsrc->history.gpu_frames++;
+
+                if (rsrc->history.gpu_frames == LAYOUT_PROMOTE_FRAMES)
+                        rsrc->history.cpu_frames = 0;
         }
 }
 
@@ -455,6 +738,24 @@ panfrost_batch_write_rsrc(struct panfrost_batch *batch,
         panfrost_batch_update_access(batch, rsrc, true);
 }
 
+/* Adds a BO written by the GPU that isn't backing a resource of the batch,
+ * like the timestamp buffers of the tracepoints */
+
+void
+panfrost_batch_write_bo(struct panfrost_batch *batch,
+                        struct panfrost_bo *bo,
+                        enum pipe_shader_type stage)
+{
+        enum panfrost_usage_type type = (stage == MESA_SHADER_FRAGMENT) ?
+                PAN_USAGE_WRITE_FRAGMENT : PAN_USAGE_WRITE_VERTEX;
+
+        util_dynarray_append(&batch->resource_bos[type], struct panfrost_bo *,
+                             bo);
+
+        panfrost_batch_add_bo_old(batch, bo, PAN_BO_ACCESS_WRITE |
+                                  panfrost_access_for_stage(stage));
+}
+
 void
 panfrost_resource_swap_bo(struct panfrost_context *ctx,
                           struct panfrost_resource *rsrc,
@@ -553,6 +854,7 @@ panfrost_batch_to_fb_info(struct panfrost_batch *batch,
         memset(s, 0, sizeof(*s));
 
         fb->width = batch->key.width;
+        fb->crc_checked_tiles = &batch->ctx->crc_checked_tiles;
         fb->height = batch->key.height;
         fb->extent.minx = batch->minx;
         fb->extent.miny = batch->miny;
@@ -593,7 +895,18 @@ panfrost_batch_to_fb_info(struct panfrost_batch *batch,
                 rts[i].image = &prsrc->image;
                 rts[i].nr_samples = surf->nr_samples ? : MAX2(surf->texture->nr_samples, 1);
                 memcpy(rts[i].swizzle, id_swz, sizeof(rts[i].swizzle));
-                fb->rts[i].crc_valid = &prsrc->valid.crc;
+
+                /* CRCs are only maintained when rendering a single layer */
+                if (prsrc->valid.crc && rts[i].first_layer == rts[i].last_layer) {
+                        fb->rts[i].crc_valid =
+                                panfrost_crc_valid(prsrc, rts[i].first_level,
+                                                   rts[i].first_layer);
+                } else {
+                        panfrost_invalidate_crc(prsrc, rts[i].first_level,
+                                                rts[i].first_layer,
+                                                rts[i].last_layer);
+                }
+
                 fb->rts[i].view = &rts[i];
 
                 /* Preload if the RT is read or updated */
@@ -703,6 +1016,44 @@ panfrost_batch_submit_kbase(struct panfrost_device *dev,
         return 0;
 }
 
+/* Start tracing a submit, snapshotting the BOs accessed by the batch and the
+ * extra BOs not tracked by it, rather than every mapped buffer */
+
+static void
+panfrost_batch_begin_trace(struct panfrost_batch *batch,
+                           struct panfrost_bo **extra, unsigned extra_count)
+{
+        struct panfrost_device *dev = pan_device(batch->ctx->base.screen);
+        struct util_dynarray vas;
+
+        util_dynarray_init(&vas, NULL);
+
+        pan_bo_access *flags = util_dynarray_begin(&batch->bos);
+        unsigned end_bo = util_dynarray_num_elements(&batch->bos, pan_bo_access);
+
+        for (unsigned i = 0; i < end_bo; ++i) {
+                if (flags[i]) {
+                        util_dynarray_append(&vas, uint64_t,
+                                             pan_lookup_bo_existing(dev, i)->ptr.gpu);
+                }
+        }
+
+        util_dynarray_foreach(&batch->pool.bos, struct panfrost_bo *, bo)
+                util_dynarray_append(&vas, uint64_t, (*bo)->ptr.gpu);
+
+        util_dynarray_foreach(&batch->invisible_pool.bos, struct panfrost_bo *, bo)
+                util_dynarray_append(&vas, uint64_t, (*bo)->ptr.gpu);
+
+        for (unsigned i = 0; i < extra_count; ++i) {
+                if (extra[i])
+                        util_dynarray_append(&vas, uint64_t, extra[i]->ptr.gpu);
+        }
+
+        pandecode_begin_submit(util_dynarray_begin(&vas),
+                               util_dynarray_num_elements(&vas, uint64_t));
+        util_dynarray_fini(&vas);
+}
+
 static int
 panfrost_batch_submit_ioctl(struct panfrost_batch *batch,
                             mali_ptr first_job_desc,
@@ -790,6 +1141,10 @@ panfrost_batch_submit_ioctl(struct panfrost_batch *batch,
         bo_handles[submit.bo_handle_count++] = dev->sample_positions->gem_handle;
 
         submit.bo_handles = (u64) (uintptr_t) bo_handles;
+
+        if (dev->capture && !ctx->is_noop)
+                pan_capture_submit_jc(dev->capture, submit.jc, submit.requirements);
+
         if (ctx->is_noop)
                 ret = 0;
         else if (dev->kbase)
@@ -810,8 +1165,16 @@ panfrost_batch_submit_ioctl(struct panfrost_batch *batch,
                         drmSyncobjWait(dev->fd, &out_sync, 1,
                                        INT64_MAX, 0, NULL);
 
-                if (dev->debug & PAN_DBG_TRACE)
+                if (dev->debug & PAN_DBG_TRACE) {
+                        struct panfrost_bo *extra[] = {
+                                batch->scoreboard.first_tiler ? dev->tiler_heap : NULL,
+                                dev->sample_positions,
+                        };
+
+                        panfrost_batch_begin_trace(batch, extra, ARRAY_SIZE(extra));
                         pandecode_jc(submit.jc, dev->gpu_id);
+                        pandecode_end_submit();
+                }
 
                 if (dev->debug & PAN_DBG_DUMP)
                         pandecode_dump_mappings();
@@ -912,6 +1275,27 @@ unmap:
         munmap(mem, size);
 }
 
+/* Log the most recent batches, oldest first */
+static void
+panfrost_dump_batch_stats(struct panfrost_context *ctx)
+{
+        for (unsigned i = 0; i < PAN_BATCH_STATS_RING; ++i) {
+                unsigned idx = (ctx->batch_stats.head + i) % PAN_BATCH_STATS_RING;
+                struct panfrost_batch_stats *stats = &ctx->batch_stats.ring[idx];
+
+                if (!stats->open_ns)
+                        continue;
+
+                mesa_loge("batch: %s, %u draws, %u clears, %u tiles, %u BOs, "
+                          "%zu pool bytes, %"PRIu64" us open, "
+                          "%"PRIu64" us to build, %"PRIu64" us to submit",
+                          stats->reason ?: "Flush", stats->draws, stats->clears,
+                          stats->tiles, stats->bos, stats->pool_bytes,
+                          stats->open_ns / 1000, stats->build_ns / 1000,
+                          stats->submit_ns / 1000);
+        }
+}
+
 static void
 reset_context(struct panfrost_context *ctx)
 {
@@ -924,6 +1308,7 @@ reset_context(struct panfrost_context *ctx)
         bool recover = !(dev->debug & PAN_DBG_SYNC);
 
         mesa_loge("Context reset");
+        panfrost_dump_batch_stats(ctx);
 
         dev->mali.cs_term(&dev->mali, &ctx->kbase_cs_vertex.base);
         dev->mali.cs_term(&dev->mali, &ctx->kbase_cs_fragment.base);
@@ -948,6 +1333,70 @@ reset_context(struct panfrost_context *ctx)
 
         /* TODO: this leaks memory */
         ctx->tiler_heap_desc = 0;
+
+        /* Seqnums start over, so retired pools can't be tracked anymore */
+        panfrost_free_retired_pools(ctx);
+}
+
+static void
+panfrost_capture_cs_ring(struct panfrost_device *dev, struct panfrost_cs *cs,
+                         unsigned queue, uint64_t insert)
+{
+        if (insert == cs->base.last_insert)
+                return;
+
+        pan_capture_submit_cs(dev->capture, queue, cs->base.va, cs->base.size,
+                              cs->base.last_insert, insert);
+}
+
+/* Walk the chunks of the tiler heap after a render pass, printing how much of
+ * it is used. With a capture enabled, the chunks are saved for panreplay
+ * --tiler. */
+static void
+panfrost_dump_tiler_heap(struct panfrost_batch *batch)
+{
+        struct panfrost_context *ctx = batch->ctx;
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
+
+        /* Same as pan_emit_tiler_ctx */
+        unsigned mask = (dev->tiler_features.max_levels >= 8) ? 0xFE : 0x28;
+
+        struct pan_tiler_heap *heap = pan_tiler_heap_create();
+
+        if (dev->capture) {
+                pan_capture_tiler_heap(dev->capture, batch->key.width,
+                                       batch->key.height, mask);
+        }
+
+        uint64_t va = ctx->kbase_ctx->tiler_heap_header;
+        uint32_t size = ctx->kbase_ctx->tiler_heap_chunk_size;
+
+        for (unsigned i = 0; i < PAN_TILER_HEAP_MAX_CHUNKS; ++i) {
+                void *ptr = mmap(NULL, size, PROT_READ, MAP_SHARED,
+                                 dev->mali.fd, va);
+
+                if (ptr == MAP_FAILED) {
+                        perror("mmap(tiler heap chunk)");
+                        break;
+                }
+
+                pan_tiler_heap_add_chunk(heap, va, size, ptr, size);
+
+                if (dev->capture)
+                        pan_capture_tiler_chunk(dev->capture, va, size, ptr);
+
+                uint32_t chunk_size = size;
+                bool more = pan_tiler_heap_next_chunk(ptr, &va, &size);
+
+                munmap(ptr, chunk_size);
+
+                if (!more)
+                        break;
+        }
+
+        pan_tiler_heap_analyze(heap);
+        pan_tiler_heap_print(heap, stdout);
+        pan_tiler_heap_destroy(heap);
 }
 
 static void
@@ -965,51 +1414,134 @@ pandecode_cs_ring(struct panfrost_device *dev, struct panfrost_cs *cs,
         pandecode_cs(cs->base.va + start, insert - start, dev->gpu_id);
 }
 
-static unsigned
-panfrost_add_dep_after(struct util_dynarray *deps,
-                       struct panfrost_usage u,
-                       unsigned index)
+/* A faulted queue never reaches the seqnum, so stop waiting on it too */
+static void
+panfrost_cs_wait_seqnum(kbase k, struct panfrost_cs *cs, uint64_t seqnum)
 {
-        unsigned size = util_dynarray_num_elements(deps, struct panfrost_usage);
+        if (panfrost_cs_seqnum_done(k, cs, seqnum))
+                return;
+
+        struct kbase_wait_ctx wait = kbase_wait_init(k, INT64_MAX);
+        while (kbase_wait_for_event(&wait)) {
+                if (panfrost_cs_seqnum_done(k, cs, seqnum) ||
+                    k->cs_faulted(k, &cs->base))
+                        break;
+        }
+        kbase_wait_fini(wait);
+}
 
-        for (unsigned i = index; i < size; ++i) {
-                struct panfrost_usage *d =
-                        util_dynarray_element(deps, struct panfrost_usage, i);
+/* Work which nobody waits on can fault too, and kbase only reports it as a
+ * queue group error, so check for faults whenever the queues are used */
+static bool
+panfrost_cs_faulted(struct panfrost_device *dev, struct panfrost_cs *cs)
+{
+        kbase_ensure_handle_events(&dev->mali);
 
-                /* TODO: Remove d if it is an invalid entry? */
+        return dev->mali.cs_faulted(&dev->mali, &cs->base);
+}
 
-                if ((d->queue == u.queue) && (d->write == u.write)) {
-                        d->seqnum = MAX2(d->seqnum, u.seqnum);
-                        return i;
+static bool
+panfrost_context_faulted(struct panfrost_context *ctx)
+{
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
 
-                } else if (d->queue > u.queue) {
-                        void *p = util_dynarray_grow(deps, struct panfrost_usage, 1);
-                        assert(p);
-                        memmove(util_dynarray_element(deps, struct panfrost_usage, i + 1),
-                                util_dynarray_element(deps, struct panfrost_usage, i),
-                                (size - i) * sizeof(struct panfrost_usage));
+        return panfrost_cs_faulted(dev, &ctx->kbase_cs_vertex) ||
+               panfrost_cs_faulted(dev, &ctx->kbase_cs_fragment);
+}
 
-                        *util_dynarray_element(deps, struct panfrost_usage, i) = u;
-                        return i;
-                }
-        }
+/* Called after waiting on fences, which have no other way to find out */
+void
+panfrost_check_faults(struct panfrost_context *ctx)
+{
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
 
-        util_dynarray_append(deps, struct panfrost_usage, u);
-        return size;
+        if (dev->kbase && dev->arch >= 10 && panfrost_context_faulted(ctx))
+                reset_context(ctx);
 }
 
 static void
-panfrost_update_deps(struct util_dynarray *deps, struct panfrost_bo *bo, bool write)
+panfrost_cs_retire_mark(struct panfrost_cs *cs)
 {
-        /* Both lists should be sorted, so each dependency is at a higher
-         * index than the last */
-        unsigned index = 0;
-        util_dynarray_foreach(&bo->usage, struct panfrost_usage, u) {
-                /* read->read access does not require a dependency */
-                if (!write && !u->write)
-                        continue;
+        assert(cs->mark_count);
 
-                index = panfrost_add_dep_after(deps, *u, index);
+        cs->consumed = cs->marks[cs->mark_head].insert;
+        cs->mark_head = (cs->mark_head + 1) % PAN_CS_RING_MARKS;
+        --cs->mark_count;
+}
+
+/* Record that the CS has been submitted up to insert, so that the ring
+ * allocator knows which seqnum to wait on before reusing that space */
+static void
+panfrost_cs_push_mark(struct panfrost_device *dev, struct panfrost_cs *cs,
+                      uint64_t insert, uint64_t seqnum)
+{
+        if (cs->mark_count == PAN_CS_RING_MARKS) {
+                perf_debug(dev, "Waiting for a CS submission to complete");
+                panfrost_cs_wait_seqnum(&dev->mali, cs,
+                                        cs->marks[cs->mark_head].seqnum);
+                panfrost_cs_retire_mark(cs);
+        }
+
+        unsigned tail = (cs->mark_head + cs->mark_count) % PAN_CS_RING_MARKS;
+        cs->marks[tail] = (struct panfrost_cs_mark) {
+                .insert = insert,
+                .seqnum = seqnum,
+        };
+        ++cs->mark_count;
+}
+
+/* Make sure the GPU has consumed everything which will be overwritten by
+ * writing instructions up to the ring offset end. Offsets count each lap of
+ * the ring, like the insert offsets passed to cs_submit. */
+void
+panfrost_cs_wait_ring(struct panfrost_device *dev, struct panfrost_cs *cs,
+                      uint64_t end)
+{
+        kbase k = &dev->mali;
+        uint64_t needed = end > cs->base.size ? end - cs->base.size : 0;
+
+        if (cs->consumed >= needed)
+                return;
+
+        /* Retire whatever has finished without blocking */
+        while (cs->mark_count &&
+               panfrost_cs_seqnum_done(k, cs, cs->marks[cs->mark_head].seqnum))
+                panfrost_cs_retire_mark(cs);
+
+        if (cs->consumed >= needed)
+                return;
+
+        /* A faulted queue won't consume anything anymore. The ring starts
+         * over when the context is reset after the next submit, so the
+         * space can be overwritten right away. */
+        if (panfrost_cs_faulted(dev, cs)) {
+                cs->mark_count = 0;
+                cs->consumed = needed;
+                return;
+        }
+
+        perf_debug(dev, "Waiting for the GPU to consume the command stream ring");
+
+        /* Queues execute in order, so only wait on the first submission
+         * reaching the required offset. If nothing does, a single batch is
+         * larger than the ring, so wait for everything. */
+        while (cs->mark_count) {
+                struct panfrost_cs_mark m = cs->marks[cs->mark_head];
+
+                if (m.insert >= needed || cs->mark_count == 1) {
+                        panfrost_cs_wait_seqnum(k, cs, m.seqnum);
+                        panfrost_cs_retire_mark(cs);
+                        break;
+                }
+
+                cs->mark_head = (cs->mark_head + 1) % PAN_CS_RING_MARKS;
+                --cs->mark_count;
+        }
+
+        /* The queue may have faulted during the wait */
+        if (cs->consumed < needed && panfrost_cs_faulted(dev, cs)) {
+                cs->mark_count = 0;
+                cs->consumed = needed;
         }
 }
 
@@ -1062,6 +1594,38 @@ panfrost_clean_deps(struct panfrost_device *dev, struct util_dynarray *deps)
         (void)! util_dynarray_resize(deps, struct panfrost_usage, index);
 }
 
+/* Render targets loaded from memory by the fragment job, with bits 8 and 9
+ * for depth and stencil, for the fragment tracepoints */
+
+static uint16_t
+panfrost_fb_preload_mask(const struct pan_fb_info *fb)
+{
+        uint16_t mask = 0;
+
+        for (unsigned i = 0; i < fb->rt_count; ++i) {
+                if (fb->rts[i].preload)
+                        mask |= BITFIELD_BIT(i);
+        }
+
+        if (fb->zs.preload.z)
+                mask |= BITFIELD_BIT(8);
+
+        if (fb->zs.preload.s)
+                mask |= BITFIELD_BIT(9);
+
+        return mask;
+}
+
+static unsigned
+panfrost_fb_tile_count(const struct pan_fb_info *fb)
+{
+        unsigned maxx = MIN2(fb->extent.maxx, fb->width - 1);
+        unsigned maxy = MIN2(fb->extent.maxy, fb->height - 1);
+
+        return (maxx / 16 - fb->extent.minx / 16 + 1) *
+               (maxy / 16 - fb->extent.miny / 16 + 1);
+}
+
 static int
 panfrost_batch_submit_csf(struct panfrost_batch *batch,
                           const struct pan_fb_info *fb)
@@ -1074,7 +1638,16 @@ panfrost_batch_submit_csf(struct panfrost_batch *batch,
         ++ctx->kbase_cs_vertex.seqnum;
 
         if (panfrost_has_fragment_job(batch)) {
+                /* The tracepoints are recorded in the fragment stream of the
+                 * batch, so that the timestamp buffers are tracked like the
+                 * other BOs written by the fragment job */
+                trace_start_fragment(&batch->trace, &batch->cs_fragment,
+                                     ctx->submit_count, fb->width, fb->height,
+                                     fb->rt_count, fb->nr_samples,
+                                     panfrost_fb_preload_mask(fb),
+                                     panfrost_fb_tile_count(fb));
                 screen->vtbl.emit_fragment_job(batch, fb);
+                trace_end_fragment(&batch->trace, &batch->cs_fragment);
                 ++ctx->kbase_cs_fragment.seqnum;
         }
 
@@ -1139,8 +1712,23 @@ panfrost_batch_submit_csf(struct panfrost_batch *batch,
                 (void *)ctx->kbase_cs_fragment.cs.ptr - ctx->kbase_cs_fragment.bo->ptr.cpu;
 
         if (dev->debug & PAN_DBG_TRACE) {
+                struct panfrost_bo *extra[] = {
+                        ctx->kbase_cs_vertex.bo,
+                        ctx->kbase_cs_fragment.bo,
+                        ctx->tiler_heap_desc,
+                        dev->tiler_heap,
+                        dev->sample_positions,
+                };
+
+                panfrost_batch_begin_trace(batch, extra, ARRAY_SIZE(extra));
                 pandecode_cs_ring(dev, &ctx->kbase_cs_vertex, vs_offset);
                 pandecode_cs_ring(dev, &ctx->kbase_cs_fragment, fs_offset);
+                pandecode_end_submit();
+        }
+
+        if (dev->capture) {
+                panfrost_capture_cs_ring(dev, &ctx->kbase_cs_vertex, 0, vs_offset);
+                panfrost_capture_cs_ring(dev, &ctx->kbase_cs_fragment, 1, fs_offset);
         }
 
         bool log = (dev->debug & PAN_DBG_LOG);
@@ -1150,16 +1738,27 @@ panfrost_batch_submit_csf(struct panfrost_batch *batch,
         if (log)
                 printf("About to submit\n");
 
-        dev->mali.cs_submit(&dev->mali, &ctx->kbase_cs_vertex.base, vs_offset,
-                            ctx->syncobj_kbase, ctx->kbase_cs_vertex.seqnum);
+        uint64_t vs_last = ctx->kbase_cs_vertex.base.last_insert;
+        uint64_t fs_last = ctx->kbase_cs_fragment.base.last_insert;
+
+        if (dev->mali.cs_submit(&dev->mali, &ctx->kbase_cs_vertex.base, vs_offset,
+                                ctx->syncobj_kbase, ctx->kbase_cs_vertex.seqnum) &&
+            vs_offset != vs_last)
+                panfrost_cs_push_mark(dev, &ctx->kbase_cs_vertex, vs_offset,
+                                      ctx->kbase_cs_vertex.seqnum);
 
-        dev->mali.cs_submit(&dev->mali, &ctx->kbase_cs_fragment.base, fs_offset,
-                            ctx->syncobj_kbase, ctx->kbase_cs_fragment.seqnum);
+        if (dev->mali.cs_submit(&dev->mali, &ctx->kbase_cs_fragment.base, fs_offset,
+                                ctx->syncobj_kbase, ctx->kbase_cs_fragment.seqnum) &&
+            fs_offset != fs_last)
+                panfrost_cs_push_mark(dev, &ctx->kbase_cs_fragment, fs_offset,
+                                      ctx->kbase_cs_fragment.seqnum);
 
         bool reset = false;
 
-        // TODO: How will we know to reset a CS when waiting is not done?
-        if (batch->needs_sync) {
+        /* The tiler heap is only complete once the batch is done */
+        bool wait = batch->needs_sync || (dev->debug & PAN_DBG_TILER);
+
+        if (wait) {
                 if (!dev->mali.cs_wait(&dev->mali, &ctx->kbase_cs_vertex.base, vs_offset, ctx->syncobj_kbase))
                         reset = true;
 
@@ -1167,29 +1766,11 @@ panfrost_batch_submit_csf(struct panfrost_batch *batch,
                         reset = true;
         }
 
-        if (dev->debug & PAN_DBG_TILER) {
-                fflush(stdout);
-                FILE *stream = popen("tiler-hex-read", "w");
-
-                /* TODO: Dump more than just the first chunk */
-                unsigned size = batch->ctx->kbase_ctx->tiler_heap_chunk_size;
-                uint64_t va = batch->ctx->kbase_ctx->tiler_heap_header;
-
-                fprintf(stream, "width %i\n" "height %i\n" "mask %i\n"
-                        "vaheap 0x%"PRIx64"\n" "size %i\n",
-                        batch->key.width, batch->key.height, 0xfe, va, size);
-
-                void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
-                                 MAP_SHARED, dev->mali.fd, va);
-
-                pan_hexdump(stream, ptr, size, false);
-                //memset(ptr, 0, size);
-                munmap(ptr, size);
-
-                pclose(stream);
-        }
+        if (dev->debug & PAN_DBG_TILER)
+                panfrost_dump_tiler_heap(batch);
 
-        if (reset)
+        /* Without a wait, this also catches faults of earlier batches */
+        if (reset || panfrost_context_faulted(ctx))
                 reset_context(ctx);
 
         return 0;
@@ -1214,9 +1795,102 @@ panfrost_emit_tile_map(struct panfrost_batch *batch, struct pan_fb_info *fb)
         }
 }
 
+/* The damage region of the render targets lasts until the frontend flushes
+ * them for presentation, so it covers implicit flushes within the frame too:
+ * anything drawn inside it by an earlier batch is preloaded again. Pixels
+ * outside are undefined for the frame (EGL_KHR_partial_update), so restrict
+ * the fragment job to the damage, skipping both their preload and writeback.
+ */
+
 static void
-panfrost_batch_submit(struct panfrost_context *ctx,
-                      struct panfrost_batch *batch)
+panfrost_batch_clip_to_damage(struct panfrost_batch *batch)
+{
+        unsigned minx = ~0, miny = ~0, maxx = 0, maxy = 0;
+
+        for (unsigned i = 0; i < batch->key.nr_cbufs; ++i) {
+                struct pipe_surface *surf = batch->key.cbufs[i];
+
+                if (!surf)
+                        continue;
+
+                /* Damage only describes the first level */
+                if (surf->u.tex.level)
+                        return;
+
+                const struct pipe_scissor_state *damage =
+                        &pan_resource(surf->texture)->damage.extent;
+
+                minx = MIN2(minx, damage->minx);
+                miny = MIN2(miny, damage->miny);
+                maxx = MAX2(maxx, damage->maxx);
+                maxy = MAX2(maxy, damage->maxy);
+        }
+
+        if (minx >= maxx || miny >= maxy)
+                return;
+
+        batch->minx = MAX2(batch->minx, minx);
+        batch->miny = MAX2(batch->miny, miny);
+        batch->maxx = MIN2(batch->maxx, maxx);
+        batch->maxy = MIN2(batch->maxy, maxy);
+
+        /* Nothing was drawn inside the damage, but the fragment job still
+         * needs a non-empty region */
+        if (batch->minx >= batch->maxx || batch->miny >= batch->maxy) {
+                batch->minx = minx;
+                batch->miny = miny;
+                batch->maxx = minx + 1;
+                batch->maxy = miny + 1;
+        }
+}
+
+static void
+panfrost_batch_record_stats(struct panfrost_context *ctx,
+                            struct panfrost_batch *batch,
+                            uint64_t submit_ns)
+{
+        struct panfrost_batch_stats *stats = &batch->stats;
+
+        stats->clears = util_bitcount(batch->clear);
+
+        if (panfrost_has_fragment_job(batch) &&
+            batch->maxx > batch->minx && batch->maxy > batch->miny) {
+                stats->tiles = (DIV_ROUND_UP(batch->maxx, 16) - batch->minx / 16) *
+                               (DIV_ROUND_UP(batch->maxy, 16) - batch->miny / 16);
+        }
+
+        stats->bos = batch->num_bos +
+                panfrost_pool_num_bos(&batch->pool) +
+                panfrost_pool_num_bos(&batch->invisible_pool);
+        stats->pool_bytes = batch->pool.allocated +
+                batch->invisible_pool.allocated;
+
+        stats->open_ns = submit_ns - batch->init_ns;
+        stats->submit_ns = os_time_get_nano() - submit_ns;
+
+        ctx->batch_stats.ring[ctx->batch_stats.head] = *stats;
+        ctx->batch_stats.head =
+                (ctx->batch_stats.head + 1) % PAN_BATCH_STATS_RING;
+
+        struct panfrost_batch_stats *totals = &ctx->batch_stats.totals;
+        totals->draws += stats->draws;
+        totals->clears += stats->clears;
+        totals->tiles += stats->tiles;
+        totals->bos += stats->bos;
+        totals->pool_bytes += stats->pool_bytes;
+        totals->open_ns += stats->open_ns;
+        totals->build_ns += stats->build_ns;
+        totals->submit_ns += stats->submit_ns;
+
+        ctx->batch_stats.count++;
+
+        if (stats->reason)
+                ctx->batch_stats.forced++;
+}
+
+static void
+panfrost_batch_submit_one(struct panfrost_context *ctx,
+                          struct panfrost_batch *batch, const char *reason)
 {
         struct pipe_screen *pscreen = ctx->base.screen;
         struct panfrost_screen *screen = pan_screen(pscreen);
@@ -1227,6 +1901,20 @@ panfrost_batch_submit(struct panfrost_context *ctx,
         if (!batch->scoreboard.first_job && !batch->clear)
                 goto out;
 
+        uint64_t submit_ns = os_time_get_nano();
+        batch->stats.reason = reason;
+
+        MESA_TRACE_BEGIN(reason ?: "Flush");
+
+        ++ctx->submit_count;
+
+        /* The vertex tracepoint starts with the first draw or dispatch of
+         * the batch, which may not have added a job */
+        if (batch->vertex_traced) {
+                trace_end_vertex(&batch->trace, NULL, ctx->submit_count,
+                                 batch->stats.draws);
+        }
+
         if (batch->key.zsbuf && panfrost_has_fragment_job(batch)) {
                 struct pipe_surface *surf = batch->key.zsbuf;
                 struct panfrost_resource *z_rsrc = pan_resource(surf->texture);
@@ -1250,6 +1938,7 @@ panfrost_batch_submit(struct panfrost_context *ctx,
         struct pan_fb_info fb;
         struct pan_image_view rts[8], zs, s;
 
+        panfrost_batch_clip_to_damage(batch);
         panfrost_batch_to_fb_info(batch, &fb, rts, &zs, &s, false);
 
         screen->vtbl.preload(batch, &fb);
@@ -1273,42 +1962,51 @@ panfrost_batch_submit(struct panfrost_context *ctx,
         if (ret)
                 fprintf(stderr, "panfrost_batch_submit failed: %d\n", ret);
 
-        /* We must reset the damage info of our render targets here even
-         * though a damage reset normally happens when the DRI layer swaps
-         * buffers. That's because there can be implicit flushes the GL
-         * app is not aware of, and those might impact the damage region: if
-         * part of the damaged portion is drawn during those implicit flushes,
-         * you have to reload those areas before next draws are pushed, and
-         * since the driver can't easily know what's been modified by the draws
-         * it flushed, the easiest solution is to reload everything.
-         */
-        for (unsigned i = 0; i < batch->key.nr_cbufs; i++) {
-                if (!batch->key.cbufs[i])
-                        continue;
+        u_trace_flush(&batch->trace, NULL, false);
 
-                panfrost_resource_set_damage_region(ctx->base.screen,
-                                                    batch->key.cbufs[i]->texture,
-                                                    0, NULL);
-        }
+#ifdef HAVE_PERFETTO
+        if (u_trace_perfetto_active(&ctx->trace_context))
+                pan_perfetto_submit(&ctx->base, ctx->submit_count);
+#endif
+
+        MESA_TRACE_END();
+        panfrost_batch_record_stats(ctx, batch, submit_ns);
 
 out:
         panfrost_batch_cleanup(ctx, batch);
 }
 
+/* Submits batch after the batches it depends on. Submitting a batch removes
+ * it from the dependencies of the others. */
+
+static void
+panfrost_batch_submit(struct panfrost_context *ctx,
+                      struct panfrost_batch *batch, const char *reason)
+{
+        uint8_t order[PAN_BATCH_GRAPH_MAX];
+        unsigned count = pan_batch_graph_order(&ctx->batches.graph,
+                                               panfrost_batch_idx(batch), order);
+
+        for (unsigned i = 0; i < count; ++i) {
+                panfrost_batch_submit_one(ctx, &ctx->batches.slots[order[i]],
+                                          i == count - 1 ? reason : "Dependency");
+        }
+}
+
 /* Submit all batches */
 
 void
 panfrost_flush_all_batches(struct panfrost_context *ctx, const char *reason)
 {
         struct panfrost_batch *batch = panfrost_get_batch_for_fbo(ctx);
-        panfrost_batch_submit(ctx, batch);
+        panfrost_batch_submit(ctx, batch, reason);
 
         for (unsigned i = 0; i < PAN_MAX_BATCHES; i++) {
                 if (ctx->batches.slots[i].seqnum) {
                         if (reason)
                                 perf_debug_ctx(ctx, "Flushing everything due to: %s", reason);
 
-                        panfrost_batch_submit(ctx, &ctx->batches.slots[i]);
+                        panfrost_batch_submit(ctx, &ctx->batches.slots[i], reason);
                 }
         }
 }
@@ -1322,7 +2020,7 @@ panfrost_flush_writer(struct panfrost_context *ctx,
 
         if (entry) {
                 perf_debug_ctx(ctx, "Flushing writer due to: %s", reason);
-                panfrost_batch_submit(ctx, entry->data);
+                panfrost_batch_submit(ctx, entry->data, reason);
         }
 }
 
@@ -1335,11 +2033,12 @@ panfrost_flush_batches_accessing_rsrc(struct panfrost_context *ctx,
         foreach_batch(ctx, i) {
                 struct panfrost_batch *batch = &ctx->batches.slots[i];
 
-                if (!panfrost_batch_uses_resource(batch, rsrc))
+                /* Skip batches submitted as a dependency of an earlier one */
+                if (!batch->seqnum || !panfrost_batch_uses_resource(batch, rsrc))
                         continue;
 
                 perf_debug_ctx(ctx, "Flushing user due to: %s", reason);
-                panfrost_batch_submit(ctx, batch);
+                panfrost_batch_submit(ctx, batch, reason);
         }
 }
 
@@ -1358,11 +2057,11 @@ panfrost_batch_adjust_stack_size(struct panfrost_batch *batch)
         }
 }
 
-void
-panfrost_batch_clear(struct panfrost_batch *batch,
-                     unsigned buffers,
-                     const union pipe_color_union *color,
-                     double depth, unsigned stencil)
+static void
+panfrost_batch_set_clear_values(struct panfrost_batch *batch,
+                                unsigned buffers,
+                                const union pipe_color_union *color,
+                                double depth, unsigned stencil)
 {
         struct panfrost_context *ctx = batch->ctx;
 
@@ -1388,6 +2087,17 @@ panfrost_batch_clear(struct panfrost_batch *batch,
 
         batch->clear |= buffers;
         batch->resolve |= buffers;
+}
+
+void
+panfrost_batch_clear(struct panfrost_batch *batch,
+                     unsigned buffers,
+                     const union pipe_color_union *color,
+                     double depth, unsigned stencil)
+{
+        struct panfrost_context *ctx = batch->ctx;
+
+        panfrost_batch_set_clear_values(batch, buffers, color, depth, stencil);
 
         /* Clearing affects the entire framebuffer (by definition -- this is
          * the Gallium clear callback, which clears the whole framebuffer. If
@@ -1399,6 +2109,28 @@ panfrost_batch_clear(struct panfrost_batch *batch,
                                      ctx->pipe_framebuffer.height);
 }
 
+/* Clear a region of the framebuffer by restricting the fragment job to it.
+ * Tiles are cleared in full, so the region must be tile-aligned (see
+ * pan_clear_region_is_tile_aligned), and the batch must be empty since its
+ * bounds apply to everything in it. For the same reason, the batch is
+ * submitted instead of being reused when it is looked up again.
+ */
+
+void
+panfrost_batch_clear_region(struct panfrost_batch *batch,
+                            unsigned buffers,
+                            const union pipe_color_union *color,
+                            double depth, unsigned stencil,
+                            unsigned minx, unsigned miny,
+                            unsigned maxx, unsigned maxy)
+{
+        assert(!batch->scoreboard.first_job && !batch->clear);
+
+        panfrost_batch_set_clear_values(batch, buffers, color, depth, stencil);
+        panfrost_batch_union_scissor(batch, minx, miny, maxx, maxy);
+        batch->clear_region = true;
+}
+
 /* Given a new bounding rectangle (scissor), let the job cover the union of the
  * new and old bounding rectangles */
 
@@ -27,6 +27,7 @@
 #define __PAN_JOB_H__
 
 #include "util/u_dynarray.h"
+#include "util/perf/u_trace.h"
 #include "pipe/p_state.h"
 #include "pan_cs.h"
 #include "pan_mempool.h"
@@ -90,6 +91,33 @@ enum panfrost_usage_type {
 /* A panfrost_batch corresponds to a bound FBO we're rendering to,
  * collecting over multiple draws. */
 
+/* Statistics about a submitted batch, kept to diagnose flush patterns */
+struct panfrost_batch_stats {
+        /* Why the batch was submitted, or NULL for an explicit flush */
+        const char *reason;
+
+        /* Draws and buffers cleared */
+        unsigned draws, clears;
+
+        /* Tiles covered by the fragment job */
+        unsigned tiles;
+
+        /* BOs referenced and bytes allocated from the batch pools */
+        unsigned bos;
+        size_t pool_bytes;
+
+        /* Nanoseconds of wall time between the batch being created and
+         * being submitted, which includes whatever the application did in
+         * between */
+        uint64_t open_ns;
+
+        /* Nanoseconds of CPU time spent emitting the draws and compute jobs
+         * of the batch, and submitting it */
+        uint64_t build_ns, submit_ns;
+};
+
+#define PAN_BATCH_STATS_RING 64
+
 struct panfrost_batch {
         struct panfrost_context *ctx;
         struct pipe_framebuffer_state key;
@@ -97,9 +125,25 @@ struct panfrost_batch {
         /* Sequence number used to implement LRU eviction when all batch slots are used */
         uint64_t seqnum;
 
+        /* Filled in while recording and on submission */
+        struct panfrost_batch_stats stats;
+
+        /* os_time_get_nano() when the batch was created */
+        uint64_t init_ns;
+
+        /* GPU tracepoints recorded in the batch */
+        struct u_trace trace;
+
+        /* Whether the vertex tracepoint was started, it ends on submission */
+        bool vertex_traced;
+
         /* Buffers cleared (PIPE_CLEAR_* bitmask) */
         unsigned clear;
 
+        /* Bounds restricted by panfrost_batch_clear_region, so nothing else
+         * may be added to the batch */
+        bool clear_region;
+
         /* Buffers drawn */
         unsigned draws;
 
@@ -231,6 +275,13 @@ panfrost_get_batch_for_fbo(struct panfrost_context *ctx);
 struct panfrost_batch *
 panfrost_get_fresh_batch_for_fbo(struct panfrost_context *ctx, const char *reason);
 
+struct panfrost_batch *
+panfrost_get_batch_for_upload(struct panfrost_context *ctx);
+
+bool
+panfrost_render_batches_use_resource(struct panfrost_context *ctx,
+                                     struct panfrost_resource *rsrc);
+
 void
 panfrost_batch_add_bo(struct panfrost_batch *batch,
                       struct panfrost_bo *bo,
@@ -246,6 +297,11 @@ panfrost_batch_write_rsrc(struct panfrost_batch *batch,
                           struct panfrost_resource *rsrc,
                           enum pipe_shader_type stage);
 
+void
+panfrost_batch_write_bo(struct panfrost_batch *batch,
+                        struct panfrost_bo *bo,
+                        enum pipe_shader_type stage);
+
 void
 panfrost_resource_swap_bo(struct panfrost_context *ctx,
                           struct panfrost_resource *rsrc,
@@ -284,6 +340,14 @@ panfrost_batch_clear(struct panfrost_batch *batch,
                      const union pipe_color_union *color,
                      double depth, unsigned stencil);
 
+void
+panfrost_batch_clear_region(struct panfrost_batch *batch,
+                            unsigned buffers,
+                            const union pipe_color_union *color,
+                            double depth, unsigned stencil,
+                            unsigned minx, unsigned miny,
+                            unsigned maxx, unsigned maxy);
+
 void
 panfrost_batch_union_scissor(struct panfrost_batch *batch,
                              unsigned minx, unsigned miny,
@@ -292,4 +356,10 @@ panfrost_batch_union_scissor(struct panfrost_batch *batch,
 bool
 panfrost_batch_skip_rasterization(struct panfrost_batch *batch);
 
+void
+panfrost_free_retired_pools(struct panfrost_context *ctx);
+
+void
+panfrost_check_faults(struct panfrost_context *ctx);
+
 #endif
@@ -43,17 +43,50 @@
  * packed with conservative lifetime handling.
  */
 
+/* Maximum number of spare BOs kept by a pool across a reset */
+#define PAN_POOL_MAX_SPARE_BOS 4
+
+static struct panfrost_bo *
+panfrost_pool_take_spare(struct panfrost_pool *pool, size_t bo_sz)
+{
+        unsigned count = util_dynarray_num_elements(&pool->spare_bos,
+                                                    struct panfrost_bo *);
+
+        for (unsigned i = 0; i < count; ++i) {
+                struct panfrost_bo **bo =
+                        util_dynarray_element(&pool->spare_bos,
+                                              struct panfrost_bo *, i);
+
+                if ((*bo)->size < bo_sz)
+                        continue;
+
+                struct panfrost_bo *ret = *bo;
+                *bo = util_dynarray_pop(&pool->spare_bos, struct panfrost_bo *);
+                return ret;
+        }
+
+        return NULL;
+}
+
 static struct panfrost_bo *
 panfrost_pool_alloc_backing(struct panfrost_pool *pool, size_t bo_sz)
 {
+        struct panfrost_bo *bo = NULL;
+
+        if (pool->owned)
+                bo = panfrost_pool_take_spare(pool, bo_sz);
+
         /* We don't know what the BO will be used for, so let's flag it
          * RW and attach it to both the fragment and vertex/tiler jobs.
          * TODO: if we want fine grained BO assignment we should pass
          * flags to this function and keep the read/write,
          * fragment/vertex+tiler pools separate.
          */
-        struct panfrost_bo *bo = panfrost_bo_create(pool->base.dev, bo_sz,
-                        pool->base.create_flags, pool->base.label);
+        if (!bo) {
+                bo = panfrost_bo_create(pool->base.dev, bo_sz,
+                                        pool->base.create_flags,
+                                        pool->base.label);
+        }
 
         if (pool->owned)
                 util_dynarray_append(&pool->bos, struct panfrost_bo *, bo);
@@ -94,7 +127,55 @@ panfrost_pool_cleanup(struct panfrost_pool *pool)
         util_dynarray_foreach(&pool->bos, struct panfrost_bo *, bo)
                 panfrost_bo_unreference(*bo);
 
+        util_dynarray_foreach(&pool->spare_bos, struct panfrost_bo *, bo)
+                panfrost_bo_unreference(*bo);
+
         util_dynarray_fini(&pool->bos);
+        util_dynarray_fini(&pool->spare_bos);
+}
+
+/* Empty an owned pool whose BOs are no longer in use by the GPU, keeping a
+ * few of the BOs to be reused by later allocations instead of going through
+ * the BO cache. */
+
+void
+panfrost_pool_reset(struct panfrost_pool *pool, size_t slab_size, bool prealloc)
+{
+        assert(pool->owned);
+
+        /* Guard pages and poisoning are only set up on fresh BOs */
+        bool keep = !(pool->base.dev->debug & PAN_DBG_BO_CLEAR);
+#ifdef PAN_DBG_OVERFLOW
+        keep &= !(pool->base.dev->debug & PAN_DBG_OVERFLOW);
+#endif
+
+        util_dynarray_foreach(&pool->bos, struct panfrost_bo *, bo)
+                util_dynarray_append(&pool->spare_bos, struct panfrost_bo *, *bo);
+
+        util_dynarray_clear(&pool->bos);
+
+        /* Drop BOs which don't fit the new slab size, since oversized ones
+         * would waste memory */
+        struct panfrost_bo **spare = util_dynarray_begin(&pool->spare_bos);
+        unsigned count = 0;
+
+        util_dynarray_foreach(&pool->spare_bos, struct panfrost_bo *, bo) {
+                if (keep && count < PAN_POOL_MAX_SPARE_BOS &&
+                    (*bo)->size >= slab_size && (*bo)->size <= 2 * slab_size)
+                        spare[count++] = *bo;
+                else
+                        panfrost_bo_unreference(*bo);
+        }
+
+        (void)! util_dynarray_resize(&pool->spare_bos, struct panfrost_bo *, count);
+
+        pool->base.slab_size = slab_size;
+        pool->transient_bo = NULL;
+        pool->transient_offset = 0;
+        pool->allocated = 0;
+
+        if (prealloc)
+                panfrost_pool_alloc_backing(pool, slab_size);
 }
 
 void
@@ -158,6 +239,7 @@ panfrost_pool_alloc_aligned(struct panfrost_pool *pool, size_t sz, unsigned alig
         }
 
         pool->transient_offset = offset + sz;
+        pool->allocated += sz;
 
         struct panfrost_ptr ret = {
                 .cpu = bo->ptr.cpu + offset,
@@ -46,6 +46,13 @@ struct panfrost_pool {
         /* Mode of the pool. BO management is in the pool for owned mode, but
          * the consumed for unowned mode. */
         bool owned;
+
+        /* BOs left over from before the pool was reset, handed out again
+         * before allocating new ones. Owned mode only. */
+        struct util_dynarray spare_bos;
+
+        /* Bytes allocated from the pool since it was initialised or reset */
+        size_t allocated;
 };
 
 static inline struct panfrost_pool *
@@ -88,6 +95,10 @@ panfrost_pool_init(struct panfrost_pool *pool, void *memctx,
 void
 panfrost_pool_cleanup(struct panfrost_pool *pool);
 
+void
+panfrost_pool_reset(struct panfrost_pool *pool, size_t slab_size,
+                    bool prealloc);
+
 static inline unsigned
 panfrost_pool_num_bos(struct panfrost_pool *pool)
 {
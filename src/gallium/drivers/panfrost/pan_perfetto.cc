@@ -0,0 +1,357 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <perfetto.h>
+
+#include "util/hash_table.h"
+#include "util/macros.h"
+#include "util/perf/u_perfetto.h"
+
+#include "pan_perfetto.h"
+#include "pan_tracepoints.h"
+
+static uint32_t gpu_clock_id;
+static uint64_t next_clock_sync_ns; /* CPU time of the next clock sync */
+
+/* GPU timestamp of the first clock sync. Stages that started before it are
+ * dropped, since perfetto can't place them on the CPU timeline. */
+static uint64_t sync_gpu_ts;
+
+enum {
+        PAN_QUEUE_VERTEX,
+        PAN_QUEUE_FRAGMENT,
+};
+
+static const struct {
+        const char *name;
+        const char *desc;
+} queues[] = {
+        [PAN_QUEUE_VERTEX] = { "Vertex/Compute", "Vertex, tiler and compute jobs" },
+        [PAN_QUEUE_FRAGMENT] = { "Fragment", "Fragment jobs" },
+};
+
+static const struct {
+        const char *name;
+        const char *desc;
+        unsigned queue;
+} stages[] = {
+        [PAN_STAGE_VERTEX] = { "Vertex", "Vertex shading and tiling of a batch", PAN_QUEUE_VERTEX },
+        [PAN_STAGE_FRAGMENT] = { "Fragment", "Preload, fragment shading and resolve of a batch", PAN_QUEUE_FRAGMENT },
+        [PAN_STAGE_COMPUTE] = { "Compute", "Compute job", PAN_QUEUE_VERTEX },
+        [PAN_STAGE_BLIT] = { "Blit", "Blit drawn with a fragment shader", PAN_QUEUE_VERTEX },
+};
+
+struct PanRenderpassIncrementalState {
+        bool was_cleared = true;
+};
+
+struct PanRenderpassTraits : public perfetto::DefaultDataSourceTraits {
+        using IncrementalStateType = PanRenderpassIncrementalState;
+};
+
+class PanRenderpassDataSource : public perfetto::DataSource<PanRenderpassDataSource, PanRenderpassTraits> {
+public:
+        void OnSetup(const SetupArgs &) override
+        {
+        }
+
+        void OnStart(const StartArgs &) override
+        {
+                u_trace_perfetto_start();
+                PERFETTO_LOG("Tracing started");
+
+                /* Clock IDs below 128 are reserved, custom clocks use the
+                 * hash of a namespaced string */
+                gpu_clock_id =
+                        _mesa_hash_string("org.freedesktop.mesa.panfrost") | 0x80000000;
+        }
+
+        void OnStop(const StopArgs &) override
+        {
+                PERFETTO_LOG("Tracing stopped");
+
+                u_trace_perfetto_stop();
+
+                Trace([](PanRenderpassDataSource::TraceContext ctx) {
+                        auto packet = ctx.NewTracePacket();
+                        packet->Finalize();
+                        ctx.Flush();
+                });
+        }
+};
+
+PERFETTO_DECLARE_DATA_SOURCE_STATIC_MEMBERS(PanRenderpassDataSource);
+PERFETTO_DEFINE_DATA_SOURCE_STATIC_MEMBERS(PanRenderpassDataSource);
+
+static void
+send_descriptors(PanRenderpassDataSource::TraceContext &ctx)
+{
+        PERFETTO_LOG("Sending renderstage descriptors");
+
+        auto packet = ctx.NewTracePacket();
+        packet->set_timestamp(0);
+
+        auto event = packet->set_gpu_render_stage_event();
+        event->set_gpu_id(0);
+
+        auto spec = event->set_specifications();
+
+        for (unsigned i = 0; i < ARRAY_SIZE(queues); i++) {
+                auto desc = spec->add_hw_queue();
+
+                desc->set_name(queues[i].name);
+                desc->set_description(queues[i].desc);
+        }
+
+        for (unsigned i = 0; i < ARRAY_SIZE(stages); i++) {
+                auto desc = spec->add_stage();
+
+                desc->set_name(stages[i].name);
+                desc->set_description(stages[i].desc);
+        }
+}
+
+static void
+add_extra_data(perfetto::protos::pbzero::GpuRenderStageEvent *event,
+               const char *name, uint64_t value)
+{
+        auto data = event->add_extra_data();
+
+        data->set_name(name);
+        data->set_value(std::to_string(value));
+}
+
+static void
+stage_start(struct pipe_context *pctx, uint64_t ts_ns, enum pan_stage_id stage)
+{
+        pan_perfetto_state(pctx)->start_ts[stage] = ts_ns;
+}
+
+static void
+stage_end(struct pipe_context *pctx, uint64_t ts_ns, enum pan_stage_id stage,
+          uint32_t submit_id)
+{
+        struct pan_perfetto_state *p = pan_perfetto_state(pctx);
+
+        /* Until the GPU and CPU clocks are calibrated against each other,
+         * perfetto has no way to place the stage */
+        if (!sync_gpu_ts || p->start_ts[stage] < sync_gpu_ts)
+                return;
+
+        PanRenderpassDataSource::Trace([=](PanRenderpassDataSource::TraceContext tctx) {
+                if (auto state = tctx.GetIncrementalState(); state->was_cleared) {
+                        send_descriptors(tctx);
+                        state->was_cleared = false;
+                }
+
+                auto packet = tctx.NewTracePacket();
+
+                packet->set_timestamp(p->start_ts[stage]);
+                packet->set_timestamp_clock_id(gpu_clock_id);
+
+                auto event = packet->set_gpu_render_stage_event();
+                event->set_event_id(0);
+                event->set_hw_queue_id(stages[stage].queue);
+                event->set_duration(ts_ns - p->start_ts[stage]);
+                event->set_stage_id(stage);
+                event->set_context((uintptr_t)pctx);
+
+                if (submit_id)
+                        event->set_submission_id(submit_id);
+
+                if (stage == PAN_STAGE_FRAGMENT) {
+                        add_extra_data(event, "width", p->width);
+                        add_extra_data(event, "height", p->height);
+                        add_extra_data(event, "MRTs", p->nr_cbufs);
+                        add_extra_data(event, "MSAA", p->samples);
+                        add_extra_data(event, "preload", p->preload);
+                        add_extra_data(event, "tiles", p->tiles);
+                }
+        });
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void
+pan_perfetto_init(void)
+{
+        util_perfetto_init();
+
+        perfetto::DataSourceDescriptor dsd;
+        dsd.set_name("gpu.renderstages.panfrost");
+        PanRenderpassDataSource::Register(dsd);
+}
+
+static void
+sync_timestamp(struct pipe_context *pctx)
+{
+        uint64_t cpu_ts = perfetto::base::GetBootTimeNs().count();
+
+        if (cpu_ts < next_clock_sync_ns)
+                return;
+
+        uint64_t gpu_ts = pan_perfetto_gpu_timestamp(pctx);
+
+        if (!gpu_ts) {
+                PERFETTO_ELOG("Could not sync CPU and GPU clocks");
+                return;
+        }
+
+        /* Sample the CPU clock again, the query may take a while */
+        cpu_ts = perfetto::base::GetBootTimeNs().count();
+
+        PanRenderpassDataSource::Trace([=](PanRenderpassDataSource::TraceContext tctx) {
+                auto packet = tctx.NewTracePacket();
+
+                packet->set_timestamp(cpu_ts);
+
+                auto event = packet->set_clock_snapshot();
+
+                {
+                        auto clock = event->add_clocks();
+
+                        clock->set_clock_id(perfetto::protos::pbzero::BUILTIN_CLOCK_BOOTTIME);
+                        clock->set_timestamp(cpu_ts);
+                }
+
+                {
+                        auto clock = event->add_clocks();
+
+                        clock->set_clock_id(gpu_clock_id);
+                        clock->set_timestamp(gpu_ts);
+                }
+
+                if (!sync_gpu_ts)
+                        sync_gpu_ts = gpu_ts;
+
+                next_clock_sync_ns = cpu_ts + 30000000;
+        });
+}
+
+static void
+emit_submit_id(uint32_t submit_id)
+{
+        PanRenderpassDataSource::Trace([=](PanRenderpassDataSource::TraceContext tctx) {
+                auto packet = tctx.NewTracePacket();
+
+                packet->set_timestamp(perfetto::base::GetBootTimeNs().count());
+
+                auto event = packet->set_vulkan_api_event();
+                auto submit = event->set_vk_queue_submit();
+
+                submit->set_submission_id(submit_id);
+        });
+}
+
+void
+pan_perfetto_submit(struct pipe_context *pctx, uint32_t submit_id)
+{
+        sync_timestamp(pctx);
+        emit_submit_id(submit_id);
+}
+
+/*
+ * Trace callbacks, called from u_trace once the timestamps written by the GPU
+ * have been read back.
+ */
+
+void
+pan_start_vertex(struct pipe_context *pctx, uint64_t ts_ns,
+                 const void *flush_data,
+                 const struct trace_start_vertex *payload)
+{
+        stage_start(pctx, ts_ns, PAN_STAGE_VERTEX);
+}
+
+void
+pan_end_vertex(struct pipe_context *pctx, uint64_t ts_ns,
+               const void *flush_data,
+               const struct trace_end_vertex *payload)
+{
+        stage_end(pctx, ts_ns, PAN_STAGE_VERTEX, payload->submit_id);
+}
+
+void
+pan_start_fragment(struct pipe_context *pctx, uint64_t ts_ns,
+                   const void *flush_data,
+                   const struct trace_start_fragment *payload)
+{
+        struct pan_perfetto_state *p = pan_perfetto_state(pctx);
+
+        stage_start(pctx, ts_ns, PAN_STAGE_FRAGMENT);
+
+        p->submit_id = payload->submit_id;
+        p->width = payload->width;
+        p->height = payload->height;
+        p->nr_cbufs = payload->nr_cbufs;
+        p->samples = payload->samples;
+        p->preload = payload->preload;
+        p->tiles = payload->tiles;
+}
+
+void
+pan_end_fragment(struct pipe_context *pctx, uint64_t ts_ns,
+                 const void *flush_data,
+                 const struct trace_end_fragment *payload)
+{
+        stage_end(pctx, ts_ns, PAN_STAGE_FRAGMENT,
+                  pan_perfetto_state(pctx)->submit_id);
+}
+
+void
+pan_start_compute(struct pipe_context *pctx, uint64_t ts_ns,
+                  const void *flush_data,
+                  const struct trace_start_compute *payload)
+{
+        stage_start(pctx, ts_ns, PAN_STAGE_COMPUTE);
+}
+
+void
+pan_end_compute(struct pipe_context *pctx, uint64_t ts_ns,
+                const void *flush_data,
+                const struct trace_end_compute *payload)
+{
+        stage_end(pctx, ts_ns, PAN_STAGE_COMPUTE, 0);
+}
+
+void
+pan_start_blit(struct pipe_context *pctx, uint64_t ts_ns,
+               const void *flush_data,
+               const struct trace_start_blit *payload)
+{
+        stage_start(pctx, ts_ns, PAN_STAGE_BLIT);
+}
+
+void
+pan_end_blit(struct pipe_context *pctx, uint64_t ts_ns,
+             const void *flush_data,
+             const struct trace_end_blit *payload)
+{
+        stage_end(pctx, ts_ns, PAN_STAGE_BLIT, 0);
+}
+
+#ifdef __cplusplus
+}
+#endif
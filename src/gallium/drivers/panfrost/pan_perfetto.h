@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __PAN_PERFETTO_H__
+#define __PAN_PERFETTO_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef HAVE_PERFETTO
+
+/* Render stages reported to the gpu.renderstages data source. Vertex and
+ * compute work runs on one hardware queue, fragment work on the other. */
+enum pan_stage_id {
+        PAN_STAGE_VERTEX,
+        PAN_STAGE_FRAGMENT,
+        PAN_STAGE_COMPUTE,
+        PAN_STAGE_BLIT,
+        PAN_NUM_STAGES
+};
+
+/* The u_trace tracepoints come in begin/end pairs, while perfetto wants a
+ * single event per stage, so stash the start of each stage and the payload
+ * of the begin tracepoint until the end tracepoint is read back */
+struct pan_perfetto_state {
+        uint64_t start_ts[PAN_NUM_STAGES];
+
+        /* Fragment stage arguments */
+        uint32_t submit_id;
+        uint16_t width, height;
+        uint8_t nr_cbufs, samples;
+        uint16_t preload;
+        uint32_t tiles;
+};
+
+struct pipe_context;
+
+void pan_perfetto_init(void);
+void pan_perfetto_submit(struct pipe_context *pctx, uint32_t submit_id);
+
+/* Implemented in pan_context.c, since the driver headers are C only */
+struct pan_perfetto_state *pan_perfetto_state(struct pipe_context *pctx);
+uint64_t pan_perfetto_gpu_timestamp(struct pipe_context *pctx);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
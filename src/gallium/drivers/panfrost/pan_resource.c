@@ -42,6 +42,7 @@
 #include "util/u_transfer.h"
 #include "util/u_transfer_helper.h"
 #include "util/u_gen_mipmap.h"
+#include "util/u_upload_mgr.h"
 #include "util/u_drm.h"
 
 #include "pan_bo.h"
@@ -255,10 +256,22 @@ panfrost_resource_get_param(struct pipe_screen *pscreen,
         }
 }
 
+/* Called by the frontend on a resource about to be presented or shared, e.g.
+ * the back buffer on swap. AFBC and CRC data are written together with the
+ * colour data and the modifier travels with the handle, so there is nothing
+ * to resolve: submitting the pending writer, if any, is enough. This is also
+ * the end of the frame the damage region was set for.
+ */
+
 static void
 panfrost_flush_resource(struct pipe_context *pctx, struct pipe_resource *prsc)
 {
-        /* TODO */
+        struct panfrost_context *ctx = pan_context(pctx);
+        struct panfrost_resource *rsrc = pan_resource(prsc);
+
+        panfrost_flush_writer(ctx, rsrc, "Flush resource");
+
+        panfrost_resource_set_damage_region(pctx->screen, prsc, 0, NULL);
 }
 
 static struct pipe_surface *
@@ -270,6 +283,7 @@ panfrost_create_surface(struct pipe_context *pipe,
         struct pipe_surface *ps = NULL;
 
         pan_legalize_afbc_format(ctx, pan_resource(pt), surf_tmpl->format);
+        panfrost_unpack_afbc(ctx, pan_resource(pt), "Rendering to packed AFBC");
 
         ps = CALLOC_STRUCT(pipe_surface);
 
@@ -471,12 +485,18 @@ panfrost_should_checksum(const struct panfrost_device *dev, const struct panfros
                 util_format_get_blocksize(pres->base.format);
 
         return pres->base.bind & PIPE_BIND_RENDER_TARGET &&
-                panfrost_is_2d(pres) &&
+                (panfrost_is_2d(pres) ||
+                 pres->base.target == PIPE_TEXTURE_2D_ARRAY) &&
                 bytes_per_pixel <= bytes_per_pixel_max &&
-                pres->base.last_level == 0 &&
                 !(dev->debug & PAN_DBG_NO_CRC);
 }
 
+static unsigned
+panfrost_crc_count(const struct panfrost_resource *rsrc)
+{
+        return (rsrc->base.last_level + 1) * rsrc->base.array_size;
+}
+
 static void
 panfrost_resource_setup(struct panfrost_device *dev,
                         struct panfrost_resource *pres,
@@ -514,6 +534,26 @@ panfrost_resource_setup(struct panfrost_device *dev,
 
         ASSERTED bool valid = pan_image_layout_init(&pres->image.layout, NULL);
         assert(valid);
+
+        pres->afbc.packed = false;
+        pres->afbc.checked = false;
+
+        /* Every level and layer has its own CRC buffer, which is invalid
+         * until the first full render */
+        free(pres->valid.crc);
+        pres->valid.crc = pres->image.layout.crc ?
+                calloc(panfrost_crc_count(pres), sizeof(bool)) : NULL;
+}
+
+void
+panfrost_invalidate_crc(struct panfrost_resource *rsrc, unsigned level,
+                        unsigned first_layer, unsigned last_layer)
+{
+        if (!rsrc->valid.crc)
+                return;
+
+        for (unsigned l = first_layer; l <= last_layer; ++l)
+                *panfrost_crc_valid(rsrc, level, l) = false;
 }
 
 static void
@@ -758,11 +798,13 @@ panfrost_resource_create_with_modifier(struct pipe_screen *screen,
                 /* We create a BO immediately but don't bother mapping, since we don't
                  * care to map e.g. FBOs which the CPU probably won't touch */
 
-                /* For now, don't cache buffers as syncing can be slow when
-                 * too much memory is mapped. TODO: dynamically switch, or use
-                 * the STREAM_READ etc. hints? */
+                /* Syncing can be slow when too much memory is mapped, so
+                 * buffers are only cached when the state tracker hints at CPU
+                 * reads. Mapping patterns may migrate them later, see
+                 * panfrost_buffer_update_placement. */
                 bool buffer = (template->target == PIPE_BUFFER);
-                unsigned cache_flag = buffer ? 0 : PAN_BO_CACHEABLE;
+                bool cached = !buffer || template->usage == PIPE_USAGE_STAGING;
+                unsigned cache_flag = cached ? PAN_BO_CACHEABLE : 0;
 
                 so->image.data.bo =
                         panfrost_bo_create(dev, so->image.layout.data_size,
@@ -839,41 +881,105 @@ panfrost_resource_destroy(struct pipe_screen *screen,
 
         free(rsrc->index_cache);
         free(rsrc->damage.tile_map.data);
+        free(rsrc->valid.crc);
 
         util_range_destroy(&rsrc->valid_buffer_range);
         free(rsrc);
 }
 
+/* Clear a region of a surface. Tile-aligned regions are cleared by a batch of
+ * their own whose fragment job only covers the region, so no other tile is
+ * loaded or written. Other regions are drawn with the blitter, which also
+ * restricts the fragment job to the tiles covered by the draw.
+ */
+
 static void
-panfrost_clear_render_target(struct pipe_context *pipe,
-                             struct pipe_surface *dst,
-                             const union pipe_color_union *color,
-                             unsigned dstx, unsigned dsty,
-                             unsigned width, unsigned height,
-                             bool render_condition_enabled)
+panfrost_clear_surface(struct pipe_context *pipe,
+                       struct pipe_surface *dst,
+                       unsigned buffers,
+                       const union pipe_color_union *color,
+                       double depth, unsigned stencil,
+                       unsigned dstx, unsigned dsty,
+                       unsigned width, unsigned height,
+                       bool render_condition_enabled)
 {
         struct panfrost_context *ctx = pan_context(pipe);
+        bool zs = !(buffers & PIPE_CLEAR_COLOR);
 
-        /* TODO: dstx, etc. */
+        if (render_condition_enabled &&
+            !panfrost_render_condition_check(ctx))
+                return;
 
-        struct pipe_framebuffer_state tmp = {0};
-        util_copy_framebuffer_state(&tmp, &ctx->pipe_framebuffer);
+        bool full = dstx == 0 && dsty == 0 &&
+                    width == dst->width && height == dst->height;
 
-        struct pipe_framebuffer_state fb = {
-                .width = dst->width,
-                .height = dst->height,
-                .layers = 1,
-                .samples = 1,
-                .nr_cbufs = 1,
-                .cbufs[0] = dst,
-        };
-        pipe->set_framebuffer_state(pipe, &fb);
+        bool fast = pan_clear_region_is_tile_aligned(dstx, dsty, width, height,
+                                                     dst->width, dst->height);
+
+        if (fast) {
+                struct pipe_framebuffer_state tmp = {0};
+                util_copy_framebuffer_state(&tmp, &ctx->pipe_framebuffer);
+
+                struct pipe_framebuffer_state fb = {
+                        .width = dst->width,
+                        .height = dst->height,
+                        .layers = 1,
+                        .samples = 1,
+                        .nr_cbufs = zs ? 0 : 1,
+                        .cbufs[0] = zs ? NULL : dst,
+                        .zsbuf = zs ? dst : NULL,
+                };
+                pipe->set_framebuffer_state(pipe, &fb);
+
+                struct panfrost_batch *batch =
+                        panfrost_get_fresh_batch_for_fbo(ctx, zs ?
+                                                         "Clear depth/stencil" :
+                                                         "Clear render target");
+
+                /* A pending clear of the whole surface cannot be restricted
+                 * to the region, draw on top of it instead */
+                if (full) {
+                        panfrost_batch_clear(batch, buffers, color, depth,
+                                             stencil);
+                } else if (!batch->clear) {
+                        panfrost_batch_clear_region(batch, buffers, color,
+                                                    depth, stencil, dstx, dsty,
+                                                    dstx + width,
+                                                    dsty + height);
+                } else {
+                        fast = false;
+                }
 
-        struct panfrost_batch *batch = panfrost_get_fresh_batch_for_fbo(ctx, "Clear render target");
-        panfrost_batch_clear(batch, PIPE_CLEAR_COLOR0, color, 0, 0);
+                pipe->set_framebuffer_state(pipe, &tmp);
+                util_unreference_framebuffer_state(&tmp);
+        }
 
-        pipe->set_framebuffer_state(pipe, &tmp);
-        util_unreference_framebuffer_state(&tmp);
+        if (fast)
+                return;
+
+        panfrost_blitter_save(ctx, render_condition_enabled);
+
+        if (zs) {
+                util_blitter_clear_depth_stencil(ctx->blitter, dst, buffers,
+                                                 depth, stencil, dstx, dsty,
+                                                 width, height);
+        } else {
+                util_blitter_clear_render_target(ctx->blitter, dst, color,
+                                                 dstx, dsty, width, height);
+        }
+}
+
+static void
+panfrost_clear_render_target(struct pipe_context *pipe,
+                             struct pipe_surface *dst,
+                             const union pipe_color_union *color,
+                             unsigned dstx, unsigned dsty,
+                             unsigned width, unsigned height,
+                             bool render_condition_enabled)
+{
+        panfrost_clear_surface(pipe, dst, PIPE_CLEAR_COLOR0, color, 0, 0,
+                               dstx, dsty, width, height,
+                               render_condition_enabled);
 }
 
 static void
@@ -885,28 +991,9 @@ panfrost_clear_depth_stencil(struct pipe_context *pipe,
                              unsigned width, unsigned height,
                              bool render_condition_enabled)
 {
-        struct panfrost_context *ctx = pan_context(pipe);
-
-        /* TODO: dstx, etc. */
-
-        struct pipe_framebuffer_state tmp = {0};
-        util_copy_framebuffer_state(&tmp, &ctx->pipe_framebuffer);
-
-        struct pipe_framebuffer_state fb = {
-                .width = dst->width,
-                .height = dst->height,
-                .layers = 1,
-                .samples = 1,
-                .nr_cbufs = 0,
-                .zsbuf = dst,
-        };
-        pipe->set_framebuffer_state(pipe, &fb);
-
-        struct panfrost_batch *batch = panfrost_get_fresh_batch_for_fbo(ctx, "Clear depth/stencil");
-        panfrost_batch_clear(batch, clear_flags, NULL, depth, stencil);
-
-        pipe->set_framebuffer_state(pipe, &tmp);
-        util_unreference_framebuffer_state(&tmp);
+        panfrost_clear_surface(pipe, dst, clear_flags, NULL, depth, stencil,
+                               dstx, dsty, width, height,
+                               render_condition_enabled);
 }
 
 /* Most of the time we can do CPU-side transfers, but sometimes we need to use
@@ -1069,6 +1156,350 @@ panfrost_box_covers_resource(const struct pipe_resource *resource,
                                                 box->depth);
 }
 
+/* Buffers are created write-combined unless usage hints at CPU reads, but
+ * hints are often missing or wrong (e.g. transform feedback or SSBO results
+ * read back every frame). Track how a buffer is actually mapped, and move its
+ * storage to a BO with the other caching mode once the balance of reads
+ * against write-only maps crosses a threshold. The gap between the two
+ * thresholds avoids bouncing between the two on mixed access patterns.
+ */
+
+#define PAN_BUFFER_READ_BIAS_MAX 8
+#define PAN_BUFFER_MIGRATE_THRESHOLD 4
+
+static struct panfrost_bo *
+panfrost_buffer_update_placement(struct panfrost_context *ctx,
+                                 struct panfrost_resource *rsrc,
+                                 unsigned usage)
+{
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
+        struct panfrost_bo *bo = rsrc->image.data.bo;
+
+        if (usage & PIPE_MAP_READ) {
+                rsrc->cpu_read_bias = MIN2(rsrc->cpu_read_bias + 1,
+                                           PAN_BUFFER_READ_BIAS_MAX);
+        } else {
+                rsrc->cpu_read_bias = MAX2(rsrc->cpu_read_bias - 1,
+                                           -PAN_BUFFER_READ_BIAS_MAX);
+        }
+
+        bool cacheable = bo->flags & PAN_BO_CACHEABLE;
+        bool want_cached = cacheable ?
+                rsrc->cpu_read_bias > -PAN_BUFFER_MIGRATE_THRESHOLD :
+                rsrc->cpu_read_bias >= PAN_BUFFER_MIGRATE_THRESHOLD;
+
+        if (want_cached == cacheable)
+                return bo;
+
+        /* Swapping the BO behind a persistent mapping or an importer is not
+         * possible.
+         */
+        if ((rsrc->base.flags & PIPE_RESOURCE_FLAG_MAP_PERSISTENT) ||
+            (usage & PIPE_MAP_PERSISTENT) ||
+            (bo->flags & PAN_BO_SHARED) || rsrc->scanout)
+                return bo;
+
+        uint32_t flags = bo->flags & ~(PAN_BO_DELAY_MMAP | PAN_BO_CACHEABLE);
+        struct panfrost_bo *newbo =
+                panfrost_bo_create(dev, bo->size,
+                                   flags | (want_cached ? PAN_BO_CACHEABLE : 0),
+                                   bo->label);
+
+        if (!newbo)
+                return bo;
+
+        /* Only the valid range has meaningful contents */
+        unsigned start = rsrc->valid_buffer_range.start;
+        unsigned end = rsrc->valid_buffer_range.end;
+
+        if (start < end) {
+                panfrost_bo_mem_invalidate(bo, start, end - start);
+                memcpy(newbo->ptr.cpu + start, bo->ptr.cpu + start,
+                       end - start);
+                panfrost_bo_mem_clean(newbo, start, end - start);
+        }
+
+        perf_debug_ctx(ctx, "Migrating buffer to %s memory",
+                       want_cached ? "cached" : "write-combined");
+
+        panfrost_dirty_state_all(ctx);
+        panfrost_resource_swap_bo(ctx, rsrc, newbo);
+        ctx->buffer_migrations++;
+
+        return newbo;
+}
+
+/* Discarding writes to a buffer the GPU is still reading would require either
+ * waiting for the GPU or reallocating the BO. Instead, write into staging
+ * memory and copy into place on the GPU, ordered after the pending reads.
+ *
+ * If a pending render pass reads the buffer, its fragment jobs would see the
+ * new contents. The copy then goes to a new BO together with the rest of the
+ * old contents, and the new BO replaces the old one. The render pass keeps
+ * reading the old BO in the draws recorded so far, while later draws are
+ * ordered after the copy. Large uploads are better served by reallocating.
+ */
+
+#define PAN_STAGED_UPLOAD_MAX_SIZE (64 * 1024)
+
+enum panfrost_staged_upload {
+        PAN_STAGED_UPLOAD_NONE = 0,
+
+        /* Copy into the buffer, after its pending users */
+        PAN_STAGED_UPLOAD_IN_PLACE,
+
+        /* Copy into a new BO, ahead of the render passes reading the buffer */
+        PAN_STAGED_UPLOAD_SHADOW,
+};
+
+static enum panfrost_staged_upload
+panfrost_should_stage_upload(struct panfrost_context *ctx,
+                             struct panfrost_resource *rsrc,
+                             unsigned usage, const struct pipe_box *box)
+{
+        struct panfrost_bo *bo = rsrc->image.data.bo;
+
+        if (rsrc->base.target != PIPE_BUFFER)
+                return false;
+
+        if (!(usage & PIPE_MAP_WRITE) || (usage & PIPE_MAP_READ))
+                return PAN_STAGED_UPLOAD_NONE;
+
+        if (!(usage & (PIPE_MAP_DISCARD_RANGE | PIPE_MAP_DISCARD_WHOLE_RESOURCE)))
+                return PAN_STAGED_UPLOAD_NONE;
+
+        if (usage & (PIPE_MAP_UNSYNCHRONIZED | PIPE_MAP_PERSISTENT |
+                     PIPE_MAP_DIRECTLY))
+                return PAN_STAGED_UPLOAD_NONE;
+
+        if (rsrc->base.flags & PIPE_RESOURCE_FLAG_MAP_PERSISTENT)
+                return PAN_STAGED_UPLOAD_NONE;
+
+        /* The copy shader moves whole words */
+        if ((box->x | box->width) & 3 || box->width > PAN_STAGED_UPLOAD_MAX_SIZE)
+                return PAN_STAGED_UPLOAD_NONE;
+
+        if (panfrost_render_batches_use_resource(ctx, rsrc)) {
+                struct hash_entry *entry =
+                        _mesa_hash_table_search(ctx->writers, rsrc);
+                struct panfrost_batch *writer = entry ? entry->data : NULL;
+
+                /* Reallocating without a copy is cheaper when everything is
+                 * discarded. Shared BOs can't be replaced, and the old
+                 * contents can't be copied ahead of a render pass writing
+                 * them. Very large buffers are not worth copying.
+                 */
+                if ((usage & PIPE_MAP_DISCARD_WHOLE_RESOURCE) ||
+                    (bo->flags & PAN_BO_SHARED) ||
+                    (writer && (writer->key.nr_cbufs || writer->key.zsbuf)) ||
+                    bo->size >= 16 * 1024 * 1024)
+                        return PAN_STAGED_UPLOAD_NONE;
+
+                return PAN_STAGED_UPLOAD_SHADOW;
+        }
+
+        /* Only worth it if we would otherwise have to wait */
+        if (rsrc->track.nr_users > 0 || !panfrost_bo_wait(bo, 0, true))
+                return PAN_STAGED_UPLOAD_IN_PLACE;
+
+        return PAN_STAGED_UPLOAD_NONE;
+}
+
+/* Land a staged upload in a copy of the buffer made on the GPU, see
+ * panfrost_should_stage_upload. Only the valid range of the old contents is
+ * copied, the shadow BO then replaces the old one.
+ */
+
+static void
+panfrost_staged_upload_shadow(struct panfrost_context *ctx,
+                              struct panfrost_resource *rsrc,
+                              struct panfrost_transfer *trans)
+{
+        const struct pipe_box *box = &trans->base.box;
+        struct pipe_resource *shadow = trans->upload.shadow;
+        unsigned start = ROUND_DOWN_TO(rsrc->valid_buffer_range.start, 4);
+        unsigned end = ALIGN_POT(rsrc->valid_buffer_range.end, 4);
+        unsigned box_end = box->x + box->width;
+
+        if (start < MIN2(end, box->x)) {
+                panfrost_copy_buffer_gpu(ctx, shadow, start, &rsrc->base,
+                                         start, MIN2(end, box->x) - start);
+        }
+
+        if (MAX2(start, box_end) < end) {
+                unsigned offset = MAX2(start, box_end);
+
+                panfrost_copy_buffer_gpu(ctx, shadow, offset, &rsrc->base,
+                                         offset, end - offset);
+        }
+
+        panfrost_copy_buffer_gpu(ctx, shadow, box->x, trans->upload.rsrc,
+                                 trans->upload.offset, box->width);
+
+        /* Swapping drops the resource from the pending batches, which keep
+         * their reference to the old BO. Tracking the upload batch as the
+         * writer then orders later users of the resource after the copies.
+         */
+        struct panfrost_bo *bo = pan_resource(shadow)->image.data.bo;
+
+        panfrost_bo_reference(bo);
+        panfrost_resource_swap_bo(ctx, rsrc, bo);
+        panfrost_batch_write_rsrc(panfrost_get_batch_for_upload(ctx), rsrc,
+                                  PIPE_SHADER_COMPUTE);
+        panfrost_dirty_state_all(ctx);
+
+        pipe_resource_reference(&trans->upload.shadow, NULL);
+}
+
+/* Invalidate or clean only the parts of a resource's BO accessed through a
+ * transfer, rather than the whole BO. Ranges of consecutive layers are merged
+ * when they are contiguous in memory, to keep the number of cache operations
+ * down for full-surface accesses.
+ */
+
+static void
+panfrost_transfer_mem_op(struct panfrost_resource *rsrc,
+                         struct panfrost_bo *bo, unsigned level,
+                         const struct pipe_box *box, bool invalidate)
+{
+        void (*op)(struct panfrost_bo *, size_t, size_t) = invalidate ?
+                panfrost_bo_mem_invalidate : panfrost_bo_mem_clean;
+
+        if (rsrc->base.target == PIPE_BUFFER) {
+                size_t bytes_per_block =
+                        util_format_get_blocksize(rsrc->image.layout.format);
+
+                op(bo, box->x * bytes_per_block, box->width * bytes_per_block);
+                return;
+        }
+
+        struct pan_image_range pending = { 0 };
+
+        for (unsigned z = box->z; z < box->z + box->depth; ++z) {
+                struct pan_image_range range =
+                        pan_image_surface_range(&rsrc->image.layout, level, z,
+                                                box->x, box->y,
+                                                box->width, box->height);
+
+                if (pending.size &&
+                    pending.offset + pending.size == range.offset) {
+                        pending.size += range.size;
+                        continue;
+                }
+
+                if (pending.size)
+                        op(bo, pending.offset, pending.size);
+
+                pending = range;
+        }
+
+        if (pending.size)
+                op(bo, pending.offset, pending.size);
+}
+
+/* Layouts in increasing order of GPU efficiency, used to decide whether a
+ * layout change is a promotion */
+
+static unsigned
+panfrost_modifier_rank(uint64_t modifier)
+{
+        if (drm_is_afbc(modifier))
+                return 2;
+        else if (modifier == DRM_FORMAT_MOD_ARM_16X16_BLOCK_U_INTERLEAVED)
+                return 1;
+        else
+                return 0;
+}
+
+static const char *
+panfrost_modifier_name(uint64_t modifier)
+{
+        if (drm_is_afbc(modifier))
+                return "AFBC";
+        else if (modifier == DRM_FORMAT_MOD_ARM_16X16_BLOCK_U_INTERLEAVED)
+                return "u-interleaved";
+        else if (modifier == DRM_FORMAT_MOD_LINEAR)
+                return "linear";
+        else
+                return "unknown";
+}
+
+/* Can the driver change the layout of a resource based on its usage? Shared
+ * resources have their layout negotiated with other processes, and the
+ * conversion blits only handle simple colour surfaces. */
+
+static bool
+panfrost_can_adapt_layout(const struct panfrost_resource *rsrc)
+{
+        return !rsrc->modifier_constant &&
+               !(rsrc->base.bind & PAN_BIND_SHARED_MASK) &&
+               panfrost_is_2d(rsrc) &&
+               rsrc->base.nr_samples <= 1 &&
+               !util_format_is_depth_or_stencil(rsrc->base.format);
+}
+
+/* Called after the driver changed the layout of a resource. Restart the usage
+ * history and freeze the layout once it has changed too often, so resources
+ * with mixed usage don't bounce between layouts. */
+
+static void
+panfrost_resource_relayout_done(struct panfrost_device *dev,
+                                struct panfrost_resource *rsrc,
+                                uint64_t old_modifier, const char *reason)
+{
+        uint64_t modifier = rsrc->image.layout.modifier;
+
+        if (modifier != old_modifier)
+                rsrc->history.conversions++;
+
+        rsrc->history.gpu_frames = 0;
+        rsrc->history.cpu_frames = 0;
+        rsrc->modifier_updates = 0;
+        rsrc->modifier_constant =
+                rsrc->history.conversions >= LAYOUT_MAX_CONVERSIONS;
+
+        if (unlikely(dev->debug & PAN_DBG_LAYOUT)) {
+                mesa_logi("Resource %p (%ux%u %s): %s -> %s, %s (%u conversions%s)",
+                          rsrc, rsrc->base.width0, rsrc->base.height0,
+                          util_format_short_name(rsrc->base.format),
+                          panfrost_modifier_name(old_modifier),
+                          panfrost_modifier_name(modifier), reason,
+                          rsrc->history.conversions,
+                          rsrc->modifier_constant ? ", frozen" : "");
+        }
+}
+
+/* Record a CPU map. Resources mapped across several frames are demoted to
+ * linear, which is mapped without staging blits or software tiling. */
+
+static void
+panfrost_note_cpu_access(struct panfrost_context *ctx,
+                         struct panfrost_resource *rsrc, unsigned usage)
+{
+        /* Any GPU use later in this frame is not GPU-only */
+        rsrc->history.gpu_frames = 0;
+        rsrc->history.gpu_frame = ctx->frame;
+
+        if (rsrc->history.cpu_frames && rsrc->history.cpu_frame == ctx->frame)
+                return;
+
+        rsrc->history.cpu_frame = ctx->frame;
+
+        if (rsrc->history.cpu_frames < UINT8_MAX)
+                rsrc->history.cpu_frames++;
+
+        /* Whole-resource overwrites are handled by
+         * panfrost_should_linear_convert without a blit */
+        if (rsrc->history.cpu_frames < LAYOUT_DEMOTE_FRAMES ||
+            rsrc->image.layout.modifier == DRM_FORMAT_MOD_LINEAR ||
+            (usage & PIPE_MAP_DISCARD_WHOLE_RESOURCE) ||
+            !panfrost_can_adapt_layout(rsrc))
+                return;
+
+        pan_resource_modifier_convert(ctx, rsrc, DRM_FORMAT_MOD_LINEAR,
+                                      "Repeated CPU access");
+}
+
 static void *
 panfrost_ptr_map(struct pipe_context *pctx,
                       struct pipe_resource *resource,
@@ -1080,6 +1511,11 @@ panfrost_ptr_map(struct pipe_context *pctx,
         struct panfrost_context *ctx = pan_context(pctx);
         struct panfrost_device *dev = pan_device(pctx->screen);
         struct panfrost_resource *rsrc = pan_resource(resource);
+
+        /* May change the layout, so do this first */
+        if (resource->target != PIPE_BUFFER)
+                panfrost_note_cpu_access(ctx, rsrc, usage);
+
         enum pipe_format format = rsrc->image.layout.format;
         int bytes_per_block = util_format_get_blocksize(format);
         struct panfrost_bo *bo = rsrc->image.data.bo;
@@ -1162,6 +1598,33 @@ panfrost_ptr_map(struct pipe_context *pctx,
                 usage |= PIPE_MAP_DISCARD_WHOLE_RESOURCE;
         }
 
+        enum panfrost_staged_upload staged =
+                panfrost_should_stage_upload(ctx, rsrc, usage, box);
+
+        if (staged == PAN_STAGED_UPLOAD_SHADOW) {
+                transfer->upload.shadow =
+                        pctx->screen->resource_create(pctx->screen, resource);
+
+                if (!transfer->upload.shadow)
+                        staged = PAN_STAGED_UPLOAD_NONE;
+        }
+
+        if (staged != PAN_STAGED_UPLOAD_NONE) {
+                void *cpu = NULL;
+
+                u_upload_alloc(ctx->transfer_uploader, 0, box->width, 16,
+                               &transfer->upload.offset,
+                               &transfer->upload.rsrc, &cpu);
+
+                if (cpu) {
+                        transfer->base.stride = 0;
+                        transfer->base.layer_stride = 0;
+                        return cpu;
+                }
+
+                pipe_resource_reference(&transfer->upload.shadow, NULL);
+        }
+
         bool create_new_bo = usage & PIPE_MAP_DISCARD_WHOLE_RESOURCE;
         bool copy_resource = false;
 
@@ -1229,6 +1692,12 @@ panfrost_ptr_map(struct pipe_context *pctx,
                                     drm_is_afbc(rsrc->image.layout.modifier))
                                         panfrost_resource_init_afbc_headers(rsrc);
 
+                                /* CRC buffers are garbage in the new BO */
+                                if (!copy_resource && rsrc->valid.crc) {
+                                        memset(rsrc->valid.crc, 0,
+                                               panfrost_crc_count(rsrc) * sizeof(bool));
+                                }
+
                                 bo = newbo;
                         } else {
                                 /* Allocation failed or was impossible, let's
@@ -1252,18 +1721,15 @@ panfrost_ptr_map(struct pipe_context *pctx,
                 cache_inval = false;
         }
 
-        /* TODO: Only the accessed region for textures */
-        if (cache_inval) {
-                size_t offset = 0;
-                size_t size = bo->size;
-
-                if (resource->target == PIPE_BUFFER) {
-                        offset = box->x * (size_t) bytes_per_block;
-                        size = box->width * (size_t) bytes_per_block;
-                }
+        /* Synchronized buffer maps are a good time to reconsider caching, as
+         * no pending write to the BO remains.
+         */
+        if (cache_inval && resource->target == PIPE_BUFFER &&
+            !rsrc->separate_stencil)
+                bo = panfrost_buffer_update_placement(ctx, rsrc, usage);
 
-                panfrost_bo_mem_invalidate(bo, offset, size);
-        }
+        if (cache_inval)
+                panfrost_transfer_mem_op(rsrc, bo, level, box, true);
 
         /* For access to compressed textures, we want the (x, y, w, h)
          * region-of-interest in blocks, not pixels. Then we compute the stride
@@ -1323,7 +1789,9 @@ pan_resource_modifier_convert(struct panfrost_context *ctx,
 {
         assert(!rsrc->modifier_constant);
 
-        perf_debug_ctx(ctx, "Disabling AFBC with a blit. Reason: %s", reason);
+        perf_debug_ctx(ctx, "Converting layout with a blit. Reason: %s", reason);
+
+        uint64_t old_modifier = rsrc->image.layout.modifier;
 
         struct pipe_resource *tmp_prsrc =
                 panfrost_resource_create_with_modifier(
@@ -1362,6 +1830,8 @@ pan_resource_modifier_convert(struct panfrost_context *ctx,
 
         panfrost_resource_setup(pan_device(ctx->base.screen), rsrc, modifier,
                                 blit.dst.format);
+        panfrost_resource_relayout_done(pan_device(ctx->base.screen), rsrc,
+                                        old_modifier, reason);
         pipe_resource_reference(&tmp_prsrc, NULL);
 }
 
@@ -1388,6 +1858,158 @@ pan_legalize_afbc_format(struct panfrost_context *ctx,
                         "Reinterpreting AFBC surface as incompatible format");
 }
 
+/* Promote a resource left linear or u-interleaved by earlier CPU use once it
+ * has been used only by the GPU for a while. Called when binding resources as
+ * the given format, before any draw using them is recorded. */
+
+void
+panfrost_promote_layout(struct panfrost_context *ctx,
+                        struct panfrost_resource *rsrc,
+                        enum pipe_format format)
+{
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
+
+        if (rsrc->history.gpu_frames < LAYOUT_PROMOTE_FRAMES ||
+            ctx->blitter->running || !panfrost_can_adapt_layout(rsrc))
+                return;
+
+        uint64_t modifier = panfrost_best_modifier(dev, rsrc, rsrc->base.format);
+
+        /* Don't compress if the binding would need to decompress again, see
+         * pan_legalize_afbc_format */
+        if (drm_is_afbc(modifier) &&
+            panfrost_afbc_format(dev->arch, pan_blit_format(rsrc->base.format)) !=
+            panfrost_afbc_format(dev->arch, pan_blit_format(format)))
+                modifier = DRM_FORMAT_MOD_ARM_16X16_BLOCK_U_INTERLEAVED;
+
+        if (panfrost_modifier_rank(modifier) <=
+            panfrost_modifier_rank(rsrc->image.layout.modifier))
+                return;
+
+        pan_resource_modifier_convert(ctx, rsrc, modifier, "GPU-only usage");
+}
+
+static bool
+panfrost_is_bound_render_target(struct panfrost_context *ctx,
+                                struct panfrost_resource *rsrc)
+{
+        struct pipe_framebuffer_state *fb = &ctx->pipe_framebuffer;
+
+        for (unsigned i = 0; i < fb->nr_cbufs; ++i) {
+                if (fb->cbufs[i] && fb->cbufs[i]->texture == &rsrc->base)
+                        return true;
+        }
+
+        return fb->zsbuf && fb->zsbuf->texture == &rsrc->base;
+}
+
+/* AFBC bodies are allocated for the worst case, uncompressed superblocks.
+ * Once rendering is done and a texture is sampled from, pack the superblocks
+ * tightly in a smaller BO, which saves memory and improves the locality of
+ * texturing. This waits for the rendering and for the GPU to compute the
+ * packed size, so it is only done with PAN_MESA_DEBUG=afbcpack. Packed
+ * resources cannot be rendered to and are unpacked before being written, see
+ * panfrost_unpack_afbc. */
+
+void
+panfrost_pack_afbc(struct panfrost_context *ctx,
+                   struct panfrost_resource *rsrc)
+{
+        struct panfrost_device *dev = pan_device(ctx->base.screen);
+        struct pan_image_layout *layout = &rsrc->image.layout;
+
+        if (!drm_is_afbc(layout->modifier) || rsrc->modifier_constant ||
+            (rsrc->base.bind & PAN_BIND_SHARED_MASK) ||
+            rsrc->afbc.packed || rsrc->afbc.checked ||
+            rsrc->afbc.unpacks >= AFBC_UNPACK_THRESHOLD ||
+            !BITSET_COUNT(rsrc->valid.data))
+                return;
+
+        /* Leave feedback loops and internal blits alone */
+        if (ctx->blitter->running || panfrost_is_bound_render_target(ctx, rsrc))
+                return;
+
+        rsrc->afbc.checked = true;
+
+        struct pan_image_layout packed = *layout;
+        unsigned body_sizes[MAX_MIP_LEVELS] = { 0 };
+        unsigned offsets[MAX_MIP_LEVELS];
+        unsigned nr_blocks = 0;
+
+        /* Check the layout can be packed at all before doing any work */
+        if (!pan_image_layout_pack_afbc(&packed, body_sizes))
+                return;
+
+        for (unsigned l = 0; l < layout->nr_slices; ++l) {
+                offsets[l] = nr_blocks * sizeof(struct pan_afbc_block_info);
+                nr_blocks += pan_afbc_superblock_count(layout, l);
+        }
+
+        unsigned metadata_size = nr_blocks * sizeof(struct pan_afbc_block_info);
+        struct panfrost_bo *metadata =
+                panfrost_bo_create(dev, metadata_size, PAN_BO_CACHEABLE,
+                                   "AFBC superblock sizes");
+
+        for (unsigned l = 0; l < layout->nr_slices; ++l)
+                panfrost_afbc_size_gpu(ctx, rsrc, metadata, offsets[l], l);
+
+        /* The packed size is needed to allocate the BO */
+        panfrost_flush_batches_accessing_rsrc(ctx, rsrc, "AFBC size");
+        panfrost_bo_wait(metadata, INT64_MAX, false);
+        panfrost_bo_mem_invalidate(metadata, 0, metadata_size);
+
+        for (unsigned l = 0; l < layout->nr_slices; ++l) {
+                body_sizes[l] =
+                        pan_afbc_pack_offsets(metadata->ptr.cpu + offsets[l],
+                                              pan_afbc_superblock_count(layout, l));
+        }
+
+        pan_image_layout_pack_afbc(&packed, body_sizes);
+
+        /* Not worth a copy for less than an eighth */
+        if (packed.data_size > layout->data_size - (layout->data_size / 8)) {
+                panfrost_bo_unreference(metadata);
+                return;
+        }
+
+        perf_debug_ctx(ctx, "Packing AFBC texture from %u to %u bytes",
+                       layout->data_size, packed.data_size);
+
+        /* The pack job reads the offsets back */
+        panfrost_bo_mem_clean(metadata, 0, metadata_size);
+
+        struct panfrost_bo *bo =
+                panfrost_bo_create(dev, packed.data_size,
+                                   PAN_BO_DELAY_MMAP |
+                                   (rsrc->image.data.bo->flags & PAN_BO_CACHEABLE),
+                                   "Packed AFBC texture");
+
+        for (unsigned l = 0; l < layout->nr_slices; ++l) {
+                panfrost_afbc_pack_gpu(ctx, rsrc, bo, &packed.slices[l],
+                                       metadata, offsets[l], l);
+        }
+
+        /* The pack batch holds the metadata and the old BO until it is done */
+        panfrost_flush_batches_accessing_rsrc(ctx, rsrc, "AFBC pack");
+        panfrost_bo_unreference(metadata);
+
+        panfrost_resource_swap_bo(ctx, rsrc, bo);
+        *layout = packed;
+        rsrc->afbc.packed = true;
+}
+
+void
+panfrost_unpack_afbc(struct panfrost_context *ctx,
+                     struct panfrost_resource *rsrc, const char *reason)
+{
+        if (!rsrc->afbc.packed)
+                return;
+
+        rsrc->afbc.unpacks++;
+        pan_resource_modifier_convert(ctx, rsrc, rsrc->image.layout.modifier,
+                                      reason);
+}
+
 static bool
 panfrost_should_linear_convert(struct panfrost_device *dev,
                                struct panfrost_resource *prsrc,
@@ -1436,8 +2058,10 @@ panfrost_ptr_unmap(struct pipe_context *pctx,
         struct panfrost_resource *prsrc = (struct panfrost_resource *) transfer->resource;
         struct panfrost_device *dev = pan_device(pctx->screen);
 
-        if (transfer->usage & PIPE_MAP_WRITE)
-                prsrc->valid.crc = false;
+        if (transfer->usage & PIPE_MAP_WRITE) {
+                panfrost_invalidate_crc(prsrc, transfer->level, transfer->box.z,
+                                        transfer->box.z + transfer->box.depth - 1);
+        }
 
         /* AFBC will use a staging resource. `initialized` will be set when the
          * fragment job is created; this is deferred to prevent useless surface
@@ -1454,11 +2078,14 @@ panfrost_ptr_unmap(struct pipe_context *pctx,
                         panfrost_bo_mem_clean(trans_bo, 0, trans_bo->size);
 
                         if (panfrost_should_linear_convert(dev, prsrc, transfer)) {
+                                uint64_t old_modifier = prsrc->image.layout.modifier;
 
                                 panfrost_bo_unreference(prsrc->image.data.bo);
 
                                 panfrost_resource_setup(dev, prsrc, DRM_FORMAT_MOD_LINEAR,
                                                         prsrc->image.layout.format);
+                                panfrost_resource_relayout_done(dev, prsrc, old_modifier,
+                                                                "Streaming usage");
 
                                 prsrc->image.data.bo = trans_bo;
                                 panfrost_bo_reference(prsrc->image.data.bo);
@@ -1484,6 +2111,9 @@ panfrost_ptr_unmap(struct pipe_context *pctx,
                                 if (panfrost_should_linear_convert(dev, prsrc, transfer)) {
                                         panfrost_resource_setup(dev, prsrc, DRM_FORMAT_MOD_LINEAR,
                                                                 prsrc->image.layout.format);
+                                        panfrost_resource_relayout_done(dev, prsrc,
+                                                                        DRM_FORMAT_MOD_ARM_16X16_BLOCK_U_INTERLEAVED,
+                                                                        "Streaming usage");
                                         if (prsrc->image.layout.data_size > bo->size) {
                                                 /* We want the BO to be MMAPed. */
                                                 uint32_t flags = bo->flags & ~PAN_BO_DELAY_MMAP;
@@ -1512,24 +2142,28 @@ panfrost_ptr_unmap(struct pipe_context *pctx,
                 }
         }
 
-        /* TODO: Only the accessed region */
-        /* It is important to not do this for AFBC resources, or else the
-         * clean might overwrite the result of the blit. */
-        if (!afbc && (transfer->usage & PIPE_MAP_WRITE)) {
-                size_t offset = 0;
-                size_t size = prsrc->image.data.bo->size;
-
-                /* TODO: Don't recalculate */
-                if (prsrc->base.target == PIPE_BUFFER) {
-                        enum pipe_format format = prsrc->image.layout.format;
-                        int bytes_per_block = util_format_get_blocksize(format);
+        if (trans->upload.rsrc) {
+                struct panfrost_context *ctx = pan_context(pctx);
 
-                        offset = transfer->box.x * (size_t) bytes_per_block;
-                        size = transfer->box.width * (size_t) bytes_per_block;
+                /* The uploader maps its buffers persistently, nothing to
+                 * unmap */
+                if (trans->upload.shadow) {
+                        panfrost_staged_upload_shadow(ctx, prsrc, trans);
+                } else {
+                        panfrost_copy_buffer_gpu(ctx, transfer->resource,
+                                                 transfer->box.x,
+                                                 trans->upload.rsrc,
+                                                 trans->upload.offset,
+                                                 transfer->box.width);
                 }
 
-                panfrost_bo_mem_clean(prsrc->image.data.bo,
-                                      offset, size);
+                pipe_resource_reference(&trans->upload.rsrc, NULL);
+        } else if (!afbc && (transfer->usage & PIPE_MAP_WRITE)) {
+                /* It is important to not do this for AFBC resources, or else
+                 * the clean might overwrite the result of the blit. */
+                panfrost_transfer_mem_op(prsrc, prsrc->image.data.bo,
+                                         transfer->level, &transfer->box,
+                                         false);
         }
 
         util_range_add(&prsrc->base, &prsrc->valid_buffer_range,
@@ -1600,10 +2234,9 @@ panfrost_generate_mipmap(
         unsigned first_layer,
         unsigned last_layer)
 {
+        struct panfrost_context *ctx = pan_context(pctx);
         struct panfrost_resource *rsrc = pan_resource(prsrc);
 
-        perf_debug_ctx(pan_context(pctx), "Unoptimized mipmap generation");
-
         /* Generating a mipmap invalidates the written levels, so make that
          * explicit so we don't try to wallpaper them back and end up with
          * u_blitter recursion */
@@ -1612,7 +2245,14 @@ panfrost_generate_mipmap(
         for (unsigned l = base_level + 1; l <= last_level; ++l)
                 BITSET_CLEAR(rsrc->valid.data, l);
 
+        /* Compute writes each level straight from the one above, several
+         * levels per job, without going through the tile buffer */
+        if (panfrost_generate_mipmap_gpu(ctx, prsrc, format, base_level,
+                                         last_level))
+                return true;
+
         /* Beyond that, we just delegate the hard stuff. */
+        perf_debug_ctx(ctx, "Unoptimized mipmap generation");
 
         bool blit_res = util_gen_mipmap(
                                 pctx, prsrc, format,
@@ -33,8 +33,17 @@
 #include "util/u_range.h"
 
 #define LAYOUT_CONVERT_THRESHOLD 8
+#define AFBC_UNPACK_THRESHOLD 2
 #define PAN_MAX_BATCHES 32
 
+/* Usage history thresholds for adaptive layouts: frames of GPU-only use before
+ * promoting a resource to a compressed/tiled layout, frames with CPU maps
+ * before demoting it to linear, and layout changes after which the modifier is
+ * frozen to avoid churn */
+#define LAYOUT_PROMOTE_FRAMES 16
+#define LAYOUT_DEMOTE_FRAMES 4
+#define LAYOUT_MAX_CONVERSIONS 4
+
 #define PAN_BIND_SHARED_MASK (PIPE_BIND_DISPLAY_TARGET | PIPE_BIND_SCANOUT | \
                               PIPE_BIND_SHARED)
 
@@ -71,20 +80,49 @@ struct panfrost_resource {
         struct pan_image image;
 
         struct {
-                /* Is the checksum for this image valid? Implicitly refers to
-                 * the first slice; we only checksum non-mipmapped 2D images */
-                bool crc;
+                /* Is the checksum valid? One entry per level and layer of
+                 * images with CRC, see panfrost_crc_valid */
+                bool *crc;
 
                 /* Has anything been written to this slice? */
                 BITSET_DECLARE(data, MAX_MIP_LEVELS);
         } valid;
 
+        struct {
+                /* Are superblock bodies packed? Packed resources are only
+                 * sampled from, and are unpacked before being written */
+                bool packed;
+
+                /* Has packing been considered since the last write? */
+                bool checked;
+
+                /* Number of times the resource was unpacked to be written.
+                 * Resources rendered to repeatedly are not worth packing */
+                uint8_t unpacks;
+        } afbc;
+
         /* Whether the modifier can be changed */
         bool modifier_constant;
 
         /* Used to decide when to convert to another modifier */
         uint16_t modifier_updates;
 
+        /* Usage history, see panfrost_promote_layout */
+        struct {
+                /* Last frames the resource was accessed by the GPU and
+                 * mapped by the CPU */
+                unsigned gpu_frame, cpu_frame;
+
+                /* Frames with GPU access since the last CPU map */
+                uint8_t gpu_frames;
+
+                /* Frames with CPU maps, decayed by GPU-only use */
+                uint8_t cpu_frames;
+
+                /* Layout changes made by the driver */
+                uint8_t conversions;
+        } history;
+
         /* Do all pixels have the same stencil value? */
         bool constant_stencil;
 
@@ -93,6 +131,10 @@ struct panfrost_resource {
 
         /* Cached min/max values for index buffers */
         struct panfrost_minmax_cache *index_cache;
+
+        /* For buffers, balance of CPU maps that read against write-only maps,
+         * used to choose between a CPU-cached and a write-combined BO */
+        int8_t cpu_read_bias;
 };
 
 static inline struct panfrost_resource *
@@ -108,6 +150,15 @@ struct panfrost_transfer {
                 struct pipe_resource *rsrc;
                 struct pipe_box box;
         } staging;
+
+        /* Range of the context's transfer uploader staging a buffer write,
+         * and the buffer replacing the resource's BO if the write must not
+         * be seen by pending render passes */
+        struct {
+                struct pipe_resource *rsrc;
+                unsigned offset;
+                struct pipe_resource *shadow;
+        } upload;
 };
 
 static inline struct panfrost_transfer *
@@ -116,6 +167,18 @@ pan_transfer(struct pipe_transfer *p)
         return (struct panfrost_transfer *)p;
 }
 
+static inline bool *
+panfrost_crc_valid(struct panfrost_resource *rsrc, unsigned level,
+                   unsigned layer)
+{
+        assert(rsrc->valid.crc);
+        return &rsrc->valid.crc[level * rsrc->base.array_size + layer];
+}
+
+void
+panfrost_invalidate_crc(struct panfrost_resource *rsrc, unsigned level,
+                        unsigned first_layer, unsigned last_layer);
+
 void panfrost_resource_screen_init(struct pipe_screen *screen);
 
 void panfrost_resource_screen_destroy(struct pipe_screen *screen);
@@ -131,6 +194,44 @@ void
 panfrost_blit(struct pipe_context *pipe,
               const struct pipe_blit_info *info);
 
+void
+panfrost_copy_buffer_gpu(struct panfrost_context *ctx,
+                         struct pipe_resource *dst, unsigned dst_offset,
+                         struct pipe_resource *src, unsigned src_offset,
+                         unsigned size);
+
+/* Levels written by one compute job generating mipmaps, one per halving of
+ * the 8x8 workgroup */
+#define PAN_MIPMAP_MAX_LEVELS 4
+
+bool
+panfrost_generate_mipmap_gpu(struct panfrost_context *ctx,
+                             struct pipe_resource *prsrc,
+                             enum pipe_format format,
+                             unsigned base_level, unsigned last_level);
+
+void
+panfrost_afbc_size_gpu(struct panfrost_context *ctx,
+                       struct panfrost_resource *rsrc,
+                       struct panfrost_bo *metadata, unsigned offset,
+                       unsigned level);
+
+void
+panfrost_afbc_pack_gpu(struct panfrost_context *ctx,
+                       struct panfrost_resource *rsrc,
+                       struct panfrost_bo *dst,
+                       const struct pan_image_slice_layout *dst_slice,
+                       struct panfrost_bo *metadata, unsigned offset,
+                       unsigned level);
+
+void
+panfrost_pack_afbc(struct panfrost_context *ctx,
+                   struct panfrost_resource *rsrc);
+
+void
+panfrost_unpack_afbc(struct panfrost_context *ctx,
+                     struct panfrost_resource *rsrc, const char *reason);
+
 void
 panfrost_resource_set_damage_region(struct pipe_screen *screen,
                                     struct pipe_resource *res,
@@ -173,4 +274,9 @@ pan_legalize_afbc_format(struct panfrost_context *ctx,
                          struct panfrost_resource *rsrc,
                          enum pipe_format format);
 
+void
+panfrost_promote_layout(struct panfrost_context *ctx,
+                        struct panfrost_resource *rsrc,
+                        enum pipe_format format);
+
 #endif /* PAN_RESOURCE_H */
@@ -51,6 +51,7 @@
 #include "pan_public.h"
 #include "pan_util.h"
 #include "decode.h"
+#include "perf/pan_perf.h"
 
 #include "pan_context.h"
 
@@ -72,13 +73,17 @@ static const struct debug_named_value panfrost_debug_options[] = {
 #ifdef PAN_DBG_OVERFLOW
         {"overflow",  PAN_DBG_OVERFLOW, "Check for buffer overflows in pool uploads"},
 #endif
-        {"tiler",     PAN_DBG_TILER,    "Decode the tiler heap"},
+        {"tiler",     PAN_DBG_TILER,    "Analyse the tiler heap after each render pass"},
         {"bolog",     PAN_DBG_BO_LOG,   "Log BO allocations/deallocations"},
         {"boclear",   PAN_DBG_BO_CLEAR, "Clear BOs on allocation"},
         {"nogpuc",    PAN_DBG_UNCACHED_GPU, "Use uncached GPU memory for textures"},
         {"nocpuc",    PAN_DBG_UNCACHED_CPU, "Use uncached CPU mappings for textures"},
         {"log",       PAN_DBG_LOG,      "Log job submission etc."},
-        {"gofaster",  PAN_DBG_GOFASTER, "Experimental performance improvements"},
+        {"capture",   PAN_DBG_CAPTURE,  "Capture submitted work to $PAN_CAPTURE_FILE for panreplay"},
+        {"specialize", PAN_DBG_SPECIALIZE, "Specialize shaders on uniforms that are stable across draws"},
+        {"afbcpack",  PAN_DBG_AFBC_PACK, "Pack AFBC textures after rendering to reclaim memory"},
+        {"layout",    PAN_DBG_LAYOUT,   "Log resource layout conversions"},
+        {"gofaster",  PAN_DBG_GOFASTER, "Pipeline CSF submissions instead of waiting for each batch (experimental)"},
         DEBUG_NAMED_VALUE_END
 };
 
@@ -779,6 +784,7 @@ panfrost_destroy_screen(struct pipe_screen *pscreen)
         panfrost_close_device(dev);
 
         disk_cache_destroy(screen->disk_cache);
+        simple_mtx_destroy(&screen->perf.lock);
         ralloc_free(pscreen);
 }
 
@@ -796,11 +802,33 @@ panfrost_get_disk_shader_cache(struct pipe_screen *pscreen)
         return pan_screen(pscreen)->disk_cache;
 }
 
+static unsigned
+panfrost_num_derived_queries(struct panfrost_screen *screen)
+{
+        return screen->perf.cfg ? screen->perf.cfg->n_derived : 0;
+}
+
+static enum pipe_driver_query_type
+panfrost_derived_query_type(const struct panfrost_perf_derived *derived)
+{
+        switch (derived->units) {
+        case PAN_PERF_DERIVED_UNITS_PERCENT:
+                return PIPE_DRIVER_QUERY_TYPE_PERCENTAGE;
+        case PAN_PERF_DERIVED_UNITS_BYTES:
+        case PAN_PERF_DERIVED_UNITS_BYTES_PER_SECOND:
+                return PIPE_DRIVER_QUERY_TYPE_BYTES;
+        default:
+                return PIPE_DRIVER_QUERY_TYPE_FLOAT;
+        }
+}
+
 int
 panfrost_get_driver_query_info(struct pipe_screen *pscreen, unsigned index,
                                struct pipe_driver_query_info *info)
 {
-        int num_queries = ARRAY_SIZE(panfrost_driver_query_list);
+        struct panfrost_screen *screen = pan_screen(pscreen);
+        unsigned num_static = ARRAY_SIZE(panfrost_driver_query_list);
+        int num_queries = num_static + panfrost_num_derived_queries(screen);
 
         if (!info)
            return num_queries;
@@ -808,11 +836,56 @@ panfrost_get_driver_query_info(struct pipe_screen *pscreen, unsigned index,
         if (index >= num_queries)
            return 0;
 
-        *info = panfrost_driver_query_list[index];
+        if (index < num_static) {
+                *info = panfrost_driver_query_list[index];
+                return 1;
+        }
+
+        /* Derived metrics are listed after the driver queries */
+        unsigned derived_index = index - num_static;
+        const struct panfrost_perf_derived *derived =
+                &screen->perf.cfg->derived[derived_index];
+
+        *info = (struct pipe_driver_query_info) {
+                .name = derived->symbol_name,
+                .query_type = PAN_QUERY_PERF_DERIVED + derived_index,
+                .type = panfrost_derived_query_type(derived),
+                .result_type = PIPE_DRIVER_QUERY_RESULT_TYPE_AVERAGE,
+                .group_id = PAN_QUERY_GROUP_GPU_METRICS,
+        };
 
         return 1;
 }
 
+int
+panfrost_get_driver_query_group_info(struct pipe_screen *pscreen,
+                                     unsigned index,
+                                     struct pipe_driver_query_group_info *info)
+{
+        static const char *names[] = {
+                [PAN_QUERY_GROUP_DRIVER] = "Driver",
+                [PAN_QUERY_GROUP_BATCHES] = "Batches",
+                [PAN_QUERY_GROUP_GPU_METRICS] = "GPU metrics",
+        };
+
+        if (!info)
+                return ARRAY_SIZE(names);
+
+        if (index >= ARRAY_SIZE(names))
+                return 0;
+
+        unsigned num_queries = 0;
+        for (unsigned i = 0; i < ARRAY_SIZE(panfrost_driver_query_list); ++i)
+                num_queries += (panfrost_driver_query_list[i].group_id == index);
+
+        if (index == PAN_QUERY_GROUP_GPU_METRICS)
+                num_queries = panfrost_num_derived_queries(pan_screen(pscreen));
+
+        info->name = names[index];
+        info->max_active_queries = num_queries;
+        info->num_queries = num_queries;
+        return 1;
+}
 
 struct pipe_screen *
 panfrost_create_screen(int fd, struct renderonly *ro)
@@ -823,6 +896,8 @@ panfrost_create_screen(int fd, struct renderonly *ro)
         if (!screen)
                 return NULL;
 
+        simple_mtx_init(&screen->perf.lock, mtx_plain);
+
         struct panfrost_device *dev = pan_device(&screen->base);
 
         /* Debug must be set first for pandecode to work correctly */
@@ -840,6 +915,11 @@ panfrost_create_screen(int fd, struct renderonly *ro)
         }
 
         dev->ro = ro;
+        screen->perf.cfg = panfrost_perf_lookup_config(dev);
+
+#ifdef HAVE_PERFETTO
+        pan_perfetto_init();
+#endif
 
         /* The functionality is only useful with kbase */
         if (dev->kbase)
@@ -851,6 +931,7 @@ panfrost_create_screen(int fd, struct renderonly *ro)
         screen->base.get_vendor = panfrost_get_vendor;
         screen->base.get_device_vendor = panfrost_get_device_vendor;
         screen->base.get_driver_query_info = panfrost_get_driver_query_info;
+        screen->base.get_driver_query_group_info = panfrost_get_driver_query_group_info;
         screen->base.get_param = panfrost_get_param;
         screen->base.get_shader_param = panfrost_get_shader_param;
         screen->base.get_compute_param = panfrost_get_compute_param;
@@ -38,23 +38,70 @@
 #include "util/set.h"
 #include "util/log.h"
 #include "util/disk_cache.h"
+#include "util/simple_mtx.h"
 
 #include "pan_device.h"
 #include "pan_mempool.h"
 
 #define PAN_QUERY_DRAW_CALLS (PIPE_QUERY_DRIVER_SPECIFIC + 0)
+#define PAN_QUERY_BUFFER_MIGRATIONS (PIPE_QUERY_DRIVER_SPECIFIC + 1)
+#define PAN_QUERY_CRC_CHECKED_TILES (PIPE_QUERY_DRIVER_SPECIFIC + 2)
+#define PAN_QUERY_BATCHES (PIPE_QUERY_DRIVER_SPECIFIC + 3)
+#define PAN_QUERY_BATCHES_FORCED (PIPE_QUERY_DRIVER_SPECIFIC + 4)
+#define PAN_QUERY_BATCH_DRAWS (PIPE_QUERY_DRIVER_SPECIFIC + 5)
+#define PAN_QUERY_BATCH_TILES (PIPE_QUERY_DRIVER_SPECIFIC + 6)
+#define PAN_QUERY_BATCH_BOS (PIPE_QUERY_DRIVER_SPECIFIC + 7)
+#define PAN_QUERY_BATCH_POOL_BYTES (PIPE_QUERY_DRIVER_SPECIFIC + 8)
+#define PAN_QUERY_BATCH_OPEN_TIME (PIPE_QUERY_DRIVER_SPECIFIC + 9)
+#define PAN_QUERY_BATCH_BUILD_TIME (PIPE_QUERY_DRIVER_SPECIFIC + 10)
+#define PAN_QUERY_BATCH_SUBMIT_TIME (PIPE_QUERY_DRIVER_SPECIFIC + 11)
+
+/* Metrics derived from the hardware counters, see panfrost/perf/derived.xml.
+ * The query type of a metric is PAN_QUERY_PERF_DERIVED plus its index in the
+ * counter configuration of the GPU, so this must stay last. */
+#define PAN_QUERY_PERF_DERIVED (PIPE_QUERY_DRIVER_SPECIFIC + 12)
+
+#define PAN_QUERY_GROUP_DRIVER 0
+#define PAN_QUERY_GROUP_BATCHES 1
+#define PAN_QUERY_GROUP_GPU_METRICS 2
 
 static const struct pipe_driver_query_info panfrost_driver_query_list[] = {
         {"draw-calls", PAN_QUERY_DRAW_CALLS, { 0 }},
+        {"buffer-migrations", PAN_QUERY_BUFFER_MIGRATIONS, { 0 }},
+        {"crc-checked-tiles", PAN_QUERY_CRC_CHECKED_TILES, { 0 }},
+        {"batches", PAN_QUERY_BATCHES, { 0 },
+         .group_id = PAN_QUERY_GROUP_BATCHES},
+        {"batches-forced", PAN_QUERY_BATCHES_FORCED, { 0 },
+         .group_id = PAN_QUERY_GROUP_BATCHES},
+        {"batch-draws", PAN_QUERY_BATCH_DRAWS, { 0 },
+         .group_id = PAN_QUERY_GROUP_BATCHES},
+        {"batch-tiles", PAN_QUERY_BATCH_TILES, { 0 },
+         .group_id = PAN_QUERY_GROUP_BATCHES},
+        {"batch-bos", PAN_QUERY_BATCH_BOS, { 0 },
+         .group_id = PAN_QUERY_GROUP_BATCHES},
+        {"batch-pool-bytes", PAN_QUERY_BATCH_POOL_BYTES, { 0 },
+         PIPE_DRIVER_QUERY_TYPE_BYTES, .group_id = PAN_QUERY_GROUP_BATCHES},
+        {"batch-open-time", PAN_QUERY_BATCH_OPEN_TIME, { 0 },
+         PIPE_DRIVER_QUERY_TYPE_MICROSECONDS,
+         .group_id = PAN_QUERY_GROUP_BATCHES},
+        {"batch-build-time", PAN_QUERY_BATCH_BUILD_TIME, { 0 },
+         PIPE_DRIVER_QUERY_TYPE_MICROSECONDS,
+         .group_id = PAN_QUERY_GROUP_BATCHES},
+        {"batch-submit-time", PAN_QUERY_BATCH_SUBMIT_TIME, { 0 },
+         PIPE_DRIVER_QUERY_TYPE_MICROSECONDS,
+         .group_id = PAN_QUERY_GROUP_BATCHES},
 };
 
 struct panfrost_batch;
 struct panfrost_context;
+struct pipe_grid_info;
 struct panfrost_cs;
 struct panfrost_resource;
 struct panfrost_compiled_shader;
 struct pan_fb_info;
 struct pan_blend_state;
+struct panfrost_perf;
+struct panfrost_perf_config;
 
 /* Virtual table of per-generation (GenXML) functions */
 
@@ -105,7 +152,18 @@ struct panfrost_vtable {
 
         void (*emit_csf_toplevel)(struct panfrost_batch *);
 
+        /* Emits a write of the GPU system timestamp to address, in the
+         * vertex or fragment work of the batch. With end_of_pipe, the write
+         * waits for the work emitted so far to complete. */
+        void (*emit_timestamp)(struct panfrost_batch *batch, bool fragment,
+                               mali_ptr address, bool end_of_pipe);
+
         void (*init_cs)(struct panfrost_context *ctx, struct panfrost_cs *cs);
+
+        /* Emits a compute job for the bound compute state into a given batch,
+         * without the barriers of launch_grid */
+        void (*launch_grid_on_batch)(struct panfrost_batch *batch,
+                                     const struct pipe_grid_info *info);
 };
 
 struct panfrost_screen {
@@ -121,6 +179,23 @@ struct panfrost_screen {
 
         struct panfrost_vtable vtbl;
         struct disk_cache *disk_cache;
+
+        /* Hardware counters backing the derived metric queries, enabled
+         * while such queries exist. Dumps reset the counters, so every dump
+         * is accumulated in totals, which the queries snapshot. */
+        struct {
+                simple_mtx_t lock;
+                const struct panfrost_perf_config *cfg;
+                struct panfrost_perf *perf;
+                unsigned users;
+
+                uint64_t *totals;
+                uint64_t next_sample;
+
+                /* A dump is in progress without the lock held, and the
+                 * samples are only read by the thread doing it */
+                bool dumping;
+        } perf;
 };
 
 static inline struct panfrost_screen *
@@ -139,6 +214,11 @@ int
 panfrost_get_driver_query_info(struct pipe_screen *pscreen, unsigned index,
                                struct pipe_driver_query_info *info);
 
+int
+panfrost_get_driver_query_group_info(struct pipe_screen *pscreen,
+                                     unsigned index,
+                                     struct pipe_driver_query_group_info *info);
+
 void panfrost_cmdstream_screen_init_v4(struct panfrost_screen *screen);
 void panfrost_cmdstream_screen_init_v5(struct panfrost_screen *screen);
 void panfrost_cmdstream_screen_init_v6(struct panfrost_screen *screen);
@@ -34,6 +34,7 @@
 #include "pan_shader.h"
 #include "util/u_memory.h"
 #include "nir/tgsi_to_nir.h"
+#include "nir_builder.h"
 #include "nir_serialize.h"
 
 static struct panfrost_uncompiled_shader *
@@ -67,6 +68,72 @@ panfrost_alloc_variant(struct panfrost_uncompiled_shader *so)
         return util_dynarray_grow(&so->variants, struct panfrost_compiled_shader, 1);
 }
 
+/* Replace loads from specialized words of UBO 0 with the observed constants.
+ * Only loads with a constant offset can be specialized, which are precisely
+ * the loads the backend may push.
+ */
+
+static bool
+panfrost_specialize_uniform(nir_builder *b, nir_instr *instr, void *data)
+{
+        const struct panfrost_uniform_key *key = data;
+
+        if (instr->type != nir_instr_type_intrinsic)
+                return false;
+
+        nir_intrinsic_instr *intr = nir_instr_as_intrinsic(instr);
+
+        if (intr->intrinsic != nir_intrinsic_load_ubo ||
+            !nir_src_is_const(intr->src[0]) ||
+            nir_src_as_uint(intr->src[0]) != 0 ||
+            !nir_src_is_const(intr->src[1]) ||
+            nir_dest_bit_size(intr->dest) != 32)
+                return false;
+
+        unsigned offset = nir_src_as_uint(intr->src[1]);
+        unsigned nr = nir_dest_num_components(intr->dest);
+        nir_const_value values[NIR_MAX_VEC_COMPONENTS];
+
+        for (unsigned c = 0; c < nr; ++c) {
+                unsigned i;
+
+                for (i = 0; i < key->count; ++i) {
+                        if (key->offsets[i] == offset + (c * 4))
+                                break;
+                }
+
+                if (i == key->count)
+                        return false;
+
+                values[c] = nir_const_value_for_uint(key->values[i], 32);
+        }
+
+        b->cursor = nir_before_instr(instr);
+        nir_ssa_def *imm = nir_build_imm(b, nr, 32, values);
+        nir_ssa_def_rewrite_uses(&intr->dest.ssa, imm);
+        nir_instr_remove(instr);
+        return true;
+}
+
+static void
+panfrost_specialize_uniforms(nir_shader *s,
+                             const struct panfrost_uniform_key *key)
+{
+        bool progress = false;
+
+        NIR_PASS(progress, s, nir_shader_instructions_pass,
+                 panfrost_specialize_uniform,
+                 nir_metadata_block_index | nir_metadata_dominance,
+                 (void *) key);
+
+        /* Fold the constants so branches on uniforms disappear */
+        if (progress) {
+                NIR_PASS_V(s, nir_opt_constant_folding);
+                NIR_PASS_V(s, nir_opt_dead_cf);
+                NIR_PASS_V(s, nir_opt_dce);
+        }
+}
+
 static void
 panfrost_shader_compile(struct panfrost_screen *screen,
                         const nir_shader *ir,
@@ -74,6 +141,7 @@ panfrost_shader_compile(struct panfrost_screen *screen,
                         struct panfrost_shader_key *key,
                         unsigned req_local_mem,
                         unsigned fixed_varying_mask,
+                        const struct pan_varying_layout *varying_layout,
                         struct panfrost_shader_binary *out)
 {
         struct panfrost_device *dev = pan_device(&screen->base);
@@ -86,10 +154,16 @@ panfrost_shader_compile(struct panfrost_screen *screen,
                 .fixed_sysval_ubo = -1,
         };
 
+        if (key->uniforms.count)
+                panfrost_specialize_uniforms(s, &key->uniforms);
+
         /* Lower this early so the backends don't have to worry about it */
         if (s->info.stage == MESA_SHADER_FRAGMENT) {
                 inputs.fixed_varying_mask = key->fs.fixed_varying_mask;
 
+                if (dev->arch >= 9)
+                        inputs.varying_layout = &key->fs.varying_layout;
+
                 if (s->info.outputs_written & BITFIELD_BIT(FRAG_RESULT_COLOR)) {
                         NIR_PASS_V(s, nir_lower_fragcolor,
                                    key->fs.nr_cbufs_for_fragcolor);
@@ -112,6 +186,9 @@ panfrost_shader_compile(struct panfrost_screen *screen,
         } else if (s->info.stage == MESA_SHADER_VERTEX) {
                 inputs.fixed_varying_mask = fixed_varying_mask;
 
+                if (dev->arch >= 9)
+                        inputs.varying_layout = varying_layout;
+
                 /* No IDVS for internal XFB shaders */
                 inputs.no_idvs = s->info.has_transform_feedback_varyings;
         }
@@ -148,7 +225,8 @@ panfrost_shader_get(struct pipe_screen *pscreen,
         if (!panfrost_disk_cache_retrieve(screen->disk_cache, uncompiled, &state->key, &res)) {
                 panfrost_shader_compile(screen, uncompiled->nir, dbg, &state->key,
                                         req_local_mem,
-                                        uncompiled->fixed_varying_mask, &res);
+                                        uncompiled->fixed_varying_mask,
+                                        &uncompiled->varying_layout, &res);
 
                 panfrost_disk_cache_store(screen->disk_cache, uncompiled, &state->key, &res);
         }
@@ -220,6 +298,7 @@ panfrost_build_key(struct panfrost_context *ctx,
         if (dev->arch >= 9) {
                 assert(vs != NULL && "too early");
                 key->fs.fixed_varying_mask = vs->fixed_varying_mask;
+                key->fs.varying_layout = vs->varying_layout;
         }
 }
 
@@ -288,6 +367,18 @@ panfrost_new_variant_locked(
         return prog;
 }
 
+static struct panfrost_compiled_shader *
+panfrost_find_variant(struct panfrost_uncompiled_shader *uncompiled,
+                      const struct panfrost_shader_key *key)
+{
+        util_dynarray_foreach(&uncompiled->variants, struct panfrost_compiled_shader, so) {
+                if (memcmp(key, &so->key, sizeof(*key)) == 0)
+                        return so;
+        }
+
+        return NULL;
+}
+
 static void
 panfrost_bind_shader_state(
         struct pipe_context *pctx,
@@ -330,12 +421,7 @@ panfrost_update_shader_variant(struct panfrost_context *ctx,
         struct panfrost_shader_key key = { 0 };
         panfrost_build_key(ctx, &key, uncompiled->nir);
 
-        util_dynarray_foreach(&uncompiled->variants, struct panfrost_compiled_shader, so) {
-                if (memcmp(&key, &so->key, sizeof(key)) == 0) {
-                        compiled = so;
-                        break;
-                }
-        }
+        compiled = panfrost_find_variant(uncompiled, &key);
 
         if (compiled == NULL)
                 compiled = panfrost_new_variant_locked(ctx, uncompiled, &key);
@@ -348,6 +434,165 @@ panfrost_update_shader_variant(struct panfrost_context *ctx,
         simple_mtx_unlock(&uncompiled->lock);
 }
 
+/* Number of consecutive draws a uniform must be unchanged to be specialized */
+#define PAN_SPECIALIZE_STABLE_DRAWS 64
+
+/* Bound the number of specialized variants per shader, so uniforms that only
+ * appear stable do not cause unbounded recompiles.
+ */
+#define PAN_SPECIALIZE_MAX_VARIANTS 4
+
+/* Collect the words of UBO 0 pushed by the generic variant. These are the
+ * uniforms that may be specialized, as bi_opt_push_ubo only pushes loads with
+ * constant offsets.
+ */
+
+static void
+panfrost_collect_specialization_candidates(struct panfrost_uncompiled_shader *uncompiled,
+                                           const struct panfrost_compiled_shader *generic)
+{
+        /* The sysval UBO is appended after the user UBOs */
+        unsigned sysval_ubo = generic->info.sysvals.sysval_count ?
+                              generic->info.ubo_count - 1 : ~0;
+
+        for (unsigned i = 0; i < generic->info.push.count; ++i) {
+                struct panfrost_ubo_word word = generic->info.push.words[i];
+
+                if (word.ubo != 0 || word.ubo == sysval_ubo)
+                        continue;
+
+                if (uncompiled->spec.count == PAN_MAX_SPECIALIZED_UNIFORMS)
+                        break;
+
+                uncompiled->spec.offsets[uncompiled->spec.count++] = word.offset;
+        }
+
+        uncompiled->spec.analyzed = true;
+}
+
+/*
+ * Observe the contents of UBO 0 at draw-time. Once pushed uniforms have been
+ * stable for enough draws, switch to a variant with them inlined, so branches
+ * on them can be folded. If a specialized uniform changes, fall back to a less
+ * specialized variant immediately. Only user constant buffers are observed,
+ * since reading a resource would require synchronizing with the GPU.
+ */
+void
+panfrost_update_uniform_specialization(struct panfrost_context *ctx,
+                                       enum pipe_shader_type type)
+{
+        struct panfrost_uncompiled_shader *uncompiled = ctx->uncompiled[type];
+        struct panfrost_compiled_shader *current = ctx->prog[type];
+        struct panfrost_constant_buffer *buf = &ctx->constant_buffer[type];
+        const struct pipe_constant_buffer *cb = &buf->cb[0];
+
+        if (!uncompiled || !current)
+                return;
+
+        simple_mtx_lock(&uncompiled->lock);
+
+        if (!uncompiled->spec.analyzed && current->key.uniforms.count == 0)
+                panfrost_collect_specialization_candidates(uncompiled, current);
+
+        const uint8_t *data = NULL;
+
+        if ((buf->enabled_mask & BITFIELD_BIT(0)) && cb->user_buffer)
+                data = (const uint8_t *) cb->user_buffer + cb->buffer_offset;
+
+        /* Track the stability of each candidate */
+        for (unsigned i = 0; i < uncompiled->spec.count; ++i) {
+                unsigned offset = uncompiled->spec.offsets[i];
+                uint32_t value;
+
+                if (!data || (offset + 4) > cb->buffer_size) {
+                        uncompiled->spec.stable_draws[i] = 0;
+                        continue;
+                }
+
+                memcpy(&value, data + offset, sizeof(value));
+
+                if (uncompiled->spec.stable_draws[i] &&
+                    value == uncompiled->spec.values[i]) {
+                        uncompiled->spec.stable_draws[i] =
+                                MIN2(uncompiled->spec.stable_draws[i] + 1,
+                                     PAN_SPECIALIZE_STABLE_DRAWS);
+                } else {
+                        uncompiled->spec.values[i] = value;
+                        uncompiled->spec.stable_draws[i] = 1;
+                }
+        }
+
+        /* Specialize on every candidate that is currently stable. If a
+         * specialized uniform changed, it is no longer stable, so this also
+         * handles switching back.
+         */
+        struct panfrost_shader_key key = current->key;
+        memset(&key.uniforms, 0, sizeof(key.uniforms));
+
+        for (unsigned i = 0; i < uncompiled->spec.count; ++i) {
+                if (uncompiled->spec.stable_draws[i] < PAN_SPECIALIZE_STABLE_DRAWS)
+                        continue;
+
+                key.uniforms.offsets[key.uniforms.count] = uncompiled->spec.offsets[i];
+                key.uniforms.values[key.uniforms.count] = uncompiled->spec.values[i];
+                key.uniforms.count++;
+        }
+
+        if (memcmp(&key, &current->key, sizeof(key)) == 0) {
+                simple_mtx_unlock(&uncompiled->lock);
+                return;
+        }
+
+        /* The current variant remains correct as long as each of its
+         * specialized uniforms is still stable.
+         */
+        bool current_valid = true;
+
+        for (unsigned j = 0; j < current->key.uniforms.count; ++j) {
+                bool found = false;
+
+                for (unsigned i = 0; i < key.uniforms.count; ++i) {
+                        found |= (key.uniforms.offsets[i] == current->key.uniforms.offsets[j] &&
+                                  key.uniforms.values[i] == current->key.uniforms.values[j]);
+                }
+
+                current_valid &= found;
+        }
+
+        struct panfrost_compiled_shader *compiled =
+                panfrost_find_variant(uncompiled, &key);
+
+        if (compiled == NULL && current_valid)
+                compiled = current;
+
+        if (compiled == NULL && key.uniforms.count &&
+            uncompiled->spec.nr_variants < PAN_SPECIALIZE_MAX_VARIANTS) {
+                perf_debug_ctx(ctx, "Specializing shader on %u uniforms",
+                               key.uniforms.count);
+
+                uncompiled->spec.nr_variants++;
+                compiled = panfrost_new_variant_locked(ctx, uncompiled, &key);
+        }
+
+        /* Out of specialized variants, use the generic one */
+        if (compiled == NULL) {
+                memset(&key.uniforms, 0, sizeof(key.uniforms));
+                compiled = panfrost_find_variant(uncompiled, &key);
+
+                if (compiled == NULL)
+                        compiled = panfrost_new_variant_locked(ctx, uncompiled, &key);
+        }
+
+        if (compiled != ctx->prog[type]) {
+                ctx->prog[type] = compiled;
+                ctx->dirty |= PAN_DIRTY_TLS_SIZE;
+                ctx->dirty_shader[type] |= PAN_DIRTY_STAGE_SHADER |
+                                           PAN_DIRTY_STAGE_CONST;
+        }
+
+        simple_mtx_unlock(&uncompiled->lock);
+}
+
 static void
 panfrost_bind_vs_state(struct pipe_context *pctx, void *hwcso)
 {
@@ -388,6 +633,8 @@ panfrost_create_shader_state(
                 so->fixed_varying_mask =
                         (so->nir->info.outputs_written & BITFIELD_MASK(VARYING_SLOT_VAR0)) &
                         ~VARYING_BIT_POS & ~VARYING_BIT_PSIZ;
+
+                pan_nir_build_varying_layout(so->nir, &so->varying_layout);
         }
 
         /* If this shader uses transform feedback, compile the transform
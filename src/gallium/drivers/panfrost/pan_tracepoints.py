@@ -0,0 +1,112 @@
+#
+# Copyright (C) 2026 agent <agent@local>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice (including the next
+# paragraph) shall be included in all copies or substantial portions of the
+# Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+# THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+# IN THE SOFTWARE.
+#
+
+import argparse
+import sys
+
+parser = argparse.ArgumentParser()
+parser.add_argument('-p', '--import-path', required=True)
+parser.add_argument('-C', '--src', required=True)
+parser.add_argument('-H', '--hdr', required=True)
+args = parser.parse_args()
+sys.path.insert(0, args.import_path)
+
+
+from u_trace import Header
+from u_trace import Tracepoint
+from u_trace import TracepointArg
+from u_trace import utrace_generate
+
+# Tracepoints enabled by default, see PAN_GPU_TRACEPOINT
+pan_default_tps = []
+
+Header('pipe/p_defines.h')
+Header('util/u_dump.h')
+
+
+# The end tracepoint writes its timestamp once all the work recorded
+# between the two tracepoints is complete, so it may carry arguments that
+# are only known at that point (like the submission ID of the batch).
+def begin_end_tp(name, args=[], end_args=[], tp_print=None,
+                 end_tp_print=None, tp_default_enabled=True):
+    global pan_default_tps
+    if tp_default_enabled:
+        pan_default_tps.append(name)
+    Tracepoint('start_{0}'.format(name),
+               toggle_name=name,
+               args=args,
+               tp_perfetto='pan_start_{0}'.format(name),
+               tp_print=tp_print)
+    Tracepoint('end_{0}'.format(name),
+               toggle_name=name,
+               args=end_args,
+               tp_perfetto='pan_end_{0}'.format(name),
+               tp_print=end_tp_print,
+               end_of_pipe=True)
+
+
+# Vertex/tiler and compute work of a batch. The start is recorded with the
+# first job of the batch, the end when the batch is submitted.
+begin_end_tp('vertex',
+    end_args=[TracepointArg(type='uint32_t', var='submit_id', c_format='%u'),
+              TracepointArg(type='uint32_t', var='draws',     c_format='%u')],
+    end_tp_print=['submit_id=%u, draws=%u',
+        '__entry->submit_id', '__entry->draws'],
+)
+
+# The fragment job of a batch, including the preload of the render targets
+# that are not cleared, which runs as part of it.
+begin_end_tp('fragment',
+    args=[TracepointArg(type='uint32_t', var='submit_id', c_format='%u'),
+          TracepointArg(type='uint16_t', var='width',     c_format='%u'),
+          TracepointArg(type='uint16_t', var='height',    c_format='%u'),
+          TracepointArg(type='uint8_t',  var='nr_cbufs',  c_format='%u'),
+          TracepointArg(type='uint8_t',  var='samples',   c_format='%u'),
+          TracepointArg(type='uint16_t', var='preload',   c_format='0x%x'),
+          TracepointArg(type='uint32_t', var='tiles',     c_format='%u')],
+    tp_print=['submit_id=%u, %ux%u, cbufs=%u, samples=%u, preload=0x%x, tiles=%u',
+        '__entry->submit_id', '__entry->width', '__entry->height',
+        '__entry->nr_cbufs', '__entry->samples', '__entry->preload',
+        '__entry->tiles'],
+)
+
+begin_end_tp('compute',
+    args=[TracepointArg(type='uint32_t', var='grid_x', c_format='%u'),
+          TracepointArg(type='uint32_t', var='grid_y', c_format='%u'),
+          TracepointArg(type='uint32_t', var='grid_z', c_format='%u')],
+    tp_print=['grid=%ux%ux%u',
+        '__entry->grid_x', '__entry->grid_y', '__entry->grid_z'],
+)
+
+begin_end_tp('blit',
+    args=[TracepointArg(type='enum pipe_texture_target', var='src_target', c_format='%s', to_prim_type="util_str_tex_target({}, true)"),
+          TracepointArg(type='enum pipe_texture_target', var='dst_target', c_format='%s', to_prim_type="util_str_tex_target({}, true)")],
+    tp_print=['%s -> %s', 'util_str_tex_target(__entry->src_target, true)',
+        'util_str_tex_target(__entry->dst_target, true)'],
+)
+
+utrace_generate(cpath=args.src,
+                hpath=args.hdr,
+                ctx_param='struct pipe_context *pctx',
+                trace_toggle_name='pan_gpu_tracepoint',
+                trace_toggle_defaults=pan_default_tps)
@@ -125,6 +125,9 @@ struct kbase_ {
         // TODO: USe a bitset?
         unsigned event_slot_usage;
 
+        /* Queue groups which reported a fatal error, by handle */
+        bool group_fault[256];
+
         uint8_t atom_number;
 
         struct util_dynarray gem_handles;
@@ -133,6 +136,7 @@ struct kbase_ {
 
         void (*close)(kbase k);
 
+        /* name is a drm_panfrost_param or a PAN_BASE_PROP_* */
         bool (*get_pan_gpuprop)(kbase k, unsigned name, uint64_t *value);
         bool (*get_mali_gpuprop)(kbase k, unsigned name, uint64_t *value);
 
@@ -171,6 +175,9 @@ struct kbase_ {
                           struct kbase_syncobj *o, uint64_t seqnum);
         bool (*cs_wait)(kbase k, struct kbase_cs *cs, uint64_t extract_offset,
                         struct kbase_syncobj *o);
+        /* Returns true if the queue stopped on a fault, which is reported
+         * even when nothing waits on the faulting work */
+        bool (*cs_faulted)(kbase k, struct kbase_cs *cs);
 
         int (*kcpu_fence_export)(kbase k, struct kbase_context *ctx);
         bool (*kcpu_fence_import)(kbase k, struct kbase_context *ctx, int fd);
@@ -193,6 +200,10 @@ struct kbase_ {
 
         void (*mem_sync)(kbase k, base_va gpu, void *cpu, size_t size,
                          bool invalidate);
+
+        /* Returns the fd of a hardware counter reader with buffer_count
+         * dump buffers, or -1 on error. Not available on the old API. */
+        int (*hwcnt_reader_setup)(kbase k, unsigned buffer_count);
 };
 
 bool kbase_open(kbase k, int fd, unsigned cs_queue_count, bool verbose);
@@ -227,6 +238,11 @@ void kbase_ensure_handle_events(kbase k);
 
 bool kbase_poll_fd_until(int fd, bool wait_shared, struct timespec tp);
 
+/* Properties without a panfrost DRM param, kept clear of the values of
+ * enum drm_panfrost_param */
+#define PAN_BASE_PROP_SYSTEM_TIMESTAMP           0x10000
+#define PAN_BASE_PROP_SYSTEM_TIMESTAMP_FREQUENCY 0x10001
+
 /* Must not conflict with PANFROST_BO_* flags */
 #define MALI_BO_CACHED_CPU   (1 << 16)
 #define MALI_BO_UNCACHED_GPU (1 << 17)
@@ -96,6 +96,20 @@ kbase_ioctl(int fd, unsigned long request, ...)
       break;
    }
 
+   case KBASE_IOCTL_GET_CPU_GPU_TIMEINFO: {
+      union kbase_ioctl_get_cpu_gpu_timeinfo *info = ptr;
+      struct timespec ts;
+
+      /* There is no GPU, so synthesize a timestamp from the CPU clock */
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+
+      info->out.sec = ts.tv_sec;
+      info->out.nsec = ts.tv_nsec;
+      info->out.timestamp = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+      info->out.cycle_counter = 0;
+      break;
+   }
+
    case KBASE_IOCTL_MEM_IMPORT: {
       union kbase_ioctl_mem_import *import = ptr;
 
@@ -122,6 +136,7 @@ kbase_ioctl(int fd, unsigned long request, ...)
    case KBASE_IOCTL_CS_TILER_HEAP_TERM:
    case KBASE_IOCTL_CS_QUEUE_GROUP_TERMINATE:
    case KBASE_IOCTL_MEM_SYNC:
+   case KBASE_IOCTL_MEM_FREE:
       break;
 
    default:
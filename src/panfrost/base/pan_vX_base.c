@@ -410,6 +410,11 @@ cs_group_create(kbase k, struct kbase_context *c)
         c->csg_handle = create.out.group_handle;
         c->csg_uid = create.out.group_uid;
 
+        /* Handles are reused once groups are terminated */
+        pthread_mutex_lock(&k->queue_lock);
+        k->group_fault[c->csg_handle] = false;
+        pthread_mutex_unlock(&k->queue_lock);
+
         /* Should be at least 1 */
         assert(c->csg_uid);
 
@@ -557,6 +562,32 @@ kbase_get_pan_gpuprop(kbase k, unsigned name, uint64_t *value)
                 *value &= 0xffff;
                 return true;
         }
+#if PAN_BASE_API >= 1
+        case PAN_BASE_PROP_SYSTEM_TIMESTAMP: {
+                union kbase_ioctl_get_cpu_gpu_timeinfo info = {
+                        .in.request_flags = BASE_TIMEINFO_TIMESTAMP_FLAG,
+                };
+
+                if (kbase_ioctl(k->fd, KBASE_IOCTL_GET_CPU_GPU_TIMEINFO, &info) == -1)
+                        return false;
+
+                *value = info.out.timestamp;
+                return true;
+        }
+        case PAN_BASE_PROP_SYSTEM_TIMESTAMP_FREQUENCY:
+#if defined(PAN_BASE_NOOP)
+                /* The fake timestamps count nanoseconds */
+                *value = 1000000000;
+                return true;
+#elif defined(__aarch64__)
+                /* The GPU system timestamp is the SoC system counter, which
+                 * kbase has no property for */
+                __asm__ volatile("mrs %0, cntfrq_el0" : "=r" (*value));
+                return *value != 0;
+#else
+                return false;
+#endif
+#endif
         default:
                 return false;
         }
@@ -1000,6 +1031,12 @@ kbase_read_event(kbase k)
 
         struct base_gpu_queue_group_error e = event.payload.csg_error.error;
 
+        /* Every group error terminates the group. Remember it for
+         * cs_faulted, as the work which faulted may never be waited on. */
+        pthread_mutex_lock(&k->queue_lock);
+        k->group_fault[event.payload.csg_error.handle] = true;
+        pthread_mutex_unlock(&k->queue_lock);
+
         switch (e.error_type) {
         case BASE_GPU_QUEUE_GROUP_ERROR_FATAL: {
                 // See CS_FATAL_EXCEPTION_* in mali_gpu_csf_registers.h
@@ -1513,6 +1550,24 @@ kbase_cs_wait(kbase k, struct kbase_cs *cs, uint64_t extract_offset,
         return false;
 }
 
+static bool
+kbase_cs_faulted(kbase k, struct kbase_cs *cs)
+{
+        /* Terminated without being bound again, nothing runs on it */
+        if (!cs->user_io)
+                return false;
+
+        uint64_t *event_data = k->event_mem.cpu + cs->event_mem_offset * PAN_EVENT_SIZE;
+
+        /* Besides group errors, check the error field of the event, which
+         * is the error state of the sync object (see kbase_cs_bind_noevent) */
+        pthread_mutex_lock(&k->queue_lock);
+        bool fault = k->group_fault[cs->ctx->csg_handle] || event_data[1];
+        pthread_mutex_unlock(&k->queue_lock);
+
+        return fault;
+}
+
 static bool
 kbase_kcpu_queue_create(kbase k, struct kbase_context *ctx)
 {
@@ -1740,6 +1795,27 @@ kbase_mem_sync(kbase k, base_va gpu, void *cpu, size_t size,
                 perror("ioctl(KBASE_IOCTL_MEM_SYNC)");
 }
 
+#if PAN_BASE_API >= 1
+static int
+kbase_hwcnt_reader_setup(kbase k, unsigned buffer_count)
+{
+        /* Enable every counter of every block, users pick the counters
+         * they want out of the dumps */
+        struct kbase_ioctl_hwcnt_reader_setup setup = {
+                .buffer_count = buffer_count,
+                .fe_bm = ~0,
+                .shader_bm = ~0,
+                .tiler_bm = ~0,
+                .mmu_l2_bm = ~0,
+        };
+
+        int ret = kbase_ioctl(k->fd, KBASE_IOCTL_HWCNT_READER_SETUP, &setup);
+        LOG("hwcnt reader setup %u buffers: %i\n", buffer_count, ret);
+
+        return ret;
+}
+#endif
+
 bool
 #if defined(PAN_BASE_NOOP)
 kbase_open_csf_noop
@@ -1798,6 +1874,7 @@ kbase_open_csf
         k->cs_rebind = kbase_cs_rebind;
         k->cs_submit = kbase_cs_submit;
         k->cs_wait = kbase_cs_wait;
+        k->cs_faulted = kbase_cs_faulted;
 
         k->kcpu_fence_export = kbase_kcpu_fence_export;
         k->kcpu_fence_import = kbase_kcpu_fence_import;
@@ -1814,6 +1891,10 @@ kbase_open_csf
 
         k->mem_sync = kbase_mem_sync;
 
+#if PAN_BASE_API >= 1
+        k->hwcnt_reader_setup = kbase_hwcnt_reader_setup;
+#endif
+
         for (unsigned i = 0; i < ARRAY_SIZE(kbase_main); ++i) {
                 ++k->setup_state;
                 if (!kbase_main[i].part(k)) {
@@ -600,32 +600,134 @@ bi_rewrite_index_src_single(bi_instr *ins, bi_index old, bi_index new)
         }
 }
 
-/* If register allocation fails, find the best spill node */
+/* Spill costs are weighted by loop nesting, on the assumption that each loop
+ * iterates a handful of times. Saturate to avoid overflow in deep nests.
+ */
+
+static unsigned
+bi_spill_weight(bi_block *block)
+{
+        return 1 << (3 * MIN2(block->loop_nesting, 3));
+}
+
+/* Values that are cheap to recompute from constants or uniforms can be
+ * rematerialized before each use instead of going through memory. Only a
+ * whitelist of side-effect-free ALU ops is considered.
+ */
+
+static bool
+bi_can_remat(bi_instr *I)
+{
+        switch (I->op) {
+        case BI_OPCODE_MOV_I32:
+        case BI_OPCODE_IADD_IMM_I32:
+        case BI_OPCODE_IADD_U32:
+        case BI_OPCODE_IADD_S32:
+        case BI_OPCODE_ISUB_U32:
+        case BI_OPCODE_LSHIFT_OR_I32:
+        case BI_OPCODE_LSHIFT_AND_I32:
+        case BI_OPCODE_MKVEC_V2I16:
+                break;
+        default:
+                return false;
+        }
+
+        if (I->nr_dests != 1 || I->dest[0].offset != 0)
+                return false;
+
+        bi_foreach_src(I, s) {
+                if (I->src[s].type != BI_INDEX_NULL &&
+                    I->src[s].type != BI_INDEX_CONSTANT &&
+                    I->src[s].type != BI_INDEX_FAU)
+                        return false;
+        }
+
+        return true;
+}
+
+/* Returns the unique definition of index if it may be rematerialized */
+
+static bi_instr *
+bi_find_remat(bi_context *ctx, bi_index index)
+{
+        bi_instr *def = NULL;
+
+        bi_foreach_instr_global(ctx, I) {
+                bi_foreach_dest(I, d) {
+                        if (!bi_is_equiv(I->dest[d], index)) continue;
+                        if (def) return NULL;
+
+                        def = I;
+                }
+        }
+
+        return (def && bi_can_remat(def)) ? def : NULL;
+}
+
+/* Relative cost of a spill or fill compared to a rematerialized ALU op */
+#define BI_SPILL_MEMORY_COST 4
+
+/* If register allocation fails, find the best spill node. Benefits are
+ * calculated from the constraints, costs from the (loop-weighted) number of
+ * instructions that spilling the node will insert.
+ */
 
 static signed
 bi_choose_spill_node(bi_context *ctx, struct lcra_state *l)
 {
         /* Pick a node satisfying bi_spill_register's preconditions */
         BITSET_WORD *no_spill = calloc(sizeof(BITSET_WORD), BITSET_WORDS(l->node_count));
+        unsigned *def_cost = calloc(l->node_count, sizeof(unsigned));
+        unsigned *use_cost = calloc(l->node_count, sizeof(unsigned));
+        bi_instr **defs = calloc(l->node_count, sizeof(bi_instr *));
 
-        bi_foreach_instr_global(ctx, ins) {
-                bi_foreach_dest(ins, d) {
-                        /* Don't allow spilling coverage mask writes because the
-                         * register preload logic assumes it will stay in R60.
-                         * This could be optimized.
-                         */
-                        if (ins->no_spill ||
-                            ins->op == BI_OPCODE_ATEST ||
-                            ins->op == BI_OPCODE_ZS_EMIT ||
-                            (ins->op == BI_OPCODE_MOV_I32 &&
-                             ins->src[0].type == BI_INDEX_REGISTER &&
-                             ins->src[0].value == 60)) {
-                                BITSET_SET(no_spill, ins->dest[d].value);
+        bi_foreach_block(ctx, block) {
+                unsigned weight = bi_spill_weight(block);
+
+                bi_foreach_instr_in_block(block, ins) {
+                        bi_foreach_dest(ins, d) {
+                                unsigned node = ins->dest[d].value;
+
+                                /* Don't allow spilling coverage mask writes because the
+                                 * register preload logic assumes it will stay in R60.
+                                 * This could be optimized.
+                                 */
+                                if (ins->no_spill ||
+                                    ins->op == BI_OPCODE_ATEST ||
+                                    ins->op == BI_OPCODE_ZS_EMIT ||
+                                    (ins->op == BI_OPCODE_MOV_I32 &&
+                                     ins->src[0].type == BI_INDEX_REGISTER &&
+                                     ins->src[0].value == 60)) {
+                                        BITSET_SET(no_spill, node);
+                                }
+
+                                if (ins->dest[d].type != BI_INDEX_NORMAL)
+                                        continue;
+
+                                /* Only a unique definition may be rematerialized */
+                                defs[node] = def_cost[node] ? NULL : ins;
+                                def_cost[node] += weight;
+                        }
+
+                        bi_foreach_src(ins, s) {
+                                if (ins->src[s].type == BI_INDEX_NORMAL)
+                                        use_cost[ins->src[s].value] += weight;
                         }
                 }
         }
 
-        unsigned best_benefit = 0.0;
+        /* Spilling costs a store per definition and a fill per use, whereas
+         * rematerializing costs only a cheap ALU op per use.
+         */
+        for (unsigned i = 0; i < l->node_count; ++i) {
+                if (defs[i] && bi_can_remat(defs[i]))
+                        use_cost[i] = MAX2(use_cost[i], 1);
+                else
+                        use_cost[i] = MAX2((use_cost[i] + def_cost[i]) * BI_SPILL_MEMORY_COST, 1);
+        }
+
+        unsigned best_benefit = 0;
+        unsigned best_cost = 1;
         signed best_node = -1;
 
         if (nodearray_is_sparse(&l->linear[l->spill_node])) {
@@ -641,8 +743,11 @@ bi_choose_spill_node(bi_context *ctx, struct lcra_state *l)
 
                         unsigned benefit = lcra_count_constraints(l, i);
 
-                        if (benefit > best_benefit) {
+                        /* Maximize benefit / cost */
+                        if ((uint64_t) benefit * best_cost >
+                            (uint64_t) best_benefit * use_cost[i]) {
                                 best_benefit = benefit;
+                                best_cost = use_cost[i];
                                 best_node = i;
                         }
                 }
@@ -658,14 +763,20 @@ bi_choose_spill_node(bi_context *ctx, struct lcra_state *l)
 
                         unsigned benefit = lcra_count_constraints(l, i);
 
-                        if (benefit > best_benefit) {
+                        /* Maximize benefit / cost */
+                        if ((uint64_t) benefit * best_cost >
+                            (uint64_t) best_benefit * use_cost[i]) {
                                 best_benefit = benefit;
+                                best_cost = use_cost[i];
                                 best_node = i;
                         }
                 }
         }
 
         free(no_spill);
+        free(def_cost);
+        free(use_cost);
+        free(defs);
         return best_node;
 }
 
@@ -707,23 +818,48 @@ bi_load_tl(bi_builder *b, unsigned bits, bi_index src, unsigned offset)
         }
 }
 
-static void
+static bi_instr *
 bi_store_tl(bi_builder *b, unsigned bits, bi_index src, unsigned offset)
 {
         if (b->shader->arch >= 9) {
-                bi_store(b, bits, src, bi_tls_ptr(false), bi_tls_ptr(true), BI_SEG_TL, offset);
+                return bi_store(b, bits, src, bi_tls_ptr(false),
+                                bi_tls_ptr(true), BI_SEG_TL, offset);
         } else {
-                bi_store(b, bits, src, bi_imm_u32(offset), bi_zero(), BI_SEG_TL, 0);
+                return bi_store(b, bits, src, bi_imm_u32(offset), bi_zero(),
+                                BI_SEG_TL, 0);
         }
 }
 
-/* Once we've chosen a spill node, spill it and returns bytes spilled */
+/* Spilled values are assigned to spill slots. Offsets are only assigned to
+ * slots once register allocation succeeds, so slots with disjoint lifetimes
+ * may share memory. Until then, TLS accesses are encoded relative to the start
+ * of their slot.
+ */
+struct bi_spill_slot {
+        /* Size of the slot in bytes */
+        unsigned size;
+
+        /* Byte offset of the slot in thread local storage */
+        unsigned offset;
 
-static unsigned
-bi_spill_register(bi_context *ctx, bi_index index, uint32_t offset)
+        /* Whether the slot is stored exactly once, so the store kills it */
+        bool single_store;
+
+        /* bi_instr * of every spill (store) and fill (load) of the slot */
+        struct util_dynarray stores, fills;
+};
+
+/* Once we've chosen a spill node, spill it to a new slot */
+
+static void
+bi_spill_register(bi_context *ctx, bi_index index, struct bi_spill_slot *slot)
 {
         bi_builder b = { .shader = ctx };
         unsigned channels = 0;
+        unsigned stores = 0;
+
+        util_dynarray_init(&slot->stores, NULL);
+        util_dynarray_init(&slot->fills, NULL);
 
         /* Spill after every store, fill before every load */
         bi_foreach_instr_global_safe(ctx, I) {
@@ -740,9 +876,11 @@ bi_spill_register(bi_context *ctx, bi_index index, uint32_t offset)
                         unsigned bits = count * 32;
 
                         b.cursor = bi_after_instr(I);
-                        bi_store_tl(&b, bits, tmp, offset + 4 * extra);
+                        bi_instr *st = bi_store_tl(&b, bits, tmp, 4 * extra);
+                        util_dynarray_append(&slot->stores, bi_instr *, st);
 
                         ctx->spills++;
+                        stores++;
                         channels = MAX2(channels, extra + count);
                 }
 
@@ -753,13 +891,208 @@ bi_spill_register(bi_context *ctx, bi_index index, uint32_t offset)
                         unsigned bits = bi_count_read_index(I, index) * 32;
                         bi_rewrite_index_src_single(I, index, tmp);
 
-                        bi_instr *ld = bi_load_tl(&b, bits, tmp, offset);
+                        bi_instr *ld = bi_load_tl(&b, bits, tmp, 0);
                         ld->no_spill = true;
+                        util_dynarray_append(&slot->fills, bi_instr *, ld);
                         ctx->fills++;
                 }
         }
 
-        return (channels * 4);
+        slot->size = channels * 4;
+        slot->single_store = (stores == 1);
+}
+
+/* Rematerialize a value before each use instead of spilling it */
+
+static void
+bi_rematerialize(bi_context *ctx, bi_index index, bi_instr *def)
+{
+        size_t size = sizeof(bi_instr) +
+                      sizeof(bi_index) * (def->nr_dests + def->nr_srcs);
+
+        bi_foreach_instr_global_safe(ctx, I) {
+                if (I == def || !bi_has_arg(I, index)) continue;
+
+                bi_index tmp = bi_temp(ctx);
+                bi_instr *clone = rzalloc_size(ctx, size);
+                memcpy(clone, def, size);
+                clone->dest = (bi_index *) (&clone[1]);
+                clone->src = clone->dest + def->nr_dests;
+                clone->dest[0] = bi_replace_index(def->dest[0], tmp);
+                clone->no_spill = true;
+
+                bi_cursor cursor = bi_before_instr(I);
+                bi_builder_insert(&cursor, clone);
+
+                bi_rewrite_index_src_single(I, index, tmp);
+                ctx->remats++;
+        }
+
+        bi_remove_instruction(def);
+}
+
+static int
+bi_spill_slot_index(struct hash_table *ht, bi_instr *I)
+{
+        struct hash_entry *ent = _mesa_hash_table_search(ht, I);
+        return ent ? ((int) (uintptr_t) ent->data) - 1 : -1;
+}
+
+/* Slot liveness is a backwards dataflow analysis like register liveness:
+ * fills generate, and stores kill if they are the only store to the slot.
+ * Two slots interfere if one is stored while the other is live.
+ */
+
+static void
+bi_spill_slot_liveness_update(bi_block *blk, BITSET_WORD *live,
+                              struct hash_table *access,
+                              struct bi_spill_slot *slots,
+                              BITSET_WORD *interference, unsigned nr_slots)
+{
+        bi_foreach_instr_in_block_rev(blk, I) {
+                int s = bi_spill_slot_index(access, I);
+                if (s < 0) continue;
+
+                if (I->nr_dests == 0) {
+                        if (interference) {
+                                unsigned j;
+                                BITSET_FOREACH_SET(j, live, nr_slots) {
+                                        BITSET_SET(interference, s * nr_slots + j);
+                                        BITSET_SET(interference, j * nr_slots + s);
+                                }
+                        }
+
+                        if (slots[s].single_store)
+                                BITSET_CLEAR(live, s);
+                } else {
+                        BITSET_SET(live, s);
+                }
+        }
+}
+
+/* Assign offsets to spill slots after register allocation succeeds, sharing
+ * memory between slots that are never simultaneously live. Returns the TLS
+ * size required.
+ */
+
+static unsigned
+bi_assign_spill_slots(bi_context *ctx, struct bi_spill_slot *slots,
+                      unsigned nr_slots, unsigned base)
+{
+        if (nr_slots == 0)
+                return base;
+
+        struct hash_table *access = _mesa_pointer_hash_table_create(NULL);
+
+        for (unsigned s = 0; s < nr_slots; ++s) {
+                util_dynarray_foreach(&slots[s].stores, bi_instr *, I)
+                        _mesa_hash_table_insert(access, *I, (void *) (uintptr_t) (s + 1));
+
+                util_dynarray_foreach(&slots[s].fills, bi_instr *, I)
+                        _mesa_hash_table_insert(access, *I, (void *) (uintptr_t) (s + 1));
+        }
+
+        unsigned words = BITSET_WORDS(nr_slots);
+        BITSET_WORD *live_in = calloc(ctx->num_blocks * words, sizeof(BITSET_WORD));
+        BITSET_WORD *live_out = calloc(ctx->num_blocks * words, sizeof(BITSET_WORD));
+        BITSET_WORD *live = calloc(words, sizeof(BITSET_WORD));
+        BITSET_WORD *interference = calloc(BITSET_WORDS(nr_slots * nr_slots),
+                                           sizeof(BITSET_WORD));
+
+        u_worklist worklist;
+        bi_worklist_init(ctx, &worklist);
+
+        bi_foreach_block(ctx, block)
+                bi_worklist_push_tail(&worklist, block);
+
+        while (!u_worklist_is_empty(&worklist)) {
+                bi_block *blk = bi_worklist_pop_tail(&worklist);
+                BITSET_WORD *out = live_out + (blk->index * words);
+                BITSET_WORD *in = live_in + (blk->index * words);
+
+                bi_foreach_successor(blk, succ) {
+                        for (unsigned i = 0; i < words; ++i)
+                                out[i] |= live_in[(succ->index * words) + i];
+                }
+
+                memcpy(live, out, words * sizeof(BITSET_WORD));
+                bi_spill_slot_liveness_update(blk, live, access, slots,
+                                              NULL, nr_slots);
+
+                if (memcmp(live, in, words * sizeof(BITSET_WORD))) {
+                        memcpy(in, live, words * sizeof(BITSET_WORD));
+
+                        bi_foreach_predecessor(blk, pred)
+                                bi_worklist_push_head(&worklist, *pred);
+                }
+        }
+
+        u_worklist_fini(&worklist);
+
+        /* With liveness converged, a final pass collects interference */
+        bi_foreach_block(ctx, blk) {
+                memcpy(live, live_out + (blk->index * words),
+                       words * sizeof(BITSET_WORD));
+                bi_spill_slot_liveness_update(blk, live, access, slots,
+                                              interference, nr_slots);
+        }
+
+        /* By default, we use packed TLS addressing on Valhall. We cannot
+         * cross 16 byte boundaries with packed TLS addressing. Align to ensure
+         * this doesn't happen. This could be optimized a bit.
+         */
+        unsigned alignment = (ctx->arch >= 9) ? 16 : 4;
+        unsigned size = base;
+
+        /* First-fit each slot below the slots it interferes with */
+        for (unsigned s = 0; s < nr_slots; ++s) {
+                unsigned offset = ALIGN_POT(base, alignment);
+                bool progress;
+
+                do {
+                        progress = false;
+
+                        for (unsigned t = 0; t < s; ++t) {
+                                if (!BITSET_TEST(interference, s * nr_slots + t))
+                                        continue;
+
+                                if (offset < slots[t].offset + slots[t].size &&
+                                    slots[t].offset < offset + slots[s].size) {
+                                        offset = ALIGN_POT(slots[t].offset + slots[t].size,
+                                                           alignment);
+                                        progress = true;
+                                }
+                        }
+                } while (progress);
+
+                slots[s].offset = offset;
+                size = MAX2(size, offset + slots[s].size);
+
+                /* Rebase accesses. Stores take the address in the second
+                 * source, loads in the first.
+                 */
+                util_dynarray_foreach(&slots[s].stores, bi_instr *, I) {
+                        if (ctx->arch >= 9)
+                                (*I)->byte_offset += offset;
+                        else
+                                (*I)->src[1].value += offset;
+                }
+
+                util_dynarray_foreach(&slots[s].fills, bi_instr *, I) {
+                        if (ctx->arch >= 9)
+                                (*I)->byte_offset += offset;
+                        else
+                                (*I)->src[0].value += offset;
+                }
+        }
+
+        _mesa_hash_table_destroy(access, NULL);
+        free(live_in);
+        free(live_out);
+        free(live);
+        free(interference);
+
+        return size;
 }
 
 /*
@@ -1062,8 +1395,9 @@ bi_register_allocate(bi_context *ctx)
 
         unsigned iter_count = 1000; /* max iterations */
 
-        /* Number of bytes of memory we've spilled into */
-        unsigned spill_count = ctx->info.tls_size;
+        /* Spilled values, assigned memory once allocation succeeds */
+        struct util_dynarray slots;
+        util_dynarray_init(&slots, NULL);
 
         if (ctx->arch >= 9)
                 va_lower_split_64bit(ctx);
@@ -1103,16 +1437,17 @@ bi_register_allocate(bi_context *ctx)
                         if (ctx->inputs->is_blend)
                                 unreachable("Blend shaders may not spill");
 
-                        /* By default, we use packed TLS addressing on Valhall.
-                         * We cannot cross 16 byte boundaries with packed TLS
-                         * addressing. Align to ensure this doesn't happen. This
-                         * could be optimized a bit.
-                         */
-                        if (ctx->arch >= 9)
-                                spill_count = ALIGN_POT(spill_count, 16);
+                        bi_index index = bi_get_index(spill_node);
+                        bi_instr *remat = bi_find_remat(ctx, index);
 
-                        spill_count += bi_spill_register(ctx,
-                                        bi_get_index(spill_node), spill_count);
+                        if (remat) {
+                                bi_rematerialize(ctx, index, remat);
+                        } else {
+                                struct bi_spill_slot slot = { 0 };
+
+                                bi_spill_register(ctx, index, &slot);
+                                util_dynarray_append(&slots, struct bi_spill_slot, slot);
+                        }
 
                         /* In case the spill affected an instruction with tied
                          * operands, we need to fix up.
@@ -1124,7 +1459,18 @@ bi_register_allocate(bi_context *ctx)
         assert(success);
         assert(l != NULL);
 
-        ctx->info.tls_size = spill_count;
+        unsigned nr_slots = util_dynarray_num_elements(&slots, struct bi_spill_slot);
+        struct bi_spill_slot *slot_array = slots.data;
+
+        ctx->info.tls_size = bi_assign_spill_slots(ctx, slot_array, nr_slots,
+                                                   ctx->info.tls_size);
+
+        for (unsigned s = 0; s < nr_slots; ++s) {
+                util_dynarray_fini(&slot_array[s].stores);
+                util_dynarray_fini(&slot_array[s].fills);
+        }
+
+        util_dynarray_fini(&slots);
         bi_install_registers(ctx, l);
 
         lcra_free(l);
@@ -468,20 +468,27 @@ bi_emit_load_attr(bi_builder *b, nir_intrinsic_instr *instr)
 
 /*
  * ABI: Special (desktop GL) slots come first, tightly packed. General varyings
- * come later, sparsely packed. This handles both linked and separable shaders
- * with a common code path, with minimal keying only for desktop GL. Each slot
- * consumes 16 bytes (TODO: fp16, partial vectors).
+ * come later. If the driver provides a layout for the linked shaders, general
+ * varyings are packed according to it. Otherwise they are sparsely packed,
+ * which handles separable shaders with minimal keying. Each special slot, and
+ * each general slot without a layout, consumes 16 bytes (TODO: fp16).
  */
 static unsigned
 bi_varying_base_bytes(bi_context *ctx, nir_intrinsic_instr *intr)
 {
         nir_io_semantics sem = nir_intrinsic_io_semantics(intr);
         uint32_t mask = ctx->inputs->fixed_varying_mask;
+        const struct pan_varying_layout *layout = ctx->inputs->varying_layout;
 
         if (sem.location >= VARYING_SLOT_VAR0) {
                 unsigned nr_special = util_bitcount(mask);
                 unsigned general_index = (sem.location - VARYING_SLOT_VAR0);
 
+                if (layout) {
+                        return (16 * nr_special) +
+                               pan_varying_layout_offset(layout, general_index);
+                }
+
                 return 16 * (nr_special + general_index);
         } else {
                 return 16 * (util_bitcount(mask & BITFIELD_MASK(sem.location)));
@@ -565,13 +572,14 @@ bi_emit_load_vary(bi_builder *b, nir_intrinsic_instr *instr)
 
                 if (b->shader->malloc_idvs) {
                         /* Index needs to be in bytes, but NIR gives the index
-                         * in slots. For now assume 16 bytes per element.
+                         * in slots. Indirectly indexed varyings always use 16
+                         * bytes per element, even with a packed layout.
                          */
                         bi_index idx_bytes = bi_lshift_or_i32(b, idx, bi_zero(), bi_imm_u8(4));
                         unsigned vbase = bi_varying_base_bytes(b->shader, instr);
 
                         if (vbase != 0)
-                                idx_bytes = bi_iadd_u32(b, idx, bi_imm_u32(vbase), false);
+                                idx_bytes = bi_iadd_u32(b, idx_bytes, bi_imm_u32(vbase), false);
 
                         bi_ld_var_buf_to(b, sz, dest, src0, idx_bytes, regfmt,
                                          sample, source_format, update,
@@ -4037,6 +4045,7 @@ create_empty_block(bi_context *ctx)
         bi_block *blk = rzalloc(ctx, bi_block);
 
         util_dynarray_init(&blk->predecessors, blk);
+        blk->loop_nesting = ctx->loop_nesting;
 
         return blk;
 }
@@ -4114,8 +4123,10 @@ emit_loop(bi_context *ctx, nir_loop *nloop)
         bi_block *saved_break = ctx->break_block;
         bi_block *saved_continue = ctx->continue_block;
 
-        ctx->continue_block = create_empty_block(ctx);
+        /* The break block is outside the loop, the header is inside */
         ctx->break_block = create_empty_block(ctx);
+        ctx->loop_nesting++;
+        ctx->continue_block = create_empty_block(ctx);
         ctx->after_block = ctx->continue_block;
 
         /* Emit the body itself */
@@ -4131,6 +4142,7 @@ emit_loop(bi_context *ctx, nir_loop *nloop)
         ctx->after_block = ctx->break_block;
 
         /* Pop off */
+        ctx->loop_nesting--;
         ctx->break_block = saved_break;
         ctx->continue_block = saved_continue;
         ++ctx->loop_count;
@@ -4322,8 +4334,8 @@ bi_print_stats(bi_context *ctx, unsigned size)
                 ralloc_asprintf_append(&str, ", %u preloads", bi_count_preload_cost(ctx));
         }
 
-        ralloc_asprintf_append(&str, ", %u loops, %u:%u spills:fills",
-                        ctx->loop_count, ctx->spills, ctx->fills);
+        ralloc_asprintf_append(&str, ", %u loops, %u:%u spills:fills, %u remats",
+                        ctx->loop_count, ctx->spills, ctx->fills, ctx->remats);
 
         return str;
 }
@@ -4331,13 +4343,16 @@ bi_print_stats(bi_context *ctx, unsigned size)
 static char *
 va_print_stats(bi_context *ctx, unsigned size)
 {
-        unsigned nr_ins = 0;
+        unsigned nr_ins = 0, nr_waits = 0;
         struct va_stats stats = { 0 };
 
-        /* Count instructions */
+        /* Count instructions and scoreboard waits */
         bi_foreach_instr_global(ctx, I) {
                 nr_ins++;
                 va_count_instr_stats(I, &stats);
+
+                if (I->flow && va_flow_is_wait_or_none(I->flow))
+                        nr_waits++;
         }
 
         /* Mali G78 peak performance:
@@ -4370,11 +4385,12 @@ va_print_stats(bi_context *ctx, unsigned size)
         return ralloc_asprintf(NULL, "%s shader: "
                         "%u inst, %f cycles, %f fma, %f cvt, %f sfu, %f v, "
                         "%f t, %f ls, %u quadwords, %u threads, %u loops, "
-                        "%u:%u spills:fills",
+                        "%u:%u spills:fills, %u remats, %u waits",
                         bi_shader_stage_name(ctx),
                         nr_ins, cycles, cycles_fma, cycles_cvt, cycles_sfu,
                         cycles_v, cycles_t, cycles_ls, size / 16, nr_threads,
-                        ctx->loop_count, ctx->spills, ctx->fills);
+                        ctx->loop_count, ctx->spills, ctx->fills, ctx->remats,
+                        nr_waits);
 }
 
 static int
@@ -686,6 +686,9 @@ struct bi_scoreboard_state {
         /* Nonregister dependencies present by a slot */
         uint8_t varying : BI_NUM_SLOTS;
         uint8_t memory : BI_NUM_SLOTS;
+
+        /* Subset of memory accesses that write memory (stores, atomics) */
+        uint8_t memory_write : BI_NUM_SLOTS;
 };
 
 typedef struct bi_block {
@@ -698,6 +701,9 @@ typedef struct bi_block {
         /* Index of the block in source order */
         unsigned index;
 
+        /* Number of loops enclosing the block, used to weight spill costs */
+        unsigned loop_nesting;
+
         /* Control flow graph */
         struct bi_block *successors[2];
         struct util_dynarray predecessors;
@@ -862,10 +868,14 @@ typedef struct {
         */
        struct hash_table_u64 *allocated_vec;
 
+       /* During NIR->BIR, the number of loops enclosing the current block */
+       unsigned loop_nesting;
+
        /* Stats for shader-db */
        unsigned loop_count;
        unsigned spills;
        unsigned fills;
+       unsigned remats;
 } bi_context;
 
 static inline void
@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "compiler.h"
+#include "bi_test.h"
+#include "bi_builder.h"
+
+#include <gtest/gtest.h>
+
+/* More values than fit in the 64 registers, so the allocator must spill */
+#define PRESSURE 72
+
+class Spill : public testing::Test {
+protected:
+   Spill() {
+      mem_ctx = ralloc_context(NULL);
+      b = bit_builder(mem_ctx);
+      b->shader->arch = 7;
+      entry = bi_start_block(&b->shader->blocks);
+
+      base = bi_mov_i32(b, bi_register(0));
+   }
+
+   ~Spill() {
+      ralloc_free(mem_ctx);
+   }
+
+   /* A value that can't be rematerialized */
+   bi_index value(unsigned i)
+   {
+      return bi_iadd_u32(b, base, bi_imm_u32(i), false);
+   }
+
+   /* A use without a destination, so it doesn't add to the pressure */
+   void use(bi_index x)
+   {
+      bi_store_i32(b, x, bi_zero(), bi_zero(), BI_SEG_NONE, 0);
+   }
+
+   void use_n(bi_index x, unsigned n)
+   {
+      for (unsigned i = 0; i < n; ++i)
+         use(x);
+   }
+
+   void allocate()
+   {
+      bi_register_allocate(b->shader);
+   }
+
+   static unsigned count_tl(bi_block *block, enum bi_opcode op)
+   {
+      unsigned count = 0;
+
+      bi_foreach_instr_in_block(block, I)
+         count += (I->op == op && I->seg == BI_SEG_TL);
+
+      return count;
+   }
+
+   unsigned count_tl(enum bi_opcode op)
+   {
+      unsigned count = 0;
+
+      bi_foreach_block(b->shader, block)
+         count += count_tl(block, op);
+
+      return count;
+   }
+
+   void *mem_ctx;
+   bi_builder *b;
+   bi_block *entry;
+   bi_index base;
+};
+
+TEST_F(Spill, LoopUsesSpilledLast)
+{
+   bi_index inner[PRESSURE / 2], outer[PRESSURE / 2];
+
+   for (unsigned i = 0; i < PRESSURE / 2; ++i) {
+      inner[i] = value(i);
+      outer[i] = value(PRESSURE + i);
+   }
+
+   bi_block *loop = bit_block(b->shader);
+   bi_block *exit = bit_block(b->shader);
+   loop->loop_nesting = 1;
+
+   bi_block_add_successor(entry, loop);
+   bi_block_add_successor(loop, loop);
+   bi_block_add_successor(loop, exit);
+
+   /* Both sets are live across the loop, only one is used in it */
+   b->cursor = bi_after_block(loop);
+   for (unsigned i = 0; i < PRESSURE / 2; ++i)
+      use(inner[i]);
+
+   b->cursor = bi_after_block(exit);
+   for (unsigned i = 0; i < PRESSURE / 2; ++i)
+      use(outer[i]);
+
+   allocate();
+
+   EXPECT_GT(b->shader->spills, 0u);
+   EXPECT_EQ(count_tl(loop, BI_OPCODE_LOAD_I32), 0u);
+   EXPECT_GT(count_tl(exit, BI_OPCODE_LOAD_I32), 0u);
+}
+
+TEST_F(Spill, RematerializeConstant)
+{
+   bi_index constant = bi_mov_i32(b, bi_imm_u32(0xcafe));
+   bi_index values[PRESSURE];
+
+   for (unsigned i = 0; i < PRESSURE; ++i)
+      values[i] = value(i);
+
+   /* Using the other values more makes them costlier to spill */
+   for (unsigned i = 0; i < PRESSURE; ++i)
+      use_n(values[i], 2);
+
+   use(constant);
+
+   allocate();
+
+   EXPECT_EQ(b->shader->remats, 1u);
+
+   /* The definition moved to the use, nothing was stored for it */
+   unsigned movs = 0;
+   bi_foreach_instr_global(b->shader, I) {
+      if (I->op == BI_OPCODE_MOV_I32 &&
+          I->src[0].type == BI_INDEX_CONSTANT && I->src[0].value == 0xcafe) {
+         bi_instr *next = bi_next_op(I);
+
+         ASSERT_NE(next, nullptr);
+         EXPECT_EQ(next->op, BI_OPCODE_STORE_I32);
+         EXPECT_EQ(next->seg, BI_SEG_NONE);
+         movs++;
+      }
+   }
+
+   EXPECT_EQ(movs, 1u);
+}
+
+TEST_F(Spill, DisjointSlotsShareMemory)
+{
+   /* With base, the fillers and one of the cheap values below, one more
+    * value doesn't fit in the register file */
+   bi_index fillers[62];
+
+   for (unsigned i = 0; i < ARRAY_SIZE(fillers); ++i)
+      fillers[i] = value(i);
+
+   /* Two cheap values live one after the other, each across a point where
+    * one register is missing */
+   bi_index first = value(100);
+   bi_index x = value(101);
+   use_n(x, 3);
+   use(first);
+
+   bi_index second = value(102);
+   bi_index y = value(103);
+   use_n(y, 3);
+   use(second);
+
+   for (unsigned i = 0; i < ARRAY_SIZE(fillers); ++i)
+      use_n(fillers[i], 4);
+
+   use(base);
+
+   allocate();
+
+   ASSERT_EQ(b->shader->spills, 2u);
+   EXPECT_EQ(count_tl(BI_OPCODE_STORE_I32), 2u);
+
+   /* Two 4-byte slots in the space of one */
+   EXPECT_EQ(b->shader->info.tls_size, 4u);
+}
@@ -211,6 +211,72 @@ TEST_F(InsertFlow, TextureExplicit) {
    });
 }
 
+TEST_F(InsertFlow, LdVarAcrossStraightLineEdge) {
+   CASE(FRAGMENT, {
+         bi_block *A = bi_start_block(&b->shader->blocks);
+         bi_block *B = bit_block(b->shader);
+
+         bi_block_add_successor(A, B);
+
+         b->cursor = bi_after_block(A);
+         flow(DISCARD);
+         bi_ld_var_buf_imm_f16_to(b, bi_register(2), bi_register(61),
+                                 BI_REGISTER_FORMAT_F16, BI_SAMPLE_CENTER,
+                                 BI_SOURCE_FORMAT_F16,
+                                 BI_UPDATE_RETRIEVE, BI_VECSIZE_V4, 0);
+         bi_fadd_f32_to(b, bi_register(0), bi_register(0), bi_register(0));
+
+         b->cursor = bi_after_block(B);
+         flow(WAIT0);
+         bi_fadd_f32_to(b, bi_register(4), bi_register(2), bi_register(2));
+         flow(END);
+   });
+}
+
+TEST_F(InsertFlow, LoadsNotSerialized) {
+   CASE(KERNEL, {
+         bi_instr *I = bi_load_i32_to(b, bi_register(8), bi_register(0),
+                                      bi_register(1), BI_SEG_NONE, 0);
+         I->slot = 0;
+
+         I = bi_load_i32_to(b, bi_register(9), bi_register(2),
+                            bi_register(3), BI_SEG_NONE, 0);
+         I->slot = 1;
+
+         flow(WAIT01);
+         bi_fadd_f32_to(b, bi_register(10), bi_register(8), bi_register(9));
+         flow(END);
+   });
+}
+
+TEST_F(InsertFlow, StoreAfterLoad) {
+   CASE(KERNEL, {
+         bi_instr *I = bi_load_i32_to(b, bi_register(8), bi_register(0),
+                                      bi_register(1), BI_SEG_NONE, 0);
+         I->slot = 0;
+
+         flow(WAIT0);
+         I = bi_store_i32(b, bi_register(10), bi_register(2), bi_register(3),
+                          BI_SEG_NONE, 0);
+         I->slot = 1;
+         flow(END);
+   });
+}
+
+TEST_F(InsertFlow, LoadAfterStore) {
+   CASE(KERNEL, {
+         bi_instr *I = bi_store_i32(b, bi_register(10), bi_register(2),
+                                    bi_register(3), BI_SEG_NONE, 0);
+         I->slot = 0;
+
+         flow(WAIT0);
+         I = bi_load_i32_to(b, bi_register(8), bi_register(0),
+                            bi_register(1), BI_SEG_NONE, 0);
+         I->slot = 1;
+         flow(END);
+   });
+}
+
 /*      A
  *     / \
  *    B   C
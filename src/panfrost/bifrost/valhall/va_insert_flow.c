@@ -40,7 +40,9 @@
  *    must first wait for that instruction's slot, unless all
  *    reaching code paths already depended on it.
  * 2. More generally, any dependencies must be encoded. This includes
- *    Write-After-Write and Write-After-Read hazards with LOAD/STORE to memory.
+ *    Read-After-Write, Write-After-Write and Write-After-Read hazards with
+ *    LOAD/STORE to memory. Loads do not need to be ordered with respect to
+ *    other loads.
  * 3. The shader must wait on slot #6 before running BLEND, ATEST
  * 4. The shader must wait on slot #7 before running BLEND, ST_TILE
  * 6. BARRIER must wait on every active slot.
@@ -133,6 +135,21 @@ bi_is_memory_access(const bi_instr *I)
    }
 }
 
+static bool
+bi_is_memory_write(const bi_instr *I)
+{
+   if (!bi_is_memory_access(I))
+      return false;
+
+   switch (bi_opcode_props[I->op].message) {
+   case BIFROST_MESSAGE_STORE:
+   case BIFROST_MESSAGE_ATOMIC:
+      return true;
+   default:
+      return false;
+   }
+}
+
 /* Update the scoreboard model to assign an instruction to a given slot */
 
 static void
@@ -144,6 +161,9 @@ bi_push_instr(struct bi_scoreboard_state *st, bi_instr *I)
    if (bi_is_memory_access(I))
       st->memory |= BITFIELD_BIT(I->slot);
 
+   if (bi_is_memory_write(I))
+      st->memory_write |= BITFIELD_BIT(I->slot);
+
    if (bi_opcode_props[I->op].message == BIFROST_MESSAGE_VARYING)
       st->varying |= BITFIELD_BIT(I->slot);
 }
@@ -154,6 +174,7 @@ bi_pop_slot(struct bi_scoreboard_state *st, unsigned slot)
    st->write[slot] = 0;
    st->varying &= ~BITFIELD_BIT(slot);
    st->memory &= ~BITFIELD_BIT(slot);
+   st->memory_write &= ~BITFIELD_BIT(slot);
 
    return BITFIELD_BIT(slot);
 }
@@ -192,10 +213,17 @@ bi_set_dependencies(bi_block *block, bi_instr *I, struct bi_scoreboard_state *st
          I->flow |= bi_pop_slot(st, slot);
    }
 
-   /* For now, serialize all memory access */
-   if (bi_is_memory_access(I)) {
+   /* Writes to memory are ordered against all outstanding memory access.
+    * Reads only need to be ordered against outstanding writes, since
+    * read-after-read is not a hazard. We do not know the addresses, so any
+    * two accesses may alias.
+    */
+   if (bi_is_memory_write(I)) {
       u_foreach_bit(slot, st->memory)
          I->flow |= bi_pop_slot(st, slot);
+   } else if (bi_is_memory_access(I)) {
+      u_foreach_bit(slot, st->memory_write)
+         I->flow |= bi_pop_slot(st, slot);
    }
 
    /* We need to wait for all general slots before a barrier. The reason is
@@ -236,6 +264,7 @@ scoreboard_block_update(bi_context *ctx, bi_block *blk)
          blk->scoreboard_in.write[i] |= (*pred)->scoreboard_out.write[i];
          blk->scoreboard_in.varying |= (*pred)->scoreboard_out.varying;
          blk->scoreboard_in.memory |= (*pred)->scoreboard_out.memory;
+         blk->scoreboard_in.memory_write |= (*pred)->scoreboard_out.memory_write;
       }
    }
 
@@ -266,9 +295,11 @@ scoreboard_block_update(bi_context *ctx, bi_block *blk)
     * graph. However, this probably doesn't matter much in practice. This seems
     * like a decent compromise for now.
     *
-    * TODO: Consider optimizing this case.
+    * Divergence is only possible across a branch or reconvergence point. If
+    * the block falls through to a block with no other predecessors, the quad
+    * stays together and the varying loads may remain outstanding.
     */
-   if (state.varying) {
+   if (state.varying && bi_reconverge_branches(blk)) {
       uint8_t flow = 0;
 
       u_foreach_bit(slot, state.varying)
@@ -9,7 +9,9 @@
 
 #include "pan_pps_driver.h"
 
+#include <cinttypes>
 #include <cstring>
+#include <ctime>
 #include <perfetto.h>
 #include <xf86drm.h>
 
@@ -62,7 +64,7 @@ PanfrostDriver::create_available_counters(const PanfrostPerf &perf)
       group.id = gid;
       group.name = category.name;
 
-      for (; cid < category.n_counters; ++cid) {
+      for (uint32_t i = 0; i < category.n_counters; ++i, ++cid) {
          Counter counter = {};
          counter.id = cid;
          counter.group = gid;
@@ -75,7 +77,8 @@ PanfrostDriver::create_available_counters(const PanfrostPerf &perf)
             struct panfrost_perf *perf = pan_driver.perf->perf;
             uint32_t id_within_group = find_id_within_group(c.id, perf->cfg);
             const auto counter = &perf->cfg->categories[c.group].counters[id_within_group];
-            return int64_t(panfrost_perf_counter_read(counter, perf));
+            return int64_t(
+               panfrost_perf_counter_read_sample(counter, perf, pan_driver.current_sample));
          });
 
          group.counters.push_back(cid);
@@ -86,6 +89,47 @@ PanfrostDriver::create_available_counters(const PanfrostPerf &perf)
       groups.push_back(group);
    }
 
+   // Metrics derived from the counters above, in a group of their own
+   CounterGroup derived_group = {};
+   derived_group.id = perf.perf->cfg->n_categories;
+   derived_group.name = "Derived";
+
+   for (uint32_t i = 0; i < perf.perf->cfg->n_derived; ++i) {
+      const struct panfrost_perf_derived *derived = &perf.perf->cfg->derived[i];
+
+      Counter counter = {};
+      counter.id = cid;
+      counter.group = derived_group.id;
+      counter.name = derived->name;
+      counter.derived = true;
+
+      switch (derived->units) {
+      case PAN_PERF_DERIVED_UNITS_PERCENT:
+         counter.units = Counter::Units::Percent;
+         break;
+      case PAN_PERF_DERIVED_UNITS_BYTES:
+      case PAN_PERF_DERIVED_UNITS_BYTES_PER_SECOND:
+         counter.units = Counter::Units::Byte;
+         break;
+      default:
+         counter.units = Counter::Units::None;
+         break;
+      }
+
+      counter.set_getter([derived](const Counter &c, const Driver &d) {
+         auto &pan_driver = PanfrostDriver::into(d);
+         return panfrost_perf_derived_read(derived, pan_driver.perf->perf, pan_driver.current_sample);
+      });
+
+      derived_group.counters.push_back(cid++);
+
+      counters.emplace_back(counter);
+   }
+
+   if (!derived_group.counters.empty()) {
+      groups.push_back(derived_group);
+   }
+
    return ret;
 }
 
@@ -116,7 +160,7 @@ void PanfrostDriver::enable_all_counters()
    }
 }
 
-void PanfrostDriver::enable_perfcnt(const uint64_t /* sampling_period_ns */)
+void PanfrostDriver::enable_perfcnt(const uint64_t sampling_period_ns)
 {
    auto res = perf->enable();
    if (!check(res, "Failed to enable performance counters")) {
@@ -125,11 +169,24 @@ void PanfrostDriver::enable_perfcnt(const uint64_t /* sampling_period_ns */)
       }
       PERFETTO_FATAL("Please verify graphics card");
    }
+
+   // Let the kernel sample the counters when it can, which gives accurate
+   // timestamps and does not depend on the producer being scheduled
+   periodic = perf->set_period(sampling_period_ns) == 0;
+   next_sample = 0;
 }
 
 bool PanfrostDriver::dump_perfcnt()
 {
-   last_dump_ts = perfetto::base::GetBootTimeNs().count();
+   if (periodic) {
+      // Read back whatever the kernel sampled since the last call
+      if (perf->poll() < 0) {
+         PERFETTO_ELOG("Failed to read performance counters");
+         return false;
+      }
+
+      return true;
+   }
 
    // Dump performance counters to buffer
    if (!check(perf->dump(), "Failed to dump performance counters")) {
@@ -142,13 +199,29 @@ bool PanfrostDriver::dump_perfcnt()
 
 uint64_t PanfrostDriver::next()
 {
-   auto ret = last_dump_ts;
-   last_dump_ts = 0;
-   return ret;
+   struct panfrost_perf *pan_perf = perf->perf;
+
+   // Samples overwritten in the ring buffer before we got to them are lost
+   if (pan_perf->n_samples > next_sample + PAN_PERF_MAX_SAMPLES) {
+      PERFETTO_ELOG("Dropped %" PRIu64 " samples",
+                    pan_perf->n_samples - PAN_PERF_MAX_SAMPLES - next_sample);
+      next_sample = pan_perf->n_samples - PAN_PERF_MAX_SAMPLES;
+   }
+
+   current_sample = panfrost_perf_get_sample(pan_perf, next_sample);
+   if (!current_sample) {
+      return 0;
+   }
+
+   next_sample++;
+   return current_sample->timestamp;
 }
 
 void PanfrostDriver::disable_perfcnt()
 {
+   if (periodic) {
+      perf->set_period(0);
+   }
    perf->disable();
    perf.reset();
    dev.reset();
@@ -159,12 +232,15 @@ void PanfrostDriver::disable_perfcnt()
 
 uint32_t PanfrostDriver::gpu_clock_id() const
 {
-   return perfetto::protos::pbzero::BUILTIN_CLOCK_BOOTTIME;
+   // Samples are timestamped with CLOCK_MONOTONIC_RAW by both kernel drivers
+   return perfetto::protos::pbzero::BUILTIN_CLOCK_MONOTONIC_RAW;
 }
 
 uint64_t PanfrostDriver::gpu_timestamp() const
 {
-   return perfetto::base::GetBootTimeNs().count();
+   struct timespec tp;
+   clock_gettime(CLOCK_MONOTONIC_RAW, &tp);
+   return tp.tv_sec * 1000000000ull + tp.tv_nsec;
 }
 
 } // namespace pps
@@ -19,6 +19,7 @@ namespace pps
 /// This driver queries the GPU through `drm/panfrost_drm.h`, using performance counters ioctls,
 /// which can be enabled by setting a kernel parameter: `modprobe panfrost unstable_ioctls=1`.
 /// The ioctl needs a buffer to copy data from kernel to user space.
+/// With kbase, the kernel dumps the counters periodically through a hardware counter reader.
 class PanfrostDriver : public Driver
 {
    public:
@@ -44,7 +45,14 @@ class PanfrostDriver : public Driver
    uint32_t gpu_clock_id() const override;
    uint64_t gpu_timestamp() const override;
 
-   uint64_t last_dump_ts = 0;
+   /// Whether the kernel samples the counters by itself
+   bool periodic = false;
+
+   /// Index of the next sample to return from `next()`
+   uint64_t next_sample = 0;
+
+   /// Sample read by the counter getters
+   const struct panfrost_perf_sample *current_sample = nullptr;
 
    std::unique_ptr<PanfrostDevice> dev = nullptr;
    std::unique_ptr<PanfrostPerf> perf = nullptr;
@@ -86,4 +86,16 @@ int PanfrostPerf::dump() const
    return panfrost_perf_dump(perf);
 }
 
+int PanfrostPerf::set_period(uint64_t period_ns) const
+{
+   assert(perf);
+   return panfrost_perf_set_period(perf, period_ns);
+}
+
+int PanfrostPerf::poll() const
+{
+   assert(perf);
+   return panfrost_perf_poll(perf, 0);
+}
+
 } // namespace pps
@@ -7,8 +7,11 @@
 
 #pragma once
 
+#include <cstdint>
+
 struct panfrost_device;
 struct panfrost_perf;
+struct panfrost_perf_sample;
 
 namespace pps
 {
@@ -43,6 +46,8 @@ class PanfrostPerf
    int enable() const;
    void disable() const;
    int dump() const;
+   int set_period(uint64_t period_ns) const;
+   int poll() const;
 
    struct panfrost_perf *perf = nullptr;
 };
@@ -1716,7 +1716,7 @@ pandecode_cs_command(uint64_t command, mali_ptr va,
         }
 
         case 40: {
-                if (addr || l >> 16 || arg1 > 1) {
+                if (addr || arg1 > 1) {
                         pandecode_log("str type %02x, (unk %02x), "
                                       "(unk %x), [x%02x, %i]\n",
                                       addr, arg1,
@@ -1727,8 +1727,12 @@ pandecode_cs_command(uint64_t command, mali_ptr va,
                                 "cycles",
                         }[arg1];
 
-                        pandecode_log("str %s, [x%02x, %i]\n",
-                                      type, arg2, (int16_t) l);
+                        if (l >> 16)
+                                pandecode_log("str %s, [x%02x, %i], wait 0x%x\n",
+                                              type, arg2, (int16_t) l, l >> 16);
+                        else
+                                pandecode_log("str %s, [x%02x, %i]\n",
+                                              type, arg2, (int16_t) l);
                 }
                 break;
         }
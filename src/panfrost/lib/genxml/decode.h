@@ -42,6 +42,9 @@ struct pandecode_mapped_memory {
         uint64_t gpu_va;
         bool ro;
         char name[32];
+
+        /* With PANDECODE_SNAPSHOT, the latest copy of the contents */
+        struct pandecode_copy *copy;
 };
 
 char *pointer_as_memory_reference(uint64_t ptr);
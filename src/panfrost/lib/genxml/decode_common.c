@@ -34,7 +34,10 @@
 #include "util/macros.h"
 #include "util/u_debug.h"
 #include "util/u_dynarray.h"
+#include "util/u_queue.h"
 #include "util/simple_mtx.h"
+#define XXH_INLINE_ALL
+#include "util/xxhash.h"
 
 FILE *pandecode_dump_stream;
 
@@ -44,7 +47,79 @@ static struct rb_tree mmap_tree;
 
 static struct util_dynarray ro_mappings;
 
+/* Most fetches are from the same buffer as the previous one */
+static struct pandecode_mapped_memory *last_hit;
+
+/* pandecode_lock serializes decoding and the dump file, mmap_lock protects
+ * the mappings. Snapshots are decoded without mmap_lock, so the driver can
+ * keep mapping and freeing buffers while the decode thread runs. When both
+ * are needed, pandecode_lock is taken first. */
 static simple_mtx_t pandecode_lock = SIMPLE_MTX_INITIALIZER;
+static simple_mtx_t mmap_lock = SIMPLE_MTX_INITIALIZER;
+
+/*
+ * With PANDECODE_SNAPSHOT, each submit is decoded from a snapshot of the
+ * mapped memory taken when it is submitted, instead of from the live
+ * mappings, so the buffers don't have to be made read-only while decoding.
+ * Buffers are hashed, and only copied again when they changed since the
+ * previous snapshot. Snapshots share the copies of the buffers that didn't
+ * change, and lookups are a binary search in a sorted array. The latest copy
+ * of each buffer is kept to compare against, which doubles the memory used by
+ * the snapshotted buffers.
+ *
+ * A snapshot is taken by pandecode_begin_submit(), and shared by the decodes
+ * requested until pandecode_end_submit(), e.g. those of the vertex and
+ * fragment rings of a CSF submit. The driver passes the buffers of the submit,
+ * and only those are snapshotted. Outside of those, pandecode can't tell which
+ * buffers a decode references, so every decode snapshots every CPU-visible
+ * buffer.
+ *
+ * With PANDECODE_THREAD, the decodes run in order on a background thread, so
+ * tracing mostly costs the application the hashes and copies.
+ */
+
+/* Contents of a buffer, shared by the snapshots taken while they don't
+ * change */
+struct pandecode_copy {
+        int refcount;
+        size_t length;
+        uint64_t hash;
+        uint8_t data[];
+};
+
+struct pandecode_snapshot {
+        int refcount;
+
+        /* Mappings pointing to the copies, sorted by GPU address */
+        struct pandecode_mapped_memory *mappings;
+        unsigned count;
+        struct pandecode_mapped_memory *last_hit;
+};
+
+enum pandecode_request_type {
+        PANDECODE_REQUEST_JC,
+        PANDECODE_REQUEST_CS,
+        PANDECODE_REQUEST_FRAME,
+};
+
+struct pandecode_request {
+        enum pandecode_request_type type;
+        mali_ptr gpu_va;
+        unsigned size;
+        unsigned gpu_id;
+
+        /* NULL for frame boundaries */
+        struct pandecode_snapshot *snap;
+};
+
+static bool snapshot_mode;
+static struct util_queue decode_queue;
+
+/* Snapshot of the submit in progress on this thread, if any */
+static thread_local struct pandecode_snapshot *submit_snapshot;
+
+/* Snapshot being decoded, protected by pandecode_lock */
+static struct pandecode_snapshot *active_snapshot;
 
 #define to_mapped_memory(x) \
 	rb_node_data(struct pandecode_mapped_memory, x, node)
@@ -72,24 +147,73 @@ pandecode_cmp(const struct rb_node *lhs, const struct rb_node *rhs)
         return to_mapped_memory(lhs)->gpu_va - to_mapped_memory(rhs)->gpu_va;
 }
 
+static bool
+pandecode_mapping_contains(const struct pandecode_mapped_memory *mem,
+                           uint64_t addr)
+{
+        return mem && mem->gpu_va <= addr && addr < (mem->gpu_va + mem->length);
+}
+
 static struct pandecode_mapped_memory *
-pandecode_find_mapped_gpu_mem_containing_rw(uint64_t addr)
+pandecode_snapshot_find(struct pandecode_snapshot *snap, uint64_t addr)
 {
-        simple_mtx_assert_locked(&pandecode_lock);
+        if (pandecode_mapping_contains(snap->last_hit, addr))
+                return snap->last_hit;
+
+        unsigned lo = 0, hi = snap->count;
+
+        while (lo < hi) {
+                unsigned mid = lo + (hi - lo) / 2;
+                struct pandecode_mapped_memory *mem = &snap->mappings[mid];
+
+                if (pandecode_mapping_contains(mem, addr)) {
+                        snap->last_hit = mem;
+                        return mem;
+                } else if (addr < mem->gpu_va) {
+                        hi = mid;
+                } else {
+                        lo = mid + 1;
+                }
+        }
+
+        return NULL;
+}
+
+static struct pandecode_mapped_memory *
+pandecode_find_mapping(uint64_t addr)
+{
+        simple_mtx_assert_locked(&mmap_lock);
+
+        if (pandecode_mapping_contains(last_hit, addr))
+                return last_hit;
 
         struct rb_node *node = rb_tree_search(&mmap_tree, &addr, pandecode_cmp_key);
 
+        if (node)
+                last_hit = to_mapped_memory(node);
+
         return to_mapped_memory(node);
 }
 
-struct pandecode_mapped_memory *
-pandecode_find_mapped_gpu_mem_containing(uint64_t addr)
+/* Lookup for the decoders, from the snapshot being decoded if any */
+static struct pandecode_mapped_memory *
+pandecode_find_mapped_gpu_mem_containing_rw(uint64_t addr)
 {
         simple_mtx_assert_locked(&pandecode_lock);
 
+        if (active_snapshot)
+                return pandecode_snapshot_find(active_snapshot, addr);
+
+        return pandecode_find_mapping(addr);
+}
+
+struct pandecode_mapped_memory *
+pandecode_find_mapped_gpu_mem_containing(uint64_t addr)
+{
         struct pandecode_mapped_memory *mem = pandecode_find_mapped_gpu_mem_containing_rw(addr);
 
-        if (mem && mem->addr && !mem->ro) {
+        /* Snapshots are private copies, so there is no need to catch writes */
+        if (!active_snapshot && mem && mem->addr && !mem->ro) {
                 mprotect(mem->addr, mem->length, PROT_READ);
                 mem->ro = true;
                 util_dynarray_append(&ro_mappings, struct pandecode_mapped_memory *, mem);
@@ -110,10 +234,17 @@ pandecode_map_read_write(void)
         util_dynarray_clear(&ro_mappings);
 }
 
+static void
+pandecode_copy_put(struct pandecode_copy *copy)
+{
+        if (copy && p_atomic_dec_zero(&copy->refcount))
+                free(copy);
+}
+
 static void
 pandecode_add_name(struct pandecode_mapped_memory *mem, uint64_t gpu_va, const char *name)
 {
-        simple_mtx_assert_locked(&pandecode_lock);
+        simple_mtx_assert_locked(&mmap_lock);
 
         if (!name) {
                 /* If we don't have a name, assign one */
@@ -129,12 +260,11 @@ pandecode_add_name(struct pandecode_mapped_memory *mem, uint64_t gpu_va, const c
 void
 pandecode_inject_mmap(uint64_t gpu_va, void *cpu, unsigned sz, const char *name)
 {
-        simple_mtx_lock(&pandecode_lock);
+        simple_mtx_lock(&mmap_lock);
 
         /* First, search if we already mapped this and are just updating an address */
 
-        struct pandecode_mapped_memory *existing =
-                pandecode_find_mapped_gpu_mem_containing_rw(gpu_va);
+        struct pandecode_mapped_memory *existing = pandecode_find_mapping(gpu_va);
 
         if (existing && existing->gpu_va == gpu_va) {
                 existing->length = sz;
@@ -154,26 +284,29 @@ pandecode_inject_mmap(uint64_t gpu_va, void *cpu, unsigned sz, const char *name)
                 rb_tree_insert(&mmap_tree, &mapped_mem->node, pandecode_cmp);
         }
 
-        simple_mtx_unlock(&pandecode_lock);
+        simple_mtx_unlock(&mmap_lock);
 }
 
 void
 pandecode_inject_free(uint64_t gpu_va, unsigned sz)
 {
-        simple_mtx_lock(&pandecode_lock);
+        simple_mtx_lock(&mmap_lock);
 
-        struct pandecode_mapped_memory *mem =
-                pandecode_find_mapped_gpu_mem_containing_rw(gpu_va);
+        struct pandecode_mapped_memory *mem = pandecode_find_mapping(gpu_va);
 
         if (mem) {
                 assert(mem->gpu_va == gpu_va);
                 assert(mem->length == sz);
 
+                if (mem == last_hit)
+                        last_hit = NULL;
+
                 rb_tree_remove(&mmap_tree, &mem->node);
+                pandecode_copy_put(mem->copy);
                 free(mem);
         }
 
-        simple_mtx_unlock(&pandecode_lock);
+        simple_mtx_unlock(&mmap_lock);
 }
 
 char *
@@ -243,17 +376,250 @@ pandecode_dump_file_close(void)
         }
 }
 
+static int
+pandecode_snapshot_cmp(const void *a, const void *b)
+{
+        const struct pandecode_mapped_memory *lhs = a, *rhs = b;
+
+        return (lhs->gpu_va > rhs->gpu_va) - (lhs->gpu_va < rhs->gpu_va);
+}
+
+/* Latest copy of a buffer, made again if its contents changed. Returns NULL
+ * if out of memory. */
+static struct pandecode_copy *
+pandecode_update_copy(struct pandecode_mapped_memory *mem)
+{
+        simple_mtx_assert_locked(&mmap_lock);
+
+        struct pandecode_copy *copy = mem->copy;
+
+        if (copy && copy->length == mem->length &&
+            copy->hash == XXH64(mem->addr, mem->length, 0))
+                return copy;
+
+        copy = malloc(sizeof(*copy) + mem->length);
+        if (!copy)
+                return NULL;
+
+        copy->refcount = 1;
+        copy->length = mem->length;
+        memcpy(copy->data, mem->addr, mem->length);
+
+        /* Hash what was copied, the GPU may be writing the buffer */
+        copy->hash = XXH64(copy->data, copy->length, 0);
+
+        pandecode_copy_put(mem->copy);
+        mem->copy = copy;
+        return copy;
+}
+
+static void
+pandecode_snapshot_put(struct pandecode_snapshot *snap)
+{
+        if (!snap || !p_atomic_dec_zero(&snap->refcount))
+                return;
+
+        for (unsigned i = 0; i < snap->count; ++i)
+                pandecode_copy_put(snap->mappings[i].copy);
+
+        free(snap->mappings);
+        free(snap);
+}
+
+static int
+pandecode_va_cmp(const void *a, const void *b)
+{
+        uint64_t va_a = *(const uint64_t *) a, va_b = *(const uint64_t *) b;
+
+        return (va_a > va_b) - (va_a < va_b);
+}
+
+/* Snapshot the buffers starting at the given sorted GPU addresses, or every
+ * buffer if there are none. Returns NULL if out of memory */
+static struct pandecode_snapshot *
+pandecode_snapshot_create(const uint64_t *vas, unsigned va_count)
+{
+        struct pandecode_snapshot *snap = calloc(1, sizeof(*snap));
+
+        if (!snap)
+                return NULL;
+
+        snap->refcount = 1;
+
+        simple_mtx_lock(&mmap_lock);
+
+        unsigned count = 0;
+
+        rb_tree_foreach(struct pandecode_mapped_memory, it, &mmap_tree, node) {
+                if (!vas || bsearch(&it->gpu_va, vas, va_count, sizeof(*vas),
+                                    pandecode_va_cmp))
+                        count++;
+        }
+
+        snap->mappings = calloc(MAX2(count, 1), sizeof(*snap->mappings));
+
+        if (!snap->mappings) {
+                simple_mtx_unlock(&mmap_lock);
+                free(snap);
+                return NULL;
+        }
+
+        rb_tree_foreach(struct pandecode_mapped_memory, it, &mmap_tree, node) {
+                if (vas && !bsearch(&it->gpu_va, vas, va_count, sizeof(*vas),
+                                    pandecode_va_cmp))
+                        continue;
+
+                struct pandecode_mapped_memory *mem = &snap->mappings[snap->count++];
+
+                *mem = *it;
+                mem->ro = false;
+                mem->copy = NULL;
+
+                if (!it->addr)
+                        continue;
+
+                struct pandecode_copy *copy = pandecode_update_copy(it);
+
+                if (!copy) {
+                        simple_mtx_unlock(&mmap_lock);
+                        pandecode_snapshot_put(snap);
+                        return NULL;
+                }
+
+                p_atomic_inc(&copy->refcount);
+                mem->copy = copy;
+                mem->addr = copy->data;
+        }
+
+        simple_mtx_unlock(&mmap_lock);
+
+        /* The tree is ordered already, but by a comparison that wraps */
+        qsort(snap->mappings, snap->count, sizeof(*snap->mappings),
+              pandecode_snapshot_cmp);
+
+        return snap;
+}
+
+static void
+pandecode_request_destroy(void *job, void *gdata, int thread_index)
+{
+        struct pandecode_request *req = job;
+
+        pandecode_snapshot_put(req->snap);
+        free(req);
+}
+
+static void
+pandecode_decode_request(void *job, void *gdata, int thread_index)
+{
+        struct pandecode_request *req = job;
+
+        simple_mtx_lock(&pandecode_lock);
+        active_snapshot = req->snap;
+
+        switch (req->type) {
+        case PANDECODE_REQUEST_JC:
+                switch (pan_arch(req->gpu_id)) {
+                case 4: pandecode_jc_v4(req->gpu_va, req->gpu_id); break;
+                case 5: pandecode_jc_v5(req->gpu_va, req->gpu_id); break;
+                case 6: pandecode_jc_v6(req->gpu_va, req->gpu_id); break;
+                case 7: pandecode_jc_v7(req->gpu_va, req->gpu_id); break;
+                case 9: pandecode_jc_v9(req->gpu_va, req->gpu_id); break;
+                default: unreachable("Unsupported architecture");
+                }
+                break;
+
+        case PANDECODE_REQUEST_CS:
+                pandecode_cs_v10(req->gpu_va, req->size, req->gpu_id);
+                break;
+
+        case PANDECODE_REQUEST_FRAME:
+                pandecode_dump_file_close();
+                pandecode_dump_frame_count++;
+                break;
+        }
+
+        active_snapshot = NULL;
+        simple_mtx_unlock(&pandecode_lock);
+}
+
+/* Decode from the snapshot of the submit, on the decode thread if any.
+ * Returns false if out of memory, leaving the decode to the caller. */
+static bool
+pandecode_submit_request(enum pandecode_request_type type, mali_ptr gpu_va,
+                         unsigned size, unsigned gpu_id)
+{
+        struct pandecode_request *req = calloc(1, sizeof(*req));
+
+        if (!req)
+                return false;
+
+        req->type = type;
+        req->gpu_va = gpu_va;
+        req->size = size;
+        req->gpu_id = gpu_id;
+
+        if (type != PANDECODE_REQUEST_FRAME) {
+                if (submit_snapshot) {
+                        p_atomic_inc(&submit_snapshot->refcount);
+                        req->snap = submit_snapshot;
+                } else {
+                        req->snap = pandecode_snapshot_create(NULL, 0);
+                }
+
+                if (!req->snap) {
+                        free(req);
+                        return false;
+                }
+        }
+
+        if (util_queue_is_initialized(&decode_queue)) {
+                /* Blocks if the decode thread is too far behind */
+                util_queue_add_job(&decode_queue, req, NULL,
+                                   pandecode_decode_request,
+                                   pandecode_request_destroy, 0);
+        } else {
+                pandecode_decode_request(req, NULL, 0);
+                pandecode_request_destroy(req, NULL, 0);
+        }
+
+        return true;
+}
+
+/* Wait for the decode thread to catch up */
+static void
+pandecode_drain(void)
+{
+        if (util_queue_is_initialized(&decode_queue))
+                util_queue_finish(&decode_queue);
+}
+
 void
 pandecode_initialize(bool to_stderr)
 {
         force_stderr = to_stderr;
         rb_tree_init(&mmap_tree);
         util_dynarray_init(&ro_mappings, NULL);
+
+        snapshot_mode = debug_get_bool_option("PANDECODE_SNAPSHOT", false);
+
+        if (debug_get_bool_option("PANDECODE_THREAD", false)) {
+                snapshot_mode = true;
+
+                if (!util_queue_is_initialized(&decode_queue))
+                        util_queue_init(&decode_queue, "pandecode", 8, 1, 0, NULL);
+        }
 }
 
 void
 pandecode_next_frame(void)
 {
+        /* Keep the frame boundary in order with the pending submits */
+        if (util_queue_is_initialized(&decode_queue) &&
+            pandecode_submit_request(PANDECODE_REQUEST_FRAME, 0, 0, 0))
+                return;
+
+        pandecode_drain();
         simple_mtx_lock(&pandecode_lock);
 
         pandecode_dump_file_close();
@@ -265,23 +631,35 @@ pandecode_next_frame(void)
 void
 pandecode_close(void)
 {
+        if (util_queue_is_initialized(&decode_queue)) {
+                util_queue_finish(&decode_queue);
+                util_queue_destroy(&decode_queue);
+        }
+
         simple_mtx_lock(&pandecode_lock);
+        simple_mtx_lock(&mmap_lock);
 
         rb_tree_foreach_safe(struct pandecode_mapped_memory, it, &mmap_tree, node) {
                 rb_tree_remove(&mmap_tree, &it->node);
+                pandecode_copy_put(it->copy);
                 free(it);
         }
 
+        last_hit = NULL;
         util_dynarray_fini(&ro_mappings);
         pandecode_dump_file_close();
 
+        simple_mtx_unlock(&mmap_lock);
         simple_mtx_unlock(&pandecode_lock);
 }
 
 void
 pandecode_dump_mappings(void)
 {
+        pandecode_drain();
+
         simple_mtx_lock(&pandecode_lock);
+        simple_mtx_lock(&mmap_lock);
 
         pandecode_dump_file_open();
 
@@ -298,13 +676,18 @@ pandecode_dump_mappings(void)
         }
 
         fflush(pandecode_dump_stream);
+        simple_mtx_unlock(&mmap_lock);
         simple_mtx_unlock(&pandecode_lock);
 }
 
 void
 pandecode_abort_on_fault(mali_ptr jc_gpu_va, unsigned gpu_id)
 {
+        /* The job just completed, so look at the live memory */
+        pandecode_drain();
+
         simple_mtx_lock(&pandecode_lock);
+        simple_mtx_lock(&mmap_lock);
 
         switch (pan_arch(gpu_id)) {
         case 4: pandecode_abort_on_fault_v4(jc_gpu_va); break;
@@ -315,13 +698,50 @@ pandecode_abort_on_fault(mali_ptr jc_gpu_va, unsigned gpu_id)
         default: unreachable("Unsupported architecture");
         }
 
+        simple_mtx_unlock(&mmap_lock);
         simple_mtx_unlock(&pandecode_lock);
 }
 
+void
+pandecode_begin_submit(const uint64_t *gpu_vas, unsigned count)
+{
+        if (!snapshot_mode || submit_snapshot)
+                return;
+
+        uint64_t *sorted = malloc(MAX2(count, 1) * sizeof(*sorted));
+
+        /* Without memory to sort, each decode snapshots everything */
+        if (!sorted)
+                return;
+
+        memcpy(sorted, gpu_vas, count * sizeof(*sorted));
+        qsort(sorted, count, sizeof(*sorted), pandecode_va_cmp);
+
+        submit_snapshot = pandecode_snapshot_create(sorted, count);
+        free(sorted);
+}
+
+void
+pandecode_end_submit(void)
+{
+        pandecode_snapshot_put(submit_snapshot);
+        submit_snapshot = NULL;
+}
+
 void
 pandecode_jc(mali_ptr jc_gpu_va, unsigned gpu_id)
 {
+        if (snapshot_mode) {
+                if (pandecode_submit_request(PANDECODE_REQUEST_JC, jc_gpu_va,
+                                             0, gpu_id))
+                        return;
+
+                /* No memory for a snapshot, decode the live memory */
+                pandecode_drain();
+        }
+
         simple_mtx_lock(&pandecode_lock);
+        simple_mtx_lock(&mmap_lock);
 
         switch (pan_arch(gpu_id)) {
         case 4: pandecode_jc_v4(jc_gpu_va, gpu_id); break;
@@ -332,6 +752,7 @@ pandecode_jc(mali_ptr jc_gpu_va, unsigned gpu_id)
         default: unreachable("Unsupported architecture");
         }
 
+        simple_mtx_unlock(&mmap_lock);
         simple_mtx_unlock(&pandecode_lock);
 }
 
@@ -340,7 +761,17 @@ void pandecode_cs_v10(mali_ptr cs_gpu_va, unsigned cs_size, unsigned gpu_id);
 void
 pandecode_cs(mali_ptr cs_gpu_va, unsigned cs_size, unsigned gpu_id)
 {
+        if (snapshot_mode) {
+                if (pandecode_submit_request(PANDECODE_REQUEST_CS, cs_gpu_va,
+                                             cs_size, gpu_id))
+                        return;
+
+                /* No memory for a snapshot, decode the live memory */
+                pandecode_drain();
+        }
+
         simple_mtx_lock(&pandecode_lock);
+        simple_mtx_lock(&mmap_lock);
 
         switch (pan_arch(gpu_id)) {
         // Hack hack hackity hack: gpu_id == 1 means "don't decode" (only
@@ -349,5 +780,6 @@ pandecode_cs(mali_ptr cs_gpu_va, unsigned cs_size, unsigned gpu_id)
         default: unreachable("Unsupported architecture");
         }
 
+        simple_mtx_unlock(&mmap_lock);
         simple_mtx_unlock(&pandecode_lock);
 }
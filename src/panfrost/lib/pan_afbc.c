@@ -194,3 +194,97 @@ panfrost_afbc_only_native(unsigned arch, enum pipe_format format)
 {
         return (arch >= 7 && format != unswizzled_format(format));
 }
+
+/* The header of a superblock starts with the offset of its body from the start
+ * of the headers, followed by the 6-bit sizes in bytes of its 16 4x4
+ * subblocks. Superblocks of a solid colour have no body and hold the colour in
+ * the header instead. From v7, they are flagged by a zero size for the first
+ * subblock, earlier by a zero body offset. Zeroed headers are thus valid, as
+ * plain black, on all GPUs.
+ */
+
+unsigned
+pan_afbc_superblock_body_size(unsigned arch, const uint32_t *header,
+                              unsigned uncompressed_size)
+{
+        if (arch >= 7 ? !(header[1] & BITFIELD_MASK(6)) : !header[0])
+                return 0;
+
+        unsigned size = 0;
+
+        for (unsigned i = 0; i < 16; ++i) {
+                unsigned bit = 32 + (i * 6);
+                unsigned word = bit / 32, shift = bit % 32;
+                uint32_t bits = header[word] >> shift;
+
+                /* Sizes may straddle two words */
+                if (shift > 32 - 6)
+                        bits |= header[word + 1] << (32 - shift);
+
+                unsigned subblock_size = bits & BITFIELD_MASK(6);
+                size += (subblock_size == 1) ? uncompressed_size : subblock_size;
+        }
+
+        return size;
+}
+
+/* Packing an AFBC image places the bodies of the superblocks of each level
+ * back to back in header order, trading the fixed worst-case footprint of
+ * each superblock for the actual compressed size. Given the body size of each
+ * superblock, compute its offset in the packed body and return the size of the
+ * packed body. */
+
+unsigned
+pan_afbc_pack_offsets(struct pan_afbc_block_info *info, unsigned count)
+{
+        unsigned offset = 0;
+
+        for (unsigned i = 0; i < count; ++i) {
+                info[i].offset = offset;
+                offset += ALIGN_POT(info[i].size, PAN_AFBC_PACKED_BODY_ALIGN);
+        }
+
+        return offset;
+}
+
+/* CPU reference for packing a level of an AFBC image, the GPU does the same
+ * with a compute shader. dst_layout is src_layout after
+ * pan_image_layout_pack_afbc, src and dst point to the start of the images. */
+
+void
+pan_afbc_pack_slice(unsigned arch,
+                    const struct pan_image_layout *src_layout,
+                    const struct pan_image_layout *dst_layout,
+                    unsigned level, const void *src, void *dst)
+{
+        const struct pan_image_slice_layout *src_slice =
+                &src_layout->slices[level];
+        const struct pan_image_slice_layout *dst_slice =
+                &dst_layout->slices[level];
+        const uint8_t *src_base = (const uint8_t *)src + src_slice->offset;
+        uint8_t *dst_base = (uint8_t *)dst + dst_slice->offset;
+        unsigned uncompressed_size =
+                pan_afbc_uncompressed_subblock_size(src_layout->format);
+        unsigned count = pan_afbc_superblock_count(src_layout, level);
+        unsigned offset = dst_slice->afbc.header_size;
+
+        for (unsigned i = 0; i < count; ++i) {
+                const uint32_t *src_header = (const uint32_t *)
+                        (src_base + (i * AFBC_HEADER_BYTES_PER_TILE));
+                uint32_t *dst_header = (uint32_t *)
+                        (dst_base + (i * AFBC_HEADER_BYTES_PER_TILE));
+                unsigned size = pan_afbc_superblock_body_size(arch, src_header,
+                                                              uncompressed_size);
+
+                memcpy(dst_header, src_header, AFBC_HEADER_BYTES_PER_TILE);
+
+                if (!size)
+                        continue;
+
+                memcpy(dst_base + offset, src_base + src_header[0], size);
+                dst_header[0] = offset;
+                offset += ALIGN_POT(size, PAN_AFBC_PACKED_BODY_ALIGN);
+        }
+
+        assert(offset <= dst_slice->afbc.header_size + dst_slice->afbc.body_size);
+}
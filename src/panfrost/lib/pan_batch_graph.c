@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <assert.h>
+
+#include "pan_batch_graph.h"
+
+bool
+pan_batch_graph_depends_on(const struct pan_batch_graph *graph, unsigned slot,
+                           unsigned other)
+{
+        BITSET_DECLARE(visited, PAN_BATCH_GRAPH_MAX);
+        BITSET_DECLARE(pending, PAN_BATCH_GRAPH_MAX);
+        int i;
+
+        BITSET_ZERO(visited);
+        BITSET_COPY(pending, graph->deps[slot]);
+
+        while ((i = BITSET_FFS(pending)) > 0) {
+                unsigned idx = i - 1;
+
+                if (idx == other)
+                        return true;
+
+                BITSET_CLEAR(pending, idx);
+                BITSET_SET(visited, idx);
+
+                for (unsigned w = 0; w < BITSET_WORDS(PAN_BATCH_GRAPH_MAX); ++w)
+                        pending[w] |= graph->deps[idx][w] & ~visited[w];
+        }
+
+        return false;
+}
+
+bool
+pan_batch_graph_has_dependents(const struct pan_batch_graph *graph,
+                               unsigned slot)
+{
+        for (unsigned i = 0; i < PAN_BATCH_GRAPH_MAX; ++i) {
+                if (BITSET_TEST(graph->deps[i], slot))
+                        return true;
+        }
+
+        return false;
+}
+
+bool
+pan_batch_graph_add(struct pan_batch_graph *graph, unsigned slot,
+                    unsigned other, int current)
+{
+        assert(slot != other);
+
+        if (other == current)
+                return false;
+
+        /* Batches that others depend on are never recorded into again, so
+         * there can't be a cycle */
+        assert(!pan_batch_graph_depends_on(graph, other, slot));
+
+        BITSET_SET(graph->deps[slot], other);
+        return true;
+}
+
+static void
+pan_batch_graph_visit(const struct pan_batch_graph *graph, unsigned slot,
+                      BITSET_WORD *visited, uint8_t *order, unsigned *count)
+{
+        unsigned dep;
+
+        BITSET_SET(visited, slot);
+
+        BITSET_FOREACH_SET(dep, graph->deps[slot], PAN_BATCH_GRAPH_MAX) {
+                if (!BITSET_TEST(visited, dep))
+                        pan_batch_graph_visit(graph, dep, visited, order, count);
+        }
+
+        order[(*count)++] = slot;
+}
+
+unsigned
+pan_batch_graph_order(const struct pan_batch_graph *graph, unsigned slot,
+                      uint8_t order[PAN_BATCH_GRAPH_MAX])
+{
+        BITSET_DECLARE(visited, PAN_BATCH_GRAPH_MAX);
+        unsigned count = 0;
+
+        BITSET_ZERO(visited);
+        pan_batch_graph_visit(graph, slot, visited, order, &count);
+
+        return count;
+}
+
+void
+pan_batch_graph_remove(struct pan_batch_graph *graph, unsigned slot)
+{
+        BITSET_ZERO(graph->deps[slot]);
+
+        for (unsigned i = 0; i < PAN_BATCH_GRAPH_MAX; ++i)
+                BITSET_CLEAR(graph->deps[i], slot);
+}
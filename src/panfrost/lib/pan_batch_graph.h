@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __PAN_BATCH_GRAPH_H__
+#define __PAN_BATCH_GRAPH_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "util/bitset.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Order in which the batches of a context are submitted, by batch slot. A
+ * batch depends on the batches that accessed one of its resources in a
+ * conflicting way before it, and is submitted after them.
+ *
+ * A batch that others depend on must not be recorded into again, as what is
+ * added to it would be seen by them too early. This is what keeps the graph
+ * free of cycles: such a batch is submitted when the context needs it again,
+ * and a dependency on the batch being recorded into submits it at once.
+ */
+
+#define PAN_BATCH_GRAPH_MAX 32
+
+struct pan_batch_graph {
+        /* Slots that must be submitted before each slot */
+        BITSET_WORD deps[PAN_BATCH_GRAPH_MAX][BITSET_WORDS(PAN_BATCH_GRAPH_MAX)];
+};
+
+/* Returns whether slot must be submitted after other, directly or through
+ * other dependencies */
+bool
+pan_batch_graph_depends_on(const struct pan_batch_graph *graph, unsigned slot,
+                           unsigned other);
+
+/* Returns whether other slots must be submitted after slot. It must then be
+ * submitted before being recorded into again. */
+bool
+pan_batch_graph_has_dependents(const struct pan_batch_graph *graph,
+                               unsigned slot);
+
+static inline bool
+pan_batch_graph_has_deps(const struct pan_batch_graph *graph, unsigned slot)
+{
+        return BITSET_COUNT(graph->deps[slot]) != 0;
+}
+
+/* Orders slot after other. current is the slot being recorded into, or -1.
+ * Returns false without adding anything if other is current, which must be
+ * submitted before slot instead. */
+bool
+pan_batch_graph_add(struct pan_batch_graph *graph, unsigned slot,
+                    unsigned other, int current);
+
+/* Fills order with the slots to submit for slot, its dependencies first and
+ * slot last, and returns how many there are */
+unsigned
+pan_batch_graph_order(const struct pan_batch_graph *graph, unsigned slot,
+                      uint8_t order[PAN_BATCH_GRAPH_MAX]);
+
+/* Drops the slot of a batch that was submitted or destroyed, so that it can
+ * be reused by an unrelated batch */
+void
+pan_batch_graph_remove(struct pan_batch_graph *graph, unsigned slot);
+
+#ifdef __cplusplus
+} /* extern C */
+#endif
+
+#endif
@@ -31,6 +31,7 @@
 #include "drm-uapi/panfrost_drm.h"
 
 #include "pan_bo.h"
+#include "pan_capture.h"
 #include "pan_device.h"
 #include "pan_util.h"
 #include "wrap.h"
@@ -164,6 +165,59 @@ panfrost_bo_free(struct panfrost_bo *bo)
         memset(bo, 0, sizeof(*bo));
 }
 
+/* Dependency lists are sorted by queue, with at most one entry for each
+ * (queue, write) pair. Merge the usage u into deps, starting the search at
+ * index, and return the index it ended up at. */
+
+unsigned
+panfrost_add_dep_after(struct util_dynarray *deps,
+                       struct panfrost_usage u,
+                       unsigned index)
+{
+        unsigned size = util_dynarray_num_elements(deps, struct panfrost_usage);
+
+        for (unsigned i = index; i < size; ++i) {
+                struct panfrost_usage *d =
+                        util_dynarray_element(deps, struct panfrost_usage, i);
+
+                /* TODO: Remove d if it is an invalid entry? */
+
+                if ((d->queue == u.queue) && (d->write == u.write)) {
+                        d->seqnum = MAX2(d->seqnum, u.seqnum);
+                        return i;
+
+                } else if (d->queue > u.queue) {
+                        void *p = util_dynarray_grow(deps, struct panfrost_usage, 1);
+                        assert(p);
+                        memmove(util_dynarray_element(deps, struct panfrost_usage, i + 1),
+                                util_dynarray_element(deps, struct panfrost_usage, i),
+                                (size - i) * sizeof(struct panfrost_usage));
+
+                        *util_dynarray_element(deps, struct panfrost_usage, i) = u;
+                        return i;
+                }
+        }
+
+        util_dynarray_append(deps, struct panfrost_usage, u);
+        return size;
+}
+
+void
+panfrost_update_deps(struct util_dynarray *deps, const struct panfrost_bo *bo,
+                     bool write)
+{
+        /* Both lists should be sorted, so each dependency is at a higher
+         * index than the last */
+        unsigned index = 0;
+        util_dynarray_foreach(&bo->usage, struct panfrost_usage, u) {
+                /* read->read access does not require a dependency */
+                if (!write && !u->write)
+                        continue;
+
+                index = panfrost_add_dep_after(deps, *u, index);
+        }
+}
+
 static bool
 panfrost_bo_usage_finished(struct panfrost_bo *bo, bool readers)
 {
@@ -492,6 +546,24 @@ panfrost_bo_cache_evict_all(
         pthread_mutex_unlock(&dev->bo_cache.lock);
 }
 
+/* Tell the capture about a BO, or about its CPU mapping if it was created
+ * before being mapped */
+
+static void
+panfrost_bo_capture_map(struct panfrost_bo *bo)
+{
+        uint32_t flags = 0;
+
+        if (bo->flags & PAN_BO_EXECUTE)
+                flags |= PAN_CAPTURE_MAP_EXECUTE;
+
+        if (bo->flags & PAN_BO_INVISIBLE)
+                flags |= PAN_CAPTURE_MAP_INVISIBLE;
+
+        pan_capture_map(bo->dev->capture, bo->ptr.gpu, bo->ptr.cpu, bo->size,
+                        flags);
+}
+
 void
 panfrost_bo_mmap(struct panfrost_bo *bo)
 {
@@ -515,6 +587,8 @@ panfrost_bo_mmap(struct panfrost_bo *bo)
                         "mmap failed: result=%p size=0x%llx fd=%i offset=0x%llx %m\n",
                         bo->ptr.cpu, (long long)bo->size, bo->dev->fd,
                         (long long)mmap_bo.offset);
+        } else if (bo->dev->capture) {
+                panfrost_bo_capture_map(bo);
         }
 }
 
@@ -603,6 +677,9 @@ panfrost_bo_create(struct panfrost_device *dev, size_t size,
                         pandecode_inject_mmap(bo->ptr.gpu, bo->ptr.cpu, bo->size, NULL);
         }
 
+        if (dev->capture)
+                panfrost_bo_capture_map(bo);
+
         if (dev->bo_log) {
                 struct timespec tp;
                 clock_gettime(CLOCK_MONOTONIC_RAW, &tp);
@@ -628,6 +705,10 @@ panfrost_bo_fini(struct panfrost_bo *bo)
 {
         struct panfrost_device *dev = bo->dev;
 
+        /* Stop capturing the BO before its CPU mapping goes away */
+        if (dev->capture)
+                pan_capture_unmap(dev->capture, bo->ptr.gpu);
+
         /* When the reference count goes to zero, we need to cleanup */
         panfrost_bo_munmap(bo);
 
@@ -807,6 +888,9 @@ panfrost_bo_import(struct panfrost_device *dev, int fd)
                         bo->dmabuf_fd = -1;
                 }
                 p_atomic_set(&bo->refcnt, 1);
+
+                if (dev->capture)
+                        panfrost_bo_capture_map(bo);
         } else {
                 found = true;
 
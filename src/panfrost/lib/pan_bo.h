@@ -31,6 +31,10 @@
 #include "panfrost-job.h"
 #include <time.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /* Flags for allocated memory */
 
 /* This memory region is executable */
@@ -173,4 +177,15 @@ panfrost_bo_export(struct panfrost_bo *bo);
 void
 panfrost_bo_cache_evict_all(struct panfrost_device *dev);
 
+unsigned
+panfrost_add_dep_after(struct util_dynarray *deps, struct panfrost_usage u,
+                       unsigned index);
+void
+panfrost_update_deps(struct util_dynarray *deps, const struct panfrost_bo *bo,
+                     bool write);
+
+#ifdef __cplusplus
+} /* extern C */
+#endif
+
 #endif /* __PAN_BO_H__ */
@@ -0,0 +1,376 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/hash_table.h"
+#include "util/macros.h"
+#include "util/rb_tree.h"
+#include "util/simple_mtx.h"
+#include "util/u_math.h"
+
+#define XXH_INLINE_ALL
+#include "util/xxhash.h"
+
+#include "pan_capture.h"
+#include "pan_tiler_heap.h"
+
+struct pan_capture_mapping {
+        struct rb_node node;
+
+        uint64_t va;
+        size_t size;
+        void *cpu;
+        uint32_t flags;
+
+        /* Hash of each page as of the last DATA record, or of zeroes if
+         * the page was never written to the capture */
+        uint64_t *hashes;
+};
+
+struct pan_capture {
+        simple_mtx_t lock;
+        FILE *fp;
+
+        struct rb_tree mappings;
+
+        /* Hashes of the blobs already written, so the contents of a page
+         * are only written once however many times it is seen */
+        struct hash_table_u64 *blobs;
+
+        /* Hash of a full page of zeroes */
+        uint64_t zero_hash;
+};
+
+#define to_mapping(x) rb_node_data(struct pan_capture_mapping, x, node)
+
+static const uint8_t zero_page[PAN_CAPTURE_PAGE_SIZE];
+
+uint64_t
+pan_capture_hash(const void *data, size_t size)
+{
+        uint64_t hash = XXH64(data, size, 0);
+
+        /* Keep 0 free for readers to mean "no contents" */
+        return hash ?: 1;
+}
+
+static int
+pan_capture_cmp_key(const struct rb_node *lhs, const void *key)
+{
+        uint64_t va = to_mapping(lhs)->va;
+        uint64_t other = *(const uint64_t *) key;
+
+        return (va > other) - (va < other);
+}
+
+static int
+pan_capture_cmp(const struct rb_node *lhs, const struct rb_node *rhs)
+{
+        return pan_capture_cmp_key(lhs, &to_mapping(rhs)->va);
+}
+
+static struct pan_capture_mapping *
+pan_capture_find(struct pan_capture *cap, uint64_t va)
+{
+        struct rb_node *node = rb_tree_search(&cap->mappings, &va,
+                                              pan_capture_cmp_key);
+
+        return node ? to_mapping(node) : NULL;
+}
+
+static void
+pan_capture_write(struct pan_capture *cap, enum pan_capture_record_type type,
+                  const void *payload, size_t size,
+                  const void *data, size_t data_size)
+{
+        struct pan_capture_record record = {
+                .type = type,
+                .size = size + data_size,
+        };
+
+        fwrite(&record, sizeof(record), 1, cap->fp);
+
+        if (size)
+                fwrite(payload, size, 1, cap->fp);
+
+        if (data_size)
+                fwrite(data, data_size, 1, cap->fp);
+}
+
+static uint64_t
+pan_capture_zero_hash(struct pan_capture *cap, size_t size)
+{
+        if (size == PAN_CAPTURE_PAGE_SIZE)
+                return cap->zero_hash;
+
+        return pan_capture_hash(zero_page, size);
+}
+
+struct pan_capture *
+pan_capture_create(const char *path, unsigned gpu_id)
+{
+        FILE *fp = fopen(path, "wb");
+
+        if (!fp) {
+                fprintf(stderr, "panfrost: could not open capture file %s\n",
+                        path);
+                return NULL;
+        }
+
+        struct pan_capture *cap = calloc(1, sizeof(*cap));
+
+        simple_mtx_init(&cap->lock, mtx_plain);
+        rb_tree_init(&cap->mappings);
+        cap->blobs = _mesa_hash_table_u64_create(NULL);
+        cap->zero_hash = pan_capture_hash(zero_page, sizeof(zero_page));
+        cap->fp = fp;
+
+        struct pan_capture_header header = {
+                .magic = PAN_CAPTURE_MAGIC,
+                .version = PAN_CAPTURE_VERSION,
+                .gpu_id = gpu_id,
+                .page_size = PAN_CAPTURE_PAGE_SIZE,
+        };
+
+        fwrite(&header, sizeof(header), 1, fp);
+        return cap;
+}
+
+void
+pan_capture_destroy(struct pan_capture *cap)
+{
+        if (!cap)
+                return;
+
+        rb_tree_foreach_safe(struct pan_capture_mapping, it, &cap->mappings, node) {
+                rb_tree_remove(&cap->mappings, &it->node);
+                free(it->hashes);
+                free(it);
+        }
+
+        _mesa_hash_table_u64_destroy(cap->blobs);
+        fclose(cap->fp);
+        simple_mtx_destroy(&cap->lock);
+        free(cap);
+}
+
+void
+pan_capture_map(struct pan_capture *cap, uint64_t va, void *cpu, size_t size,
+                uint32_t flags)
+{
+        simple_mtx_lock(&cap->lock);
+
+        /* Buffers created with PAN_BO_DELAY_MMAP are announced again once
+         * they get a CPU mapping */
+        struct pan_capture_mapping *mapping = pan_capture_find(cap, va);
+
+        if (mapping) {
+                assert(mapping->size == size);
+                mapping->cpu = cpu;
+                simple_mtx_unlock(&cap->lock);
+                return;
+        }
+
+        unsigned nr_pages = DIV_ROUND_UP(size, PAN_CAPTURE_PAGE_SIZE);
+
+        mapping = calloc(1, sizeof(*mapping));
+        mapping->va = va;
+        mapping->size = size;
+        mapping->cpu = cpu;
+        mapping->flags = flags;
+        mapping->hashes = malloc(nr_pages * sizeof(uint64_t));
+
+        for (unsigned i = 0; i < nr_pages; ++i) {
+                size_t offset = (size_t) i * PAN_CAPTURE_PAGE_SIZE;
+
+                mapping->hashes[i] =
+                        pan_capture_zero_hash(cap, MIN2(size - offset,
+                                                        PAN_CAPTURE_PAGE_SIZE));
+        }
+
+        rb_tree_insert(&cap->mappings, &mapping->node, pan_capture_cmp);
+
+        struct pan_capture_map record = {
+                .va = va,
+                .size = size,
+                .flags = flags,
+        };
+
+        pan_capture_write(cap, PAN_CAPTURE_MAP, &record, sizeof(record), NULL, 0);
+        simple_mtx_unlock(&cap->lock);
+}
+
+void
+pan_capture_unmap(struct pan_capture *cap, uint64_t va)
+{
+        simple_mtx_lock(&cap->lock);
+
+        struct pan_capture_mapping *mapping = pan_capture_find(cap, va);
+
+        if (mapping) {
+                struct pan_capture_unmap record = { .va = va };
+
+                pan_capture_write(cap, PAN_CAPTURE_UNMAP, &record,
+                                  sizeof(record), NULL, 0);
+
+                rb_tree_remove(&cap->mappings, &mapping->node);
+                free(mapping->hashes);
+                free(mapping);
+        }
+
+        simple_mtx_unlock(&cap->lock);
+}
+
+/* Write the pages that changed since the previous submit. The GPU and other
+ * threads may write to the buffers while we look at them, so each page is
+ * copied first to make sure the hash matches the data written out. */
+static void
+pan_capture_snapshot(struct pan_capture *cap)
+{
+        uint8_t page[PAN_CAPTURE_PAGE_SIZE];
+
+        rb_tree_foreach(struct pan_capture_mapping, it, &cap->mappings, node) {
+                if (!it->cpu)
+                        continue;
+
+                for (size_t offset = 0, i = 0; offset < it->size;
+                     offset += PAN_CAPTURE_PAGE_SIZE, ++i) {
+                        size_t size = MIN2(it->size - offset, sizeof(page));
+
+                        memcpy(page, (uint8_t *) it->cpu + offset, size);
+
+                        uint64_t hash = pan_capture_hash(page, size);
+
+                        if (hash == it->hashes[i])
+                                continue;
+
+                        if (!_mesa_hash_table_u64_search(cap->blobs, hash)) {
+                                struct pan_capture_blob blob = {
+                                        .hash = hash,
+                                        .size = size,
+                                };
+
+                                pan_capture_write(cap, PAN_CAPTURE_BLOB, &blob,
+                                                  sizeof(blob), page, size);
+                                _mesa_hash_table_u64_insert(cap->blobs, hash,
+                                                            (void *) 1);
+                        }
+
+                        struct pan_capture_data data = {
+                                .va = it->va + offset,
+                                .hash = hash,
+                        };
+
+                        pan_capture_write(cap, PAN_CAPTURE_DATA, &data,
+                                          sizeof(data), NULL, 0);
+                        it->hashes[i] = hash;
+                }
+        }
+}
+
+void
+pan_capture_submit_jc(struct pan_capture *cap, uint64_t jc,
+                      uint32_t requirements)
+{
+        simple_mtx_lock(&cap->lock);
+        pan_capture_snapshot(cap);
+
+        struct pan_capture_submit_jc record = {
+                .jc = jc,
+                .requirements = requirements,
+        };
+
+        pan_capture_write(cap, PAN_CAPTURE_SUBMIT_JC, &record, sizeof(record),
+                          NULL, 0);
+
+        /* Keep the capture usable if the submit hangs the GPU */
+        fflush(cap->fp);
+        simple_mtx_unlock(&cap->lock);
+}
+
+void
+pan_capture_submit_cs(struct pan_capture *cap, unsigned queue,
+                      uint64_t ring_va, uint32_t ring_size,
+                      uint64_t start, uint64_t end)
+{
+        simple_mtx_lock(&cap->lock);
+        pan_capture_snapshot(cap);
+
+        struct pan_capture_submit_cs record = {
+                .ring_va = ring_va,
+                .ring_size = ring_size,
+                .queue = queue,
+                .start = start,
+                .end = end,
+        };
+
+        pan_capture_write(cap, PAN_CAPTURE_SUBMIT_CS, &record, sizeof(record),
+                          NULL, 0);
+
+        fflush(cap->fp);
+        simple_mtx_unlock(&cap->lock);
+}
+
+void
+pan_capture_frame(struct pan_capture *cap)
+{
+        simple_mtx_lock(&cap->lock);
+        pan_capture_write(cap, PAN_CAPTURE_FRAME, NULL, 0, NULL, 0);
+        fflush(cap->fp);
+        simple_mtx_unlock(&cap->lock);
+}
+
+void
+pan_capture_tiler_heap(struct pan_capture *cap, unsigned width,
+                       unsigned height, unsigned hierarchy_mask)
+{
+        struct pan_capture_tiler_heap record = {
+                .width = width,
+                .height = height,
+                .hierarchy_mask = hierarchy_mask,
+        };
+
+        simple_mtx_lock(&cap->lock);
+        pan_capture_write(cap, PAN_CAPTURE_TILER_HEAP, &record, sizeof(record),
+                          NULL, 0);
+        simple_mtx_unlock(&cap->lock);
+}
+
+void
+pan_capture_tiler_chunk(struct pan_capture *cap, uint64_t va, uint32_t size,
+                        const void *data)
+{
+        struct pan_capture_tiler_chunk record = {
+                .va = va,
+                .size = size,
+        };
+
+        simple_mtx_lock(&cap->lock);
+        pan_capture_write(cap, PAN_CAPTURE_TILER_CHUNK, &record, sizeof(record),
+                          data, pan_tiler_heap_used_size(data, size));
+        fflush(cap->fp);
+        simple_mtx_unlock(&cap->lock);
+}
@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __PAN_CAPTURE_H__
+#define __PAN_CAPTURE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Binary capture of the work submitted to the GPU, for panreplay.
+ *
+ * A capture is a pan_capture_header followed by records, each made of a
+ * pan_capture_record and its payload. Buffers are tracked per page: when a
+ * job is submitted, the pages whose contents changed since the previous
+ * submit get a DATA record, and the contents of a page are only written to
+ * the file the first time they are seen, as a BLOB identified by its hash.
+ *
+ * Values are stored in the byte order of the capturing CPU, the magic
+ * number tells the reader whether it matches its own.
+ */
+
+#define PAN_CAPTURE_MAGIC 0x50414e43 /* "PANC" */
+#define PAN_CAPTURE_VERSION 2
+
+#define PAN_CAPTURE_PAGE_SIZE 4096
+
+enum pan_capture_record_type {
+        /* Contents of a page, followed by the data */
+        PAN_CAPTURE_BLOB = 1,
+
+        /* Buffer mapped in the GPU address space, initially zeroed */
+        PAN_CAPTURE_MAP,
+
+        /* Buffer unmapped */
+        PAN_CAPTURE_UNMAP,
+
+        /* Page of a buffer set to the contents of a blob */
+        PAN_CAPTURE_DATA,
+
+        /* Job chain submitted on a Job Manager GPU */
+        PAN_CAPTURE_SUBMIT_JC,
+
+        /* Instructions submitted to a command stream ring on a CSF GPU */
+        PAN_CAPTURE_SUBMIT_CS,
+
+        /* End of a frame, no payload */
+        PAN_CAPTURE_FRAME,
+
+        /* Tiler heap of the previous CSF submit, followed by its chunks.
+         * Added in version 2. */
+        PAN_CAPTURE_TILER_HEAP,
+
+        /* Chunk of the tiler heap, followed by the data up to the last
+         * non-zero byte */
+        PAN_CAPTURE_TILER_CHUNK,
+};
+
+struct pan_capture_header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t gpu_id;
+        uint32_t page_size;
+};
+
+struct pan_capture_record {
+        uint32_t type;
+
+        /* Size of the payload following the record */
+        uint32_t size;
+};
+
+struct pan_capture_blob {
+        uint64_t hash;
+        uint64_t size;
+};
+
+/* Buffer may contain shaders */
+#define PAN_CAPTURE_MAP_EXECUTE (1 << 0)
+
+/* Contents are not visible to the CPU, so never captured */
+#define PAN_CAPTURE_MAP_INVISIBLE (1 << 1)
+
+struct pan_capture_map {
+        uint64_t va;
+        uint64_t size;
+        uint32_t flags;
+        uint32_t pad;
+};
+
+struct pan_capture_unmap {
+        uint64_t va;
+};
+
+struct pan_capture_data {
+        /* Page aligned */
+        uint64_t va;
+        uint64_t hash;
+};
+
+struct pan_capture_submit_jc {
+        uint64_t jc;
+
+        /* PANFROST_JD_REQ_* */
+        uint32_t requirements;
+        uint32_t pad;
+};
+
+struct pan_capture_submit_cs {
+        uint64_t ring_va;
+        uint32_t ring_size;
+
+        /* 0 for the vertex/compute queue, 1 for the fragment queue */
+        uint32_t queue;
+
+        /* Offsets of the submitted instructions in the ring. Like the
+         * insert offsets passed to the kernel, they count every lap of the
+         * ring, so start % ring_size is where the instructions begin. */
+        uint64_t start;
+        uint64_t end;
+};
+
+struct pan_capture_tiler_heap {
+        uint32_t width;
+        uint32_t height;
+        uint32_t hierarchy_mask;
+        uint32_t pad;
+};
+
+struct pan_capture_tiler_chunk {
+        uint64_t va;
+        uint32_t size;
+        uint32_t pad;
+};
+
+/* Hash of the contents of a page, never 0 */
+uint64_t pan_capture_hash(const void *data, size_t size);
+
+struct pan_capture;
+
+struct pan_capture *
+pan_capture_create(const char *path, unsigned gpu_id);
+
+void pan_capture_destroy(struct pan_capture *cap);
+
+void
+pan_capture_map(struct pan_capture *cap, uint64_t va, void *cpu, size_t size,
+                uint32_t flags);
+
+void pan_capture_unmap(struct pan_capture *cap, uint64_t va);
+
+void
+pan_capture_submit_jc(struct pan_capture *cap, uint64_t jc,
+                      uint32_t requirements);
+
+void
+pan_capture_submit_cs(struct pan_capture *cap, unsigned queue,
+                      uint64_t ring_va, uint32_t ring_size,
+                      uint64_t start, uint64_t end);
+
+void pan_capture_frame(struct pan_capture *cap);
+
+void
+pan_capture_tiler_heap(struct pan_capture *cap, unsigned width,
+                       unsigned height, unsigned hierarchy_mask);
+
+void
+pan_capture_tiler_chunk(struct pan_capture *cap, uint64_t va, uint32_t size,
+                        const void *data);
+
+#ifdef __cplusplus
+} /* extern C */
+#endif
+
+#endif
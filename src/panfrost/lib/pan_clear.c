@@ -164,3 +164,29 @@ pan_pack_color(uint32_t *packed, const union pipe_color_union *color,
 
         pan_pack_color_32(packed, ur | ug | ub | ua);
 }
+
+/* Fragment jobs are bounded in units of 16x16 tiles, and cleared tiles are
+ * written out in full. A clear of a region of a render target can thus be
+ * expressed by restricting the bounds of a cleared fragment job only if the
+ * region is aligned to tiles, except where it extends to the edge of the
+ * framebuffer since nothing is written out beyond it.
+ */
+
+#define PAN_CLEAR_TILE_SIZE 16
+
+bool
+pan_clear_region_is_tile_aligned(unsigned x, unsigned y,
+                                 unsigned width, unsigned height,
+                                 unsigned fb_width, unsigned fb_height)
+{
+        unsigned maxx = x + width, maxy = y + height;
+
+        if (!width || !height || maxx > fb_width || maxy > fb_height)
+                return false;
+
+        if ((x | y) & (PAN_CLEAR_TILE_SIZE - 1))
+                return false;
+
+        return ((maxx & (PAN_CLEAR_TILE_SIZE - 1)) == 0 || maxx == fb_width) &&
+               ((maxy & (PAN_CLEAR_TILE_SIZE - 1)) == 0 || maxy == fb_height);
+}
@@ -88,6 +88,16 @@ pan_sample_pattern(unsigned samples)
 }
 #endif
 
+/* CRC buffers live in each level of the miptree, which is duplicated for
+ * every layer of an array */
+
+static unsigned
+pan_crc_layer_offset(const struct pan_image_view *rt)
+{
+        return rt->first_layer *
+               panfrost_get_layer_stride(&rt->image->layout, rt->first_level);
+}
+
 int
 GENX(pan_select_crc_rt)(const struct pan_fb_info *fb, unsigned tile_size)
 {
@@ -107,7 +117,7 @@ GENX(pan_select_crc_rt)(const struct pan_fb_info *fb, unsigned tile_size)
 
 #if PAN_ARCH <= 6
         if (fb->rt_count == 1 && fb->rts[0].view && !fb->rts[0].discard &&
-            fb->rts[0].view->image->layout.crc)
+            fb->rts[0].view->image->layout.crc && fb->rts[0].crc_valid)
                 return 0;
 
         return -1;
@@ -117,7 +127,8 @@ GENX(pan_select_crc_rt)(const struct pan_fb_info *fb, unsigned tile_size)
 
         for (unsigned i = 0; i < fb->rt_count; i++) {
 		if (!fb->rts[i].view || fb->rts[0].discard ||
-                    !fb->rts[i].view->image->layout.crc)
+                    !fb->rts[i].view->image->layout.crc ||
+                    !fb->rts[i].crc_valid)
                         continue;
 
                 bool valid = *(fb->rts[i].crc_valid);
@@ -275,6 +286,7 @@ pan_prepare_crc(const struct pan_fb_info *fb, int rt_crc,
         const struct pan_image_view *rt = fb->rts[rt_crc].view;
         const struct pan_image_slice_layout *slice = &rt->image->layout.slices[rt->first_level];
         ext->crc_base = rt->image->data.bo->ptr.gpu + rt->image->data.offset
+                                                    + pan_crc_layer_offset(rt)
                                                     + slice->crc.offset;
         ext->crc_row_stride = slice->crc.stride;
 
@@ -794,6 +806,12 @@ GENX(pan_emit_fbd)(const struct panfrost_device *dev,
                          * valid for next time. */
                         cfg.crc_write_enable = *valid || full;
 
+                        if (*valid && fb->crc_checked_tiles) {
+                                *fb->crc_checked_tiles +=
+                                        (fb->extent.maxx / 16 - fb->extent.minx / 16 + 1) *
+                                        (fb->extent.maxy / 16 - fb->extent.miny / 16 + 1);
+                        }
+
                         *valid |= full;
                 }
 
@@ -831,7 +849,7 @@ GENX(pan_emit_fbd)(const struct panfrost_device *dev,
                 cbuf_offset += pan_bytes_per_pixel_tib(fb->rts[i].view->format) *
                                tile_size * fb->rts[i].view->image->layout.nr_samples;
 
-                if (i != crc_rt)
+                if (i != crc_rt && fb->rts[i].crc_valid)
                         *(fb->rts[i].crc_valid) = false;
         }
         tags |= MALI_POSITIVE(MAX2(fb->rt_count, 1)) << 2;
@@ -910,6 +928,7 @@ GENX(pan_emit_fbd)(const struct panfrost_device *dev,
                                 cfg.crc_buffer.row_stride = slice->crc.stride;
                                 cfg.crc_buffer.base = rt->image->data.bo->ptr.gpu +
                                                       rt->image->data.offset +
+                                                      pan_crc_layer_offset(rt) +
                                                       slice->crc.offset;
                         }
                 }
@@ -114,6 +114,10 @@ struct pan_fb_info {
                 mali_ptr base;
         } tile_map;
 
+        /* If set, incremented by the number of tiles whose writeback is
+         * checked against a valid CRC, and may thus be eliminated */
+        uint64_t *crc_checked_tiles;
+
         union {
                 struct pan_fb_bifrost_info bifrost;
         };
@@ -185,6 +185,9 @@ struct panfrost_device {
         int fd;
         bool kbase;
 
+        /* No GPU executes the work, with drm-shim or the noop kbase */
+        bool no_gpu;
+
         /* Properties of the GPU in use */
         unsigned arch;
         unsigned gpu_id;
@@ -209,6 +212,11 @@ struct panfrost_device {
         /* Does the kernel support dma-buf fence import/export? */
         bool has_dmabuf_fence;
 
+        /* Frequency of the GPU system timestamp in Hz, or zero if the
+         * kernel can't report it, which is always the case with the
+         * panfrost DRM driver */
+        uint64_t timestamp_frequency;
+
         /* Table of formats, indexed by a PIPE format */
         const struct panfrost_format *formats;
 
@@ -275,6 +283,9 @@ struct panfrost_device {
         struct kbase_ mali;
 
         FILE *bo_log;
+
+        /* Capture of the submitted work, see pan_capture.h */
+        struct pan_capture *capture;
 };
 
 void
@@ -304,6 +315,21 @@ panfrost_query_sample_position(
 unsigned
 panfrost_query_l2_slices(struct panfrost_device *dev);
 
+uint64_t
+panfrost_query_timestamp(struct panfrost_device *dev);
+
+/* Converts a GPU system timestamp to nanoseconds, splitting the
+ * multiplication so that it doesn't overflow for large timestamps */
+
+static inline uint64_t
+panfrost_timestamp_to_ns(const struct panfrost_device *dev, uint64_t ts)
+{
+        uint64_t freq = dev->timestamp_frequency;
+
+        return (ts / freq) * 1000000000ull +
+               (ts % freq) * 1000000000ull / freq;
+}
+
 static inline struct panfrost_bo *
 pan_lookup_bo(struct panfrost_device *dev, uint32_t gem_handle)
 {
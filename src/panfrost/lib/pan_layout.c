@@ -285,6 +285,70 @@ panfrost_texture_offset(const struct pan_image_layout *layout,
                (surface_idx * layout->slices[level].surface_stride);
 }
 
+/* Computes the byte range of a surface (array layer or 3D slice) at a given
+ * level that holds a rectangle of pixels, for cache maintenance of partial
+ * accesses. Rows of texels (or of tiles, for u-interleaved images) outside the
+ * rectangle are excluded, but the range is contiguous, so it spans the full
+ * row stride between the first and last rows. AFBC images are not addressable
+ * at this granularity, so the whole surface is returned.
+ */
+
+struct pan_image_range
+pan_image_surface_range(const struct pan_image_layout *layout,
+                        unsigned level, unsigned surface,
+                        unsigned x, unsigned y,
+                        unsigned width, unsigned height)
+{
+        const struct pan_image_slice_layout *slice = &layout->slices[level];
+        bool is_3d = layout->dim == MALI_TEXTURE_DIMENSION_3D;
+
+        if (drm_is_afbc(layout->modifier)) {
+                /* 3D AFBC headers are allocated together ahead of the bodies */
+                if (is_3d) {
+                        return (struct pan_image_range) {
+                                .offset = slice->offset,
+                                .size = slice->afbc.header_size +
+                                        slice->afbc.body_size,
+                        };
+                }
+
+                return (struct pan_image_range) {
+                        .offset = panfrost_texture_offset(layout, level,
+                                                          surface, 0),
+                        .size = slice->afbc.surface_stride,
+                };
+        }
+
+        if (width == 0 || height == 0)
+                return (struct pan_image_range) { 0 };
+
+        unsigned base = is_3d ?
+                panfrost_texture_offset(layout, level, 0, surface) :
+                panfrost_texture_offset(layout, level, surface, 0);
+
+        /* Convert to format blocks, then to interleaving tiles (1x1 if linear) */
+        const struct util_format_description *desc =
+                util_format_description(layout->format);
+        struct pan_block_size tile =
+                panfrost_block_size(layout->modifier, layout->format);
+
+        unsigned x0 = (x / desc->block.width) / tile.width;
+        unsigned y0 = (y / desc->block.height) / tile.height;
+        unsigned x1 = DIV_ROUND_UP(DIV_ROUND_UP(x + width, desc->block.width),
+                                   tile.width);
+        unsigned y1 = DIV_ROUND_UP(DIV_ROUND_UP(y + height, desc->block.height),
+                                   tile.height);
+
+        unsigned tile_bytes = (desc->block.bits / 8) * tile.width * tile.height;
+        unsigned start = (y0 * slice->row_stride) + (x0 * tile_bytes);
+        unsigned end = ((y1 - 1) * slice->row_stride) + (x1 * tile_bytes);
+
+        return (struct pan_image_range) {
+                .offset = base + start,
+                .size = end - start,
+        };
+}
+
 bool
 pan_image_layout_init(struct pan_image_layout *layout,
                       const struct pan_image_explicit_layout *explicit_layout)
@@ -423,6 +487,58 @@ pan_image_layout_init(struct pan_image_layout *layout,
         return true;
 }
 
+/* Number of superblocks, and thus of headers, in a level of an AFBC image */
+
+unsigned
+pan_afbc_superblock_count(const struct pan_image_layout *layout,
+                          unsigned level)
+{
+        unsigned align_h = panfrost_afbc_superblock_height(layout->modifier) *
+                           pan_afbc_tile_size(layout->modifier);
+        unsigned height = ALIGN_POT(u_minify(layout->height, level), align_h);
+
+        return (layout->slices[level].row_stride / AFBC_HEADER_BYTES_PER_TILE) *
+               (height / align_h);
+}
+
+/* Rewrite the layout of an AFBC image whose superblock bodies are packed, given
+ * the packed body size of each level as returned by pan_afbc_pack_offsets.
+ * Headers keep their size, only the bodies and thus the level offsets change.
+ * Only single-layer, single-sampled 2D images without CRC may be packed.
+ */
+
+bool
+pan_image_layout_pack_afbc(struct pan_image_layout *layout,
+                           const unsigned *body_sizes)
+{
+        if (!drm_is_afbc(layout->modifier) ||
+            layout->dim != MALI_TEXTURE_DIMENSION_2D ||
+            layout->array_size > 1 || layout->nr_samples > 1 || layout->crc)
+                return false;
+
+        unsigned offset = 0;
+
+        for (unsigned l = 0; l < layout->nr_slices; ++l) {
+                struct pan_image_slice_layout *slice = &layout->slices[l];
+
+                offset = ALIGN_POT(offset, 64);
+
+                slice->offset = offset;
+                slice->afbc.body_size = ALIGN_POT(body_sizes[l], 64);
+                slice->surface_stride =
+                        slice->afbc.header_size + slice->afbc.body_size;
+                slice->afbc.surface_stride = slice->surface_stride;
+                slice->size = slice->surface_stride;
+
+                offset += slice->size;
+        }
+
+        layout->array_stride = ALIGN_POT(offset, 64);
+        layout->data_size = ALIGN_POT(layout->array_stride, 4096);
+
+        return true;
+}
+
 void
 pan_iview_get_surface(const struct pan_image_view *iview,
                       unsigned level, unsigned layer, unsigned sample,
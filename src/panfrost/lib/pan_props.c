@@ -31,11 +31,13 @@
 #include "util/macros.h"
 #include "util/hash_table.h"
 #include "util/u_thread.h"
+#include "util/u_debug.h"
 #include "drm-uapi/panfrost_drm.h"
 #include "dma-uapi/dma-buf.h"
 #include "pan_encoder.h"
 #include "pan_device.h"
 #include "pan_bo.h"
+#include "pan_capture.h"
 #include "pan_texture.h"
 #include "wrap.h"
 #include "pan_util.h"
@@ -148,6 +150,29 @@ panfrost_query_gpu_version(struct panfrost_device *dev)
         return panfrost_query_raw(dev, DRM_PANFROST_PARAM_GPU_PROD_ID, true, 0);
 }
 
+/* The panfrost DRM uapi has no param for the GPU system timestamp, so it is
+ * only known through kbase. Returns 0 if it can't be read. */
+
+static uint64_t
+panfrost_query_kbase_prop(struct panfrost_device *dev, unsigned name)
+{
+        uint64_t value;
+
+        if (dev->kbase && dev->mali.get_pan_gpuprop(&dev->mali, name, &value))
+                return value;
+
+        return 0;
+}
+
+/* Current value of the GPU system timestamp, in the same units as the
+ * timestamps written by the GPU */
+
+uint64_t
+panfrost_query_timestamp(struct panfrost_device *dev)
+{
+        return panfrost_query_kbase_prop(dev, PAN_BASE_PROP_SYSTEM_TIMESTAMP);
+}
+
 static unsigned
 panfrost_query_gpu_revision(struct panfrost_device *dev)
 {
@@ -308,6 +333,9 @@ panfrost_query_optimal_tib_size(const struct panfrost_device *dev)
 void
 panfrost_open_device(void *memctx, int fd, struct panfrost_device *dev)
 {
+        /* kbase falls back to a noop backend without a file descriptor */
+        dev->no_gpu = (fd == -1);
+
         if (kbase_open(&dev->mali, fd, 4, (dev->debug & PAN_DBG_LOG))) {
                 dev->kbase = true;
                 fd = -1;
@@ -325,6 +353,11 @@ panfrost_open_device(void *memctx, int fd, struct panfrost_device *dev)
                 };
         } else {
                 dev->kernel_version = drmGetVersion(fd);
+
+                /* drm-shim describes itself as such */
+                if (dev->kernel_version && dev->kernel_version->desc &&
+                    !strcmp(dev->kernel_version->desc, "shim"))
+                        dev->no_gpu = true;
         }
         dev->revision = panfrost_query_gpu_revision(dev);
         dev->model = panfrost_get_model(dev->gpu_id);
@@ -342,6 +375,8 @@ panfrost_open_device(void *memctx, int fd, struct panfrost_device *dev)
         dev->compressed_formats = panfrost_query_compressed_formats(dev);
         dev->tiler_features = panfrost_query_tiler_features(dev);
         dev->has_afbc = panfrost_query_afbc(dev, dev->arch);
+        dev->timestamp_frequency =
+                panfrost_query_kbase_prop(dev, PAN_BASE_PROP_SYSTEM_TIMESTAMP_FREQUENCY);
 
         if (dev->arch <= 6)
                 dev->formats = panfrost_pipe_format_v6;
@@ -364,6 +399,14 @@ panfrost_open_device(void *memctx, int fd, struct panfrost_device *dev)
         if (dev->debug & (PAN_DBG_TRACE | PAN_DBG_SYNC))
                 pandecode_initialize(!(dev->debug & PAN_DBG_TRACE));
 
+        /* Likewise, the capture has to see every BO from the start */
+        if (dev->debug & PAN_DBG_CAPTURE) {
+                const char *path = debug_get_option("PAN_CAPTURE_FILE",
+                                                    "/tmp/pan.capture");
+
+                dev->capture = pan_capture_create(path, dev->gpu_id);
+        }
+
         /* Tiler heap is internally required by the tiler, which can only be
          * active for a single job chain at once, so a single heap can be
          * shared across batches/contextes */
@@ -389,6 +432,7 @@ panfrost_close_device(struct panfrost_device *dev)
                 panfrost_bo_unreference(dev->tiler_heap);
                 panfrost_bo_unreference(dev->sample_positions);
                 panfrost_bo_cache_evict_all(dev);
+                pan_capture_destroy(dev->capture);
                 pthread_mutex_destroy(&dev->bo_cache.lock);
                 pthread_mutex_destroy(&dev->bo_map_lock);
                 pthread_mutex_destroy(&dev->bo_usage_lock);
@@ -157,6 +157,14 @@ panfrost_afbc_format(unsigned arch, enum pipe_format format);
 
 #define AFBC_HEADER_BYTES_PER_TILE 16
 
+/* Subblocks with a size of 1 in the AFBC header are stored uncompressed */
+
+static inline unsigned
+pan_afbc_uncompressed_subblock_size(enum pipe_format format)
+{
+        return util_format_get_blocksize(format) * 4 * 4;
+}
+
 bool
 panfrost_afbc_can_ytr(enum pipe_format format);
 
@@ -213,6 +221,17 @@ panfrost_texture_offset(const struct pan_image_layout *layout,
                         unsigned level, unsigned array_idx,
                         unsigned surface_idx);
 
+struct pan_image_range {
+        unsigned offset;
+        unsigned size;
+};
+
+struct pan_image_range
+pan_image_surface_range(const struct pan_image_layout *layout,
+                        unsigned level, unsigned surface,
+                        unsigned x, unsigned y,
+                        unsigned width, unsigned height);
+
 struct pan_pool;
 struct pan_scoreboard;
 
@@ -231,6 +250,40 @@ bool
 pan_image_layout_init(struct pan_image_layout *layout,
                       const struct pan_image_explicit_layout *explicit_layout);
 
+/* Superblock bodies of a packed AFBC image are placed back to back in header
+ * order, each aligned to this many bytes */
+
+#define PAN_AFBC_PACKED_BODY_ALIGN 16
+
+/* Per-superblock metadata computed when packing an AFBC image: the size of the
+ * body and its offset from the start of the packed body */
+
+struct pan_afbc_block_info {
+        uint32_t size;
+        uint32_t offset;
+};
+
+unsigned
+pan_afbc_superblock_count(const struct pan_image_layout *layout,
+                          unsigned level);
+
+unsigned
+pan_afbc_superblock_body_size(unsigned arch, const uint32_t *header,
+                              unsigned uncompressed_size);
+
+unsigned
+pan_afbc_pack_offsets(struct pan_afbc_block_info *info, unsigned count);
+
+bool
+pan_image_layout_pack_afbc(struct pan_image_layout *layout,
+                           const unsigned *body_sizes);
+
+void
+pan_afbc_pack_slice(unsigned arch,
+                    const struct pan_image_layout *src_layout,
+                    const struct pan_image_layout *dst_layout,
+                    unsigned level, const void *src, void *dst);
+
 unsigned
 panfrost_get_legacy_stride(const struct pan_image_layout *layout,
                            unsigned level);
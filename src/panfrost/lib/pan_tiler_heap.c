@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/macros.h"
+#include "util/u_math.h"
+
+#include "pan_tiler_heap.h"
+
+/* Lower bits of a chunk header, the size of the next chunk in pages */
+#define CHUNK_HEADER_SIZE_MASK 0xfff
+#define CHUNK_HEADER_SIZE_SHIFT 12
+
+bool
+pan_tiler_heap_next_chunk(const void *chunk, uint64_t *va, uint32_t *size)
+{
+        uint64_t header;
+
+        memcpy(&header, chunk, sizeof(header));
+
+        *va = header & ~(uint64_t) CHUNK_HEADER_SIZE_MASK;
+        *size = (header & CHUNK_HEADER_SIZE_MASK) << CHUNK_HEADER_SIZE_SHIFT;
+
+        return *va && *size;
+}
+
+uint32_t
+pan_tiler_heap_used_size(const void *data, uint32_t size)
+{
+        const uint8_t *bytes = data;
+        uint32_t used = size;
+
+        while (used && !bytes[used - 1])
+                --used;
+
+        return MIN2(ALIGN_POT(used, 8), size);
+}
+
+struct pan_tiler_heap *
+pan_tiler_heap_create(void)
+{
+        return calloc(1, sizeof(struct pan_tiler_heap));
+}
+
+void
+pan_tiler_heap_destroy(struct pan_tiler_heap *heap)
+{
+        if (!heap)
+                return;
+
+        free(heap->chunks);
+        free(heap);
+}
+
+void
+pan_tiler_heap_add_chunk(struct pan_tiler_heap *heap, uint64_t va,
+                         uint32_t size, const void *data, uint32_t data_size)
+{
+        heap->chunks = realloc(heap->chunks, (heap->chunk_count + 1) *
+                                             sizeof(*heap->chunks));
+
+        struct pan_tiler_heap_chunk *chunk = &heap->chunks[heap->chunk_count++];
+
+        chunk->va = va;
+        chunk->size = size;
+        chunk->used = pan_tiler_heap_used_size(data, MIN2(data_size, size));
+}
+
+void
+pan_tiler_heap_analyze(struct pan_tiler_heap *heap)
+{
+        heap->size = 0;
+        heap->used = 0;
+
+        for (unsigned i = 0; i < heap->chunk_count; ++i) {
+                heap->size += heap->chunks[i].size;
+                heap->used += heap->chunks[i].used;
+        }
+}
+
+void
+pan_tiler_heap_print(const struct pan_tiler_heap *heap, FILE *fp)
+{
+        unsigned percent = heap->size ? heap->used * 100 / heap->size : 0;
+
+        fprintf(fp, "Tiler heap: %u chunks, at most %" PRIu64 " KiB used of "
+                "%" PRIu64 " KiB (%u%%)\n", heap->chunk_count,
+                heap->used / 1024, heap->size / 1024, percent);
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __PAN_TILER_HEAP_H__
+#define __PAN_TILER_HEAP_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Analysis of the chunked tiler heap used on CSF GPUs, for PAN_MESA_DEBUG=tiler
+ * and panreplay.
+ *
+ * kbase links the chunks of the heap together: the first 8 bytes of each
+ * chunk give the address of the next one in the upper bits and its size in
+ * 4 KiB units in the lower 12 bits, 0 ending the list. Only this walk and the
+ * utilization of the chunks are reported. The layout of the bin table and
+ * polygon lists the tiler writes in the chunks has not been checked against
+ * a heap dumped from hardware, so they are not decoded.
+ *
+ * Nothing clears the chunks between render passes, so what earlier passes
+ * wrote past the data of the current one is still there and counted as used.
+ * The used size is therefore an upper bound.
+ */
+
+#define PAN_TILER_HEAP_CHUNK_HEADER_SIZE 64
+
+/* The heap is created with at most 200 chunks, see pan_vX_base.c */
+#define PAN_TILER_HEAP_MAX_CHUNKS 200
+
+struct pan_tiler_heap_chunk {
+        uint64_t va;
+        uint32_t size;
+
+        /* Bytes up to the last one written, the rest is zero */
+        uint32_t used;
+};
+
+struct pan_tiler_heap {
+        struct pan_tiler_heap_chunk *chunks;
+        unsigned chunk_count;
+
+        /* Filled in by pan_tiler_heap_analyze */
+        uint64_t size, used;
+};
+
+/* Read the chunk header, returns false at the end of the list */
+bool
+pan_tiler_heap_next_chunk(const void *chunk, uint64_t *va, uint32_t *size);
+
+/* Size of the data, leaving out the trailing zeroes */
+uint32_t pan_tiler_heap_used_size(const void *data, uint32_t size);
+
+struct pan_tiler_heap *pan_tiler_heap_create(void);
+
+void pan_tiler_heap_destroy(struct pan_tiler_heap *heap);
+
+/* Chunks are added in list order, data_size may be less than the size of the
+ * chunk when the rest is known to be zero */
+void
+pan_tiler_heap_add_chunk(struct pan_tiler_heap *heap, uint64_t va,
+                         uint32_t size, const void *data, uint32_t data_size);
+
+void pan_tiler_heap_analyze(struct pan_tiler_heap *heap);
+
+/* Chunk count and utilization */
+void pan_tiler_heap_print(const struct pan_tiler_heap *heap, FILE *fp);
+
+#ifdef __cplusplus
+} /* extern C */
+#endif
+
+#endif
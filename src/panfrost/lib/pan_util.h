@@ -56,7 +56,12 @@
 #define PAN_DBG_UNCACHED_GPU  0x100000
 #define PAN_DBG_UNCACHED_CPU  0x200000
 #define PAN_DBG_LOG           0x400000
-#define PAN_DBG_GOFASTER      0x800000
+#define PAN_DBG_CAPTURE       0x800000
+#define PAN_DBG_SPECIALIZE   0x1000000
+#define PAN_DBG_AFBC_PACK    0x2000000
+#define PAN_DBG_LAYOUT       0x4000000
+/* 0x8000000 unused */
+#define PAN_DBG_GOFASTER    0x10000000
 
 struct panfrost_device;
 
@@ -75,6 +80,11 @@ void
 pan_pack_color(uint32_t *packed, const union pipe_color_union *color,
                enum pipe_format format, bool dithered);
 
+bool
+pan_clear_region_is_tile_aligned(unsigned x, unsigned y,
+                                 unsigned width, unsigned height,
+                                 unsigned fb_width, unsigned fb_height);
+
 /* Get the last blend shader, for an erratum workaround on v5 */
 
 static inline uint64_t
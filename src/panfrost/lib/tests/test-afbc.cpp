@@ -0,0 +1,347 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pan_texture.h"
+
+#include <gtest/gtest.h>
+#include <vector>
+
+static void
+set_subblock_size(uint32_t *header, unsigned i, unsigned size)
+{
+   for (unsigned b = 0; b < 6; ++b) {
+      unsigned bit = 32 + (i * 6) + b;
+
+      if (size & BITFIELD_BIT(b))
+         header[bit / 32] |= BITFIELD_BIT(bit % 32);
+   }
+}
+
+TEST(AFBCPack, SuperblockBodySize)
+{
+   uint32_t header[4] = { 4096 };
+
+   /* Subblocks 5 and 10 straddle two words of the header */
+   set_subblock_size(header, 0, 63);
+   set_subblock_size(header, 5, 33);
+   set_subblock_size(header, 10, 17);
+   set_subblock_size(header, 15, 2);
+
+   EXPECT_EQ(pan_afbc_superblock_body_size(6, header, 64), 63 + 33 + 17 + 2);
+   EXPECT_EQ(pan_afbc_superblock_body_size(7, header, 64), 63 + 33 + 17 + 2);
+
+   /* A size of 1 denotes an uncompressed subblock */
+   set_subblock_size(header, 3, 1);
+   EXPECT_EQ(pan_afbc_superblock_body_size(7, header, 64), 64 + 63 + 33 + 17 + 2);
+   EXPECT_EQ(pan_afbc_superblock_body_size(7, header, 32), 32 + 63 + 33 + 17 + 2);
+}
+
+TEST(AFBCPack, SolidColour)
+{
+   uint32_t zero[4] = { 0 };
+
+   /* Zeroed headers are plain black on all GPUs */
+   EXPECT_EQ(pan_afbc_superblock_body_size(5, zero, 64), 0);
+   EXPECT_EQ(pan_afbc_superblock_body_size(7, zero, 64), 0);
+
+   /* From v7, the colour replaces the sizes after an empty first subblock */
+   uint32_t v7[4] = { 0x12345678, 0xffffffc0, 0xffffffff, 0xffffffff };
+   EXPECT_EQ(pan_afbc_superblock_body_size(7, v7, 64), 0);
+
+   /* Earlier, solid colour superblocks have no body offset */
+   uint32_t v6[4] = { 0, 0x9abcdef0, 0x12345678, 0x9abcdef0 };
+   EXPECT_EQ(pan_afbc_superblock_body_size(6, v6, 64), 0);
+}
+
+TEST(AFBCPack, Offsets)
+{
+   struct pan_afbc_block_info info[] = {
+      { 100, ~0u }, { 0, ~0u }, { 16, ~0u }, { 1, ~0u }, { 1024, ~0u },
+   };
+
+   EXPECT_EQ(pan_afbc_pack_offsets(info, ARRAY_SIZE(info)), 112 + 16 + 16 + 1024);
+
+   EXPECT_EQ(info[0].offset, 0);
+   EXPECT_EQ(info[1].offset, 112);
+   EXPECT_EQ(info[2].offset, 112);
+   EXPECT_EQ(info[3].offset, 128);
+   EXPECT_EQ(info[4].offset, 144);
+}
+
+TEST(AFBCPack, SuperblockCount)
+{
+   uint64_t modifier = DRM_FORMAT_MOD_ARM_AFBC(AFBC_FORMAT_MOD_BLOCK_SIZE_16x16 |
+                        AFBC_FORMAT_MOD_TILED |
+                        AFBC_FORMAT_MOD_SPARSE);
+
+   struct pan_image_layout l = {
+      .modifier = modifier,
+      .format = PIPE_FORMAT_R8G8B8A8_UNORM,
+      .width = 917,
+      .height = 417,
+      .depth = 1,
+      .nr_samples = 1,
+      .dim = MALI_TEXTURE_DIMENSION_2D,
+      .nr_slices = 2
+   };
+
+   ASSERT_TRUE(pan_image_layout_init(&l, NULL));
+
+   /* 8x4 tiles of 8x8 superblocks, then 4x2 tiles at level 1 */
+   EXPECT_EQ(pan_afbc_superblock_count(&l, 0), 8 * 4 * 8 * 8);
+   EXPECT_EQ(pan_afbc_superblock_count(&l, 1), 4 * 2 * 8 * 8);
+
+   l.modifier = DRM_FORMAT_MOD_ARM_AFBC(AFBC_FORMAT_MOD_BLOCK_SIZE_32x8 |
+                                        AFBC_FORMAT_MOD_SPARSE);
+   ASSERT_TRUE(pan_image_layout_init(&l, NULL));
+
+   /* 29x53 superblocks, then 15x26 at 458x208 */
+   EXPECT_EQ(pan_afbc_superblock_count(&l, 0), 29 * 53);
+   EXPECT_EQ(pan_afbc_superblock_count(&l, 1), 15 * 26);
+}
+
+TEST(AFBCPack, Layout)
+{
+   struct pan_image_layout l = {
+      .modifier = DRM_FORMAT_MOD_ARM_AFBC(AFBC_FORMAT_MOD_BLOCK_SIZE_16x16 |
+                                          AFBC_FORMAT_MOD_SPARSE),
+      .format = PIPE_FORMAT_R8G8B8A8_UNORM,
+      .width = 64,
+      .height = 64,
+      .depth = 1,
+      .nr_samples = 1,
+      .dim = MALI_TEXTURE_DIMENSION_2D,
+      .nr_slices = 3,
+      .array_size = 1,
+   };
+
+   ASSERT_TRUE(pan_image_layout_init(&l, NULL));
+
+   unsigned body_sizes[] = { 1000, 64, 0 };
+   struct pan_image_layout packed = l;
+
+   ASSERT_TRUE(pan_image_layout_pack_afbc(&packed, body_sizes));
+
+   /* Headers are 256, 64 and 16 bytes, each padded to 64 bytes */
+   EXPECT_EQ(packed.slices[0].offset, 0);
+   EXPECT_EQ(packed.slices[0].afbc.header_size, 256);
+   EXPECT_EQ(packed.slices[0].afbc.body_size, 1024);
+   EXPECT_EQ(packed.slices[0].surface_stride, 1280);
+   EXPECT_EQ(packed.slices[0].size, 1280);
+
+   EXPECT_EQ(packed.slices[1].offset, 1280);
+   EXPECT_EQ(packed.slices[1].afbc.body_size, 64);
+   EXPECT_EQ(packed.slices[1].size, 128);
+
+   EXPECT_EQ(packed.slices[2].offset, 1408);
+   EXPECT_EQ(packed.slices[2].afbc.body_size, 0);
+   EXPECT_EQ(packed.slices[2].size, 64);
+
+   EXPECT_EQ(packed.array_stride, 1472);
+   EXPECT_EQ(packed.data_size, 4096);
+
+   for (unsigned i = 0; i < 3; ++i)
+      EXPECT_EQ(packed.slices[i].row_stride, l.slices[i].row_stride);
+}
+
+TEST(AFBCPack, LayoutUnsupported)
+{
+   struct pan_image_layout base = {
+      .modifier = DRM_FORMAT_MOD_ARM_AFBC(AFBC_FORMAT_MOD_BLOCK_SIZE_16x16 |
+                                          AFBC_FORMAT_MOD_SPARSE),
+      .format = PIPE_FORMAT_R8G8B8A8_UNORM,
+      .width = 64,
+      .height = 64,
+      .depth = 1,
+      .nr_samples = 1,
+      .dim = MALI_TEXTURE_DIMENSION_2D,
+      .nr_slices = 1,
+      .array_size = 1,
+   };
+
+   unsigned body_sizes[] = { 0 };
+   struct pan_image_layout l;
+
+   l = base;
+   l.array_size = 2;
+   ASSERT_TRUE(pan_image_layout_init(&l, NULL));
+   EXPECT_FALSE(pan_image_layout_pack_afbc(&l, body_sizes));
+
+   l = base;
+   l.crc = true;
+   ASSERT_TRUE(pan_image_layout_init(&l, NULL));
+   EXPECT_FALSE(pan_image_layout_pack_afbc(&l, body_sizes));
+
+   l = base;
+   l.dim = MALI_TEXTURE_DIMENSION_3D;
+   ASSERT_TRUE(pan_image_layout_init(&l, NULL));
+   EXPECT_FALSE(pan_image_layout_pack_afbc(&l, body_sizes));
+
+   l = base;
+   l.modifier = DRM_FORMAT_MOD_ARM_16X16_BLOCK_U_INTERLEAVED;
+   ASSERT_TRUE(pan_image_layout_init(&l, NULL));
+   EXPECT_FALSE(pan_image_layout_pack_afbc(&l, body_sizes));
+}
+
+/* Fill an AFBC image with pseudo-random superblocks at their worst-case
+ * location, as the GPU writes them, pack it and check every superblock is
+ * found intact at its new location. */
+
+static void
+test_pack_roundtrip(unsigned arch, uint64_t modifier, enum pipe_format format,
+                    unsigned width, unsigned height, unsigned nr_slices)
+{
+   struct pan_image_layout l = {
+      .modifier = modifier,
+      .format = format,
+      .width = width,
+      .height = height,
+      .depth = 1,
+      .nr_samples = 1,
+      .dim = MALI_TEXTURE_DIMENSION_2D,
+      .nr_slices = nr_slices,
+      .array_size = 1,
+   };
+
+   ASSERT_TRUE(pan_image_layout_init(&l, NULL));
+
+   std::vector<uint8_t> src(l.data_size, 0xaa);
+   unsigned uncompressed_size = pan_afbc_uncompressed_subblock_size(format);
+   unsigned superblock_size = 16 * uncompressed_size;
+   unsigned body_sizes[MAX_MIP_LEVELS] = { 0 };
+   uint32_t seed = 1;
+
+   for (unsigned level = 0; level < nr_slices; ++level) {
+      const struct pan_image_slice_layout *slice = &l.slices[level];
+      unsigned count = pan_afbc_superblock_count(&l, level);
+      std::vector<pan_afbc_block_info> info(count);
+
+      ASSERT_LE(count * superblock_size, slice->afbc.body_size);
+
+      for (unsigned i = 0; i < count; ++i) {
+         uint32_t *header = (uint32_t *)
+            &src[slice->offset + (i * AFBC_HEADER_BYTES_PER_TILE)];
+
+         memset(header, 0, AFBC_HEADER_BYTES_PER_TILE);
+         seed = seed * 1103515245 + 12345;
+
+         /* One superblock in four is a solid colour */
+         if ((seed >> 16) % 4 == 0) {
+            if (arch >= 7) {
+               header[0] = seed;
+               header[1] = seed & ~BITFIELD_MASK(6);
+               header[2] = header[3] = ~seed;
+            }
+
+            continue;
+         }
+
+         unsigned offset = slice->afbc.header_size + (i * superblock_size);
+         header[0] = offset;
+
+         for (unsigned s = 0; s < 16; ++s) {
+            seed = seed * 1103515245 + 12345;
+            unsigned size = MAX2((seed >> 16) % 64, s == 0 ? 2 : 0);
+
+            /* Subblocks compressing badly are stored uncompressed */
+            set_subblock_size(header, s, size > uncompressed_size ? 1 : size);
+         }
+
+         info[i].size = pan_afbc_superblock_body_size(arch, header,
+                                                      uncompressed_size);
+         ASSERT_LE(info[i].size, superblock_size);
+
+         for (unsigned b = 0; b < info[i].size; ++b)
+            src[slice->offset + offset + b] = (i * 31) + b;
+      }
+
+      body_sizes[level] = pan_afbc_pack_offsets(info.data(), count);
+   }
+
+   struct pan_image_layout packed = l;
+   ASSERT_TRUE(pan_image_layout_pack_afbc(&packed, body_sizes));
+   EXPECT_LT(packed.data_size, l.data_size);
+
+   std::vector<uint8_t> dst(packed.data_size, 0x55);
+
+   for (unsigned level = 0; level < nr_slices; ++level)
+      pan_afbc_pack_slice(arch, &l, &packed, level, src.data(), dst.data());
+
+   for (unsigned level = 0; level < nr_slices; ++level) {
+      const struct pan_image_slice_layout *src_slice = &l.slices[level];
+      const struct pan_image_slice_layout *dst_slice = &packed.slices[level];
+      unsigned count = pan_afbc_superblock_count(&l, level);
+      unsigned end = dst_slice->afbc.header_size;
+
+      for (unsigned i = 0; i < count; ++i) {
+         const uint32_t *src_header = (const uint32_t *)
+            &src[src_slice->offset + (i * AFBC_HEADER_BYTES_PER_TILE)];
+         const uint32_t *dst_header = (const uint32_t *)
+            &dst[dst_slice->offset + (i * AFBC_HEADER_BYTES_PER_TILE)];
+         unsigned size = pan_afbc_superblock_body_size(arch, src_header,
+                                                       uncompressed_size);
+
+         EXPECT_EQ(dst_header[1], src_header[1]);
+         EXPECT_EQ(dst_header[2], src_header[2]);
+         EXPECT_EQ(dst_header[3], src_header[3]);
+
+         if (!size) {
+            EXPECT_EQ(dst_header[0], src_header[0]);
+            continue;
+         }
+
+         /* Bodies are aligned, in order and within the packed level */
+         EXPECT_EQ(dst_header[0] % PAN_AFBC_PACKED_BODY_ALIGN, 0);
+         EXPECT_EQ(dst_header[0], end);
+         end = dst_header[0] + ALIGN_POT(size, PAN_AFBC_PACKED_BODY_ALIGN);
+         ASSERT_LE(dst_header[0] + size, dst_slice->size);
+
+         EXPECT_EQ(memcmp(&dst[dst_slice->offset + dst_header[0]],
+                          &src[src_slice->offset + src_header[0]], size), 0);
+      }
+
+      EXPECT_EQ(end, dst_slice->afbc.header_size + body_sizes[level]);
+   }
+}
+
+TEST(AFBCPack, Linear16x16)
+{
+   test_pack_roundtrip(6, DRM_FORMAT_MOD_ARM_AFBC(AFBC_FORMAT_MOD_BLOCK_SIZE_16x16 |
+                                                  AFBC_FORMAT_MOD_SPARSE),
+                       PIPE_FORMAT_R8G8B8A8_UNORM, 129, 67, 4);
+}
+
+TEST(AFBCPack, Tiled16x16)
+{
+   test_pack_roundtrip(7, DRM_FORMAT_MOD_ARM_AFBC(AFBC_FORMAT_MOD_BLOCK_SIZE_16x16 |
+                                                  AFBC_FORMAT_MOD_TILED |
+                                                  AFBC_FORMAT_MOD_SPARSE),
+                       PIPE_FORMAT_R8G8B8A8_UNORM, 300, 200, 3);
+}
+
+TEST(AFBCPack, Wide32x8RGB565)
+{
+   test_pack_roundtrip(7, DRM_FORMAT_MOD_ARM_AFBC(AFBC_FORMAT_MOD_BLOCK_SIZE_32x8 |
+                                                  AFBC_FORMAT_MOD_SPARSE),
+                       PIPE_FORMAT_R5G6B5_UNORM, 100, 50, 2);
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pan_batch_graph.h"
+
+#include <gtest/gtest.h>
+#include <string.h>
+#include <vector>
+
+/* Follows what pan_job.c does with the graph, minus the actual work */
+class BatchGraph : public testing::Test {
+protected:
+   BatchGraph()
+   {
+      memset(&graph, 0, sizeof(graph));
+   }
+
+   /* A batch that accesses a resource last accessed by other */
+   bool add(unsigned slot, unsigned other, int current = -1)
+   {
+      return pan_batch_graph_add(&graph, slot, other, current);
+   }
+
+   /* Submitting a batch cleans it up, which removes it from the graph */
+   std::vector<unsigned> submit(unsigned slot)
+   {
+      uint8_t order[PAN_BATCH_GRAPH_MAX];
+      unsigned count = pan_batch_graph_order(&graph, slot, order);
+      std::vector<unsigned> submitted;
+
+      for (unsigned i = 0; i < count; ++i) {
+         submitted.push_back(order[i]);
+         pan_batch_graph_remove(&graph, order[i]);
+      }
+
+      return submitted;
+   }
+
+   bool empty()
+   {
+      for (unsigned i = 0; i < PAN_BATCH_GRAPH_MAX; ++i) {
+         if (pan_batch_graph_has_deps(&graph, i))
+            return false;
+      }
+
+      return true;
+   }
+
+   struct pan_batch_graph graph;
+};
+
+TEST_F(BatchGraph, ReadAfterWriteChain)
+{
+   /* Slot 4 writes A, slot 2 reads A and writes B, slot 7 reads B */
+   ASSERT_TRUE(add(2, 4));
+   ASSERT_TRUE(add(7, 2));
+
+   EXPECT_TRUE(pan_batch_graph_depends_on(&graph, 7, 4));
+   EXPECT_FALSE(pan_batch_graph_depends_on(&graph, 4, 7));
+
+   EXPECT_EQ(submit(7), std::vector<unsigned>({ 4, 2, 7 }));
+   EXPECT_TRUE(empty());
+}
+
+TEST_F(BatchGraph, SharedDependencySubmittedOnce)
+{
+   /* Slots 1 and 2 both read what slot 0 wrote, slot 3 reads both */
+   add(1, 0);
+   add(2, 0);
+   add(3, 1);
+   add(3, 2);
+
+   EXPECT_EQ(submit(3), std::vector<unsigned>({ 0, 1, 2, 3 }));
+   EXPECT_TRUE(empty());
+}
+
+TEST_F(BatchGraph, OnlySubmitsDependencies)
+{
+   add(1, 0);
+   add(3, 2);
+
+   EXPECT_EQ(submit(1), std::vector<unsigned>({ 0, 1 }));
+   EXPECT_TRUE(pan_batch_graph_has_deps(&graph, 3));
+   EXPECT_TRUE(pan_batch_graph_has_dependents(&graph, 2));
+}
+
+TEST_F(BatchGraph, DependencyOnCurrentBatch)
+{
+   /* Slot 0 is being recorded into, so slot 1 can't wait for it: it must be
+    * submitted before it can grow any further */
+   EXPECT_FALSE(add(1, 0, 0));
+   EXPECT_FALSE(pan_batch_graph_has_deps(&graph, 1));
+   EXPECT_FALSE(pan_batch_graph_has_dependents(&graph, 0));
+
+   /* Other batches can wait */
+   EXPECT_TRUE(add(1, 2, 0));
+   EXPECT_TRUE(pan_batch_graph_has_deps(&graph, 1));
+}
+
+TEST_F(BatchGraph, DependentsSubmittedBeforeReuse)
+{
+   /* Slot 0 is recorded into again after slot 1 started depending on it,
+    * so it has to be submitted first, see panfrost_get_batch */
+   add(1, 0, 1);
+   ASSERT_TRUE(pan_batch_graph_has_dependents(&graph, 0));
+
+   EXPECT_EQ(submit(0), std::vector<unsigned>({ 0 }));
+
+   EXPECT_FALSE(pan_batch_graph_has_dependents(&graph, 0));
+   EXPECT_FALSE(pan_batch_graph_has_deps(&graph, 1));
+
+   /* Slot 1 no longer waits for anything */
+   EXPECT_EQ(submit(1), std::vector<unsigned>({ 1 }));
+}
+
+TEST_F(BatchGraph, RemoveClearsBits)
+{
+   add(1, 0);
+   add(2, 1);
+   add(1, 3);
+
+   /* Slot 1 is destroyed without its dependencies being submitted */
+   pan_batch_graph_remove(&graph, 1);
+
+   EXPECT_FALSE(pan_batch_graph_has_deps(&graph, 1));
+   EXPECT_FALSE(pan_batch_graph_has_deps(&graph, 2));
+   EXPECT_FALSE(pan_batch_graph_has_dependents(&graph, 0));
+   EXPECT_FALSE(pan_batch_graph_has_dependents(&graph, 3));
+
+   /* An unrelated batch in the slot starts with no dependencies */
+   EXPECT_EQ(submit(1), std::vector<unsigned>({ 1 }));
+   EXPECT_TRUE(empty());
+}
+
+TEST_F(BatchGraph, LastSlot)
+{
+   const unsigned last = PAN_BATCH_GRAPH_MAX - 1;
+
+   add(last, 0);
+   add(5, last);
+
+   EXPECT_TRUE(pan_batch_graph_depends_on(&graph, 5, 0));
+   EXPECT_EQ(submit(5), std::vector<unsigned>({ 0, last, 5 }));
+   EXPECT_TRUE(empty());
+}
@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pan_capture.h"
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+struct record {
+   uint32_t type;
+   std::vector<uint8_t> payload;
+
+   template <typename T>
+   const T *as() const
+   {
+      return (const T *)payload.data();
+   }
+};
+
+class Capture : public testing::Test {
+protected:
+   Capture()
+   {
+      strcpy(path, "/tmp/pan_capture_XXXXXX");
+      close(mkstemp(path));
+      cap = pan_capture_create(path, 0x7212);
+   }
+
+   ~Capture()
+   {
+      pan_capture_destroy(cap);
+      unlink(path);
+   }
+
+   /* Records written since the last call */
+   std::vector<record> read_records()
+   {
+      std::vector<record> records;
+      FILE *fp = fopen(path, "rb");
+
+      fseek(fp, offset, SEEK_SET);
+
+      struct pan_capture_record header;
+
+      while (fread(&header, sizeof(header), 1, fp) == 1) {
+         record r = { header.type, std::vector<uint8_t>(header.size) };
+
+         if (header.size) {
+            EXPECT_EQ(fread(r.payload.data(), header.size, 1, fp), 1u);
+         }
+
+         records.push_back(r);
+      }
+
+      offset = ftell(fp);
+      fclose(fp);
+      return records;
+   }
+
+   char path[32];
+   struct pan_capture *cap;
+   long offset = sizeof(struct pan_capture_header);
+};
+
+TEST_F(Capture, Header)
+{
+   pan_capture_frame(cap);
+
+   FILE *fp = fopen(path, "rb");
+   struct pan_capture_header header;
+
+   ASSERT_EQ(fread(&header, sizeof(header), 1, fp), 1u);
+   fclose(fp);
+
+   EXPECT_EQ(header.magic, PAN_CAPTURE_MAGIC);
+   EXPECT_EQ(header.version, PAN_CAPTURE_VERSION);
+   EXPECT_EQ(header.gpu_id, 0x7212);
+   EXPECT_EQ(header.page_size, PAN_CAPTURE_PAGE_SIZE);
+}
+
+TEST_F(Capture, DedupPages)
+{
+   std::vector<uint8_t> buf(3 * PAN_CAPTURE_PAGE_SIZE, 0);
+
+   pan_capture_map(cap, 0x100000, buf.data(), buf.size(), 0);
+
+   /* The first and last pages have the same contents, the middle one is
+    * still zero */
+   buf[0] = 0xab;
+   buf[2 * PAN_CAPTURE_PAGE_SIZE] = 0xab;
+
+   pan_capture_submit_jc(cap, 0x100040, 0);
+
+   std::vector<record> records = read_records();
+   ASSERT_EQ(records.size(), 5u);
+
+   EXPECT_EQ(records[0].type, PAN_CAPTURE_MAP);
+   EXPECT_EQ(records[0].as<struct pan_capture_map>()->va, 0x100000u);
+   EXPECT_EQ(records[0].as<struct pan_capture_map>()->size, buf.size());
+
+   EXPECT_EQ(records[1].type, PAN_CAPTURE_BLOB);
+   EXPECT_EQ(records[1].payload.size(),
+             sizeof(struct pan_capture_blob) + PAN_CAPTURE_PAGE_SIZE);
+
+   uint64_t hash = records[1].as<struct pan_capture_blob>()->hash;
+   EXPECT_EQ(hash, pan_capture_hash(buf.data(), PAN_CAPTURE_PAGE_SIZE));
+
+   EXPECT_EQ(records[2].type, PAN_CAPTURE_DATA);
+   EXPECT_EQ(records[2].as<struct pan_capture_data>()->va, 0x100000u);
+   EXPECT_EQ(records[2].as<struct pan_capture_data>()->hash, hash);
+
+   EXPECT_EQ(records[3].type, PAN_CAPTURE_DATA);
+   EXPECT_EQ(records[3].as<struct pan_capture_data>()->va,
+             0x100000u + 2 * PAN_CAPTURE_PAGE_SIZE);
+   EXPECT_EQ(records[3].as<struct pan_capture_data>()->hash, hash);
+
+   EXPECT_EQ(records[4].type, PAN_CAPTURE_SUBMIT_JC);
+   EXPECT_EQ(records[4].as<struct pan_capture_submit_jc>()->jc, 0x100040u);
+}
+
+TEST_F(Capture, UnchangedPagesSkipped)
+{
+   std::vector<uint8_t> buf(2 * PAN_CAPTURE_PAGE_SIZE, 0);
+
+   pan_capture_map(cap, 0x200000, buf.data(), buf.size(), 0);
+   buf[1] = 1;
+   pan_capture_submit_cs(cap, 1, 0x200000, buf.size(), 0, 64);
+   read_records();
+
+   /* Nothing changed, so only the submit is recorded */
+   pan_capture_submit_cs(cap, 1, 0x200000, buf.size(), 64, 128);
+
+   std::vector<record> records = read_records();
+   ASSERT_EQ(records.size(), 1u);
+   EXPECT_EQ(records[0].type, PAN_CAPTURE_SUBMIT_CS);
+   EXPECT_EQ(records[0].as<struct pan_capture_submit_cs>()->start, 64u);
+   EXPECT_EQ(records[0].as<struct pan_capture_submit_cs>()->end, 128u);
+
+   /* Zeroes were never written, but the second page now has contents
+    * already seen in the first one, so it needs no new blob */
+   buf[1] = 0;
+   buf[PAN_CAPTURE_PAGE_SIZE + 1] = 1;
+   pan_capture_submit_cs(cap, 1, 0x200000, buf.size(), 128, 192);
+
+   records = read_records();
+   ASSERT_EQ(records.size(), 4u);
+   EXPECT_EQ(records[0].type, PAN_CAPTURE_BLOB);
+   EXPECT_EQ(records[1].type, PAN_CAPTURE_DATA);
+   EXPECT_EQ(records[2].type, PAN_CAPTURE_DATA);
+   EXPECT_EQ(records[3].type, PAN_CAPTURE_SUBMIT_CS);
+}
+
+TEST_F(Capture, UnmappedBuffersNotSnapshotted)
+{
+   std::vector<uint8_t> buf(PAN_CAPTURE_PAGE_SIZE, 0);
+
+   pan_capture_map(cap, 0x300000, buf.data(), buf.size(), 0);
+   pan_capture_unmap(cap, 0x300000);
+   buf[0] = 1;
+   pan_capture_submit_jc(cap, 0x300000, 0);
+
+   std::vector<record> records = read_records();
+   ASSERT_EQ(records.size(), 3u);
+   EXPECT_EQ(records[0].type, PAN_CAPTURE_MAP);
+   EXPECT_EQ(records[1].type, PAN_CAPTURE_UNMAP);
+   EXPECT_EQ(records[2].type, PAN_CAPTURE_SUBMIT_JC);
+}
@@ -138,6 +138,36 @@ static const struct test clear_tests[] = {
       { 0xCAFEBABE, 0xABAD1DEA, 0xDEADBEEF, 0xABCDEF01 } },
 };
 
+/* A region test consists of a region of a framebuffer and whether it may be
+ * cleared by restricting the tile bounds of the fragment job. */
+struct region_test {
+   unsigned x, y, width, height;
+   unsigned fb_width, fb_height;
+   bool aligned;
+};
+
+static const struct region_test region_tests[] = {
+   /* Whole framebuffer */
+   {   0,  0, 256, 128, 256, 128, true  },
+   {   0,  0, 250, 100, 250, 100, true  },
+
+   /* Tile-aligned regions, possibly extending to unaligned edges */
+   {  16, 32,  64,  16, 256, 128, true  },
+   { 192, 96,  64,  32, 256, 128, true  },
+   { 240, 64,  10,  36, 250, 100, true  },
+
+   /* Unaligned regions */
+   {   8,  0,  64,  64, 256, 128, false },
+   {   0,  4,  64,  64, 256, 128, false },
+   {   0,  0,  60,  64, 256, 128, false },
+   {   0,  0,  64,  65, 256, 128, false },
+   { 240, 64,   8,  36, 250, 100, false },
+
+   /* Degenerate or out of bounds */
+   {   0,  0,   0,  16, 256, 128, false },
+   { 240,  0,  32,  16, 256, 128, false },
+};
+
 #define ASSERT_EQ(x, y) do { \
    if ((x[0] == y[0]) && (x[1] == y[1]) && (x[2] == y[2]) && (x[3] == y[3])) { \
       nr_pass++; \
@@ -160,6 +190,22 @@ int main(int argc, const char **argv)
       ASSERT_EQ(T.packed, packed);
    }
 
+   for (unsigned i = 0; i < ARRAY_SIZE(region_tests); ++i) {
+      struct region_test T = region_tests[i];
+      bool aligned = pan_clear_region_is_tile_aligned(T.x, T.y, T.width,
+                                                      T.height, T.fb_width,
+                                                      T.fb_height);
+
+      if (aligned == T.aligned) {
+         nr_pass++;
+      } else {
+         nr_fail++;
+         fprintf(stderr, "Region %ux%u+%u+%u in %ux%u: expected %s\n",
+                 T.width, T.height, T.x, T.y, T.fb_width, T.fb_height,
+                 T.aligned ? "aligned" : "unaligned");
+      }
+   }
+
    printf("Passed %u/%u\n", nr_pass, nr_pass + nr_fail);
    return nr_fail ? 1 : 0;
 }
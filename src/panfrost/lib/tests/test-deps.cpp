@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pan_bo.h"
+
+#include <gtest/gtest.h>
+#include <random>
+#include <vector>
+
+static std::vector<struct panfrost_usage>
+to_vector(struct util_dynarray *deps)
+{
+   std::vector<struct panfrost_usage> v;
+
+   util_dynarray_foreach(deps, struct panfrost_usage, u)
+      v.push_back(*u);
+
+   return v;
+}
+
+TEST(Deps, SortedByQueue)
+{
+   struct util_dynarray deps;
+   util_dynarray_init(&deps, NULL);
+
+   panfrost_add_dep_after(&deps, { 3, false, 10 }, 0);
+   panfrost_add_dep_after(&deps, { 1, true, 4 }, 0);
+   panfrost_add_dep_after(&deps, { 2, false, 7 }, 0);
+   panfrost_add_dep_after(&deps, { 1, true, 2 }, 0);
+   panfrost_add_dep_after(&deps, { 3, false, 12 }, 0);
+
+   std::vector<struct panfrost_usage> v = to_vector(&deps);
+   ASSERT_EQ(v.size(), 3u);
+
+   EXPECT_EQ(v[0].queue, 1);
+   EXPECT_EQ(v[0].seqnum, 4);
+   EXPECT_EQ(v[1].queue, 2);
+   EXPECT_EQ(v[1].seqnum, 7);
+   EXPECT_EQ(v[2].queue, 3);
+   EXPECT_EQ(v[2].seqnum, 12);
+
+   util_dynarray_fini(&deps);
+}
+
+TEST(Deps, ReadAfterRead)
+{
+   struct panfrost_bo bo = {};
+   util_dynarray_init(&bo.usage, NULL);
+   panfrost_add_dep_after(&bo.usage, { 0, false, 5 }, 0);
+
+   struct util_dynarray deps;
+   util_dynarray_init(&deps, NULL);
+
+   panfrost_update_deps(&deps, &bo, false);
+   EXPECT_EQ(util_dynarray_num_elements(&deps, struct panfrost_usage), 0);
+
+   panfrost_update_deps(&deps, &bo, true);
+   EXPECT_EQ(util_dynarray_num_elements(&deps, struct panfrost_usage), 1);
+
+   util_dynarray_fini(&deps);
+   util_dynarray_fini(&bo.usage);
+}
+
+/* Model of the CSF queues, where each queue runs its jobs in order once the
+ * EVWAIT instructions for their dependencies are satisfied, while jobs on
+ * different queues run and complete in any order. Jobs are recorded exactly
+ * like panfrost_batch_submit_csf does, and every job is checked to never
+ * start while an earlier conflicting access to one of its BOs is pending. */
+
+#define NUM_QUEUES 3
+#define NUM_BOS 8
+#define NUM_JOBS 400
+
+struct access {
+   unsigned bo;
+   bool write;
+};
+
+struct job {
+   unsigned queue;
+   uint64_t seqnum;
+   std::vector<struct access> accesses;
+   std::vector<struct panfrost_usage> deps;
+   bool started, done;
+};
+
+static void
+stress(unsigned seed)
+{
+   std::mt19937 rng(seed);
+
+   struct panfrost_bo bos[NUM_BOS] = {};
+   for (unsigned i = 0; i < NUM_BOS; ++i)
+      util_dynarray_init(&bos[i].usage, NULL);
+
+   std::vector<struct job> jobs;
+   uint64_t seqnum[NUM_QUEUES] = {};
+
+   /* Event value written by each queue, one past the completed seqnum */
+   uint64_t event[NUM_QUEUES] = {};
+
+   /* Index in jobs of the next job to start on each queue */
+   std::vector<unsigned> pending[NUM_QUEUES];
+   unsigned head[NUM_QUEUES] = {};
+   std::vector<unsigned> running;
+
+   unsigned completed = 0;
+
+   while (completed < NUM_JOBS) {
+      unsigned action = rng() % 3;
+
+      if (action == 0 && jobs.size() < NUM_JOBS) {
+         struct job j = {};
+         j.queue = rng() % NUM_QUEUES;
+         j.seqnum = ++seqnum[j.queue];
+
+         /* Each BO is accessed at most once per job */
+         for (unsigned b = 0; b < NUM_BOS; ++b) {
+            if (rng() % 3 == 0)
+               j.accesses.push_back({ b, (rng() % 2) == 0 });
+         }
+
+         struct util_dynarray deps;
+         util_dynarray_init(&deps, NULL);
+
+         for (const struct access &a : j.accesses) {
+            panfrost_update_deps(&deps, &bos[a.bo], a.write);
+            panfrost_add_dep_after(&bos[a.bo].usage,
+                                   { j.queue, a.write, j.seqnum }, 0);
+         }
+
+         j.deps = to_vector(&deps);
+         util_dynarray_fini(&deps);
+
+         pending[j.queue].push_back(jobs.size());
+         jobs.push_back(j);
+      } else if (action == 1) {
+         /* Start the next job on a random queue, if it can run */
+         unsigned q = rng() % NUM_QUEUES;
+
+         if (head[q] == pending[q].size())
+            continue;
+
+         unsigned idx = pending[q][head[q]];
+         struct job &j = jobs[idx];
+
+         /* Queues are serial */
+         if (head[q] && !jobs[pending[q][head[q] - 1]].done)
+            continue;
+
+         bool ready = true;
+         for (const struct panfrost_usage &d : j.deps)
+            ready &= (event[d.queue] > d.seqnum);
+
+         if (!ready)
+            continue;
+
+         /* No earlier job may still be accessing a BO in a conflicting way */
+         for (unsigned i = 0; i < idx; ++i) {
+            if (jobs[i].done)
+               continue;
+
+            for (const struct access &a : j.accesses) {
+               for (const struct access &b : jobs[i].accesses) {
+                  ASSERT_FALSE(a.bo == b.bo && (a.write || b.write))
+                     << "job " << idx << " started before job " << i
+                     << " finished with BO " << a.bo << " (seed " << seed
+                     << ")";
+               }
+            }
+         }
+
+         j.started = true;
+         running.push_back(idx);
+         ++head[q];
+      } else if (!running.empty()) {
+         /* Complete a random running job */
+         unsigned r = rng() % running.size();
+         struct job &j = jobs[running[r]];
+
+         running.erase(running.begin() + r);
+         j.done = true;
+         event[j.queue] = j.seqnum + 1;
+         ++completed;
+      } else if (jobs.size() == NUM_JOBS) {
+         /* Nothing is running and nothing else will be submitted, so at
+          * least one queue must be able to make progress */
+         bool progress = false;
+
+         for (unsigned q = 0; q < NUM_QUEUES; ++q) {
+            if (head[q] == pending[q].size())
+               continue;
+
+            bool ready = true;
+            for (const struct panfrost_usage &d :
+                 jobs[pending[q][head[q]]].deps)
+               ready &= (event[d.queue] > d.seqnum);
+
+            progress |= ready;
+         }
+
+         ASSERT_TRUE(progress) << "deadlock (seed " << seed << ")";
+      }
+   }
+
+   for (unsigned i = 0; i < NUM_BOS; ++i)
+      util_dynarray_fini(&bos[i].usage);
+}
+
+TEST(Deps, RandomCompletionOrder)
+{
+   for (unsigned seed = 0; seed < 64; ++seed)
+      ASSERT_NO_FATAL_FAILURE(stress(seed));
+}
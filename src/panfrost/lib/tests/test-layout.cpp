@@ -484,3 +484,144 @@ TEST(AFBCLayout, Tiled16x16Minimal)
    EXPECT_EQ(l.slices[0].surface_stride, 4096 + (32 * 8 * 8 * 8));
    EXPECT_EQ(l.slices[0].size, 4096 + (32 * 8 * 8 * 8));
 }
+
+TEST(SurfaceRange, Linear)
+{
+   struct pan_image_layout l = {
+      .modifier = DRM_FORMAT_MOD_LINEAR,
+      .format = PIPE_FORMAT_R8G8B8A8_UNORM,
+      .width = 64,
+      .height = 64,
+      .depth = 1,
+      .nr_samples = 1,
+      .dim = MALI_TEXTURE_DIMENSION_2D,
+      .nr_slices = 1,
+      .array_size = 4
+   };
+
+   ASSERT_TRUE(pan_image_layout_init(&l, NULL));
+   ASSERT_EQ(l.slices[0].row_stride, 256);
+   ASSERT_EQ(l.array_stride, 16384);
+
+   /* Rows 4 and 5, from texel 8 of the first row to texel 23 of the last */
+   struct pan_image_range r = pan_image_surface_range(&l, 0, 0, 8, 4, 16, 2);
+   EXPECT_EQ(r.offset, (4 * 256) + (8 * 4));
+   EXPECT_EQ(r.size, 256 + (16 * 4));
+
+   r = pan_image_surface_range(&l, 0, 2, 8, 4, 16, 2);
+   EXPECT_EQ(r.offset, (2 * 16384) + (4 * 256) + (8 * 4));
+   EXPECT_EQ(r.size, 256 + (16 * 4));
+
+   r = pan_image_surface_range(&l, 0, 3, 0, 0, 64, 64);
+   EXPECT_EQ(r.offset, 3 * 16384);
+   EXPECT_EQ(r.size, 16384);
+}
+
+TEST(SurfaceRange, UInterleaved)
+{
+   struct pan_image_layout l = {
+      .modifier = DRM_FORMAT_MOD_ARM_16X16_BLOCK_U_INTERLEAVED,
+      .format = PIPE_FORMAT_R8G8B8A8_UNORM,
+      .width = 64,
+      .height = 64,
+      .depth = 1,
+      .nr_samples = 1,
+      .dim = MALI_TEXTURE_DIMENSION_2D,
+      .nr_slices = 2,
+      .array_size = 1
+   };
+
+   ASSERT_TRUE(pan_image_layout_init(&l, NULL));
+   ASSERT_EQ(l.slices[0].row_stride, 4096);
+   ASSERT_EQ(l.slices[1].offset, 16384);
+
+   /* Contained in the second tile of the second row of 16x16 tiles */
+   struct pan_image_range r = pan_image_surface_range(&l, 0, 0, 20, 17, 8, 8);
+   EXPECT_EQ(r.offset, 4096 + 1024);
+   EXPECT_EQ(r.size, 1024);
+
+   /* Straddles the first two rows of tiles */
+   r = pan_image_surface_range(&l, 0, 0, 0, 8, 64, 16);
+   EXPECT_EQ(r.offset, 0);
+   EXPECT_EQ(r.size, 8192);
+
+   /* A single texel still touches a whole tile */
+   r = pan_image_surface_range(&l, 1, 0, 0, 0, 1, 1);
+   EXPECT_EQ(r.offset, 16384);
+   EXPECT_EQ(r.size, 1024);
+}
+
+TEST(SurfaceRange, UInterleavedBlockCompressed)
+{
+   struct pan_image_layout l = {
+      .modifier = DRM_FORMAT_MOD_ARM_16X16_BLOCK_U_INTERLEAVED,
+      .format = PIPE_FORMAT_ETC2_RGB8,
+      .width = 128,
+      .height = 128,
+      .depth = 1,
+      .nr_samples = 1,
+      .dim = MALI_TEXTURE_DIMENSION_2D,
+      .nr_slices = 1,
+      .array_size = 1
+   };
+
+   ASSERT_TRUE(pan_image_layout_init(&l, NULL));
+
+   /* 4x4 tiles of 4x4 blocks, each 8 bytes, so 128 bytes per tile and 1024
+    * bytes per row of tiles. Pixels 20-23 are in block 5, hence tile 1.
+    */
+   struct pan_image_range r = pan_image_surface_range(&l, 0, 0, 20, 20, 4, 4);
+   EXPECT_EQ(r.offset, 1024 + 128);
+   EXPECT_EQ(r.size, 128);
+}
+
+TEST(SurfaceRange, AFBC)
+{
+   uint64_t modifier = DRM_FORMAT_MOD_ARM_AFBC(AFBC_FORMAT_MOD_BLOCK_SIZE_16x16 |
+                        AFBC_FORMAT_MOD_SPARSE);
+
+   struct pan_image_layout l = {
+      .modifier = modifier,
+      .format = PIPE_FORMAT_R8G8B8A8_UNORM,
+      .width = 64,
+      .height = 64,
+      .depth = 1,
+      .nr_samples = 1,
+      .dim = MALI_TEXTURE_DIMENSION_2D,
+      .nr_slices = 1,
+      .array_size = 2
+   };
+
+   ASSERT_TRUE(pan_image_layout_init(&l, NULL));
+
+   /* The whole layer is returned, headers included: 4x4 superblocks with 16
+    * byte headers, followed by 16 superblocks of 1024 bytes each.
+    */
+   struct pan_image_range r = pan_image_surface_range(&l, 0, 1, 16, 16, 1, 1);
+   EXPECT_EQ(r.offset, 256 + 16384);
+   EXPECT_EQ(r.size, 256 + 16384);
+}
+
+TEST(SurfaceRange, AFBC3D)
+{
+   uint64_t modifier = DRM_FORMAT_MOD_ARM_AFBC(AFBC_FORMAT_MOD_BLOCK_SIZE_16x16 |
+                        AFBC_FORMAT_MOD_SPARSE);
+
+   struct pan_image_layout l = {
+      .modifier = modifier,
+      .format = PIPE_FORMAT_R8G8B8A8_UNORM,
+      .width = 8,
+      .height = 32,
+      .depth = 16,
+      .nr_samples = 1,
+      .dim = MALI_TEXTURE_DIMENSION_3D,
+      .nr_slices = 1
+   };
+
+   ASSERT_TRUE(pan_image_layout_init(&l, NULL));
+
+   /* Headers of all slices precede the bodies, so the whole level is touched */
+   struct pan_image_range r = pan_image_surface_range(&l, 0, 3, 0, 0, 8, 32);
+   EXPECT_EQ(r.offset, 0);
+   EXPECT_EQ(r.size, 1024 + 32768);
+}
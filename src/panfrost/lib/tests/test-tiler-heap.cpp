@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pan_tiler_heap.h"
+
+#include <gtest/gtest.h>
+#include <string.h>
+#include <vector>
+
+#define CHUNK_SIZE 0x1000
+#define CHUNK0_VA 0x100000
+#define CHUNK1_VA 0x200000
+
+class TilerHeap : public testing::Test {
+protected:
+   TilerHeap() : chunk0(CHUNK_SIZE, 0), chunk1(CHUNK_SIZE, 0)
+   {
+      write(chunk0, 0, CHUNK1_VA | (CHUNK_SIZE >> 12));
+
+      chunk0[0x1ff] = 1;
+      chunk1[0x7f] = 1;
+
+      heap = pan_tiler_heap_create();
+   }
+
+   ~TilerHeap()
+   {
+      pan_tiler_heap_destroy(heap);
+   }
+
+   static void write(std::vector<uint8_t> &chunk, unsigned offset,
+                     uint64_t value)
+   {
+      memcpy(chunk.data() + offset, &value, sizeof(value));
+   }
+
+   void add_chunks()
+   {
+      pan_tiler_heap_add_chunk(heap, CHUNK0_VA, CHUNK_SIZE, chunk0.data(),
+                               CHUNK_SIZE);
+      pan_tiler_heap_add_chunk(heap, CHUNK1_VA, CHUNK_SIZE, chunk1.data(),
+                               CHUNK_SIZE);
+      pan_tiler_heap_analyze(heap);
+   }
+
+   std::vector<uint8_t> chunk0, chunk1;
+   struct pan_tiler_heap *heap;
+};
+
+TEST_F(TilerHeap, NextChunk)
+{
+   uint64_t va;
+   uint32_t size;
+
+   ASSERT_TRUE(pan_tiler_heap_next_chunk(chunk0.data(), &va, &size));
+   EXPECT_EQ(va, CHUNK1_VA);
+   EXPECT_EQ(size, CHUNK_SIZE);
+
+   EXPECT_FALSE(pan_tiler_heap_next_chunk(chunk1.data(), &va, &size));
+}
+
+TEST_F(TilerHeap, UsedSize)
+{
+   EXPECT_EQ(pan_tiler_heap_used_size(chunk0.data(), CHUNK_SIZE), 0x200u);
+   EXPECT_EQ(pan_tiler_heap_used_size(chunk1.data(), CHUNK_SIZE), 0x80u);
+
+   chunk1[0x7f] = 0;
+   EXPECT_EQ(pan_tiler_heap_used_size(chunk1.data(), CHUNK_SIZE), 0u);
+}
+
+TEST_F(TilerHeap, Utilization)
+{
+   add_chunks();
+
+   EXPECT_EQ(heap->chunk_count, 2u);
+   EXPECT_EQ(heap->size, 2u * CHUNK_SIZE);
+   EXPECT_EQ(heap->used, 0x280u);
+   EXPECT_EQ(heap->chunks[0].used, 0x200u);
+   EXPECT_EQ(heap->chunks[1].used, 0x80u);
+}
+
+TEST_F(TilerHeap, Print)
+{
+   add_chunks();
+
+   char *buf = NULL;
+   size_t size = 0;
+   FILE *fp = open_memstream(&buf, &size);
+
+   pan_tiler_heap_print(heap, fp);
+   fclose(fp);
+
+   EXPECT_STREQ(buf, "Tiler heap: 2 chunks, at most 0 KiB used of 8 KiB (7%)\n");
+   free(buf);
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "compiler/glsl_types.h"
+#include "compiler/nir/nir.h"
+#include "util/pan_ir.h"
+
+#include <gtest/gtest.h>
+
+/*
+ * Test the packed Valhall varying layout computed from a vertex shader. Only
+ * the offsets and size are under test, as these form the ABI between the
+ * linked vertex and fragment shaders.
+ */
+
+class VaryingLayout : public testing::Test {
+protected:
+   VaryingLayout() {
+      glsl_type_singleton_init_or_ref();
+
+      static const nir_shader_compiler_options options = {};
+      s = nir_shader_create(NULL, MESA_SHADER_VERTEX, &options, NULL);
+   }
+
+   ~VaryingLayout() {
+      ralloc_free(s);
+      glsl_type_singleton_decref();
+   }
+
+   void
+   output(unsigned index, const struct glsl_type *type, unsigned frac = 0)
+   {
+      nir_variable *var = nir_variable_create(s, nir_var_shader_out, type,
+                                              "out");
+      var->data.location = VARYING_SLOT_VAR0 + index;
+      var->data.location_frac = frac;
+
+      unsigned slots = glsl_count_attribute_slots(type, false);
+      s->info.outputs_written |=
+         BITFIELD64_RANGE(var->data.location, slots);
+   }
+
+   struct pan_varying_layout
+   layout()
+   {
+      struct pan_varying_layout layout;
+      pan_nir_build_varying_layout(s, &layout);
+      return layout;
+   }
+
+   nir_shader *s;
+};
+
+TEST_F(VaryingLayout, Empty)
+{
+   struct pan_varying_layout l = layout();
+
+   EXPECT_EQ(l.written, 0);
+   EXPECT_EQ(l.size, 0);
+   EXPECT_EQ(pan_varying_layout_offset(&l, 0), 0);
+}
+
+TEST_F(VaryingLayout, PacksPartialVectors)
+{
+   output(0, glsl_vec_type(2));
+   output(1, glsl_vec_type(3));
+   output(2, glsl_vec_type(2));
+   output(3, glsl_float_type());
+
+   struct pan_varying_layout l = layout();
+
+   EXPECT_EQ(l.written, 0xF);
+   EXPECT_EQ(pan_varying_layout_offset(&l, 0), 0);
+   EXPECT_EQ(pan_varying_layout_offset(&l, 1), 16);
+   EXPECT_EQ(pan_varying_layout_offset(&l, 2), 8);
+   EXPECT_EQ(pan_varying_layout_offset(&l, 3), 28);
+   EXPECT_EQ(l.size, 32);
+}
+
+TEST_F(VaryingLayout, CompactedComponents)
+{
+   /* nir_compact_varyings may pack several variables into one slot */
+   output(0, glsl_vec_type(2));
+   output(0, glsl_float_type(), 2);
+   output(1, glsl_float_type());
+
+   struct pan_varying_layout l = layout();
+
+   EXPECT_EQ(pan_varying_layout_offset(&l, 0), 0);
+   EXPECT_EQ(pan_varying_layout_offset(&l, 1), 12);
+   EXPECT_EQ(l.size, 16);
+}
+
+TEST_F(VaryingLayout, ArraysKeep16ByteStride)
+{
+   output(0, glsl_float_type());
+   output(1, glsl_array_type(glsl_vec_type(2), 3, 0));
+   output(4, glsl_float_type());
+
+   struct pan_varying_layout l = layout();
+
+   EXPECT_EQ(pan_varying_layout_offset(&l, 0), 0);
+   EXPECT_EQ(pan_varying_layout_offset(&l, 1), 16);
+   EXPECT_EQ(pan_varying_layout_offset(&l, 2), 32);
+   EXPECT_EQ(pan_varying_layout_offset(&l, 3), 48);
+   EXPECT_EQ(pan_varying_layout_offset(&l, 4), 4);
+   EXPECT_EQ(l.size, 64);
+}
+
+TEST_F(VaryingLayout, UnwrittenAliasesDummySlot)
+{
+   output(1, glsl_vec4_type());
+
+   struct pan_varying_layout l = layout();
+
+   EXPECT_EQ(l.written, BITFIELD_BIT(1));
+   EXPECT_EQ(pan_varying_layout_offset(&l, 1), 0);
+   EXPECT_EQ(pan_varying_layout_offset(&l, 0), 16);
+   EXPECT_EQ(pan_varying_layout_offset(&l, 5), 16);
+}
+
+TEST_F(VaryingLayout, IgnoresSpecialVaryings)
+{
+   nir_variable *pos = nir_variable_create(s, nir_var_shader_out,
+                                           glsl_vec4_type(), "pos");
+   pos->data.location = VARYING_SLOT_POS;
+   s->info.outputs_written |= VARYING_BIT_POS;
+
+   output(0, glsl_vec_type(2));
+
+   struct pan_varying_layout l = layout();
+
+   EXPECT_EQ(l.written, BITFIELD_BIT(0));
+   EXPECT_EQ(l.size, 16);
+}
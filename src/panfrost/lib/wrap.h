@@ -55,6 +55,13 @@ pandecode_inject_mmap(uint64_t gpu_va, void *cpu, unsigned sz, const char *name)
 
 void pandecode_inject_free(uint64_t gpu_va, unsigned sz);
 
+/* Decodes requested between these share one snapshot of the memory, taken
+ * by pandecode_begin_submit(). Only the buffers mapped at the given GPU
+ * addresses are snapshotted. */
+void pandecode_begin_submit(const uint64_t *gpu_vas, unsigned count);
+
+void pandecode_end_submit(void);
+
 void pandecode_jc(uint64_t jc_gpu_va, unsigned gpu_id);
 
 void pandecode_cs(uint64_t cs_gpu_va, unsigned cs_size, unsigned gpu_id);
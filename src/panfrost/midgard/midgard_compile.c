@@ -3264,6 +3264,7 @@ midgard_compile_shader_nir(nir_shader *nir,
                 mir_foreach_block(ctx, _block) {
                         midgard_block *block = (midgard_block *) _block;
                         progress |= midgard_opt_copy_prop(ctx, block);
+                        progress |= midgard_opt_vectorize(ctx, block);
                         progress |= midgard_opt_combine_projection(ctx, block);
                         progress |= midgard_opt_varying_projection(ctx, block);
                 }
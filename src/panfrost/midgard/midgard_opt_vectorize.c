@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "compiler.h"
+#include "midgard_ops.h"
+
+/* Superword-level parallelism over MIR. NIR vectorizes ALU operations whose
+ * sources come from the same SSA vectors, but out-of-SSA and the MIR lowerings
+ * leave behind independent scalar (or partial vector) operations writing
+ * disjoint components of the same register from the same sources. Each of
+ * these occupies its own ALU in a bundle, so fusing them into a single vector
+ * operation frees up units for the scheduler. E.g.
+ *
+ *      fadd r0.x, r1.y, r2.x
+ *      fmul r3.x, r4.x, r4.y
+ *      fadd r0.zw, r1.xz, r2.zw
+ *
+ * becomes
+ *
+ *      fadd r0.xzw, r1.yxz, r2.xzw
+ *      fmul r3.x, r4.x, r4.y
+ *
+ * The pass runs before scheduling, so instructions are still in source order
+ * within the block and the later instruction may be hoisted to the earlier as
+ * long as nothing in between interferes.
+ */
+
+/* Bound the search, to keep compile time linear in the size of the block */
+#define MIR_VECTORIZE_WINDOW 32
+
+static bool
+mir_is_vectorizable(midgard_instruction *ins)
+{
+        if (ins->type != TAG_ALU_4) return false;
+        if (ins->compact_branch) return false;
+        if (ins->dest == ~0) return false;
+        if (ins->is_pack) return false;
+
+        unsigned props = alu_opcode_props[ins->op].props;
+
+        /* Transcendentals and friends are scalar-only. Reductions do not
+         * operate per-component. Conditional selects have fixed requirements
+         * on the condition register.
+         */
+        if (!(props & UNITS_VECTOR)) return false;
+        if (GET_CHANNEL_COUNT(props)) return false;
+        if (OP_IS_CSEL(ins->op)) return false;
+
+        /* Swizzles must index the same components as the mask. Narrower types
+         * must also keep each source within one half of the register, and
+         * 64-bit swizzles are paired, so only handle 32-bit for now.
+         */
+        if (nir_alu_type_get_type_size(ins->dest_type) != 32) return false;
+
+        mir_foreach_src(ins, s) {
+                if (ins->src[s] == ~0) continue;
+
+                if (nir_alu_type_get_type_size(ins->src_types[s]) != 32)
+                        return false;
+        }
+
+        return true;
+}
+
+static bool
+mir_can_fuse(midgard_instruction *a, midgard_instruction *b)
+{
+        if (a->op != b->op) return false;
+        if (a->dest != b->dest) return false;
+        if (a->mask & b->mask) return false;
+
+        if (a->dest_type != b->dest_type) return false;
+        if (a->outmod != b->outmod) return false;
+        if (a->roundmode != b->roundmode) return false;
+
+        /* The second instruction must not depend on the first */
+        if (mir_has_arg(b, a->dest)) return false;
+
+        /* Constants are shared by the whole instruction */
+        if (a->has_inline_constant != b->has_inline_constant) return false;
+        if (a->has_inline_constant && a->inline_constant != b->inline_constant)
+                return false;
+
+        if (a->has_constants != b->has_constants) return false;
+        if (a->has_constants && memcmp(&a->constants, &b->constants,
+                                       sizeof(a->constants)))
+                return false;
+
+        /* Only the swizzles may differ between sources */
+        mir_foreach_src(a, s) {
+                if (a->src[s] != b->src[s]) return false;
+                if (a->src[s] == ~0) continue;
+
+                if (a->src_types[s] != b->src_types[s]) return false;
+                if (a->src_abs[s] != b->src_abs[s]) return false;
+                if (a->src_neg[s] != b->src_neg[s]) return false;
+                if (a->src_invert[s] != b->src_invert[s]) return false;
+        }
+
+        return true;
+}
+
+/* Can an instruction fusable with a be hoisted past ins? Fusable instructions
+ * share the sources and destination of a, so it suffices to check that ins
+ * neither overwrites a source of a nor touches its destination.
+ */
+
+static bool
+mir_interferes(midgard_instruction *ins, midgard_instruction *a)
+{
+        if (ins->dest != ~0 && mir_has_arg(a, ins->dest))
+                return true;
+
+        return ins->dest == a->dest || mir_has_arg(ins, a->dest);
+}
+
+static void
+mir_fuse(midgard_instruction *a, midgard_instruction *b)
+{
+        for (unsigned c = 0; c < MIR_VEC_COMPONENTS; ++c) {
+                if (!(b->mask & BITFIELD_BIT(c))) continue;
+
+                mir_foreach_src(a, s)
+                        a->swizzle[s][c] = b->swizzle[s][c];
+        }
+
+        a->mask |= b->mask;
+        mir_remove_instruction(b);
+}
+
+bool
+midgard_opt_vectorize(compiler_context *ctx, midgard_block *block)
+{
+        bool progress = false;
+
+        /* Fusing removes instructions after a, possibly the next one, so
+         * don't let the iterator cache it */
+        for (midgard_instruction *a = list_first_entry(&block->base.instructions,
+                                                       midgard_instruction, link);
+             &a->link != &block->base.instructions; a = mir_next_op(a)) {
+                if (!mir_is_vectorizable(a)) continue;
+
+                unsigned window = 0;
+                midgard_instruction *b = mir_next_op(a);
+
+                while (&b->link != &block->base.instructions &&
+                       window++ < MIR_VECTORIZE_WINDOW) {
+                        midgard_instruction *next = mir_next_op(b);
+
+                        if (mir_is_vectorizable(b) && mir_can_fuse(a, b)) {
+                                mir_fuse(a, b);
+                                progress = true;
+                        } else if (mir_interferes(b, a) || b->compact_branch) {
+                                /* Later candidates cannot be hoisted past b */
+                                break;
+                        }
+
+                        b = next;
+                }
+        }
+
+        return progress;
+}
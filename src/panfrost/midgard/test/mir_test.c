@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "compiler.h"
+#include "mir_test.h"
+
+struct mir_test {
+        compiler_context *ctx;
+        midgard_block *block;
+};
+
+struct mir_test *
+mir_test_create(void *memctx)
+{
+        struct mir_test *t = rzalloc(memctx, struct mir_test);
+
+        t->ctx = rzalloc(t, compiler_context);
+        t->block = rzalloc(t->ctx, midgard_block);
+        list_inithead(&t->block->base.instructions);
+        t->ctx->current_block = t->block;
+
+        return t;
+}
+
+static void
+mir_test_set_swizzle(unsigned *swizzle, const char *comps)
+{
+        for (unsigned c = 0; c < MIR_VEC_COMPONENTS; ++c)
+                swizzle[c] = c;
+
+        for (unsigned c = 0; c < 4 && comps[c]; ++c) {
+                if (comps[c] != '_')
+                        swizzle[c] = comps[c] == 'w' ? 3 : comps[c] - 'x';
+        }
+}
+
+midgard_instruction *
+mir_test_alu(struct mir_test *t, midgard_alu_op op, unsigned bits,
+             unsigned dest, uint16_t mask,
+             unsigned src0, const char *swz0,
+             unsigned src1, const char *swz1)
+{
+        nir_alu_type type = nir_type_float | bits;
+
+        midgard_instruction ins = {
+                .type = TAG_ALU_4,
+                .op = op,
+                .dest = dest,
+                .dest_type = type,
+                .mask = mask,
+                .src = { src0, src1, ~0, ~0 },
+                .src_types = { type, type },
+        };
+
+        mir_test_set_swizzle(ins.swizzle[0], swz0);
+        mir_test_set_swizzle(ins.swizzle[1], swz1);
+
+        return emit_mir_instruction(t->ctx, ins);
+}
+
+bool
+mir_test_vectorize(struct mir_test *t)
+{
+        return midgard_opt_vectorize(t->ctx, t->block);
+}
+
+unsigned
+mir_test_count(struct mir_test *t)
+{
+        return list_length(&t->block->base.instructions);
+}
+
+uint16_t
+mir_test_mask(const midgard_instruction *ins)
+{
+        return ins->mask;
+}
+
+unsigned
+mir_test_swizzle(const midgard_instruction *ins, unsigned src, unsigned comp)
+{
+        return ins->swizzle[src][comp];
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __MIR_TEST_H
+#define __MIR_TEST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "midgard.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* compiler.h is C only, so the tests build MIR through these helpers. A test
+ * shader is a single block. */
+
+struct mir_test;
+struct midgard_instruction;
+
+struct mir_test *mir_test_create(void *memctx);
+
+/* Append a two-source ALU op. Swizzles give the component read for each of
+ * xyzw, '_' where the component is not written. src1 may be ~0. */
+struct midgard_instruction *
+mir_test_alu(struct mir_test *t, midgard_alu_op op, unsigned bits,
+             unsigned dest, uint16_t mask,
+             unsigned src0, const char *swz0,
+             unsigned src1, const char *swz1);
+
+bool mir_test_vectorize(struct mir_test *t);
+
+unsigned mir_test_count(struct mir_test *t);
+
+uint16_t mir_test_mask(const struct midgard_instruction *ins);
+
+unsigned
+mir_test_swizzle(const struct midgard_instruction *ins, unsigned src,
+                 unsigned comp);
+
+#ifdef __cplusplus
+} /* extern C */
+#endif
+
+#endif
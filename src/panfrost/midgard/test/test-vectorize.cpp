@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "mir_test.h"
+#include "util/ralloc.h"
+
+#include <gtest/gtest.h>
+
+class Vectorize : public testing::Test {
+protected:
+   Vectorize() {
+      mem_ctx = ralloc_context(NULL);
+      t = mir_test_create(mem_ctx);
+   }
+
+   ~Vectorize() {
+      ralloc_free(mem_ctx);
+   }
+
+   struct midgard_instruction *alu(midgard_alu_op op, unsigned dest, uint16_t mask,
+                            unsigned src0, const char *swz0,
+                            unsigned src1, const char *swz1,
+                            unsigned bits = 32)
+   {
+      return mir_test_alu(t, op, bits, dest, mask, src0, swz0, src1, swz1);
+   }
+
+   bool vectorize() { return mir_test_vectorize(t); }
+   unsigned count() { return mir_test_count(t); }
+
+   void *mem_ctx;
+   struct mir_test *t;
+};
+
+#define X 0x1
+#define Y 0x2
+#define Z 0x4
+#define W 0x8
+
+TEST_F(Vectorize, FusesDisjointComponents)
+{
+   struct midgard_instruction *a = alu(midgard_alu_op_fadd, 0, X, 1, "y___", 2, "x___");
+   alu(midgard_alu_op_fmul, 3, X, 4, "x___", 4, "y___");
+   alu(midgard_alu_op_fadd, 0, Z | W, 1, "__xz", 2, "__zw");
+
+   ASSERT_TRUE(vectorize());
+   ASSERT_EQ(count(), 2u);
+
+   EXPECT_EQ(mir_test_mask(a), X | Z | W);
+   EXPECT_EQ(mir_test_swizzle(a, 0, 0), 1u);
+   EXPECT_EQ(mir_test_swizzle(a, 0, 2), 0u);
+   EXPECT_EQ(mir_test_swizzle(a, 0, 3), 2u);
+   EXPECT_EQ(mir_test_swizzle(a, 1, 0), 0u);
+   EXPECT_EQ(mir_test_swizzle(a, 1, 2), 2u);
+   EXPECT_EQ(mir_test_swizzle(a, 1, 3), 3u);
+}
+
+TEST_F(Vectorize, FusesSeveral)
+{
+   struct midgard_instruction *a = alu(midgard_alu_op_fmul, 0, X, 1, "x___", 2, "x___");
+   alu(midgard_alu_op_fmul, 0, Y, 1, "_y__", 2, "_y__");
+   alu(midgard_alu_op_fmul, 0, Z, 1, "__z_", 2, "__z_");
+   alu(midgard_alu_op_fmul, 0, W, 1, "___w", 2, "___w");
+
+   ASSERT_TRUE(vectorize());
+   ASSERT_EQ(count(), 1u);
+   EXPECT_EQ(mir_test_mask(a), X | Y | Z | W);
+}
+
+TEST_F(Vectorize, OverlappingMasks)
+{
+   alu(midgard_alu_op_fadd, 0, X | Y, 1, "xy__", 2, "xy__");
+   alu(midgard_alu_op_fadd, 0, Y | Z, 1, "_xy_", 2, "_xy_");
+
+   EXPECT_FALSE(vectorize());
+   EXPECT_EQ(count(), 2u);
+}
+
+TEST_F(Vectorize, DependentInstruction)
+{
+   /* The second reads what the first writes */
+   alu(midgard_alu_op_fadd, 0, X, 0, "_y__", 2, "x___");
+   alu(midgard_alu_op_fadd, 0, Y, 0, "_x__", 2, "_y__");
+
+   EXPECT_FALSE(vectorize());
+   EXPECT_EQ(count(), 2u);
+}
+
+TEST_F(Vectorize, InterveningSourceWrite)
+{
+   alu(midgard_alu_op_fadd, 0, X, 1, "x___", 2, "x___");
+   alu(midgard_alu_op_fmul, 1, X, 4, "x___", 4, "y___");
+   alu(midgard_alu_op_fadd, 0, Y, 1, "_y__", 2, "_y__");
+
+   EXPECT_FALSE(vectorize());
+   EXPECT_EQ(count(), 3u);
+}
+
+TEST_F(Vectorize, InterveningDestinationRead)
+{
+   alu(midgard_alu_op_fadd, 0, X, 1, "x___", 2, "x___");
+   alu(midgard_alu_op_fmul, 3, X, 0, "x___", 4, "x___");
+   alu(midgard_alu_op_fadd, 0, Y, 1, "_y__", 2, "_y__");
+
+   EXPECT_FALSE(vectorize());
+   EXPECT_EQ(count(), 3u);
+}
+
+TEST_F(Vectorize, DifferentDestinations)
+{
+   /* A vector op writes one register, so this would need a move */
+   alu(midgard_alu_op_fadd, 0, X, 1, "x___", 2, "x___");
+   alu(midgard_alu_op_fadd, 3, Y, 1, "_y__", 2, "_y__");
+
+   EXPECT_FALSE(vectorize());
+   EXPECT_EQ(count(), 2u);
+}
+
+TEST_F(Vectorize, DifferentSources)
+{
+   alu(midgard_alu_op_fadd, 0, X, 1, "x___", 2, "x___");
+   alu(midgard_alu_op_fadd, 0, Y, 1, "_y__", 4, "_y__");
+
+   EXPECT_FALSE(vectorize());
+   EXPECT_EQ(count(), 2u);
+}
+
+TEST_F(Vectorize, DifferentOps)
+{
+   alu(midgard_alu_op_fadd, 0, X, 1, "x___", 2, "x___");
+   alu(midgard_alu_op_fmul, 0, Y, 1, "_y__", 2, "_y__");
+
+   EXPECT_FALSE(vectorize());
+   EXPECT_EQ(count(), 2u);
+}
+
+TEST_F(Vectorize, OnlyThirtyTwoBit)
+{
+   alu(midgard_alu_op_fadd, 0, X, 1, "x___", 2, "x___", 16);
+   alu(midgard_alu_op_fadd, 0, Y, 1, "_y__", 2, "_y__", 16);
+
+   EXPECT_FALSE(vectorize());
+   EXPECT_EQ(count(), 2u);
+}
+
+TEST_F(Vectorize, ScalarOnlyOps)
+{
+   /* Transcendentals only run on the scalar units */
+   alu(midgard_alu_op_frcp, 0, X, 1, "x___", ~0, "____");
+   alu(midgard_alu_op_frcp, 0, Y, 1, "_y__", ~0, "____");
+
+   EXPECT_FALSE(vectorize());
+   EXPECT_EQ(count(), 2u);
+}
@@ -20,6 +20,7 @@
 # THE SOFTWARE.
 
 import argparse
+import ast
 import textwrap
 import os
 
@@ -84,11 +85,97 @@ class Product:
       for xml_cat in self.xml.findall(".//category"):
          self.categories.append(Category(self, xml_cat))
 
+      # Counter name -> (category index, counter index)
+      self.counter_index = {}
+      for i, category in enumerate(self.categories):
+         for j, counter in enumerate(category.counters):
+            self.counter_index[counter.xml.get("counter")] = (i, j)
+
+
+# Variables usable in equations besides the counters
+equation_variables = {
+   "core_count": "(double)perf->dev->core_count",
+   "duration_ns": "(double)sample->duration",
+}
+
+equation_functions = {
+   "min": "MIN2",
+   "max": "MAX2",
+}
+
+
+# Translates an equation to a C expression for a given product, or returns
+# None if the product lacks one of the counters it uses.
+class Equation:
+   def __init__(self, text):
+      self.text = text.strip()
+      self.tree = ast.parse(self.text, mode='eval').body
+
+   def to_c(self, prod):
+      try:
+         return self._to_c(self.tree, prod)
+      except KeyError:
+         return None
+
+   def _to_c(self, node, prod):
+      if isinstance(node, ast.BinOp):
+         lhs = self._to_c(node.left, prod)
+         rhs = self._to_c(node.right, prod)
+
+         if isinstance(node.op, ast.Div):
+            return "panfrost_perf_div(%s, %s)" % (lhs, rhs)
+
+         ops = { ast.Add: '+', ast.Sub: '-', ast.Mult: '*' }
+         return "(%s %s %s)" % (lhs, ops[type(node.op)], rhs)
+      elif isinstance(node, ast.UnaryOp) and isinstance(node.op, ast.USub):
+         return "(-%s)" % self._to_c(node.operand, prod)
+      elif isinstance(node, ast.Constant) and isinstance(node.value, (int, float)):
+         return "%s.0" % node.value if isinstance(node.value, int) else repr(node.value)
+      elif isinstance(node, ast.Call) and node.func.id in equation_functions:
+         assert len(node.args) == 2
+         return "%s(%s, %s)" % (equation_functions[node.func.id],
+                                self._to_c(node.args[0], prod),
+                                self._to_c(node.args[1], prod))
+      elif isinstance(node, ast.Name) and node.id in equation_variables:
+         return equation_variables[node.id]
+      elif isinstance(node, ast.Name):
+         # Raises KeyError for counters the product doesn't have
+         category, counter = prod.counter_index[node.id]
+         return "COUNTER(%u, %u)" % (category, counter)
+
+      raise Exception("Unsupported expression in equation: " + self.text)
+
+
+class DerivedMetric:
+   def __init__(self, xml):
+      self.xml = xml
+      self.name = self.xml.get("name")
+      self.desc = self.xml.get("description")
+      self.units = self.xml.get("units")
+      self.underscore_name = self.xml.get("symbol")
+      self.equations = [Equation(e.text) for e in self.xml.findall("equation")]
+      assert self.equations
+
+   # C expression of the first equation the product supports
+   def to_c(self, prod):
+      for equation in self.equations:
+         expr = equation.to_c(prod)
+         if expr is not None:
+            return expr
+
+      return None
+
+
+def parse_derived(filename):
+   xml = et.parse(filename)
+   return [DerivedMetric(m) for m in xml.findall("metric")]
+
 
 def main():
    parser = argparse.ArgumentParser()
    parser.add_argument("--header", help="Header file to write", required=True)
    parser.add_argument("--code", help="C file to write", required=True)
+   parser.add_argument("--derived", help="Derived metrics xml file", required=True)
    parser.add_argument("xml_files", nargs='+', help="List of xml metrics files to process")
 
    args = parser.parse_args()
@@ -100,6 +187,8 @@ def main():
    for xml_file in args.xml_files:
       prods.append(Product(xml_file))
 
+   derived = parse_derived(args.derived)
+
    tab_size = 3
 
    copyright = textwrap.dedent("""\
@@ -143,7 +232,18 @@ def main():
    c.write("#include \"" + os.path.basename(args.header) + "\"")
    c.write(textwrap.dedent("""\
 
+      #include <lib/pan_device.h>
       #include <util/macros.h>
+
+      static inline double
+      panfrost_perf_div(double num, double denom)
+      {
+         return denom != 0.0 ? num / denom : 0.0;
+      }
+
+      #define COUNTER(category, counter) \\
+         ((double)panfrost_perf_counter_read_sample( \\
+            &perf->cfg->categories[category].counters[counter], perf, sample))
       """))
 
    for prod in prods:
@@ -161,10 +261,25 @@ def main():
          category_counters_count = len(category.counters)
          c.write("STATIC_ASSERT(%u <= PAN_PERF_MAX_COUNTERS);" % category_counters_count)
          n_counters += category_counters_count
+
+      prod_derived = [(m, m.to_c(prod)) for m in derived]
+      prod_derived = [(m, expr) for (m, expr) in prod_derived if expr is not None]
+      c.write("STATIC_ASSERT(%u <= PAN_PERF_MAX_DERIVED);" % len(prod_derived))
       
       c.outdent(tab_size)
       c.write("}\n")
 
+      for (metric, expr) in prod_derived:
+         c.write(textwrap.dedent("""
+         static double
+         panfrost_perf_derived_%s_%s(const struct panfrost_perf *perf,
+                                     const struct panfrost_perf_sample *sample)
+         {""" % (prod.id, metric.underscore_name)))
+         c.indent(tab_size)
+         c.write("return %s;" % expr)
+         c.outdent(tab_size)
+         c.write("}")
+
 
       current_struct_name = "panfrost_perf_config_%s" % prod.id
       c.write("\nconst struct panfrost_perf_config %s = {" % current_struct_name)
@@ -216,6 +331,24 @@ def main():
       c.outdent(tab_size)
       c.write("}, // categories")
 
+      c.write(".n_derived = %u," % len(prod_derived))
+      c.write(".derived = {")
+      c.indent(tab_size)
+
+      for (metric, expr) in prod_derived:
+         c.write("{")
+         c.indent(tab_size)
+         c.write(".name = \"%s\"," % (metric.name))
+         c.write(".desc = \"%s\"," % (metric.desc))
+         c.write(".symbol_name = \"%s\"," % (metric.underscore_name))
+         c.write(".units = PAN_PERF_DERIVED_UNITS_%s," % (metric.units.upper()))
+         c.write(".evaluate = panfrost_perf_derived_%s_%s," % (prod.id, metric.underscore_name))
+         c.outdent(tab_size)
+         c.write("}, // derived metric")
+
+      c.outdent(tab_size)
+      c.write("}, // derived")
+
       c.outdent(tab_size)
       c.write("}; // %s\n" % current_struct_name)
 
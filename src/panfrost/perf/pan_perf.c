@@ -23,33 +23,96 @@
 
 #include "pan_perf.h"
 
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+
 #include <pan_perf_metrics.h>
 #include <lib/pan_device.h>
 #include <drm-uapi/panfrost_drm.h>
+#include "base/include/mali_kbase_hwcnt_reader.h"
 
 #define PAN_COUNTERS_PER_CATEGORY 64
+#define PAN_MEMORY_SYSTEM_INDEX 2
 #define PAN_SHADER_CORE_INDEX 3
 
-uint32_t
-panfrost_perf_counter_read(const struct panfrost_perf_counter *counter,
-                           const struct panfrost_perf *perf)
+/* Number of dump buffers the kernel fills before we have to read them back */
+#define PAN_HWCNT_BUFFER_COUNT 16
+
+static uint64_t
+panfrost_perf_now(void)
+{
+   struct timespec tp;
+   clock_gettime(CLOCK_MONOTONIC_RAW, &tp);
+   return tp.tv_sec * 1000000000ull + tp.tv_nsec;
+}
+
+static uint64_t
+panfrost_perf_values_read(const struct panfrost_perf_counter *counter,
+                          const struct panfrost_perf *perf,
+                          const uint64_t *values)
 {
    unsigned offset = perf->category_offset[counter->category_index];
    offset += counter->offset;
    assert(offset < perf->n_counter_values);
 
-   uint32_t ret = perf->counter_values[offset];
+   /* Summed over cores or slices, which may not fit in 32 bits */
+   uint64_t ret = values[offset];
 
    // If counter belongs to shader core, accumulate values for all other cores
    if (counter->category_index == PAN_SHADER_CORE_INDEX) {
       for (uint32_t core = 1; core < perf->dev->core_id_range; ++core) {
-         ret += perf->counter_values[offset + PAN_COUNTERS_PER_CATEGORY * core];
+         ret += values[offset + PAN_COUNTERS_PER_CATEGORY * core];
+      }
+   }
+
+   /* Same for the memory system counters, which are per L2 slice */
+   if (counter->category_index == PAN_MEMORY_SYSTEM_INDEX) {
+      unsigned l2_slices =
+         (perf->category_offset[PAN_SHADER_CORE_INDEX] -
+          perf->category_offset[PAN_MEMORY_SYSTEM_INDEX]) / PAN_COUNTERS_PER_CATEGORY;
+
+      for (uint32_t slice = 1; slice < l2_slices; ++slice) {
+         ret += values[offset + PAN_COUNTERS_PER_CATEGORY * slice];
       }
    }
 
    return ret;
 }
 
+uint64_t
+panfrost_perf_counter_read(const struct panfrost_perf_counter *counter,
+                           const struct panfrost_perf *perf)
+{
+   /* The latest sample holds the values of the latest dump */
+   const struct panfrost_perf_sample *sample = NULL;
+
+   if (perf->n_samples)
+      sample = panfrost_perf_get_sample(perf, perf->n_samples - 1);
+
+   return sample ? panfrost_perf_values_read(counter, perf, sample->values) : 0;
+}
+
+uint64_t
+panfrost_perf_counter_read_sample(const struct panfrost_perf_counter *counter,
+                                  const struct panfrost_perf *perf,
+                                  const struct panfrost_perf_sample *sample)
+{
+   return panfrost_perf_values_read(counter, perf, sample->values);
+}
+
+double
+panfrost_perf_derived_read(const struct panfrost_perf_derived *derived,
+                           const struct panfrost_perf *perf,
+                           const struct panfrost_perf_sample *sample)
+{
+   return derived->evaluate(perf, sample);
+}
+
 static const struct panfrost_perf_config *
 panfrost_lookup_counters(const char *name)
 {
@@ -61,10 +124,21 @@ panfrost_lookup_counters(const char *name)
         return NULL;
 }
 
+/* Returns NULL if the counters of the GPU are unknown */
+const struct panfrost_perf_config *
+panfrost_perf_lookup_config(const struct panfrost_device *dev)
+{
+   if (dev->model == NULL)
+      return NULL;
+
+   return panfrost_lookup_counters(dev->model->performance_counters);
+}
+
 void
 panfrost_perf_init(struct panfrost_perf *perf, struct panfrost_device *dev)
 {
    perf->dev = dev;
+   perf->hwcnt_fd = -1;
 
    if (dev->model == NULL)
            unreachable("Invalid GPU ID");
@@ -76,10 +150,17 @@ panfrost_perf_init(struct panfrost_perf *perf, struct panfrost_device *dev)
 
    // Generally counter blocks are laid out in the following order:
    // Job manager, tiler, one or more L2 caches, and one or more shader cores.
+   // CSF GPUs have the same layout, with the command stream front-end in
+   // place of the job manager.
    unsigned l2_slices = panfrost_query_l2_slices(dev);
    uint32_t n_blocks = 2 + l2_slices + dev->core_id_range;
    perf->n_counter_values = PAN_COUNTERS_PER_CATEGORY * n_blocks;
-   perf->counter_values = ralloc_array(perf, uint32_t, perf->n_counter_values);
+   perf->counter_values = rzalloc_array(perf, uint32_t, perf->n_counter_values);
+
+   for (unsigned i = 0; i < PAN_PERF_MAX_SAMPLES; ++i) {
+      perf->samples[i].values =
+         rzalloc_array(perf, uint64_t, perf->n_counter_values);
+   }
 
    /* Setup the layout */
    perf->category_offset[0] = PAN_COUNTERS_PER_CATEGORY * 0;
@@ -88,6 +169,38 @@ panfrost_perf_init(struct panfrost_perf *perf, struct panfrost_device *dev)
    perf->category_offset[3] = PAN_COUNTERS_PER_CATEGORY * (2 + l2_slices);
 }
 
+static void
+panfrost_perf_push_sample(struct panfrost_perf *perf, uint64_t timestamp,
+                          const void *values, size_t size)
+{
+   struct panfrost_perf_sample *sample =
+      &perf->samples[perf->n_samples % PAN_PERF_MAX_SAMPLES];
+
+   const uint32_t *values32 = values;
+   unsigned count = MIN2(size / sizeof(uint32_t), perf->n_counter_values);
+
+   sample->timestamp = timestamp;
+   sample->duration = timestamp - MIN2(perf->last_sample_ts, timestamp);
+
+   /* Widened so that sums over cores and over time don't wrap */
+   for (unsigned i = 0; i < count; ++i)
+      sample->values[i] = values32[i];
+
+   perf->last_sample_ts = timestamp;
+   perf->n_samples++;
+}
+
+const struct panfrost_perf_sample *
+panfrost_perf_get_sample(const struct panfrost_perf *perf, uint64_t index)
+{
+   /* Not taken yet, or already overwritten */
+   if (index >= perf->n_samples ||
+       index + PAN_PERF_MAX_SAMPLES < perf->n_samples)
+      return NULL;
+
+   return &perf->samples[index % PAN_PERF_MAX_SAMPLES];
+}
+
 static int
 panfrost_perf_query(struct panfrost_perf *perf, uint32_t enable)
 {
@@ -95,22 +208,158 @@ panfrost_perf_query(struct panfrost_perf *perf, uint32_t enable)
    return drmIoctl(perf->dev->fd, DRM_IOCTL_PANFROST_PERFCNT_ENABLE, &perfcnt_enable);
 }
 
+static int
+panfrost_perf_enable_kbase(struct panfrost_perf *perf)
+{
+   kbase k = &perf->dev->mali;
+
+   if (!k->hwcnt_reader_setup) {
+      errno = ENOSYS;
+      return -1;
+   }
+
+   int fd = k->hwcnt_reader_setup(k, PAN_HWCNT_BUFFER_COUNT);
+   if (fd < 0)
+      return -1;
+
+   uint32_t size = 0;
+   if (ioctl(fd, KBASE_HWCNT_READER_GET_BUFFER_SIZE, &size) < 0)
+      goto err_close;
+
+   void *buffers = mmap(NULL, (size_t)size * PAN_HWCNT_BUFFER_COUNT,
+                        PROT_READ, MAP_PRIVATE, fd, 0);
+   if (buffers == MAP_FAILED)
+      goto err_close;
+
+   perf->hwcnt_fd = fd;
+   perf->hwcnt_buffers = buffers;
+   perf->hwcnt_buffer_size = size;
+   perf->hwcnt_buffer_count = PAN_HWCNT_BUFFER_COUNT;
+   return 0;
+
+err_close:
+   close(fd);
+   return -1;
+}
+
 int
 panfrost_perf_enable(struct panfrost_perf *perf)
 {
+   perf->n_samples = 0;
+   perf->last_sample_ts = panfrost_perf_now();
+
+   if (perf->dev->kbase)
+      return panfrost_perf_enable_kbase(perf);
+
    return panfrost_perf_query(perf, 1 /* enable */);
 }
 
 int
 panfrost_perf_disable(struct panfrost_perf *perf)
 {
-   return panfrost_perf_query(perf, 0 /* disable */);
+   if (!perf->dev->kbase)
+      return panfrost_perf_query(perf, 0 /* disable */);
+
+   if (perf->hwcnt_fd < 0)
+      return 0;
+
+   munmap(perf->hwcnt_buffers,
+          (size_t)perf->hwcnt_buffer_size * perf->hwcnt_buffer_count);
+   close(perf->hwcnt_fd);
+
+   perf->hwcnt_fd = -1;
+   perf->hwcnt_buffers = NULL;
+   return 0;
+}
+
+/* Copy the dumps the kernel has finished writing to the sample ring and
+ * hand the buffers back. Returns the number of samples read. */
+static int
+panfrost_perf_read_kbase(struct panfrost_perf *perf)
+{
+   struct kbase_hwcnt_reader_metadata meta;
+   int count = 0;
+
+   while (ioctl(perf->hwcnt_fd, KBASE_HWCNT_READER_GET_BUFFER, &meta) == 0) {
+      assert(meta.buffer_idx < perf->hwcnt_buffer_count);
+
+      const uint8_t *buffer = (const uint8_t *)perf->hwcnt_buffers +
+         (size_t)meta.buffer_idx * perf->hwcnt_buffer_size;
+
+      panfrost_perf_push_sample(perf, meta.timestamp, buffer,
+                                perf->hwcnt_buffer_size);
+
+      if (ioctl(perf->hwcnt_fd, KBASE_HWCNT_READER_PUT_BUFFER, &meta) < 0)
+         return -1;
+
+      ++count;
+   }
+
+   return (count || errno == EAGAIN) ? count : -1;
+}
+
+int
+panfrost_perf_poll(struct panfrost_perf *perf, int64_t timeout_ns)
+{
+   if (perf->hwcnt_fd < 0) {
+      errno = ENOSYS;
+      return -1;
+   }
+
+   struct pollfd pfd = {
+      .fd = perf->hwcnt_fd,
+      .events = POLLIN,
+   };
+
+   int timeout_ms = timeout_ns < 0 ? -1 : DIV_ROUND_UP(timeout_ns, 1000000);
+   if (poll(&pfd, 1, timeout_ms) < 0)
+      return -1;
+
+   return panfrost_perf_read_kbase(perf);
+}
+
+int
+panfrost_perf_set_period(struct panfrost_perf *perf, uint64_t period_ns)
+{
+   /* The DRM ioctls can only be dumped on request */
+   if (perf->hwcnt_fd < 0) {
+      errno = ENOSYS;
+      return -1;
+   }
+
+   /* A period of zero stops the periodic dumps */
+   uint32_t interval = MIN2(period_ns, UINT32_MAX);
+   return ioctl(perf->hwcnt_fd, KBASE_HWCNT_READER_SET_INTERVAL, interval);
 }
 
 int
 panfrost_perf_dump(struct panfrost_perf *perf)
 {
+   if (perf->dev->kbase) {
+      if (perf->hwcnt_fd < 0) {
+         errno = ENOSYS;
+         return -1;
+      }
+
+      if (ioctl(perf->hwcnt_fd, KBASE_HWCNT_READER_DUMP, 0) < 0)
+         return -1;
+
+      /* The dump is written asynchronously, wait for it to land */
+      int ret = panfrost_perf_poll(perf, 1000000000ll);
+      if (ret == 0)
+         errno = ETIMEDOUT;
+
+      return ret > 0 ? 0 : -1;
+   }
+
    // Dump performance counter values to the memory buffer pointed to by counter_values
    struct drm_panfrost_perfcnt_dump perfcnt_dump = {(uint64_t)(uintptr_t)perf->counter_values};
-   return drmIoctl(perf->dev->fd, DRM_IOCTL_PANFROST_PERFCNT_DUMP, &perfcnt_dump);
+   int ret = drmIoctl(perf->dev->fd, DRM_IOCTL_PANFROST_PERFCNT_DUMP, &perfcnt_dump);
+
+   if (ret == 0) {
+      panfrost_perf_push_sample(perf, panfrost_perf_now(), perf->counter_values,
+                                perf->n_counter_values * sizeof(uint32_t));
+   }
+
+   return ret;
 }
@@ -24,6 +24,7 @@
 #ifndef PAN_PERF_H
 #define PAN_PERF_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #if defined(__cplusplus)
@@ -32,10 +33,15 @@ extern "C" {
 
 #define PAN_PERF_MAX_CATEGORIES 4
 #define PAN_PERF_MAX_COUNTERS 64
+#define PAN_PERF_MAX_DERIVED 16
+
+/* Number of samples kept in the ring buffer of struct panfrost_perf */
+#define PAN_PERF_MAX_SAMPLES 32
 
 struct panfrost_device;
 struct panfrost_perf_category;
 struct panfrost_perf;
+struct panfrost_perf_sample;
 
 enum panfrost_perf_counter_units {
    PAN_PERF_COUNTER_UNITS_CYCLES,
@@ -75,11 +81,43 @@ struct panfrost_perf_category {
    unsigned offset;
 };
 
+enum panfrost_perf_derived_units {
+   PAN_PERF_DERIVED_UNITS_PERCENT,
+   PAN_PERF_DERIVED_UNITS_RATIO,
+   PAN_PERF_DERIVED_UNITS_BYTES,
+   PAN_PERF_DERIVED_UNITS_BYTES_PER_SECOND,
+};
+
+/* Metric computed from several counters, see derived.xml */
+struct panfrost_perf_derived {
+   const char *name;
+   const char *desc;
+   const char *symbol_name;
+   enum panfrost_perf_derived_units units;
+
+   double (*evaluate)(const struct panfrost_perf *perf,
+                      const struct panfrost_perf_sample *sample);
+};
+
 struct panfrost_perf_config {
    const char *name;
 
    struct panfrost_perf_category categories[PAN_PERF_MAX_CATEGORIES];
    uint32_t n_categories;
+
+   struct panfrost_perf_derived derived[PAN_PERF_MAX_DERIVED];
+   uint32_t n_derived;
+};
+
+struct panfrost_perf_sample {
+   /* CLOCK_MONOTONIC_RAW time at which the sample was taken, in ns */
+   uint64_t timestamp;
+
+   /* Time elapsed since the previous sample, in ns */
+   uint64_t duration;
+
+   /* Counter values accumulated over the duration of the sample */
+   uint64_t *values;
 };
 
 struct panfrost_perf {
@@ -93,12 +131,40 @@ struct panfrost_perf {
 
    /* Offsets of categories */
    unsigned category_offset[PAN_PERF_MAX_CATEGORIES];
+
+   /* kbase hardware counter reader, -1 when the DRM ioctls are used. The
+    * kernel fills hwcnt_buffer_count buffers of the mapping, either on
+    * request or periodically, and we copy them to the sample ring. */
+   int hwcnt_fd;
+   void *hwcnt_buffers;
+   uint32_t hwcnt_buffer_size;
+   uint32_t hwcnt_buffer_count;
+
+   /* Ring buffer of the latest samples, sample i is stored at index
+    * i % PAN_PERF_MAX_SAMPLES. n_samples is the number of samples taken
+    * since the counters were enabled. */
+   struct panfrost_perf_sample samples[PAN_PERF_MAX_SAMPLES];
+   uint64_t n_samples;
+   uint64_t last_sample_ts;
 };
 
-uint32_t
+uint64_t
 panfrost_perf_counter_read(const struct panfrost_perf_counter *counter,
             const struct panfrost_perf *perf);
 
+uint64_t
+panfrost_perf_counter_read_sample(const struct panfrost_perf_counter *counter,
+                                  const struct panfrost_perf *perf,
+                                  const struct panfrost_perf_sample *sample);
+
+double
+panfrost_perf_derived_read(const struct panfrost_perf_derived *derived,
+                           const struct panfrost_perf *perf,
+                           const struct panfrost_perf_sample *sample);
+
+const struct panfrost_perf_config *
+panfrost_perf_lookup_config(const struct panfrost_device *dev);
+
 void
 panfrost_perf_init(struct panfrost_perf *perf, struct panfrost_device *dev);
 
@@ -111,6 +177,15 @@ panfrost_perf_disable(struct panfrost_perf *perf);
 int
 panfrost_perf_dump(struct panfrost_perf *perf);
 
+int
+panfrost_perf_set_period(struct panfrost_perf *perf, uint64_t period_ns);
+
+int
+panfrost_perf_poll(struct panfrost_perf *perf, int64_t timeout_ns);
+
+const struct panfrost_perf_sample *
+panfrost_perf_get_sample(const struct panfrost_perf *perf, uint64_t index);
+
 #if defined(__cplusplus)
 } // extern "C"
 #endif
@@ -1,10 +1,96 @@
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <lib/pan_device.h>
 #include "pan_perf.h"
 
-int main(void) {
+static void
+print_derived(const struct panfrost_perf *perf,
+              const struct panfrost_perf_sample *sample)
+{
+        for (unsigned i = 0; i < perf->cfg->n_derived; ++i) {
+                const struct panfrost_perf_derived *d = &perf->cfg->derived[i];
+                double val = panfrost_perf_derived_read(d, perf, sample);
+
+                switch (d->units) {
+                case PAN_PERF_DERIVED_UNITS_PERCENT:
+                        printf("%s (%s): %.1f%%\n", d->name, d->symbol_name, val);
+                        break;
+                case PAN_PERF_DERIVED_UNITS_BYTES:
+                        printf("%s (%s): %.1f MB\n", d->name, d->symbol_name, val / 1e6);
+                        break;
+                case PAN_PERF_DERIVED_UNITS_BYTES_PER_SECOND:
+                        printf("%s (%s): %.1f MB/s\n", d->name, d->symbol_name, val / 1e6);
+                        break;
+                default:
+                        printf("%s (%s): %.3f\n", d->name, d->symbol_name, val);
+                        break;
+                }
+        }
+}
+
+/* Let the kernel dump the counters every period_ms and print the derived
+ * metrics of each sample. Only kbase supports periodic sampling. */
+static int
+sample_periodic(struct panfrost_perf *perf, unsigned period_ms, unsigned count)
+{
+        if (panfrost_perf_set_period(perf, period_ms * 1000000ull) < 0) {
+                fprintf(stderr, "periodic sampling is only supported with kbase\n");
+                return -1;
+        }
+
+        uint64_t next = 0;
+
+        while (next < count) {
+                if (panfrost_perf_poll(perf, -1) < 0) {
+                        fprintf(stderr, "failed to read counters\n");
+                        return -1;
+                }
+
+                /* Skip the samples that were overwritten before we could
+                 * print them */
+                if (perf->n_samples > next + PAN_PERF_MAX_SAMPLES)
+                        next = perf->n_samples - PAN_PERF_MAX_SAMPLES;
+
+                for (; next < perf->n_samples && next < count; ++next) {
+                        const struct panfrost_perf_sample *sample =
+                                panfrost_perf_get_sample(perf, next);
+
+                        printf("Sample %" PRIu64 " at %" PRIu64 " ns (%" PRIu64 " us)\n",
+                               next, sample->timestamp, sample->duration / 1000);
+                        print_derived(perf, sample);
+                        printf("\n");
+                }
+        }
+
+        panfrost_perf_set_period(perf, 0);
+        return 0;
+}
+
+int main(int argc, char **argv) {
+        unsigned period_ms = 0, count = 10;
+        int opt;
+
+        while ((opt = getopt(argc, argv, "p:n:")) != -1) {
+                switch (opt) {
+                case 'p':
+                        period_ms = atoi(optarg);
+                        break;
+                case 'n':
+                        count = atoi(optarg);
+                        break;
+                default:
+                        fprintf(stderr, "usage: %s [-p period_ms] [-n samples]\n", argv[0]);
+                        exit(1);
+                }
+        }
+
         int fd = drmOpenWithType("panfrost", NULL, DRM_NODE_RENDER);
 
+        if (fd < 0)
+                fd = open("/dev/mali0", O_RDWR | O_CLOEXEC | O_NONBLOCK);
+
         if (fd < 0) {
                 fprintf(stderr, "No panfrost device\n");
                 exit(1);
@@ -21,14 +107,26 @@ int main(void) {
         
         if (ret < 0) {
                 fprintf(stderr, "failed to enable counters (%d)\n", ret);
-                fprintf(stderr, "try `# echo Y > /sys/module/panfrost/parameters/unstable_ioctls`\n");
+
+                if (!dev.kbase)
+                        fprintf(stderr, "try `# echo Y > /sys/module/panfrost/parameters/unstable_ioctls`\n");
 
                 exit(1);
         }
 
+        if (period_ms) {
+                if (sample_periodic(perf, period_ms, count) < 0)
+                        exit(1);
+
+                goto out;
+        }
+
         sleep(1);
 
-        panfrost_perf_dump(perf);
+        if (panfrost_perf_dump(perf) < 0) {
+                fprintf(stderr, "failed to dump counters\n");
+                exit(1);
+        }
 
         for (unsigned i = 0; i < perf->cfg->n_categories; ++i) {
                 const struct panfrost_perf_category *cat = &perf->cfg->categories[i];
@@ -36,13 +134,18 @@ int main(void) {
 
                 for (unsigned j = 0; j < cat->n_counters; ++j) {
                         const struct panfrost_perf_counter *ctr = &cat->counters[j];
-                        uint32_t val = panfrost_perf_counter_read(ctr, perf);
-                        printf("%s (%s): %u\n", ctr->name, ctr->symbol_name, val);
+                        uint64_t val = panfrost_perf_counter_read(ctr, perf);
+                        printf("%s (%s): %" PRIu64 "\n", ctr->name,
+                               ctr->symbol_name, val);
                 }
 
                 printf("\n");
         }
 
+        printf("Derived\n");
+        print_derived(perf, panfrost_perf_get_sample(perf, perf->n_samples - 1));
+
+out:
         if (panfrost_perf_disable(perf) < 0) {
                 fprintf(stderr, "failed to disable counters\n");
                 exit(1);
@@ -0,0 +1,796 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ * Replayer for the captures written by the driver with
+ * PAN_MESA_DEBUG=capture, see pan_capture.h.
+ *
+ * By default, the capture is only checked for consistency: every blob must
+ * match its hash, pages may only be written in live buffers with contents
+ * seen earlier in the file, and submitted job chains and command stream
+ * rings must point into mapped memory.
+ *
+ * With --decode, the buffers are rebuilt as the records are read and each
+ * submit is passed to pandecode, giving the same output as
+ * PAN_MESA_DEBUG=trace without having to run the application again.
+ *
+ * With --submit, the buffers are allocated through kbase and the work is
+ * submitted again. Neither kbase nor the panfrost DRM driver let us choose
+ * the GPU address of a buffer, and the captured job descriptors and command
+ * streams contain absolute addresses, so this is refused when a buffer ends
+ * up somewhere else than in the capture unless --force is passed. With
+ * --noop, the submits go to the no-op CSF backend instead, which exercises
+ * the submission path without a GPU.
+ *
+ * With --tiler, the tiler heaps saved with PAN_MESA_DEBUG=tiler,capture are
+ * analysed like at runtime, see pan_tiler_heap.h.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <drm-uapi/panfrost_drm.h>
+
+#include "util/hash_table.h"
+#include "util/macros.h"
+#include "util/rb_tree.h"
+#include "util/u_math.h"
+
+#include "genxml/gen_macros.h"
+#include "pan_base.h"
+#include "pan_capture.h"
+#include "pan_tiler_heap.h"
+#include "wrap.h"
+
+struct replay_buffer {
+   struct rb_node node;
+
+   /* As captured */
+   uint64_t va;
+   uint64_t size;
+   uint32_t flags;
+
+   /* Current contents, NULL for CPU-invisible buffers when decoding */
+   uint8_t *cpu;
+
+   /* Address on the replay device */
+   uint64_t gpu;
+};
+
+struct replay_blob {
+   uint64_t size;
+   uint8_t data[];
+};
+
+struct replay_queue {
+   struct kbase_cs cs;
+   bool bound;
+   uint64_t ring_va;
+   uint64_t seqnum;
+};
+
+/* Keeping the state global is fine, since the tool is single-threaded */
+static struct rb_tree buffers;
+static struct hash_table_u64 *blobs;
+static unsigned gpu_id;
+
+static bool decode;
+static bool submit;
+static bool force;
+static bool tiler;
+
+static struct kbase_ k;
+static struct kbase_context *context;
+static struct kbase_syncobj *syncobj;
+static struct replay_queue queues[2];
+
+static unsigned relocated;
+static unsigned errors;
+
+/* Tiler heap whose chunks are being read */
+static struct pan_tiler_heap *tiler_heap;
+static unsigned tiler_passes;
+
+static struct {
+   unsigned records[PAN_CAPTURE_TILER_CHUNK + 1];
+   uint64_t blob_bytes;
+   unsigned live_buffers, max_live_buffers;
+   uint64_t live_bytes, max_live_bytes;
+} stats;
+
+#define to_buffer(x) rb_node_data(struct replay_buffer, x, node)
+
+static void
+replay_error(uint64_t offset, const char *format, ...)
+{
+   va_list args;
+
+   fprintf(stderr, "0x%" PRIx64 ": ", offset);
+   va_start(args, format);
+   vfprintf(stderr, format, args);
+   va_end(args);
+   fprintf(stderr, "\n");
+
+   errors++;
+}
+
+/* Like pandecode, look up buffers by any address they contain */
+static int
+buffer_cmp_key(const struct rb_node *lhs, const void *key)
+{
+   struct replay_buffer *buf = to_buffer(lhs);
+   uint64_t va = *(const uint64_t *)key;
+
+   if (buf->va <= va && va < buf->va + buf->size)
+      return 0;
+
+   return (buf->va > va) - (buf->va < va);
+}
+
+static int
+buffer_cmp(const struct rb_node *lhs, const struct rb_node *rhs)
+{
+   uint64_t va = to_buffer(rhs)->va;
+
+   return (to_buffer(lhs)->va > va) - (to_buffer(lhs)->va < va);
+}
+
+static struct replay_buffer *
+find_buffer(uint64_t va)
+{
+   struct rb_node *node = rb_tree_search(&buffers, &va, buffer_cmp_key);
+
+   return node ? to_buffer(node) : NULL;
+}
+
+/* Translate a captured address to the replay device */
+static uint64_t
+replay_address(uint64_t va)
+{
+   struct replay_buffer *buf = find_buffer(va);
+
+   return buf ? buf->gpu + (va - buf->va) : va;
+}
+
+static void
+replay_map(uint64_t offset, const struct pan_capture_map *map)
+{
+   if (!map->size || map->va % PAN_CAPTURE_PAGE_SIZE) {
+      replay_error(offset, "invalid mapping of 0x%" PRIx64 " bytes at "
+                   "0x%" PRIx64, map->size, map->va);
+      return;
+   }
+
+   if (find_buffer(map->va) || find_buffer(map->va + map->size - 1)) {
+      replay_error(offset, "mapping at 0x%" PRIx64 " overlaps a live buffer",
+                   map->va);
+      return;
+   }
+
+   struct replay_buffer *buf = calloc(1, sizeof(*buf));
+
+   buf->va = map->va;
+   buf->size = map->size;
+   buf->flags = map->flags;
+   buf->gpu = map->va;
+
+   if (submit) {
+      unsigned pan_flags = 0;
+
+      if (!(map->flags & PAN_CAPTURE_MAP_EXECUTE))
+         pan_flags |= PANFROST_BO_NOEXEC;
+
+      struct base_ptr p = k.alloc(&k, map->size, pan_flags, 0);
+
+      if (!p.gpu) {
+         fprintf(stderr, "Failed to allocate 0x%" PRIx64 " bytes\n",
+                 map->size);
+         exit(EXIT_FAILURE);
+      }
+
+      buf->cpu = p.cpu;
+      buf->gpu = p.gpu;
+
+      if (buf->gpu != buf->va)
+         relocated++;
+   } else if (!(map->flags & PAN_CAPTURE_MAP_INVISIBLE) && decode) {
+      buf->cpu = calloc(1, map->size);
+   }
+
+   if (decode)
+      pandecode_inject_mmap(buf->va, buf->cpu, buf->size, NULL);
+
+   rb_tree_insert(&buffers, &buf->node, buffer_cmp);
+
+   stats.live_buffers++;
+   stats.live_bytes += buf->size;
+   stats.max_live_buffers = MAX2(stats.max_live_buffers, stats.live_buffers);
+   stats.max_live_bytes = MAX2(stats.max_live_bytes, stats.live_bytes);
+}
+
+static void
+replay_unmap(uint64_t offset, const struct pan_capture_unmap *unmap)
+{
+   struct replay_buffer *buf = find_buffer(unmap->va);
+
+   if (!buf || buf->va != unmap->va) {
+      replay_error(offset, "unmapping 0x%" PRIx64 ", which is not mapped",
+                   unmap->va);
+      return;
+   }
+
+   if (submit) {
+      if (buf->gpu != buf->va)
+         relocated--;
+
+      k.free(&k, buf->gpu);
+   } else {
+      free(buf->cpu);
+   }
+
+   if (decode)
+      pandecode_inject_free(buf->va, buf->size);
+
+   rb_tree_remove(&buffers, &buf->node);
+   stats.live_buffers--;
+   stats.live_bytes -= buf->size;
+   free(buf);
+}
+
+static void
+replay_blob(uint64_t offset, const struct pan_capture_blob *blob,
+            const void *data, size_t size)
+{
+   if (blob->size != size || blob->size > PAN_CAPTURE_PAGE_SIZE) {
+      replay_error(offset, "blob size %" PRIu64 " does not match the record",
+                   blob->size);
+      return;
+   }
+
+   if (pan_capture_hash(data, size) != blob->hash) {
+      replay_error(offset, "blob contents do not match hash 0x%016" PRIx64,
+                   blob->hash);
+      return;
+   }
+
+   if (_mesa_hash_table_u64_search(blobs, blob->hash)) {
+      replay_error(offset, "blob 0x%016" PRIx64 " written twice", blob->hash);
+      return;
+   }
+
+   struct replay_blob *copy = malloc(sizeof(*copy) + size);
+
+   copy->size = size;
+   memcpy(copy->data, data, size);
+   _mesa_hash_table_u64_insert(blobs, blob->hash, copy);
+
+   stats.blob_bytes += size;
+}
+
+static void
+replay_data(uint64_t offset, const struct pan_capture_data *data)
+{
+   struct replay_buffer *buf = find_buffer(data->va);
+
+   if (!buf || (data->va - buf->va) % PAN_CAPTURE_PAGE_SIZE) {
+      replay_error(offset, "data for 0x%" PRIx64 ", which is not a mapped page",
+                   data->va);
+      return;
+   }
+
+   if (buf->flags & PAN_CAPTURE_MAP_INVISIBLE) {
+      replay_error(offset, "data for 0x%" PRIx64 ", which is not CPU visible",
+                   data->va);
+      return;
+   }
+
+   struct replay_blob *blob = _mesa_hash_table_u64_search(blobs, data->hash);
+
+   if (!blob) {
+      replay_error(offset, "data for 0x%" PRIx64 " uses unknown blob "
+                   "0x%016" PRIx64, data->va, data->hash);
+      return;
+   }
+
+   uint64_t size = MIN2(buf->va + buf->size - data->va, PAN_CAPTURE_PAGE_SIZE);
+
+   if (blob->size != size) {
+      replay_error(offset, "blob 0x%016" PRIx64 " does not fit the page at "
+                   "0x%" PRIx64, data->hash, data->va);
+      return;
+   }
+
+   if (buf->cpu)
+      memcpy(buf->cpu + (data->va - buf->va), blob->data, size);
+}
+
+static bool
+replay_can_submit(uint64_t offset)
+{
+   if (!relocated || force)
+      return true;
+
+   replay_error(offset, "%u buffers could not be placed at their captured "
+                "address, not submitting (use --force to submit anyway)",
+                relocated);
+   return false;
+}
+
+static void
+replay_submit_jc(uint64_t offset, const struct pan_capture_submit_jc *jc)
+{
+   if (pan_arch(gpu_id) >= 10) {
+      replay_error(offset, "job chain submitted on a CSF GPU");
+      return;
+   }
+
+   if (!find_buffer(jc->jc)) {
+      replay_error(offset, "job chain at 0x%" PRIx64 " is not mapped", jc->jc);
+      return;
+   }
+
+   if (decode)
+      pandecode_jc(jc->jc, gpu_id);
+
+   if (submit && replay_can_submit(offset)) {
+      if (k.submit(&k, replay_address(jc->jc), jc->requirements, syncobj,
+                   NULL, 0) == -1) {
+         replay_error(offset, "submit failed: %s", strerror(errno));
+         return;
+      }
+
+      k.syncobj_wait(&k, syncobj);
+   }
+}
+
+static void
+replay_decode_cs(const struct pan_capture_submit_cs *cs)
+{
+   uint64_t start = cs->start % cs->ring_size;
+   uint64_t end = cs->end % cs->ring_size;
+
+   if (end < start) {
+      pandecode_cs(cs->ring_va + start, cs->ring_size - start, gpu_id);
+      start = 0;
+   }
+
+   pandecode_cs(cs->ring_va + start, end - start, gpu_id);
+}
+
+static void
+replay_submit_cs(uint64_t offset, const struct pan_capture_submit_cs *cs)
+{
+   if (pan_arch(gpu_id) < 10) {
+      replay_error(offset, "command stream submitted on a Job Manager GPU");
+      return;
+   }
+
+   struct replay_buffer *ring = find_buffer(cs->ring_va);
+
+   if (!ring || cs->ring_va + cs->ring_size > ring->va + ring->size) {
+      replay_error(offset, "ring at 0x%" PRIx64 " is not mapped", cs->ring_va);
+      return;
+   }
+
+   if (cs->queue >= ARRAY_SIZE(queues) || cs->end < cs->start ||
+       cs->end - cs->start > cs->ring_size) {
+      replay_error(offset, "invalid submit of [%" PRIu64 ", %" PRIu64 ") "
+                   "to queue %u", cs->start, cs->end, cs->queue);
+      return;
+   }
+
+   if (decode)
+      replay_decode_cs(cs);
+
+   if (!submit || !replay_can_submit(offset))
+      return;
+
+   struct replay_queue *q = &queues[cs->queue];
+
+   /* The driver starts over from the beginning of the ring when it binds
+    * a new one or recovers from a fault, so do the same */
+   if (q->bound && (q->ring_va != cs->ring_va ||
+                    cs->start < q->cs.last_insert)) {
+      k.cs_term(&k, &q->cs);
+      q->bound = false;
+   }
+
+   if (!q->bound) {
+      q->cs = k.cs_bind(&k, context, ring->gpu + (cs->ring_va - ring->va),
+                        cs->ring_size);
+      q->ring_va = cs->ring_va;
+      q->bound = true;
+   }
+
+   if (cs->start != q->cs.last_insert) {
+      replay_error(offset, "submit starts at %" PRIu64 " but the ring is at "
+                   "%" PRIu64, cs->start, q->cs.last_insert);
+      return;
+   }
+
+   if (!k.cs_submit(&k, &q->cs, cs->end, syncobj, q->seqnum++)) {
+      replay_error(offset, "submit failed");
+      return;
+   }
+
+   if (!k.cs_wait(&k, &q->cs, cs->end, syncobj))
+      replay_error(offset, "submit did not complete");
+}
+
+static void
+finish_tiler_heap(void)
+{
+   if (!tiler_heap)
+      return;
+
+   pan_tiler_heap_analyze(tiler_heap);
+
+   printf("Render pass %u:\n", tiler_passes);
+   pan_tiler_heap_print(tiler_heap, stdout);
+
+   pan_tiler_heap_destroy(tiler_heap);
+   tiler_heap = NULL;
+   tiler_passes++;
+}
+
+static void
+replay_tiler_heap(void)
+{
+   if (!tiler)
+      return;
+
+   finish_tiler_heap();
+   tiler_heap = pan_tiler_heap_create();
+}
+
+static void
+replay_tiler_chunk(uint64_t offset, const struct pan_capture_tiler_chunk *chunk,
+                   const void *data, uint32_t size)
+{
+   if (size > chunk->size) {
+      replay_error(offset, "tiler heap chunk data is larger than the chunk");
+      return;
+   }
+
+   if (!tiler)
+      return;
+
+   if (!tiler_heap) {
+      replay_error(offset, "tiler heap chunk outside of a tiler heap");
+      return;
+   }
+
+   pan_tiler_heap_add_chunk(tiler_heap, chunk->va, chunk->size, data, size);
+}
+
+static bool
+read_header(FILE *fp)
+{
+   struct pan_capture_header header;
+
+   if (fread(&header, sizeof(header), 1, fp) != 1) {
+      fprintf(stderr, "Capture is too short\n");
+      return false;
+   }
+
+   if (header.magic == __builtin_bswap32(PAN_CAPTURE_MAGIC)) {
+      fprintf(stderr, "Capture was written on a CPU of the other endianness\n");
+      return false;
+   } else if (header.magic != PAN_CAPTURE_MAGIC) {
+      fprintf(stderr, "Not a panfrost capture\n");
+      return false;
+   }
+
+   /* Version 2 only added records */
+   if (header.version < 1 || header.version > PAN_CAPTURE_VERSION ||
+       header.page_size != PAN_CAPTURE_PAGE_SIZE) {
+      fprintf(stderr, "Unsupported capture version %u\n", header.version);
+      return false;
+   }
+
+   gpu_id = header.gpu_id;
+   return true;
+}
+
+#define CHECK_SIZE(payload_type)                                           \
+   if (record.size != sizeof(payload_type)) {                              \
+      replay_error(offset, "record of type %u has size %u", record.type,   \
+                   record.size);                                          \
+      break;                                                               \
+   }
+
+static bool
+replay(FILE *fp)
+{
+   struct pan_capture_record record;
+   void *payload = NULL;
+   size_t payload_size = 0;
+
+   while (fread(&record, sizeof(record), 1, fp) == 1) {
+      uint64_t offset = ftell(fp) - sizeof(record);
+
+      if (record.size > payload_size) {
+         payload_size = record.size;
+         payload = realloc(payload, payload_size);
+      }
+
+      if (record.size && fread(payload, record.size, 1, fp) != 1) {
+         replay_error(offset, "truncated record");
+         break;
+      }
+
+      if (record.type < ARRAY_SIZE(stats.records))
+         stats.records[record.type]++;
+
+      switch (record.type) {
+      case PAN_CAPTURE_BLOB:
+         if (record.size < sizeof(struct pan_capture_blob)) {
+            replay_error(offset, "truncated blob");
+            break;
+         }
+
+         replay_blob(offset, payload,
+                     (uint8_t *)payload + sizeof(struct pan_capture_blob),
+                     record.size - sizeof(struct pan_capture_blob));
+         break;
+      case PAN_CAPTURE_MAP:
+         CHECK_SIZE(struct pan_capture_map);
+         replay_map(offset, payload);
+         break;
+      case PAN_CAPTURE_UNMAP:
+         CHECK_SIZE(struct pan_capture_unmap);
+         replay_unmap(offset, payload);
+         break;
+      case PAN_CAPTURE_DATA:
+         CHECK_SIZE(struct pan_capture_data);
+         replay_data(offset, payload);
+         break;
+      case PAN_CAPTURE_SUBMIT_JC:
+         CHECK_SIZE(struct pan_capture_submit_jc);
+         replay_submit_jc(offset, payload);
+         break;
+      case PAN_CAPTURE_SUBMIT_CS:
+         CHECK_SIZE(struct pan_capture_submit_cs);
+         replay_submit_cs(offset, payload);
+         break;
+      case PAN_CAPTURE_FRAME:
+         if (decode)
+            pandecode_next_frame();
+         break;
+      case PAN_CAPTURE_TILER_HEAP:
+         CHECK_SIZE(struct pan_capture_tiler_heap);
+         replay_tiler_heap();
+         break;
+      case PAN_CAPTURE_TILER_CHUNK:
+         if (record.size < sizeof(struct pan_capture_tiler_chunk)) {
+            replay_error(offset, "truncated tiler heap chunk");
+            break;
+         }
+
+         replay_tiler_chunk(offset, payload,
+                            (uint8_t *)payload +
+                               sizeof(struct pan_capture_tiler_chunk),
+                            record.size -
+                               sizeof(struct pan_capture_tiler_chunk));
+         break;
+      default:
+         replay_error(offset, "unknown record type %u", record.type);
+         break;
+      }
+   }
+
+   finish_tiler_heap();
+   free(payload);
+   return !ferror(fp);
+}
+
+static bool
+open_device(const char *path)
+{
+   int fd = -1;
+
+   if (path) {
+      fd = open(path, O_RDWR | O_CLOEXEC);
+
+      if (fd < 0) {
+         fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+         return false;
+      }
+   } else if (pan_arch(gpu_id) < 10) {
+      fprintf(stderr, "The no-op backend only supports CSF GPUs\n");
+      return false;
+   }
+
+   if (!kbase_open(&k, fd, 4, false)) {
+      fprintf(stderr, "Failed to open kbase device\n");
+      return false;
+   }
+
+   uint64_t device_id = 0;
+
+   k.get_pan_gpuprop(&k, DRM_PANFROST_PARAM_GPU_PROD_ID, &device_id);
+
+   if (path && device_id != gpu_id && !force) {
+      fprintf(stderr, "Capture is for GPU 0x%x, but the device is 0x%" PRIx64
+              "\n", gpu_id, device_id);
+      return false;
+   }
+
+   if (pan_arch(gpu_id) >= 10)
+      context = k.context_create(&k);
+
+   syncobj = k.syncobj_create(&k);
+   return true;
+}
+
+static void
+close_device(void)
+{
+   for (unsigned i = 0; i < ARRAY_SIZE(queues); ++i) {
+      if (queues[i].bound)
+         k.cs_term(&k, &queues[i].cs);
+   }
+
+   if (syncobj)
+      k.syncobj_destroy(&k, syncobj);
+
+   if (context)
+      k.context_destroy(&k, context);
+
+   k.close(&k);
+}
+
+static void
+print_stats(void)
+{
+   printf("GPU: 0x%x\n", gpu_id);
+   printf("Frames: %u\n", stats.records[PAN_CAPTURE_FRAME]);
+   printf("Submits: %u\n", stats.records[PAN_CAPTURE_SUBMIT_JC] +
+                           stats.records[PAN_CAPTURE_SUBMIT_CS]);
+   printf("Buffers mapped: %u (at most %u live, %" PRIu64 " KiB)\n",
+          stats.records[PAN_CAPTURE_MAP], stats.max_live_buffers,
+          stats.max_live_bytes / 1024);
+   printf("Pages written: %u\n", stats.records[PAN_CAPTURE_DATA]);
+   printf("Unique pages: %u (%" PRIu64 " KiB)\n",
+          stats.records[PAN_CAPTURE_BLOB], stats.blob_bytes / 1024);
+   printf("Tiler heaps: %u\n", stats.records[PAN_CAPTURE_TILER_HEAP]);
+   printf("Errors: %u\n", errors);
+}
+
+static void
+print_help(const char *progname, FILE *file)
+{
+   fprintf(file,
+           "Usage: %s [OPTION] capture\n"
+           "Check, decode or replay a Panfrost capture.\n\n"
+           "    -h, --help             display this help and exit\n"
+           "    -d, --decode           decode the submitted work with pandecode\n"
+           "    -s, --submit[=DEVICE]  submit again through kbase, by default\n"
+           "                           on /dev/mali0\n"
+           "    -n, --noop             submit to the no-op CSF backend\n"
+           "    -f, --force            submit even if buffers were relocated\n"
+           "                           or the GPU does not match\n"
+           "    -t, --tiler            analyse the captured tiler heaps\n"
+           "Example:\n"
+           "    PAN_MESA_DEBUG=capture PAN_CAPTURE_FILE=app.capture app\n"
+           "    panreplay -d app.capture\n",
+           progname);
+}
+
+int
+main(int argc, char *argv[])
+{
+   const char *device = NULL;
+   bool noop = false;
+   int c;
+
+   const struct option longopts[] = {
+      { "decode", no_argument, NULL, 'd' },
+      { "submit", optional_argument, NULL, 's' },
+      { "noop", no_argument, NULL, 'n' },
+      { "force", no_argument, NULL, 'f' },
+      { "tiler", no_argument, NULL, 't' },
+      { "help", no_argument, NULL, 'h' },
+      { NULL, 0, NULL, 0 }
+   };
+
+   while ((c = getopt_long(argc, argv, "ds::nfth", longopts, NULL)) != -1) {
+      switch (c) {
+      case 'h':
+         print_help(argv[0], stdout);
+         return EXIT_SUCCESS;
+      case 'd':
+         decode = true;
+         break;
+      case 's':
+         submit = true;
+         device = optarg ? optarg : "/dev/mali0";
+         break;
+      case 'n':
+         submit = true;
+         noop = true;
+         break;
+      case 'f':
+         force = true;
+         break;
+      case 't':
+         tiler = true;
+         break;
+      default:
+         print_help(argv[0], stderr);
+         return EXIT_FAILURE;
+      }
+   }
+
+   if (optind >= argc) {
+      print_help(argv[0], stderr);
+      return EXIT_FAILURE;
+   }
+
+   FILE *fp = fopen(argv[optind], "rb");
+
+   if (!fp) {
+      perror("failed to open capture");
+      return EXIT_FAILURE;
+   }
+
+   if (!read_header(fp))
+      return EXIT_FAILURE;
+
+   rb_tree_init(&buffers);
+   blobs = _mesa_hash_table_u64_create(NULL);
+
+   if (decode)
+      pandecode_initialize(true);
+
+   if (submit && !open_device(noop ? NULL : device))
+      return EXIT_FAILURE;
+
+   /* The no-op backend never runs anything, so it doesn't care where the
+    * buffers are */
+   if (noop)
+      force = true;
+
+   bool ok = replay(fp);
+
+   if (submit)
+      close_device();
+
+   if (decode)
+      pandecode_close();
+
+   print_stats();
+   fclose(fp);
+
+   return (ok && !errors) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -191,3 +191,87 @@ pan_nir_collect_varyings(nir_shader *s, struct pan_shader_info *info)
         else
                 info->varyings.input_count = count;
 }
+
+/*
+ * Number of 32-bit components a vertex shader output variable occupies in
+ * each of its slots. Anything other than a 32-bit (or narrower) scalar or
+ * vector is conservatively given full 16-byte slots, which also preserves the
+ * 16-byte stride assumed for indirectly indexed arrays.
+ */
+static unsigned
+varying_components(const nir_variable *var, unsigned *nr_slots)
+{
+        const struct glsl_type *type = var->type;
+
+        *nr_slots = glsl_count_attribute_slots(type, false);
+
+        if (*nr_slots == 1 && glsl_type_is_vector_or_scalar(type) &&
+            glsl_get_bit_size(type) <= 32)
+                return var->data.location_frac + glsl_get_vector_elements(type);
+        else
+                return 4;
+}
+
+/*
+ * Lay out the general varyings written by a vertex shader. The layout is
+ * computed from the vertex shader alone, so it can be decided before the
+ * fragment shader is compiled and passed to it through the shader key.
+ * Varyings are placed in order of location, each into the first 16-byte line
+ * with enough free components.
+ */
+void
+pan_nir_build_varying_layout(const nir_shader *s,
+                             struct pan_varying_layout *layout)
+{
+        assert(s->info.stage == MESA_SHADER_VERTEX);
+
+        uint8_t comps[PAN_MAX_GENERAL_VARYINGS] = { 0 };
+
+        nir_foreach_shader_out_variable(var, s) {
+                if (var->data.location < VARYING_SLOT_VAR0)
+                        continue;
+
+                unsigned index = var->data.location - VARYING_SLOT_VAR0;
+                unsigned nr_slots;
+                unsigned nr = varying_components(var, &nr_slots);
+
+                for (unsigned i = 0; i < nr_slots; ++i) {
+                        if (index + i < PAN_MAX_GENERAL_VARYINGS)
+                                comps[index + i] = MAX2(comps[index + i], nr);
+                }
+        }
+
+        /* If outputs are written without a matching variable, we cannot tell
+         * how many components are used, so assume the whole slot.
+         */
+        uint32_t written = s->info.outputs_written >> VARYING_SLOT_VAR0;
+
+        u_foreach_bit(i, written) {
+                if (comps[i] == 0)
+                        comps[i] = 4;
+        }
+
+        uint8_t fill[PAN_MAX_GENERAL_VARYINGS] = { 0 };
+        unsigned nr_lines = 0;
+
+        memset(layout, 0, sizeof(*layout));
+
+        for (unsigned i = 0; i < PAN_MAX_GENERAL_VARYINGS; ++i) {
+                if (comps[i] == 0)
+                        continue;
+
+                unsigned line = 0;
+
+                while (line < nr_lines && (fill[line] + comps[i]) > 4)
+                        line++;
+
+                if (line == nr_lines)
+                        nr_lines++;
+
+                layout->written |= BITFIELD_BIT(i);
+                layout->offset[i] = (line * 4) + fill[line];
+                fill[line] += comps[i];
+        }
+
+        layout->size = nr_lines * 16;
+}
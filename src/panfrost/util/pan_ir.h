@@ -29,6 +29,10 @@
 #include "util/u_dynarray.h"
 #include "util/hash_table.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /* On Valhall, the driver gives the hardware a table of resource tables.
  * Resources are addressed as the index of the table together with the index of
  * the resource within the table. For simplicity, we put one type of resource
@@ -177,6 +181,28 @@ pan_lookup_sysval(struct hash_table_u64 *sysval_to_id,
 int
 panfrost_sysval_for_instr(nir_instr *instr, nir_dest *dest);
 
+/* Number of general varyings (VARYING_SLOT_VAR0 and up) */
+#define PAN_MAX_GENERAL_VARYINGS 32
+
+/* On Valhall, layout of the general varyings in the per-vertex varying record
+ * of linked shaders, following the special varyings. Each varying occupies
+ * only the 32-bit components the vertex shader writes, packed without
+ * straddling a 16-byte boundary. Varyings that may be indexed indirectly keep
+ * a 16-byte stride.
+ */
+struct pan_varying_layout {
+        /* Bit mask of general varyings written by the vertex shader */
+        uint32_t written;
+
+        /* Size of the general varyings in bytes, a multiple of 16. Varyings
+         * read but not written alias a dummy slot at this offset.
+         */
+        uint16_t size;
+
+        /* Offset of each written general varying, in 32-bit words */
+        uint8_t offset[PAN_MAX_GENERAL_VARYINGS];
+};
+
 struct panfrost_compile_inputs {
         struct util_debug_callback *debug;
 
@@ -206,6 +232,12 @@ struct panfrost_compile_inputs {
          */
         uint32_t fixed_varying_mask;
 
+        /* Used on Valhall. If set, layout of the general varyings shared by
+         * the linked vertex and fragment shaders. Otherwise, general varyings
+         * are sparsely packed with 16 bytes per slot.
+         */
+        const struct pan_varying_layout *varying_layout;
+
         union {
                 struct {
                         bool static_rt_conv;
@@ -515,6 +547,19 @@ bool pan_lower_xfb(nir_shader *nir);
 
 void pan_nir_collect_varyings(nir_shader *s, struct pan_shader_info *info);
 
+void pan_nir_build_varying_layout(const nir_shader *s,
+                                  struct pan_varying_layout *layout);
+
+static inline unsigned
+pan_varying_layout_offset(const struct pan_varying_layout *layout,
+                          unsigned general_index)
+{
+        if (layout->written & BITFIELD_BIT(general_index))
+                return layout->offset[general_index] * 4;
+        else
+                return layout->size;
+}
+
 /*
  * Helper returning the subgroup size. Generally, this is equal to the number of
  * threads in a warp. For Midgard (including warping models), this returns 1, as
@@ -533,4 +578,8 @@ pan_subgroup_size(unsigned arch)
                 return 1;
 }
 
+#ifdef __cplusplus
+} /* extern C */
+#endif
+
 #endif
@@ -9,6 +9,7 @@
 
 #include "pps_device.h"
 
+#include <algorithm>
 #include <cassert>
 #include <fcntl.h>
 #include <memory>
@@ -62,15 +63,33 @@ std::optional<DrmDevice> create_drm_device(int fd, int32_t gpu_num)
    return ret;
 }
 
+/// @brief Mali GPUs driven by kbase have no DRM render node, so their device
+/// node is exposed as a panfrost device, which handles both kernel drivers
+/// @return A kbase device, nullopt if there is none or the driver is not built
+std::optional<DrmDevice> create_kbase_device(int32_t gpu_num)
+{
+#ifdef PPS_PANFROST
+   int fd = open("/dev/mali0", O_RDWR | O_CLOEXEC | O_NONBLOCK);
+   if (fd < 0) {
+      return std::nullopt;
+   }
+
+   auto ret = DrmDevice();
+   ret.fd = fd;
+   ret.gpu_num = gpu_num;
+   ret.name = "panfrost";
+   return ret;
+#else
+   return std::nullopt;
+#endif
+}
+
 std::vector<DrmDevice> DrmDevice::create_all()
 {
    std::vector<DrmDevice> ret = {};
 
    drmDevicePtr devices[MAX_DRM_DEVICES] = {};
-   int num_devices = drmGetDevices2(0, devices, MAX_DRM_DEVICES);
-   if (num_devices <= 0) {
-      return ret;
-   }
+   int num_devices = std::max(drmGetDevices2(0, devices, MAX_DRM_DEVICES), 0);
 
    for (int32_t gpu_num = 0; gpu_num < num_devices; gpu_num++) {
       drmDevicePtr device = devices[gpu_num];
@@ -85,6 +104,12 @@ std::vector<DrmDevice> DrmDevice::create_all()
    }
 
    drmFreeDevices(devices, num_devices);
+
+   // The kbase device comes after the DRM devices
+   if (auto kbase_device = create_kbase_device(num_devices)) {
+      ret.emplace_back(std::move(kbase_device.value()));
+   }
+
    return ret;
 }
 
@@ -103,6 +128,8 @@ std::optional<DrmDevice> DrmDevice::create(int32_t gpu_num)
       drmDevicePtr device = devices[gpu_num];
       int fd = open(device->nodes[DRM_NODE_RENDER], O_RDWR);
       ret = create_drm_device(fd, gpu_num);
+   } else if (gpu_num == std::max(num_devices, 0)) {
+      ret = create_kbase_device(gpu_num);
    }
 
    drmFreeDevices(devices, num_devices);